@@ -26,6 +26,7 @@
 #include "./SockHop.h"
 #include <ccn/fetch.h>
 
+#include <poll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -119,6 +120,8 @@ struct MainBaseStruct {
 	int defaultKeepAlive;
 	int sockFD;
 	int ccnFD;
+	int nCCNFDs;
+	struct pollfd ccnFDs[CCN_WAIT_MAX_FDS];
 	struct ccn_fetch * fetchBase;
 	SockEntry client;
 	RequestBase requestList;
@@ -203,6 +206,7 @@ struct RequestBaseStruct {
 	string request;
 	string shortName;
 	struct ccn_fetch_stream * fetchStream;
+	const unsigned char * fetchRef;	// reply bytes lent by fetchStream
 	int recvOff;
 	int sendOff;
 	int origin;
@@ -585,13 +589,28 @@ RobustRecvmsg(RequestBase rb, SockEntry se) {
 	}
 }
 
+static string
+ReplyData(RequestBase rb) {
+	// the bytes to pass along, which may still be in a CCN segment
+	if (rb->fetchRef != NULL) return (string) rb->fetchRef;
+	return rb->buffer;
+}
+
+static void
+ReleaseReplyData(RequestBase rb) {
+	if (rb->fetchRef != NULL) {
+		ccn_fetch_release_ref(rb->fetchStream, rb->fetchRef);
+		rb->fetchRef = NULL;
+	}
+}
+
 static ssize_t
 RobustSendmsg(RequestBase rb, SockEntry se) {
 	MainBase mb = rb->mb;
 	FILE *f = mb->debug;
 	if (f == NULL) f = stdout;
 	struct msghdr *mp = &rb->msg;
-	rb->iov.iov_base = ((char *) rb->buffer) + rb->sendOff;
+	rb->iov.iov_base = ReplyData(rb) + rb->sendOff;
 	ssize_t len = rb->bufferLen - rb->sendOff;
 	rb->iov.iov_len = len;
 	if (len <= 0) {
@@ -903,6 +922,7 @@ DestroyRequestBase(RequestBase rb) {
 			AlterSocketCount(mb, rb->seSrc->fd, -1);
 		if (rb->seDst != NULL)
 			AlterSocketCount(mb, rb->seDst->fd, -1);
+		ReleaseReplyData(rb);
 		rb->buffer = freeString(rb->buffer);
 		rb->host = freeString(rb->host);
 		rb->request = freeString(rb->request);
@@ -919,12 +939,24 @@ static void
 TrySelect(MainBase mb) {
 	int sockFD = mb->sockFD;
 	int timeout = 20;
+	int ccnWait = -1;
+	int max = -1;
+	int k;
+	
+	// first, make sure that CCN wakes up when it needs to
+	struct ccn *h = ccn_fetch_get_ccn(mb->fetchBase);
+	mb->nCCNFDs = ccn_get_wait_info(h, mb->ccnFDs, &ccnWait);
+	if (ccnWait >= 0 && ccnWait * 1000 < timeout) timeout = ccnWait * 1000;
 	InitSelectData(&mb->sds, timeout);
-	
-	// first, make sure that CCN wakes up
-	int max = mb->ccnFD;
-	FD_SET(max, &mb->sds.readFDS);
-	FD_SET(max, &mb->sds.errorFDS);
+	for (k = 0; k < mb->nCCNFDs; k++) {
+		int fd = mb->ccnFDs[k].fd;
+		if (mb->ccnFDs[k].events & POLLIN)
+			FD_SET(fd, &mb->sds.readFDS);
+		if (mb->ccnFDs[k].events & POLLOUT)
+			FD_SET(fd, &mb->sds.writeFDS);
+		FD_SET(fd, &mb->sds.errorFDS);
+		if (fd > max) max = fd;
+	}
 
 	// gather up all of the potential bits we need
 	if ((mb->requestCount - mb->requestDone) < mb->maxBusy) {
@@ -1003,6 +1035,21 @@ TrySelect(MainBase mb) {
 		}
 		flushLog(f);
 	}
+	
+	// let CCN handle whatever it was waiting for
+	if (res > 0 && mb->nCCNFDs > 0) {
+		int ready = 0;
+		for (k = 0; k < mb->nCCNFDs; k++) {
+			int fd = mb->ccnFDs[k].fd;
+			short revents = 0;
+			if (FD_ISSET(fd, &mb->sds.readFDS)) revents |= POLLIN;
+			if (FD_ISSET(fd, &mb->sds.writeFDS)) revents |= POLLOUT;
+			if (FD_ISSET(fd, &mb->sds.errorFDS)) revents |= POLLERR;
+			mb->ccnFDs[k].revents = revents;
+			if (revents != 0) ready++;
+		}
+		if (ready > 0) ccn_process_ready(h, mb->ccnFDs, mb->nCCNFDs);
+	}
 }
 
 static int
@@ -2156,7 +2203,12 @@ RequestBaseStep(RequestBase rb) {
 			intmax_t nb = -1;
 			if (rb->fetchStream != NULL) {
 				// we get this buffer through CCN
-				nb = ccn_fetch_read(rb->fetchStream, rb->buffer, CCN_CHUNK_SIZE);
+				if (rb->msgCount == 0)
+					// the reply header is parsed from rb->buffer
+					nb = ccn_fetch_read(rb->fetchStream, rb->buffer, CCN_CHUNK_SIZE);
+				else
+					// the rest is sent straight from the segment
+					nb = ccn_fetch_read_ref(rb->fetchStream, &rb->fetchRef, CCN_CHUNK_SIZE);
 				if (nb < 0)
 					// nothing to do, no characters available
 					return 0;
@@ -2234,7 +2286,7 @@ RequestBaseStep(RequestBase rb) {
 				// verb == HTTP_NONE marks a reply
 				ExtractHTTPInfo(rb, HTTP_NONE);
 			} else if (info->state >= Chunk_Skip) {
-				AdvanceChunks(mb, rb->buffer, 0, nb, info);
+				AdvanceChunks(mb, ReplyData(rb), 0, nb, info);
 				FILE *f = mb->debug;
 				switch (info->state) {
 					case Chunk_Done: {
@@ -2309,6 +2361,7 @@ RequestBaseStep(RequestBase rb) {
 				RequestBase reply = rb->backPath;
 				if (rb->fetchStream != NULL) {
 					// we get this buffer through CCN
+					ReleaseReplyData(rb);
 				} else if (reply != NULL && reply->state == RB_None) {
 					// allow the replies to start coming back
 					// once the write has worked
@@ -2447,7 +2500,7 @@ DestroyMainBase(MainBase mb) {
 
 static void
 ScanRequestsCCN(MainBase mb) {
-	ccn_fetch_poll(mb->fetchBase);
+	// TrySelect runs the ccn connection, so there is no ccn_fetch_poll here
 	RequestBase rb = mb->requestList;
 	while (rb != NULL) {
 		RequestBaseState state = rb->state;
@@ -102,7 +102,7 @@ struct access_sys_t
 {
     vlc_url_t  url;
     block_fifo_t *p_fifo;
-    unsigned char *buf;
+    block_t *p_block;   /* block being filled straight from the content */
     int i_bufsize;
     int i_bufoffset;
     int timeouts;
@@ -150,11 +150,6 @@ static int CCNOpen(vlc_object_t *p_this)
     var_Create(p_access, "ccn-caching", VLC_VAR_INTEGER | VLC_VAR_DOINHERIT);
     p_sys->i_fifo_max = var_CreateGetInteger(p_access, "ccn-fifo-maxblocks");
     p_sys->i_bufsize = var_CreateGetInteger(p_access, "ccn-fifo-blocksize");
-    p_sys->buf = calloc(1, p_sys->i_bufsize);
-    if (p_sys->buf == NULL) {
-        i_err = VLC_ENOMEM;
-        goto exit_error;
-    }
     p_sys->p_template = make_data_template();
     p_sys->incoming = calloc(1, sizeof(struct ccn_closure));
     if (p_sys->incoming == NULL) {
@@ -242,10 +237,6 @@ static int CCNOpen(vlc_object_t *p_this)
     }
     ccn_charbuf_destroy(&p_sys->p_name);
     ccn_destroy(&(p_sys->ccn));
-    if (p_sys->buf) {
-        free(p_sys->buf);
-        p_sys->buf = NULL;
-    }
     free(p_sys);
     return (i_err);
 }
@@ -268,7 +259,7 @@ static void CCNClose(vlc_object_t *p_this)
         p_sys->p_fifo = NULL;
     }
     ccn_destroy(&(p_sys->ccn));
-    if (p_sys->buf != NULL) free(p_sys->buf);
+    if (p_sys->p_block != NULL) block_Release(p_sys->p_block);
     free(p_sys);
 }
 
@@ -367,7 +358,11 @@ static int CCNSeek(access_t *p_access, uint64_t i_pos)
 #endif
     /* flush the FIFO, restart from the specified point */
     block_FifoEmpty(p_sys->p_fifo);
-    /* forget any data in the intermediate buffer */
+    /* forget any data in the partly filled block */
+    if (p_sys->p_block != NULL) {
+        block_Release(p_sys->p_block);
+        p_sys->p_block = NULL;
+    }
     p_sys->i_bufoffset = 0;
     p_sys->incoming = calloc(1, sizeof(struct ccn_closure));
     if (p_sys->incoming == NULL) {
@@ -475,7 +470,6 @@ incoming_content(struct ccn_closure *selfp,
     access_t *p_access = (access_t *)(selfp->data);
     access_sys_t *p_sys = p_access->p_sys;
     int64_t start_offset = 0;
-    block_t *p_block = NULL;
     bool b_last = false;
     struct ccn_charbuf *name = NULL;
     struct ccn_charbuf *templ = NULL;
@@ -572,15 +566,23 @@ incoming_content(struct ccn_closure *selfp,
         if (start_offset > data_size) {
             msg_Err(p_access, "start_offset %"PRId64" > data_size %zu", start_offset, data_size);
         } else {
-            if ((data_size - start_offset) + p_sys->i_bufoffset > p_sys->i_bufsize) {
-                /* won't fit in buffer, release the buffer upstream */
-                p_block = block_New(p_access, p_sys->i_bufoffset);
-                memcpy(p_block->p_buffer, p_sys->buf, p_sys->i_bufoffset);
-                block_FifoPut(p_sys->p_fifo, p_block);
+            if (p_sys->p_block != NULL &&
+                (data_size - start_offset) + p_sys->i_bufoffset > p_sys->i_bufsize) {
+                /* won't fit in the block, release the block upstream */
+                p_sys->p_block->i_buffer = p_sys->i_bufoffset;
+                block_FifoPut(p_sys->p_fifo, p_sys->p_block);
+                p_sys->p_block = NULL;
                 p_sys->i_bufoffset = 0;
             }
-            /* will fit in buffer */
-            memcpy(p_sys->buf + p_sys->i_bufoffset, data + start_offset, data_size - start_offset);
+            if (p_sys->p_block == NULL) {
+                /* copy the content just once, into the block VLC will read */
+                p_sys->p_block = block_New(p_access, (size_t)p_sys->i_bufsize > data_size ?
+                                           p_sys->i_bufsize : data_size);
+                if (p_sys->p_block == NULL)
+                    return(CCN_UPCALL_RESULT_ERR);
+            }
+            memcpy(p_sys->p_block->p_buffer + p_sys->i_bufoffset,
+                   data + start_offset, data_size - start_offset);
             p_sys->i_bufoffset += (data_size - start_offset);
         }
     }
@@ -589,10 +591,10 @@ incoming_content(struct ccn_closure *selfp,
      * and don't express an interest
      */
     if (b_last) {
-        if (p_sys->i_bufoffset > 0) {
-            p_block = block_New(p_access, p_sys->i_bufoffset);
-            memcpy(p_block->p_buffer, p_sys->buf, p_sys->i_bufoffset);
-            block_FifoPut(p_sys->p_fifo, p_block);
+        if (p_sys->p_block != NULL) {
+            p_sys->p_block->i_buffer = p_sys->i_bufoffset;
+            block_FifoPut(p_sys->p_fifo, p_sys->p_block);
+            p_sys->p_block = NULL;
             p_sys->i_bufoffset = 0;
         }
         block_FifoPut(p_sys->p_fifo, block_New(p_access, 0));
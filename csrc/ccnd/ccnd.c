@@ -52,11 +52,13 @@
 #include <ccn/ccn_private.h>
 #include <ccn/ccnd.h>
 #include <ccn/charbuf.h>
+#include <ccn/digest.h>
 #include <ccn/face_mgmt.h>
 #include <ccn/hashtb.h>
 #include <ccn/indexbuf.h>
 #include <ccn/schedule.h>
 #include <ccn/reg_mgmt.h>
+#include <ccn/shm.h>
 #include <ccn/uri.h>
 
 #include "ccnd_private.h"
@@ -356,6 +358,23 @@ ccnd_close_fd(struct ccnd_handle *h, unsigned faceid, int *pfd)
     }
 }
 
+/**
+ * Forget the shared-memory rings of a face.
+ */
+static void
+release_shm(struct ccnd_handle *h, struct face *face)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    int fd = ccn_shm_doorbell_fd(face->shm);
+    
+    hashtb_start(h->shm_doorbells, e);
+    if (hashtb_seek(e, &fd, sizeof(fd), 0) >= 0)
+        hashtb_delete(e);
+    hashtb_end(e);
+    ccn_shm_destroy(&face->shm);
+}
+
 static void
 finalize_face(struct hashtb_enumerator *e)
 {
@@ -387,6 +406,8 @@ finalize_face(struct hashtb_enumerator *e)
     }
     else if (face->faceid != CCN_NOFACEID)
         ccnd_msg(h, "orphaned face %u", face->faceid);
+    if (face->shm != NULL)
+        release_shm(h, face);
     for (m = 0; m < CCND_FACE_METER_N; m++)
         ccnd_meter_destroy(&face->meter[m]);
 }
@@ -1770,6 +1791,11 @@ check_dgram_faces(struct ccnd_handle *h)
     while (e->data != NULL) {
         struct face *face = e->data;
         if (face->addr != NULL && (face->flags & checkflags) == wantflags) {
+            if (face->lease_expiry != 0 && face->lease_expiry <= h->sec) {
+                /* Not renewed; from now on it lasts only while in use */
+                face->lease_expiry = 0;
+                face->flags &= ~CCN_FACE_PERMANENT;
+            }
             if (face->recvcount == 0) {
                 if ((face->flags & CCN_FACE_PERMANENT) == 0) {
                     count += 1;
@@ -2372,61 +2398,28 @@ check_forwarding_entry_ccndid(struct ccnd_handle *h,
 }
 
 /**
- * Process a newface request for the ccnd internal client.
+ * Create a face (or find an existing one) as described by a newface request.
  *
- * @param h is the ccnd handle
- * @param msg points to a ccnd-encoded ContentObject containing a
- *         FaceInstance in its Content.
- * @param size is its size in bytes
- * @param reply_body is a buffer to hold the Content of the reply, as a
- *         FaceInstance including faceid
- * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
- *         set the response type to NACK.
- *
- * Is is permitted for the face to already exist.
- * A newly created face will have no registered prefixes, and so will not
- * receive any traffic.
+ * The request has already been parsed and its source checked for
+ * locality; reqface is the face it came in on.
+ * On success, face_instance is updated to describe the face and appended
+ * to reply_body.
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK.
  */
-int
-ccnd_req_newface(struct ccnd_handle *h,
-                 const unsigned char *msg, size_t size,
-                 struct ccn_charbuf *reply_body)
+static int
+ccnd_newface(struct ccnd_handle *h, struct face *reqface,
+             struct ccn_face_instance *face_instance,
+             struct ccn_charbuf *reply_body)
 {
-    struct ccn_parsed_ContentObject pco = {0};
     int res;
-    const unsigned char *req;
-    size_t req_size;
-    struct ccn_face_instance *face_instance = NULL;
     struct addrinfo hints = {0};
     struct addrinfo *addrinfo = NULL;
     int fd = -1;
     int mcast;
+    long lease;
     struct face *face = NULL;
-    struct face *reqface = NULL;
     struct face *newface = NULL;
-    int save;
-    int nackallowed = 0;
 
-    save = h->flood;
-    h->flood = 0; /* never auto-register for these */
-    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
-    if (res < 0)
-        goto Finish;
-    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
-    if (res < 0)
-        goto Finish;
-    res = -1;
-    face_instance = ccn_face_instance_parse(req, req_size);
-    if (face_instance == NULL || face_instance->action == NULL)
-        goto Finish;
-    if (strcmp(face_instance->action, "newface") != 0)
-        goto Finish;
-    /* consider the source ... */
-    reqface = face_from_faceid(h, h->interest_faceid);
-    if (reqface == NULL ||
-        (reqface->flags & (CCN_FACE_LOOPBACK | CCN_FACE_LOCAL)) == 0)
-        goto Finish;
-    nackallowed = 1;
     res = check_face_instance_ccndid(h, face_instance, reply_body);
     if (res != 0)
         goto Finish;
@@ -2497,12 +2490,30 @@ ccnd_req_newface(struct ccnd_handle *h,
                                   0);
     }
     if (newface != NULL) {
+        lease = face_instance->lifetime;
+        if (lease > 0 && lease < 0x7FFFFFFF &&
+            (newface->flags & (CCN_FACE_DGRAM | CCN_FACE_MCAST)) == CCN_FACE_DGRAM &&
+            ((newface->flags & CCN_FACE_PERMANENT) == 0 || newface->lease_expiry != 0)) {
+            /*
+             * A leased face is kept for the lifetime asked for, or for
+             * longer if it was leased before; after that it is treated
+             * like any other datagram face, and goes away when idle.
+             * A face that was made permanent without a lease stays so.
+             */
+            if (newface->lease_expiry < h->sec + lease)
+                newface->lease_expiry = h->sec + lease;
+            lease = newface->lease_expiry - h->sec;
+        }
+        else {
+            newface->lease_expiry = 0;
+            lease = 0x7FFFFFFF;
+        }
         newface->flags |= CCN_FACE_PERMANENT;
         face_instance->action = NULL;
         face_instance->ccnd_id = h->ccnd_id;
         face_instance->ccnd_id_size = sizeof(h->ccnd_id);
         face_instance->faceid = newface->faceid;
-        face_instance->lifetime = 0x7FFFFFFF;
+        face_instance->lifetime = lease;
         /*
          * A short lifetime is a clue to the client that
          * the connection has not been completed.
@@ -2516,10 +2527,65 @@ ccnd_req_newface(struct ccnd_handle *h,
     else
         res = ccnd_nack(h, reply_body, 450, "could not create face");
 Finish:
-    h->flood = save; /* restore saved flood flag */
-    ccn_face_instance_destroy(&face_instance);
     if (addrinfo != NULL)
         freeaddrinfo(addrinfo);
+    return(res);
+}
+
+/**
+ * Process a newface request for the ccnd internal client.
+ *
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a
+ *         FaceInstance in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         FaceInstance including faceid
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ * Is is permitted for the face to already exist.
+ * A newly created face will have no registered prefixes, and so will not
+ * receive any traffic.
+ */
+int
+ccnd_req_newface(struct ccnd_handle *h,
+                 const unsigned char *msg, size_t size,
+                 struct ccn_charbuf *reply_body)
+{
+    struct ccn_parsed_ContentObject pco = {0};
+    int res;
+    const unsigned char *req;
+    size_t req_size;
+    struct ccn_face_instance *face_instance = NULL;
+    struct face *reqface = NULL;
+    int save;
+    int nackallowed = 0;
+
+    save = h->flood;
+    h->flood = 0; /* never auto-register for these */
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0)
+        goto Finish;
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0)
+        goto Finish;
+    res = -1;
+    face_instance = ccn_face_instance_parse(req, req_size);
+    if (face_instance == NULL || face_instance->action == NULL)
+        goto Finish;
+    if (strcmp(face_instance->action, "newface") != 0)
+        goto Finish;
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL ||
+        (reqface->flags & (CCN_FACE_LOOPBACK | CCN_FACE_LOCAL)) == 0)
+        goto Finish;
+    nackallowed = 1;
+    res = ccnd_newface(h, reqface, face_instance, reply_body);
+Finish:
+    h->flood = save; /* restore saved flood flag */
+    ccn_face_instance_destroy(&face_instance);
     return((nackallowed || res <= 0) ? res : -1);
 }
 
@@ -2591,6 +2657,61 @@ Finish:
     return((nackallowed || res <= 0) ? res : -1);
 }
 
+/**
+ * Register a prefix as described by a checked prefixreg or selfreg request.
+ *
+ * On success the resulting ForwardingEntry is appended to reply_body.
+ * @returns 0 for success, or negative for failure.
+ */
+static int
+ccnd_prefixreg(struct ccnd_handle *h,
+               struct ccn_forwarding_entry *forwarding_entry,
+               struct ccn_charbuf *reply_body)
+{
+    struct face *face = NULL;
+    struct ccn_indexbuf *comps = NULL;
+    int res = -1;
+
+    if (forwarding_entry->name_prefix == NULL)
+        goto Finish;
+    if (forwarding_entry->ccnd_id_size == sizeof(h->ccnd_id)) {
+        if (memcmp(forwarding_entry->ccnd_id,
+                   h->ccnd_id, sizeof(h->ccnd_id)) != 0)
+            goto Finish;
+    }
+    else if (forwarding_entry->ccnd_id_size != 0)
+        goto Finish;
+    face = face_from_faceid(h, forwarding_entry->faceid);
+    if (face == NULL)
+        goto Finish;
+    if (forwarding_entry->lifetime < 0)
+        forwarding_entry->lifetime = 60;
+    else if (forwarding_entry->lifetime > 3600 &&
+             forwarding_entry->lifetime < (1 << 30))
+        forwarding_entry->lifetime = 300;
+    comps = ccn_indexbuf_create();
+    res = ccn_name_split(forwarding_entry->name_prefix, comps);
+    if (res < 0)
+        goto Finish;
+    res = ccnd_reg_prefix(h,
+                          forwarding_entry->name_prefix->buf, comps, res,
+                          face->faceid,
+                          forwarding_entry->flags,
+                          forwarding_entry->lifetime);
+    if (res < 0)
+        goto Finish;
+    forwarding_entry->flags = res;
+    forwarding_entry->action = NULL;
+    forwarding_entry->ccnd_id = h->ccnd_id;
+    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
+    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
+    if (res > 0)
+        res = 0;
+Finish:
+    ccn_indexbuf_destroy(&comps);
+    return(res);
+}
+
 /**
  * Worker bee for two very similar public functions.
  */
@@ -2604,9 +2725,7 @@ ccnd_req_prefix_or_self_reg(struct ccnd_handle *h,
     const unsigned char *req;
     size_t req_size;
     struct ccn_forwarding_entry *forwarding_entry = NULL;
-    struct face *face = NULL;
     struct face *reqface = NULL;
-    struct ccn_indexbuf *comps = NULL;
     int nackallowed = 0;
 
     res = ccn_parse_ContentObject(msg, size, &pco, NULL);
@@ -2638,44 +2757,9 @@ ccnd_req_prefix_or_self_reg(struct ccnd_handle *h,
         if (strcmp(forwarding_entry->action, "prefixreg") != 0)
         goto Finish;
     }
-    if (forwarding_entry->name_prefix == NULL)
-        goto Finish;
-    if (forwarding_entry->ccnd_id_size == sizeof(h->ccnd_id)) {
-        if (memcmp(forwarding_entry->ccnd_id,
-                   h->ccnd_id, sizeof(h->ccnd_id)) != 0)
-            goto Finish;
-    }
-    else if (forwarding_entry->ccnd_id_size != 0)
-        goto Finish;
-    face = face_from_faceid(h, forwarding_entry->faceid);
-    if (face == NULL)
-        goto Finish;
-    if (forwarding_entry->lifetime < 0)
-        forwarding_entry->lifetime = 60;
-    else if (forwarding_entry->lifetime > 3600 &&
-             forwarding_entry->lifetime < (1 << 30))
-        forwarding_entry->lifetime = 300;
-    comps = ccn_indexbuf_create();
-    res = ccn_name_split(forwarding_entry->name_prefix, comps);
-    if (res < 0)
-        goto Finish;
-    res = ccnd_reg_prefix(h,
-                          forwarding_entry->name_prefix->buf, comps, res,
-                          face->faceid,
-                          forwarding_entry->flags,
-                          forwarding_entry->lifetime);
-    if (res < 0)
-        goto Finish;
-    forwarding_entry->flags = res;
-    forwarding_entry->action = NULL;
-    forwarding_entry->ccnd_id = h->ccnd_id;
-    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
-    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
-    if (res > 0)
-        res = 0;
+    res = ccnd_prefixreg(h, forwarding_entry, reply_body);
 Finish:
     ccn_forwarding_entry_destroy(&forwarding_entry);
-    ccn_indexbuf_destroy(&comps);
     if (nackallowed && res < 0)
         res = ccnd_nack(h, reply_body, 450, "could not register prefix");
     return((nackallowed || res <= 0) ? res : -1);
@@ -2721,6 +2805,163 @@ ccnd_req_selfreg(struct ccnd_handle *h,
     return(ccnd_req_prefix_or_self_reg(h, msg, size, 1, reply_body));
 }
 
+/**
+ * Check that the Content of a bulkreg request is a Collection of
+ * well-formed newface requests, each followed by prefixreg requests,
+ * so that nothing is done for a request that is malformed part way.
+ * @returns 0 if it is, or -1 if not.
+ */
+static int
+check_bulkreg(const unsigned char *req, size_t req_size)
+{
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = NULL;
+    struct ccn_face_instance *face_instance = NULL;
+    struct ccn_forwarding_entry *forwarding_entry = NULL;
+    size_t start;
+    int res = 0;
+    
+    d = ccn_buf_decoder_start(&decoder, req, req_size);
+    if (!ccn_buf_match_dtag(d, CCN_DTAG_Collection))
+        return(-1);
+    ccn_buf_advance(d);
+    while (res == 0 && ccn_buf_match_dtag(d, CCN_DTAG_FaceInstance)) {
+        start = d->decoder.token_index;
+        ccn_buf_advance_past_element(d);
+        face_instance = ccn_face_instance_parse(req + start,
+                                                d->decoder.token_index - start);
+        if (face_instance == NULL || face_instance->action == NULL ||
+            strcmp(face_instance->action, "newface") != 0)
+            res = -1;
+        ccn_face_instance_destroy(&face_instance);
+        while (res == 0 && ccn_buf_match_dtag(d, CCN_DTAG_ForwardingEntry)) {
+            start = d->decoder.token_index;
+            ccn_buf_advance_past_element(d);
+            forwarding_entry = ccn_forwarding_entry_parse(req + start,
+                                                d->decoder.token_index - start);
+            if (forwarding_entry == NULL || forwarding_entry->action == NULL ||
+                strcmp(forwarding_entry->action, "prefixreg") != 0)
+                res = -1;
+            ccn_forwarding_entry_destroy(&forwarding_entry);
+        }
+    }
+    ccn_buf_check_close(d);
+    if (d->decoder.state < 0 || d->decoder.index != req_size)
+        res = -1;
+    return(res);
+}
+
+/**
+ * @brief Process a bulkreg request for the ccnd internal client.
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a
+ *          Collection in its Content, of FaceInstance (newface)
+ *          elements each followed by any number of ForwardingEntry
+ *          (prefixreg) elements.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         Collection with a FaceInstance or ForwardingEntry for each one
+ *         in the request; any of them may be a StatusResponse instead.
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ * Each prefix is registered on the face made by the FaceInstance it
+ * follows; the FaceID of the ForwardingEntry is ignored.
+ * The whole request is checked before any of it is acted on, and is
+ * NACKed if any part is malformed, so that the reply always tells
+ * what was done.
+ * This saves a round trip and a signature per face and per prefix
+ * when there are many of them to set up, and lets a face with many
+ * prefixes be asked for just once.
+ */
+int
+ccnd_req_bulkreg(struct ccnd_handle *h,
+                 const unsigned char *msg, size_t size,
+                 struct ccn_charbuf *reply_body)
+{
+    struct ccn_parsed_ContentObject pco = {0};
+    int res;
+    const unsigned char *req;
+    size_t req_size;
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = NULL;
+    struct ccn_face_instance *face_instance = NULL;
+    struct ccn_forwarding_entry *forwarding_entry = NULL;
+    struct ccn_charbuf *item = NULL;
+    struct face *reqface = NULL;
+    size_t start;
+    unsigned faceid;
+    int save;
+    int nackallowed = 0;
+
+    save = h->flood;
+    h->flood = 0; /* never auto-register for these */
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0)
+        goto Finish;
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0)
+        goto Finish;
+    res = -1;
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL ||
+        (reqface->flags & (CCN_FACE_LOOPBACK | CCN_FACE_LOCAL)) == 0)
+        goto Finish;
+    nackallowed = 1;
+    if (check_bulkreg(req, req_size) < 0) {
+        res = ccnd_nack(h, reply_body, 504, "parameter error");
+        goto Finish;
+    }
+    d = ccn_buf_decoder_start(&decoder, req, req_size);
+    ccn_buf_advance(d);
+    item = ccn_charbuf_create();
+    ccnb_element_begin(reply_body, CCN_DTAG_Collection);
+    while (ccn_buf_match_dtag(d, CCN_DTAG_FaceInstance)) {
+        start = d->decoder.token_index;
+        ccn_buf_advance_past_element(d);
+        face_instance = ccn_face_instance_parse(req + start,
+                                                d->decoder.token_index - start);
+        faceid = CCN_NOFACEID;
+        item->length = 0;
+        res = -1;
+        if (face_instance != NULL && face_instance->action != NULL &&
+            strcmp(face_instance->action, "newface") == 0)
+            res = ccnd_newface(h, reqface, face_instance, item);
+        if (res == 0)
+            faceid = face_instance->faceid;
+        else if (res < 0)
+            ccnd_nack(h, item, 450, "could not create face");
+        ccn_charbuf_append_charbuf(reply_body, item);
+        ccn_face_instance_destroy(&face_instance);
+        while (ccn_buf_match_dtag(d, CCN_DTAG_ForwardingEntry)) {
+            start = d->decoder.token_index;
+            ccn_buf_advance_past_element(d);
+            forwarding_entry = ccn_forwarding_entry_parse(req + start,
+                                                d->decoder.token_index - start);
+            item->length = 0;
+            res = -1;
+            if (forwarding_entry != NULL && forwarding_entry->action != NULL &&
+                strcmp(forwarding_entry->action, "prefixreg") == 0 &&
+                faceid != CCN_NOFACEID) {
+                forwarding_entry->faceid = faceid;
+                res = ccnd_prefixreg(h, forwarding_entry, item);
+            }
+            if (res < 0)
+                ccnd_nack(h, item, 450, "could not register prefix");
+            ccn_charbuf_append_charbuf(reply_body, item);
+            ccn_forwarding_entry_destroy(&forwarding_entry);
+        }
+    }
+    res = ccnb_element_end(reply_body);
+Finish:
+    h->flood = save; /* restore saved flood flag */
+    ccn_face_instance_destroy(&face_instance);
+    ccn_forwarding_entry_destroy(&forwarding_entry);
+    ccn_charbuf_destroy(&item);
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
 /**
  * @brief Process an unreg request for the ccnd internal client.
  * @param h is the ccnd handle
@@ -3779,6 +4020,113 @@ Finish:
                        &expire_content, NULL, content->accession);
 }
 
+/**
+ * Note the ContentObjects among the complete messages in a buffer.
+ *
+ * Link PDUs are opened up (one level deep, as in process_input_message)
+ * so their contents are included.
+ */
+static void
+predigest_collect(struct ccnd_handle *h, const unsigned char *msg,
+                  size_t size, int pdu_ok)
+{
+    struct ccn_skeleton_decoder decoder = {0};
+    struct ccn_skeleton_decoder *d = &decoder;
+    struct ccn_skeleton_decoder peek;
+    const unsigned char *m;
+    ssize_t dres;
+    
+    while (d->index < size && h->n_predigest < CCND_PREDIGEST_MAX) {
+        dres = ccn_skeleton_decode(d, msg + d->index, size - d->index);
+        if (d->state != 0)
+            return;
+        m = msg + d->index - dres;
+        memset(&peek, 0, sizeof(peek));
+        peek.state |= CCN_DSTATE_PAUSE;
+        ccn_skeleton_decode(&peek, m, dres);
+        if (peek.state < 0 || CCN_GET_TT_FROM_DSTATE(peek.state) != CCN_DTAG)
+            continue;
+        if (peek.numval == CCN_DTAG_ContentObject) {
+            h->predigest[h->n_predigest].msg = m;
+            h->predigest[h->n_predigest].size = dres;
+            h->n_predigest++;
+        }
+        else if (peek.numval == CCN_DTAG_CCNProtocolDataUnit && pdu_ok &&
+                 (size_t)dres > peek.index)
+            predigest_collect(h, m + peek.index, dres - peek.index - 1, 0);
+    }
+}
+
+/**
+ * Compute the digests of the ContentObjects in an input buffer as a batch.
+ *
+ * Computing several digests together lets ccn_digest_many() hash them
+ * in parallel; process_incoming_content() picks up the results.
+ * Nothing is kept unless there are at least two objects to share the work.
+ */
+static void
+predigest_input(struct ccnd_handle *h, const unsigned char *msg,
+                size_t size, int pdu_ok)
+{
+    struct ccn_digest_job jobs[CCND_PREDIGEST_MAX];
+    int i;
+    int n;
+    
+    h->n_predigest = 0;
+    predigest_collect(h, msg, size, pdu_ok);
+    n = h->n_predigest;
+    if (n < 2) {
+        h->n_predigest = 0;
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        jobs[i].data = h->predigest[i].msg;
+        jobs[i].size = h->predigest[i].size;
+        jobs[i].result = h->predigest[i].digest;
+    }
+    if (ccn_digest_many(CCN_DIGEST_SHA256, jobs, n) < 0)
+        h->n_predigest = 0;
+}
+
+/**
+ * Find the batch-computed digest for a ContentObject, if we have one.
+ */
+static const unsigned char *
+predigest_lookup(struct ccnd_handle *h, const unsigned char *msg, size_t size)
+{
+    int i;
+    
+    for (i = 0; i < h->n_predigest; i++)
+        if (h->predigest[i].msg == msg && h->predigest[i].size == size)
+            return(h->predigest[i].digest);
+    return(NULL);
+}
+
+/**
+ * Update parse information for a ContentObject after the explicit
+ * digest component has been inserted at the end of its name.
+ *
+ * @param obj and comps describe the ContentObject before the insertion.
+ * @param at is the offset where the component was inserted.
+ * @param inserted is the number of bytes inserted.
+ *
+ * The result is the same as parsing the new object from scratch.
+ */
+static void
+adjust_parse_for_digest_component(struct ccn_parsed_ContentObject *obj,
+                                  struct ccn_indexbuf *comps,
+                                  size_t at, size_t inserted)
+{
+    int i;
+    
+    for (i = 0; i <= CCN_PCO_E; i++)
+        if (obj->offset[i] > at || i == CCN_PCO_E_ComponentLast)
+            obj->offset[i] += inserted;
+    ccn_indexbuf_append_element(comps, at + inserted);
+    obj->name_ncomps += 1;
+    obj->digest_bytes = 0;
+}
+
 static void
 process_incoming_content(struct ccnd_handle *h, struct face *face,
                          unsigned char *wire_msg, size_t wire_size)
@@ -3793,6 +4141,7 @@ process_incoming_content(struct ccnd_handle *h, struct face *face,
     size_t tailsize = 0;
     unsigned char *tail = NULL;
     struct content_entry *content = NULL;
+    const unsigned char *predigest = NULL;
     int i;
     struct ccn_indexbuf *comps = indexbuf_obtain(h);
     struct ccn_charbuf *cb = charbuf_obtain(h);
@@ -3800,6 +4149,7 @@ process_incoming_content(struct ccnd_handle *h, struct face *face,
     msg = wire_msg;
     size = wire_size;
     
+    predigest = predigest_lookup(h, msg, size);
     res = ccn_parse_ContentObject(msg, size, &obj, comps);
     if (res < 0) {
         ccnd_msg(h, "error parsing ContentObject - code %d", res);
@@ -3815,7 +4165,12 @@ process_incoming_content(struct ccnd_handle *h, struct face *face,
         goto Bail;
     }
     /* Make the ContentObject-digest name component explicit */
-    ccn_digest_ContentObject(msg, &obj);
+    if (predigest != NULL) {
+        memcpy(obj.digest, predigest, sizeof(obj.digest));
+        obj.digest_bytes = sizeof(obj.digest);
+    }
+    else
+        ccn_digest_ContentObject(msg, &obj);
     if (obj.digest_bytes != 32) {
         ccnd_debug_ccnb(h, __LINE__, "indigestible", face, msg, size);
         goto Bail;
@@ -3829,8 +4184,7 @@ process_incoming_content(struct ccnd_handle *h, struct face *face,
     ccn_charbuf_append(cb, msg + i, size - i);
     msg = cb->buf;
     size = cb->length;
-    res = ccn_parse_ContentObject(msg, size, &obj, comps);
-    if (res < 0) abort(); /* must have just messed up */
+    adjust_parse_for_digest_component(&obj, comps, i, size - wire_size);
     
     if (obj.magic != 20090415) {
         if (++(h->oldformatcontent) == h->oldformatcontentgrumble) {
@@ -4120,6 +4474,7 @@ process_input_buffer(struct ccnd_handle *h, struct face *face)
     d = &face->decoder;
     msg = face->inbuf->buf;
     size = face->inbuf->length;
+    predigest_input(h, msg, size, 0);
     while (d->index < size) {
         dres = ccn_skeleton_decode(d, msg + d->index, size - d->index);
         if (d->state != 0)
@@ -4131,10 +4486,141 @@ process_input_buffer(struct ccnd_handle *h, struct face *face)
                      face->faceid, d->state, (int)(size - d->index));
         // XXX - perhaps this should be a fatal error.
     }
+    h->n_predigest = 0;
     face->inbuf->length = 0;
     memset(d, 0, sizeof(*d));
 }
 
+/**
+ * Move the traffic of a local client into shared memory, as it asked.
+ *
+ * If that cannot be done, the client is told so and carries on
+ * using its socket.
+ */
+static void
+setup_shm_face(struct ccnd_handle *h, struct face *face)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    int fd;
+    
+    face->shm = ccn_shm_offer(face->recv_fd, CCN_SHM_RING_SIZE);
+    if (face->shm == NULL) {
+        ccnd_msg(h, "no shared memory for face %u: %s",
+                 face->faceid, strerror(errno));
+        return;
+    }
+    fd = ccn_shm_doorbell_fd(face->shm);
+    hashtb_start(h->shm_doorbells, e);
+    if (hashtb_seek(e, &fd, sizeof(fd), 0) >= 0)
+        *(unsigned *)(e->data) = face->faceid;
+    hashtb_end(e);
+    if (hashtb_lookup(h->shm_doorbells, &fd, sizeof(fd)) == NULL) {
+        shutdown_client_fd(h, face->recv_fd);
+        return;
+    }
+    face->flags |= CCN_FACE_SHM;
+    ccnd_msg(h, "shared memory for face %u", face->faceid);
+}
+
+/**
+ * Process the messages waiting in the ring from a shared-memory face.
+ *
+ * What is in the ring on entry is copied out and parsed from the copy,
+ * and the space is given back to the client message by message.  Only
+ * that much is looked at, so a busy client does not starve the others.
+ * @returns -1 if the client has botched the ring, otherwise 0.
+ */
+static int
+process_shm_input(struct ccnd_handle *h, struct face *face)
+{
+    struct ccn_skeleton_decoder decoder = {0};
+    struct ccn_skeleton_decoder *d = &decoder;
+    struct ccn_shm *shm = face->shm;
+    unsigned faceid = face->faceid;
+    unsigned char *ring = NULL;
+    unsigned char *buf = NULL;
+    ssize_t avail;
+    ssize_t msgstart = 0;
+    
+    avail = ccn_shm_peek(shm, &ring);
+    if (avail <= 0)
+        return(avail);
+    /*
+     * The client may still scribble on the ring, so work from a copy;
+     * otherwise the bytes we check need not be the bytes we use.
+     */
+    if (h->shm_copy == NULL)
+        h->shm_copy = ccn_charbuf_create();
+    h->shm_copy->length = 0;
+    if (ccn_charbuf_append(h->shm_copy, ring, avail) < 0)
+        return(-1);
+    buf = h->shm_copy->buf;
+    ccnd_meter_bump(h, face->meter[FM_BYTI], avail);
+    face->recvcount++;
+    predigest_input(h, buf, avail, 1);
+    while (msgstart < avail) {
+        ccn_skeleton_decode(d, buf + msgstart, avail - msgstart);
+        if (d->state != 0)
+            break;
+        process_input_message(h, face, buf + msgstart, d->index - msgstart, 1);
+        /* The face might have been destroyed by the message */
+        face = face_from_faceid(h, faceid);
+        if (face == NULL || face->shm != shm) {
+            h->n_predigest = 0;
+            return(0);
+        }
+        ccn_shm_consume(shm, d->index - msgstart);
+        msgstart = d->index;
+    }
+    h->n_predigest = 0;
+    if (d->state < 0 || (msgstart == 0 && avail == ccn_shm_capacity(shm)))
+        return(-1);
+    return(0);
+}
+
+/**
+ * Move output that did not fit in the ring earlier.
+ */
+static void
+shm_deferred_write(struct ccnd_handle *h, struct face *face)
+{
+    size_t n;
+    
+    n = ccn_shm_write(face->shm, face->outbuf->buf + face->outbufindex,
+                      face->outbuf->length - face->outbufindex);
+    ccnd_meter_bump(h, face->meter[FM_BYTO], n);
+    face->outbufindex += n;
+    if (face->outbufindex == face->outbuf->length) {
+        face->outbufindex = 0;
+        ccn_charbuf_destroy(&face->outbuf);
+    }
+}
+
+/**
+ * Answer the doorbell of a shared-memory face.
+ */
+static void
+process_shm_doorbell(struct ccnd_handle *h, int fd)
+{
+    unsigned *faceidp;
+    struct face *face;
+    
+    faceidp = hashtb_lookup(h->shm_doorbells, &fd, sizeof(fd));
+    if (faceidp == NULL)
+        return;
+    face = face_from_faceid(h, *faceidp);
+    if (face == NULL || face->shm == NULL)
+        return;
+    ccn_shm_clear_doorbell(face->shm);
+    if (face->outbuf != NULL)
+        shm_deferred_write(h, face);
+    if (process_shm_input(h, face) < 0) {
+        ccnd_msg(h, "protocol error on face %u", face->faceid);
+        shutdown_client_fd(h, face->recv_fd);
+    }
+}
+
 /**
  * Process the input from a socket.
  *
@@ -4160,8 +4646,10 @@ process_input(struct ccnd_handle *h, int fd)
     socklen_t err_sz;
     
     face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
-    if (face == NULL)
+    if (face == NULL) {
+        process_shm_doorbell(h, fd);
         return;
+    }
     if ((face->flags & (CCN_FACE_DGRAM | CCN_FACE_PASSIVE)) == CCN_FACE_PASSIVE) {
         accept_connection(h, fd);
         check_comm_file(h);
@@ -4176,6 +4664,13 @@ process_input(struct ccnd_handle *h, int fd)
             return;
         }
     }
+    if (face->shm != NULL) {
+        /* The socket of a shared-memory face only says the client is gone */
+        process_shm_input(h, face);
+        if (hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd)) != NULL)
+            shutdown_client_fd(h, fd);
+        return;
+    }
     d = &face->decoder;
     if (face->inbuf == NULL)
         face->inbuf = ccn_charbuf_create();
@@ -4209,7 +4704,18 @@ process_input(struct ccnd_handle *h, int fd)
             ccnd_stats_handle_http_connection(h, face);
             return;
         }
+        if ((face->flags & (CCN_FACE_UNDECIDED | CCN_FACE_LOCAL)) ==
+              (CCN_FACE_UNDECIDED | CCN_FACE_LOCAL) &&
+            face->inbuf->length >= CCN_SHM_HELLO_SIZE &&
+            0 == memcmp(face->inbuf->buf, CCN_SHM_HELLO, CCN_SHM_HELLO_SIZE)) {
+            face->inbuf->length = 0;
+            setup_shm_face(h, face);
+            return;
+        }
         dres = ccn_skeleton_decode(d, buf, res);
+        if (d->state == 0)
+            predigest_input(h, face->inbuf->buf, face->inbuf->length,
+                            (face->flags & CCN_FACE_LOCAL) != 0);
         while (d->state == 0) {
             process_input_message(h, source,
                                   face->inbuf->buf + msgstart,
@@ -4217,6 +4723,7 @@ process_input(struct ccnd_handle *h, int fd)
                                   (face->flags & CCN_FACE_LOCAL) != 0);
             msgstart = d->index;
             if (msgstart == face->inbuf->length) {
+                h->n_predigest = 0;
                 face->inbuf->length = 0;
                 return;
             }
@@ -4224,6 +4731,7 @@ process_input(struct ccnd_handle *h, int fd)
                     face->inbuf->buf + d->index, // XXX - msgstart and d->index are the same here - use msgstart
                     res = face->inbuf->length - d->index);  // XXX - why is res set here?
         }
+        h->n_predigest = 0;
         if ((face->flags & CCN_FACE_DGRAM) != 0) {
             ccnd_msg(h, "protocol error on face %u, discarding %u bytes",
                 source->faceid,
@@ -4339,7 +4847,9 @@ ccnd_send(struct ccnd_handle *h,
         process_internal_client_buffer(h);
         return;
     }
-    if ((face->flags & CCN_FACE_DGRAM) == 0)
+    if (face->shm != NULL)
+        res = ccn_shm_write(face->shm, data, size);
+    else if ((face->flags & CCN_FACE_DGRAM) == 0)
         res = send(face->recv_fd, data, size, 0);
     else
         res = sendto(sending_fd(h, face), data, size, 0,
@@ -4426,8 +4936,9 @@ prepare_poll_fds(struct ccnd_handle *h)
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
     int i, j, k;
-    if (hashtb_n(h->faces_by_fd) != h->nfds) {
-        h->nfds = hashtb_n(h->faces_by_fd);
+    nfds_t n = hashtb_n(h->faces_by_fd) + hashtb_n(h->shm_doorbells);
+    if (n != h->nfds) {
+        h->nfds = n;
         h->fds = realloc(h->fds, h->nfds * sizeof(h->fds[0]));
         memset(h->fds, 0, h->nfds * sizeof(h->fds[0]));
     }
@@ -4440,11 +4951,18 @@ prepare_poll_fds(struct ccnd_handle *h)
             j = --k;
         h->fds[j].fd = face->recv_fd;
         h->fds[j].events = ((face->flags & CCN_FACE_NORECV) == 0) ? POLLIN : 0;
-        if ((face->outbuf != NULL || (face->flags & CCN_FACE_CLOSING) != 0))
+        if (face->shm != NULL) {
+            /* Output waits for room in the ring, not on the socket */
+            ccn_shm_prepare_wait(face->shm, face->outbuf != NULL);
+            j = --k;
+            h->fds[j].fd = ccn_shm_doorbell_fd(face->shm);
+            h->fds[j].events = POLLIN;
+        }
+        else if ((face->outbuf != NULL || (face->flags & CCN_FACE_CLOSING) != 0))
             h->fds[j].events |= POLLOUT;
     }
     hashtb_end(e);
-    if (i < k)
+    if (i != k)
         abort();
 }
 
@@ -4829,6 +5347,7 @@ ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
     h->faces_by_faceid = calloc(h->face_limit, sizeof(h->faces_by_faceid[0]));
     param.finalize = &finalize_face;
     h->faces_by_fd = hashtb_create(sizeof(struct face), &param);
+    h->shm_doorbells = hashtb_create(sizeof(unsigned), NULL);
     h->dgram_faces = hashtb_create(sizeof(struct face), &param);
     param.finalize = &finalize_content;
     h->content_tab = hashtb_create(sizeof(struct content_entry), &param);
@@ -4961,6 +5480,7 @@ ccnd_destroy(struct ccnd_handle **pccnd)
     ccn_schedule_destroy(&h->sched);
     hashtb_destroy(&h->dgram_faces);
     hashtb_destroy(&h->faces_by_fd);
+    hashtb_destroy(&h->shm_doorbells);
     hashtb_destroy(&h->content_tab);
     hashtb_destroy(&h->propagating_tab);
     hashtb_destroy(&h->nameprefix_tab);
@@ -4981,6 +5501,7 @@ ccnd_destroy(struct ccnd_handle **pccnd)
         h->content_by_accession_window = 0;
     }
     ccn_charbuf_destroy(&h->scratch_charbuf);
+    ccn_charbuf_destroy(&h->shm_copy);
     ccn_charbuf_destroy(&h->autoreg);
     ccn_indexbuf_destroy(&h->skiplinks);
     ccn_indexbuf_destroy(&h->scratch_indexbuf);
@@ -105,6 +105,20 @@ ccnd_init_service_ccnb(struct ccnd_handle *ccnd, const char *baseuri, int freshn
     return(cob);
 }
 
+/**
+ * Parse a service ContentObject once, to match it against interests.
+ */
+static struct ccn_parsed_ContentObject *
+ccnd_parse_service_ccnb(struct ccn_charbuf *cob)
+{
+    struct ccn_parsed_ContentObject *pco = calloc(1, sizeof(*pco));
+    
+    if (pco == NULL ||
+        ccn_parse_ContentObject(cob->buf, cob->length, pco, NULL) < 0)
+        abort();
+    return(pco);
+}
+
 /**
  * Local interpretation of selfp->intdata
  */
@@ -120,6 +134,7 @@ ccnd_init_service_ccnb(struct ccnd_handle *ccnd, const char *baseuri, int freshn
 #define OP_UNREG       0x0600
 #define OP_NOTICE      0x0700
 #define OP_SERVICE     0x0800
+#define OP_BULKREG     0x0900
 /**
  * Common interest handler for ccnd_internal_client
  */
@@ -219,18 +234,24 @@ ccnd_answer_req(struct ccn_closure *selfp,
             reply_body = ccn_charbuf_create();
             res = ccnd_req_unreg(ccnd, final_comp, final_size, reply_body);
             break;
+        case OP_BULKREG:
+            reply_body = ccn_charbuf_create();
+            res = ccnd_req_bulkreg(ccnd, final_comp, final_size, reply_body);
+            break;
         case OP_NOTICE:
             ccnd_start_notice(ccnd);
             goto Bail;
             break;
         case OP_SERVICE:
-            if (ccnd->service_ccnb == NULL)
+            if (ccnd->service_ccnb == NULL) {
                 ccnd->service_ccnb = ccnd_init_service_ccnb(ccnd, CCNDID_LOCAL_URI, 600);
+                ccnd->service_pco = ccnd_parse_service_ccnb(ccnd->service_ccnb);
+            }
             if (ccn_content_matches_interest(
                     ccnd->service_ccnb->buf,
                     ccnd->service_ccnb->length,
                     1,
-                    NULL,
+                    ccnd->service_pco,
                     info->interest_ccnb,
                     info->pi->offset[CCN_PI_E],
                     info->pi
@@ -241,13 +262,15 @@ ccnd_answer_req(struct ccn_closure *selfp,
                 goto Finish;
             }
             // XXX this needs refactoring.
-            if (ccnd->neighbor_ccnb == NULL)
+            if (ccnd->neighbor_ccnb == NULL) {
                 ccnd->neighbor_ccnb = ccnd_init_service_ccnb(ccnd, CCNDID_NEIGHBOR_URI, 5);
+                ccnd->neighbor_pco = ccnd_parse_service_ccnb(ccnd->neighbor_ccnb);
+            }
             if (ccn_content_matches_interest(
                     ccnd->neighbor_ccnb->buf,
                     ccnd->neighbor_ccnb->length,
                     1,
-                    NULL,
+                    ccnd->neighbor_pco,
                     info->interest_ccnb,
                     info->pi->offset[CCN_PI_E],
                     info->pi
@@ -416,6 +439,7 @@ ccnd_init_internal_keystore(struct ccnd_handle *ccnd)
     int res = -1;
     size_t save;
     char *keystore_path = NULL;
+    enum ccn_keytype keytype;
     struct ccn_signing_params sp = CCN_SIGNING_PARAMS_INIT;
     
     if (ccnd->internal_client == NULL)
@@ -445,7 +469,13 @@ ccnd_init_internal_keystore(struct ccnd_handle *ccnd)
     if (res >= 0)
         goto Finish;
     /* No stored keystore that we can access; create one. */
-    res = ccn_keystore_file_init(keystore_path, CCND_KEYSTORE_PASS, "CCND-internal", 0, 0);
+    keytype = ccn_keytype_from_string(getenv("CCND_KEY_TYPE"));
+    if (keytype == CCN_KEYTYPE_UNKNOWN) {
+        ccnd_msg(ccnd, "CCND_KEY_TYPE not recognized, using rsa");
+        keytype = CCN_KEYTYPE_RSA;
+    }
+    res = ccn_keystore_file_init_keytype(keystore_path, CCND_KEYSTORE_PASS,
+                                         "CCND-internal", keytype, 0, 0);
     if (res != 0) {
         culprit = temp;
         goto Finish;
@@ -611,6 +641,8 @@ ccnd_internal_client_start(struct ccnd_handle *ccnd)
                     &ccnd_answer_req, OP_SELFREG + MUST_VERIFY1);
     ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/unreg",
                     &ccnd_answer_req, OP_UNREG + MUST_VERIFY1);
+    ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/bulkreg",
+                    &ccnd_answer_req, OP_BULKREG + MUST_VERIFY1);
     ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/" CCND_NOTICE_NAME,
                     &ccnd_answer_req, OP_NOTICE);
     ccnd_uri_listen(ccnd, "ccnx:/%C1.M.S.localhost/%C1.M.SRV/ccnd",
@@ -641,6 +673,10 @@ ccnd_internal_client_stop(struct ccnd_handle *ccnd)
     ccn_destroy(&ccnd->internal_client);
     ccn_charbuf_destroy(&ccnd->service_ccnb);
     ccn_charbuf_destroy(&ccnd->neighbor_ccnb);
+    free(ccnd->service_pco);
+    ccnd->service_pco = NULL;
+    free(ccnd->neighbor_pco);
+    ccnd->neighbor_pco = NULL;
     if (ccnd->internal_client_refresh != NULL)
         ccn_schedule_cancel(ccnd->sched, ccnd->internal_client_refresh);
 }
@@ -43,6 +43,8 @@
  */
 struct ccn_charbuf;
 struct ccn_indexbuf;
+struct ccn_parsed_ContentObject;
+struct ccn_shm;
 struct hashtb;
 struct ccnd_meter;
 
@@ -62,12 +64,26 @@ typedef unsigned ccn_accession_t;
 
 typedef int (*ccnd_logger)(void *loggerdata, const char *format, va_list ap);
 
+/**
+ * Digest of a ContentObject computed ahead of time, as part of a batch
+ * covering all the complete messages that arrived in one input buffer.
+ */
+struct ccnd_predigest {
+    const unsigned char *msg;       /**< start of the ContentObject */
+    size_t size;                    /**< its size in bytes */
+    unsigned char digest[32];       /**< SHA-256 of the whole message */
+};
+#define CCND_PREDIGEST_MAX 32
+
 /**
  * We pass this handle almost everywhere within ccnd
  */
 struct ccnd_handle {
     unsigned char ccnd_id[32];      /**< sha256 digest of our public key */
     struct hashtb *faces_by_fd;     /**< keyed by fd */
+    struct hashtb *shm_doorbells;   /**< faceids of CCN_FACE_SHM faces,
+                                         keyed by doorbell fd */
+    struct ccn_charbuf *shm_copy;   /**< shm input, copied out to parse */
     struct hashtb *dgram_faces;     /**< keyed by sockaddr */
     struct hashtb *content_tab;     /**< keyed by portion of ContentObject */
     struct hashtb *nameprefix_tab;  /**< keyed by name prefix components */
@@ -136,11 +152,16 @@ struct ccnd_handle {
     struct face *face0;             /**< special face for internal client */
     struct ccn_charbuf *service_ccnb; /**< for local service discovery */
     struct ccn_charbuf *neighbor_ccnb; /**< for neighbor service discovery */
+    struct ccn_parsed_ContentObject *service_pco; /**< parse of service_ccnb */
+    struct ccn_parsed_ContentObject *neighbor_pco; /**< parse of neighbor_ccnb */
     struct ccn_seqwriter *notice;   /**< for notices of status changes */
     struct ccn_indexbuf *chface;    /**< faceids w/ recent status changes */
     struct ccn_scheduled_event *internal_client_refresh;
     struct ccn_scheduled_event *notice_push;
     unsigned data_pause_microsec;   /**< tunable, see choose_face_delay() */
+    int n_predigest;                /**< valid entries in predigest */
+    struct ccnd_predigest predigest[CCND_PREDIGEST_MAX];
+                                    /**< batch digests for current input */
     void (*appnonce)(struct ccnd_handle *, struct face *, struct ccn_charbuf *);
                                     /**< pluggable nonce generation */
 };
@@ -207,6 +228,8 @@ struct face {
     uintmax_t rseq;
     struct ccnd_meter *meter[CCND_FACE_METER_N];
     unsigned short pktseq;     /**< sequence number for sent packets */
+    struct ccn_shm *shm;        /**< rings shared with a local client */
+    long lease_expiry;          /**< when a leased newface runs out, or 0 */
 };
 
 /** face flags */
@@ -229,6 +252,7 @@ struct face {
 #define CCN_FACE_REGOK (1 << 16) /**< Allowed to do prefix registration */
 #define CCN_FACE_SEQOK (1 << 17) /** OK to send SequenceNumber link messages */
 #define CCN_FACE_SEQPROBE (1 << 18) /** SequenceNumber probe */
+#define CCN_FACE_SHM (1 << 19) /**< Traffic is in shared memory rings */
 #define CCN_NOFACEID    (~0U)    /** denotes no face */
 
 /**
@@ -405,6 +429,15 @@ int ccnd_req_selfreg(struct ccnd_handle *h,
                      const unsigned char *msg, size_t size,
                      struct ccn_charbuf *reply_body);
 
+/*
+ * The internal client calls this with the argument portion ARG of
+ * a combined face-creation and prefix-registration request
+ * (/ccnx/CCNDID/bulkreg/ARG)
+ */
+int ccnd_req_bulkreg(struct ccnd_handle *h,
+                     const unsigned char *msg, size_t size,
+                     struct ccn_charbuf *reply_body);
+
 /**
  * URIs for prefixes served by the internal client
  */
@@ -0,0 +1,368 @@
+/**
+ * @file ccnbulkbench.c
+ * @brief Compare receive pipelines for bulk data on a local ccnd.
+ *
+ * A stream of segments is published into the ccnd content store, and then
+ * read back with ccn_bulkdata, with ccn_fetch, and with ccncatchunks2,
+ * reporting the throughput of each.
+ *
+ * A CCNx command-line utility.
+ *
+ * Copyright (C) 2011 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <ccn/ccn.h>
+#include <ccn/bulkdata.h>
+#include <ccn/charbuf.h>
+#include <ccn/fetch.h>
+#include <ccn/uri.h>
+
+/* How long to wait for progress before calling a run a failure */
+#define STALL_MICROS 5000000
+
+struct result {
+    intmax_t bytes;
+    unsigned sum;                   /* a simple checksum of the bytes */
+    double seconds;
+};
+
+struct bulkclient {
+    struct ccn_closure closure;
+    struct result *r;
+};
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "%s [-s size] [-b blocksize] [-w window] [-r runs] [-c ccncatchunks2] [ccnx:/prefix]\n"
+            "   Publishes size bytes (default 4000000) under the prefix"
+            " (default ccnx:/bench/bulk)\n"
+            "   in blocks (default 4096) to the local ccnd, then reads them"
+            " back from\n"
+            "   the content store with ccn_bulkdata, ccn_fetch and ccncatchunks2,"
+            " keeping\n"
+            "   up to window (default 32) interests in flight.\n"
+            "   -c names the ccncatchunks2 program to run (\"\" to skip it)\n",
+            progname);
+    exit(1);
+}
+
+static double
+seconds_since(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return((now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6);
+}
+
+static unsigned char
+pattern(intmax_t offset)
+{
+    return((offset * 7 + (offset >> 11)) & 0xff);
+}
+
+static void
+add_bytes(struct result *r, const unsigned char *p, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        r->sum = r->sum * 31 + p[i];
+    r->bytes += n;
+}
+
+/*
+ * Put the segments straight into the content store of ccnd
+ */
+static int
+publish(struct ccn *h, struct ccn_charbuf *name, intmax_t size, int blocksize,
+        struct result *expect)
+{
+    struct ccn_signing_params sp = CCN_SIGNING_PARAMS_INIT;
+    struct ccn_charbuf *segname = ccn_charbuf_create();
+    struct ccn_charbuf *cob = ccn_charbuf_create();
+    unsigned char *buf = calloc(1, blocksize);
+    intmax_t offset = 0;
+    uintmax_t seq;
+    int n, i;
+    int res = 0;
+
+    for (seq = 0; res >= 0 && (seq == 0 || offset < size); seq++) {
+        n = (size - offset < blocksize) ? size - offset : blocksize;
+        for (i = 0; i < n; i++)
+            buf[i] = pattern(offset + i);
+        add_bytes(expect, buf, n);
+        offset += n;
+        segname->length = 0;
+        ccn_charbuf_append_charbuf(segname, name);
+        ccn_name_append_numeric(segname, CCN_MARKER_SEQNUM, seq);
+        if (offset == size)
+            sp.sp_flags |= CCN_SP_FINAL_BLOCK;
+        cob->length = 0;
+        res = ccn_sign_content(h, cob, segname, &sp, buf, n);
+        if (res >= 0)
+            res = ccn_put(h, cob->buf, cob->length);
+        while (res >= 0 && ccn_output_is_pending(h))
+            res = ccn_run(h, 1);
+    }
+    if (res >= 0)
+        res = ccn_run(h, 200);
+    ccn_charbuf_destroy(&segname);
+    ccn_charbuf_destroy(&cob);
+    free(buf);
+    return(res);
+}
+
+static enum ccn_upcall_res
+incoming_bulk(struct ccn_closure *selfp,
+              enum ccn_upcall_kind kind,
+              struct ccn_upcall_info *info)
+{
+    struct bulkclient *c = selfp->data;
+    const unsigned char *data = NULL;
+    size_t data_size = 0;
+
+    if (kind == CCN_UPCALL_FINAL)
+        return(CCN_UPCALL_RESULT_OK);
+    if (kind == CCN_UPCALL_CONTENT_BAD)
+        return(CCN_UPCALL_RESULT_ERR);
+    if (ccn_content_get_value(info->content_ccnb, info->pco->offset[CCN_PCO_E],
+                              info->pco, &data, &data_size) < 0)
+        return(CCN_UPCALL_RESULT_ERR);
+    add_bytes(c->r, data, data_size);
+    return(CCN_UPCALL_RESULT_OK);
+}
+
+static int
+run_bulkdata(struct ccn *h, struct ccn_charbuf *name, int window,
+             struct result *r)
+{
+    struct bulkclient c = {{0}};
+    struct ccn_bulkdata *b = NULL;
+    struct timeval start;
+    uintmax_t last = 0;
+    int idle = 0;
+    int ok;
+
+    c.closure.p = &incoming_bulk;
+    c.closure.data = &c;
+    c.r = r;
+    gettimeofday(&start, NULL);
+    b = ccn_bulkdata_start(h, name, &ccn_binary_seqfunc, NULL, window, &c.closure);
+    if (b == NULL)
+        return(-1);
+    while (ccn_bulkdata_finished(b) == 0 && idle < STALL_MICROS / 10000) {
+        if (ccn_run(h, 10) < 0)
+            break;
+        idle = (ccn_bulkdata_delivered(b) == last) ? idle + 1 : 0;
+        last = ccn_bulkdata_delivered(b);
+    }
+    r->seconds = seconds_since(&start);
+    ok = (ccn_bulkdata_finished(b) == 1);
+    ccn_bulkdata_stop(&b);
+    return(ok ? 0 : -1);
+}
+
+static int
+run_fetch(struct ccn *h, struct ccn_charbuf *name, int window,
+          struct result *r)
+{
+    struct ccn_fetch *f = ccn_fetch_new(h);
+    struct ccn_fetch_stream *fs = NULL;
+    unsigned char buf[8800];
+    struct timeval start;
+    intmax_t res = CCN_FETCH_READ_NONE;
+    int idle = 0;
+
+    gettimeofday(&start, NULL);
+    fs = ccn_fetch_open(f, name, "ccnbulkbench", NULL, window, 0, 1);
+    if (fs == NULL) {
+        ccn_fetch_destroy(f);
+        return(-1);
+    }
+    while (idle < STALL_MICROS / 10000) {
+        res = ccn_fetch_read(fs, buf, sizeof(buf));
+        if (res > 0) {
+            add_bytes(r, buf, res);
+            idle = 0;
+        }
+        else if (res == CCN_FETCH_READ_NONE || res == CCN_FETCH_READ_TIMEOUT) {
+            if (res == CCN_FETCH_READ_TIMEOUT)
+                ccn_reset_timeout(fs);
+            if (ccn_run(h, 10) < 0)
+                break;
+            idle++;
+        }
+        else
+            break;
+    }
+    r->seconds = seconds_since(&start);
+    ccn_fetch_close(fs);
+    ccn_fetch_destroy(f);
+    return(res == CCN_FETCH_READ_END ? 0 : -1);
+}
+
+static int
+run_catchunks2(const char *prog, const char *uri, int window, struct result *r)
+{
+    char pbuf[20];
+    unsigned char buf[8800];
+    struct timeval start;
+    ssize_t n;
+    pid_t pid;
+    int fd[2];
+    int status = 0;
+
+    if (pipe(fd) < 0)
+        return(-1);
+    snprintf(pbuf, sizeof(pbuf), "%d", window);
+    gettimeofday(&start, NULL);
+    pid = fork();
+    if (pid == 0) {
+        dup2(fd[1], 1);
+        close(fd[0]);
+        close(fd[1]);
+        close(2);
+        open("/dev/null", O_WRONLY);
+        execlp(prog, prog, "-s", "-p", pbuf, uri, (char *)NULL);
+        _exit(127);
+    }
+    close(fd[1]);
+    if (pid < 0) {
+        close(fd[0]);
+        return(-1);
+    }
+    while ((n = read(fd[0], buf, sizeof(buf))) > 0)
+        add_bytes(r, buf, n);
+    close(fd[0]);
+    waitpid(pid, &status, 0);
+    r->seconds = seconds_since(&start);
+    return((WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1);
+}
+
+static int
+report(const char *what, int res, struct result *r, struct result *expect)
+{
+    if (res >= 0 && (r->bytes != expect->bytes || r->sum != expect->sum))
+        res = -1;
+    printf("%-14s %10jd bytes %9.6f seconds %10.0f bytes/sec%s\n",
+           what, r->bytes, r->seconds,
+           r->seconds > 0 ? r->bytes / r->seconds : 0.0,
+           res < 0 ? "  FAILED" : "");
+    fflush(stdout);
+    return(res < 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    const char *catchunks2 = "ccncatchunks2";
+    const char *prefix = "ccnx:/bench/bulk";
+    struct ccn *h = NULL;
+    struct ccn_charbuf *name = NULL;
+    struct ccn_charbuf *uri = NULL;
+    struct result expect = {0};
+    struct result r;
+    intmax_t size = 4000000;
+    int blocksize = 4096;
+    int window = 32;
+    int runs = 1;
+    int failures = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "hs:b:w:r:c:")) != -1) {
+        switch (opt) {
+            case 's':
+                size = strtoll(optarg, NULL, 10);
+                if (size < 0)
+                    usage(progname);
+                break;
+            case 'b':
+                blocksize = atoi(optarg);
+                if (blocksize <= 0 || blocksize > 8800)
+                    usage(progname);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                if (window <= 0)
+                    usage(progname);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                if (runs <= 0)
+                    usage(progname);
+                break;
+            case 'c':
+                catchunks2 = optarg;
+                break;
+            case 'h':
+            default:
+                usage(progname);
+        }
+    }
+    if (argv[optind] != NULL)
+        prefix = argv[optind];
+    name = ccn_charbuf_create();
+    if (ccn_name_from_uri(name, prefix) < 0) {
+        fprintf(stderr, "%s: bad ccn URI: %s\n", progname, prefix);
+        exit(1);
+    }
+    h = ccn_create();
+    if (ccn_connect(h, NULL) == -1) {
+        perror("Could not connect to ccnd");
+        exit(1);
+    }
+    if (ccn_create_version(h, name, CCN_V_NOW, 0, 0) < 0 ||
+        publish(h, name, size, blocksize, &expect) < 0) {
+        fprintf(stderr, "%s: unable to publish under %s\n", progname, prefix);
+        exit(1);
+    }
+    uri = ccn_charbuf_create();
+    ccn_uri_append(uri, name->buf, name->length, 1);
+    printf("%s: %jd bytes in %d byte blocks, window %d\n",
+           ccn_charbuf_as_string(uri), size, blocksize, window);
+    for (i = 0; i < runs; i++) {
+        memset(&r, 0, sizeof(r));
+        failures += report("ccn_bulkdata", run_bulkdata(h, name, window, &r),
+                           &r, &expect);
+        memset(&r, 0, sizeof(r));
+        failures += report("ccn_fetch", run_fetch(h, name, window, &r),
+                           &r, &expect);
+        if (catchunks2[0] != 0) {
+            memset(&r, 0, sizeof(r));
+            failures += report("ccncatchunks2",
+                               run_catchunks2(catchunks2,
+                                              ccn_charbuf_as_string(uri),
+                                              window, &r),
+                               &r, &expect);
+        }
+    }
+    ccn_charbuf_destroy(&uri);
+    ccn_charbuf_destroy(&name);
+    ccn_destroy(&h);
+    exit(failures != 0);
+}
@@ -18,6 +18,7 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -92,7 +93,7 @@ main(int argc, char **argv)
     int allow_stale = 0;
     int scope = -1;
     int pipeline = 4;
-    unsigned char buf[8192];
+    const unsigned char *data = NULL;
     int i;
     int res;
     int opt;
@@ -151,9 +152,10 @@ main(int argc, char **argv)
         if (NULL == stream) {
             continue;
         }
-        while ((res = ccn_fetch_read(stream, buf, sizeof(buf))) != 0) {
+        while ((res = ccn_fetch_read_ref(stream, &data, INTMAX_MAX)) != 0) {
             if (res > 0) {
-                fwrite(buf, res, 1, stdout);
+                fwrite(data, res, 1, stdout);
+                ccn_fetch_release_ref(stream, data);
             } else if (res == CCN_FETCH_READ_NONE) {
                 if (ccn_run(ccn, 1000) < 0) {
                     fprintf(stderr, "%s: error during ccn_run\n", argv[0]);
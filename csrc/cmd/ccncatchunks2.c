@@ -30,32 +30,47 @@
 #include <ccn/schedule.h>
 #include <ccn/uri.h>
 
-#define PIPELIMIT (1U << 7)
+#define OOO_INITIAL (1U << 6)
+#define MAXWINDOW_DEFAULT 4096
+#define QUEUE_SLACK_USECS 5000
+#define SSTHRESH_INITIAL 8
 //#define GOT_HERE() fprintf(stderr, "LINE %d\n", __LINE__)
 #define GOT_HERE() ((void)(__LINE__))
 
 struct excludestuff;
 
+/*
+ * One segment we have asked for.  Each has a closure of its own, which
+ * lives until ccn is done with it (FINAL) and we are done with the data.
+ */
 struct ooodata {
-    struct ccn_closure closure;     /* closure per slot */
+    struct ccn_closure closure;     /* intdata is the segment number */
     unsigned char *raw_data;        /* content that has arrived out-of-order */
     size_t raw_data_size;           /* its size (plus 1) in bytes */
+    struct timeval sendtime;        /* when the interest was first expressed */
+    unsigned retries;               /* times it has been expressed again */
+    unsigned char finalized;        /* ccn has finished with the closure */
+    unsigned char detached;         /* no longer in the ooo ring */
 };
 
 struct mydata {
     struct ccn *h;
     int allow_stale;
     int use_decimal;
-    unsigned ooo_base;
+    struct ooodata **ooo;           /* segments in the window, by seq % ooo_size */
+    unsigned ooo_size;              /* a power of 2, grown as the window needs */
     unsigned ooo_count;
     unsigned curwindow;
     unsigned maxwindow;
-    unsigned sendtime;
-    unsigned sendtime_slot;
+    unsigned ssthresh;              /* slow start threshold */
+    unsigned wincount;              /* arrivals toward the next increase */
+    struct timeval lastcut;         /* when the window was last cut */
     unsigned rtt;
-    unsigned rtte;
+    unsigned srtt;
+    unsigned rttvar;
+    unsigned rttmin;                /* least round trip seen */
     unsigned backoff;
-    unsigned finalslot;
+    intmax_t finalseq;
     struct ccn_charbuf *name;
     struct ccn_charbuf *templ;
     struct excludestuff *excl;
@@ -70,17 +85,23 @@ struct mydata {
     intmax_t junk;
     intmax_t holes;
     intmax_t timeouts;
+    intmax_t retransmits;
     intmax_t dups;
     intmax_t lastcheck;
     intmax_t unverified;
+    intmax_t rtt_sum;
+    intmax_t rtt_samples;
     struct timeval start_tv;
     struct timeval stop_tv;
-    struct ooodata ooo[PIPELIMIT];
 };
 
 static int fill_holes(struct ccn_schedule *sched, void *clienth, 
                       struct ccn_scheduled_event *ev, int flags);
 
+static enum ccn_upcall_res incoming_content(struct ccn_closure *selfp,
+                                            enum ccn_upcall_kind kind,
+                                            struct ccn_upcall_info *info);
+
 static FILE* logstream = NULL;
 
 static void
@@ -91,9 +112,10 @@ usage(const char *progname)
             "   Reads stuff written by ccnsendchunks under"
             " the given uri and writes to stdout\n"
             "   -a - allow stale data\n"
-            "   -p n - use up to n pipeline slots\n"
+            "   -p n - keep at most n interests in flight (default %d);\n"
+            "          the window adapts to round trip time and loss below that\n"
             "   -s - use new-style segmentation markers\n",
-            progname);
+            progname, MAXWINDOW_DEFAULT);
     exit(1);
 }
 
@@ -113,54 +135,116 @@ static struct ccn_gettime myticker = {
     NULL
 };
 
-static void
-update_rtt(struct mydata *md, int incoming, unsigned slot)
+static unsigned
+micros_since(const struct timeval *then, const struct timeval *now)
+{
+    return((unsigned)(now->tv_sec - then->tv_sec) * 1000000U +
+           (unsigned)now->tv_usec - (unsigned)then->tv_usec);
+}
+
+/**
+ * The retransmission timeout, as for TCP, from the round trip estimates
+ */
+static unsigned
+rto(struct mydata *md)
+{
+    unsigned t = md->srtt + 4 * md->rttvar;
+    if (t < 10000)
+        t = 10000;
+    return(t);
+}
+
+/**
+ * Take a round trip sample from a segment that has arrived, unless it was
+ * asked for more than once (in which case we cannot tell which interest
+ * it answers).
+ * @returns 1 if the sample shows interests queueing up along the path.
+ */
+static int
+update_rtt(struct mydata *md, struct ooodata *ooo)
 {
     struct timeval now = {0};
-    unsigned t, delta, rtte;
+    unsigned delta, err;
+    int queued = 0;
     
-    if (!incoming && md->sendtime_slot == ~0)
-        md->sendtime_slot = slot;
-    if (slot != md->sendtime_slot)
-        return;
     gettimeofday(&now, 0);
-    t = ((unsigned)(now.tv_sec) * 1000000) + (unsigned)(now.tv_usec);
-    if (incoming) {
-        delta = t - md->sendtime;
+    if (ooo->retries == 0) {
+        delta = micros_since(&ooo->sendtime, &now);
         md->rtt = delta;
         if (delta <= 30000000) {
-            rtte = md->rtte;
-            if (delta > rtte)
-                rtte = rtte + (rtte >> 3);
-            else
-                rtte = rtte - (rtte >> 7);
-            if (rtte < 127)
-                rtte = delta;
-            md->rtte = rtte;
+            if (md->rtt_samples == 0) {
+                md->srtt = delta;
+                md->rttvar = delta / 2;
+            }
+            else {
+                err = (delta > md->srtt) ? delta - md->srtt : md->srtt - delta;
+                md->rttvar = md->rttvar - (md->rttvar >> 2) + (err >> 2);
+                md->srtt = md->srtt - (md->srtt >> 3) + (delta >> 3);
+            }
+            md->rtt_sum += delta;
+            md->rtt_samples++;
+            if (md->rttmin == 0 || delta < md->rttmin)
+                md->rttmin = delta;
+            queued = (delta > 2 * md->rttmin + QUEUE_SLACK_USECS);
         }
-        if (md->holefiller == NULL)
-            md->holefiller = ccn_schedule_event(md->sched, 10000, &fill_holes, NULL, 0);
-        md->sendtime_slot = ~0;
-        if (logstream)
-            fprintf(logstream,
-                    "%ld.%06u ccncatchunks2: "
-                    "%jd isent, %jd recvd, %jd junk, %jd holes, %jd t/o, %jd unvrf, "
-                    "%u curwin, %u rtt, %u rtte\n",
-                    (long)now.tv_sec,
-                    (unsigned)now.tv_usec,
-                    md->interests_sent,
-                    md->pkts_recvd,
-                    md->junk,
-                    md->holes,
-                    md->timeouts,
-                    md->unverified,
-                    md->curwindow,
-                    md->rtt,
-                    md->rtte
-                    );
     }
-    else
-        md->sendtime = t;
+    if (md->holefiller == NULL)
+        md->holefiller = ccn_schedule_event(md->sched, 10000, &fill_holes, NULL, 0);
+    if (logstream)
+        fprintf(logstream,
+                "%ld.%06u ccncatchunks2: "
+                "%jd isent, %jd recvd, %jd junk, %jd holes, %jd t/o, %jd unvrf, "
+                "%u curwin, %u rtt, %u srtt\n",
+                (long)now.tv_sec,
+                (unsigned)now.tv_usec,
+                md->interests_sent,
+                md->pkts_recvd,
+                md->junk,
+                md->holes,
+                md->timeouts,
+                md->unverified,
+                md->curwindow,
+                md->rtt,
+                md->srtt
+                );
+    return(queued);
+}
+
+/**
+ * A new segment has arrived: open the window by one for each in slow
+ * start, and by one per window's worth after that.
+ */
+static void
+open_window(struct mydata *md)
+{
+    if (md->curwindow >= md->maxwindow)
+        return;
+    if (md->curwindow < md->ssthresh)
+        md->curwindow++;
+    else if (++md->wincount >= md->curwindow) {
+        md->wincount = 0;
+        md->curwindow++;
+    }
+}
+
+/**
+ * Something was lost: halve the window (or, after an interest timed out,
+ * start again from 1), at most once per round trip.
+ */
+static void
+cut_window(struct mydata *md, int timedout)
+{
+    struct timeval now = {0};
+    
+    gettimeofday(&now, 0);
+    if (md->lastcut.tv_sec != 0 && micros_since(&md->lastcut, &now) < md->srtt)
+        return;
+    md->lastcut = now;
+    md->ssthresh = md->curwindow / 2;
+    if (md->ssthresh < 2)
+        md->ssthresh = 2;
+    md->curwindow = timedout ? 1 : md->ssthresh;
+    md->wincount = 0;
 }
 
 static int
@@ -174,7 +258,7 @@ reporter(struct ccn_schedule *sched, void *clienth,
     fprintf(stderr,
             "%ld.%06u ccncatchunks2[%d]: "
             "%jd isent, %jd recvd, %jd junk, %jd holes, %jd t/o, %jd unvrf, "
-            "%u curwin, %u rtt, %u rtte\n",
+            "%u curwin, %u rtt, %u srtt\n",
             (long)now.tv_sec,
             (unsigned)now.tv_usec,
             (int)getpid(),
@@ -186,7 +270,7 @@ reporter(struct ccn_schedule *sched, void *clienth,
             md->unverified,
             md->curwindow,
             md->rtt,
-            md->rtte
+            md->srtt
             );
     if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
         md->report = NULL;
@@ -203,6 +287,7 @@ print_summary(struct mydata *md)
     double elapsed = 0.0;
     intmax_t delivered_bytes;
     double rate = 0.0;
+    double avgrtt = 0.0;
     
     expid = getenv("CCN_EXPERIMENT_ID");
     if (expid == NULL)
@@ -213,9 +298,12 @@ print_summary(struct mydata *md)
     delivered_bytes = md->delivered_bytes;
     if (elapsed > 0.00001)
         rate = delivered_bytes/elapsed;
+    if (md->rtt_samples > 0)
+        avgrtt = (double)md->rtt_sum / md->rtt_samples;
     fprintf(stderr,
             "%ld.%06u ccncatchunks2[%d]: %s%s"
             "%jd bytes transferred in %.6f seconds (%.0f bytes/sec)"
+            ", %.0f us average rtt, %jd retransmits, %u final window"
             "\n",
             (long)md->stop_tv.tv_sec,
             (unsigned)md->stop_tv.tv_usec,
@@ -224,10 +312,21 @@ print_summary(struct mydata *md)
             dlm,
             delivered_bytes,
             elapsed,
-            rate
+            rate,
+            avgrtt,
+            md->retransmits,
+            md->curwindow
             );
 }
 
+static void
+finish(struct mydata *md)
+{
+    ccn_schedule_destroy(&md->sched);
+    print_summary(md);
+    exit(0);
+}
+
 struct ccn_charbuf *
 make_template(struct mydata *md)
 {
@@ -267,6 +366,41 @@ sequenced_name(struct mydata *md, uintmax_t seq)
     return(name);
 }
 
+/**
+ * Double the ooo ring, putting each segment in its new slot
+ */
+static void
+grow_ooo(struct mydata *md)
+{
+    unsigned size = md->ooo_size * 2;
+    struct ooodata **ooo = calloc(size, sizeof(*ooo));
+    unsigned i;
+    
+    if (ooo == NULL) abort();
+    for (i = 0; i < md->ooo_size; i++) {
+        if (md->ooo[i] != NULL)
+            ooo[(uintmax_t)md->ooo[i]->closure.intdata % size] = md->ooo[i];
+    }
+    free(md->ooo);
+    md->ooo = ooo;
+    md->ooo_size = size;
+}
+
+/**
+ * Take a segment out of the ooo ring, once its data has been delivered
+ */
+static void
+detach(struct mydata *md, struct ooodata *ooo)
+{
+    md->ooo[(uintmax_t)ooo->closure.intdata % md->ooo_size] = NULL;
+    ooo->detached = 1;
+    free(ooo->raw_data);
+    ooo->raw_data = NULL;
+    ooo->raw_data_size = 0;
+    if (ooo->finalized)
+        free(ooo);
+}
+
 static void
 ask_more(struct mydata *md, uintmax_t seq)
 {
@@ -274,27 +408,31 @@ ask_more(struct mydata *md, uintmax_t seq)
     struct ccn_charbuf *templ = NULL;
     int res;
     unsigned slot;
-    struct ccn_closure *cl = NULL;
+    struct ooodata *ooo = NULL;
     
-    slot = seq % PIPELIMIT;
-    cl = &md->ooo[slot].closure;
-    if (cl->intdata == -1)
-        cl->intdata = seq;
-    assert(cl->intdata == seq);
-    assert(md->ooo[slot].raw_data_size == 0);
+    assert(seq >= md->delivered);
+    if (seq == md->delivered + md->ooo_count && md->ooo_count + 1 >= md->ooo_size)
+        grow_ooo(md);
+    slot = seq % md->ooo_size;
+    assert(md->ooo[slot] == NULL);
+    ooo = calloc(1, sizeof(*ooo));
+    if (ooo == NULL) abort();
+    ooo->closure.p = &incoming_content;
+    ooo->closure.data = md;
+    ooo->closure.intdata = seq;
+    md->ooo[slot] = ooo;
     name = sequenced_name(md, seq);
     templ = make_template(md);
-    update_rtt(md, 0, slot);
-    res = ccn_express_interest(md->h, name, cl, templ);
+    gettimeofday(&ooo->sendtime, 0);
+    res = ccn_express_interest(md->h, name, &ooo->closure, templ);
     if (res < 0) abort();
     md->interests_sent++;
     ccn_charbuf_destroy(&templ);
     ccn_charbuf_destroy(&name);
     if (seq == md->delivered + md->ooo_count)
         md->ooo_count++;
-    assert(seq >= md->delivered);
     assert(seq < md->delivered + md->ooo_count);
-    assert(md->ooo_count < PIPELIMIT);
+    assert(md->ooo_count < md->ooo_size);
 }
 
 static enum ccn_upcall_res
@@ -326,19 +464,27 @@ fill_holes(struct ccn_schedule *sched, void *clienth,
     if (md->delivered == md->lastcheck && md->ooo_count > 0) {
         if (backoff == 0) {
             md->holes++;
+            md->retransmits++;
             fprintf(stderr, "*** Hole at %jd\n", md->delivered);
             reporter(sched, md, NULL, 0);
-            md->curwindow = 1;
-            cl = calloc(1, sizeof(*cl));
-            cl->p = &hole_filled;
-            name = sequenced_name(md, md->delivered);
-            templ = make_template(md);
-            ccn_express_interest(md->h, name, cl, templ);
-            md->interests_sent++;
-            ccn_charbuf_destroy(&templ);
-            ccn_charbuf_destroy(&name);
+            cut_window(md, 0);
+            if (md->ooo[md->delivered % md->ooo_size] == NULL) {
+                /* ccn gave up on it, so start over */
+                ask_more(md, md->delivered);
+            }
+            else {
+                md->ooo[md->delivered % md->ooo_size]->retries++;
+                cl = calloc(1, sizeof(*cl));
+                cl->p = &hole_filled;
+                name = sequenced_name(md, md->delivered);
+                templ = make_template(md);
+                ccn_express_interest(md->h, name, cl, templ);
+                md->interests_sent++;
+                ccn_charbuf_destroy(&templ);
+                ccn_charbuf_destroy(&name);
+            }
         }
-        if ((6000000 >> backoff) > md->rtte)
+        if ((6000000 >> backoff) > rto(md))
             backoff++;
     }
     else {
@@ -346,9 +492,7 @@ fill_holes(struct ccn_schedule *sched, void *clienth,
         backoff = 0;
     }
     md->backoff = backoff;
-    delay = (md->rtte << backoff);
-    if (delay < 10000)
-        delay = 10000;
+    delay = (rto(md) << backoff);
     return(delay);
 }
 
@@ -387,7 +531,7 @@ is_final(struct ccn_upcall_info *info)
     return(0);
 }
 
-enum ccn_upcall_res
+static enum ccn_upcall_res
 incoming_content(struct ccn_closure *selfp,
                  enum ccn_upcall_kind kind,
                  struct ccn_upcall_info *info)
@@ -399,19 +543,29 @@ incoming_content(struct ccn_closure *selfp,
     size_t written;
     int res;
     struct mydata *md = selfp->data;
-    unsigned slot;
+    struct ooodata *ooo = (struct ooodata *)selfp;
+    intmax_t seq = selfp->intdata;
     
     if (kind == CCN_UPCALL_FINAL) {
-        selfp->intdata = -1;
+        ooo->finalized = 1;
+        if (!ooo->detached && ooo->raw_data_size == 0) {
+            /* never answered; fill_holes will ask again */
+            md->ooo[(uintmax_t)seq % md->ooo_size] = NULL;
+            ooo->detached = 1;
+        }
+        if (ooo->detached)
+            free(ooo);
         return(CCN_UPCALL_RESULT_OK);
     }
 GOT_HERE();
     if (kind == CCN_UPCALL_INTEREST_TIMED_OUT) {
         md->timeouts++;
-        if (selfp->refcount > 1 || selfp->intdata == -1)
+        if (selfp->refcount > 1 || ooo->detached)
             return(CCN_UPCALL_RESULT_OK);
         md->interests_sent++;
-        md->curwindow = 1;
+        md->retransmits++;
+        ooo->retries++;
+        cut_window(md, 1);
         // XXX - may need to reseed bloom filter
         return(CCN_UPCALL_RESULT_REEXPRESS);
     }
@@ -425,8 +579,8 @@ GOT_HERE();
         md->unverified++;
     }
     md->pkts_recvd++;
-    if (selfp->intdata == -1) {
-        /* Outside the window we care about. Toss it. */
+    if (ooo->detached || ooo->raw_data_size != 0) {
+        /* Outside the window we care about, or we have it. Toss it. */
         md->dups++;
         return(CCN_UPCALL_RESULT_OK);
     }
@@ -437,73 +591,58 @@ GOT_HERE();
 GOT_HERE();
     /* OK, we will accept this block. */
     md->co_bytes_recvd += data_size;
-    slot = ((uintptr_t)selfp->intdata) % PIPELIMIT;
-    assert(selfp == &md->ooo[slot].closure);
+    assert(md->ooo[(uintmax_t)seq % md->ooo_size] == ooo);
     if (is_final(info)) {
         GOT_HERE();
-        md->finalslot = slot;
+        md->finalseq = seq;
     }
-    if (slot != md->ooo_base || md->ooo_count == 0) {
-        /* out-of-order data, save for later */
-        struct ooodata *ooo = &md->ooo[slot];
-        if (ooo->raw_data_size == 0) {
+    if (update_rtt(md, ooo) || seq != md->delivered)
+        cut_window(md, 0);
+    else
+        open_window(md);
+    if (seq != md->delivered) {
+        /* out-of-order data, save for later; something before it is lost */
 GOT_HERE();
-            update_rtt(md, 1, slot);
-            ooo->raw_data = malloc(data_size);
-            memcpy(ooo->raw_data, data, data_size);
-            ooo->raw_data_size = data_size + 1;
-        }
-        else
-            md->dups++;
-        if (md->curwindow > 1)
-            md->curwindow--;
+        ooo->raw_data = malloc(data_size + 1);
+        memcpy(ooo->raw_data, data, data_size);
+        ooo->raw_data_size = data_size + 1;
     }
     else {
-        assert(md->ooo[slot].raw_data_size == 0);
-        update_rtt(md, 1, slot);
-        md->ooo[slot].closure.intdata = -1;
         md->delivered++;
         md->delivered_bytes += data_size;
         written = fwrite(data, data_size, 1, stdout);
         if (written != 1)
             exit(1);
+        detach(md, ooo);
         /* Check for EOF */
-        if (slot == md->finalslot) {
+        if (seq == md->finalseq) {
             GOT_HERE();
-            ccn_schedule_destroy(&md->sched);
-            print_summary(md);
-            exit(0);
+            finish(md);
         }
         md->ooo_count--;
-        slot = (slot + 1) % PIPELIMIT;
-        if (md->curwindow < md->maxwindow)
-            md->curwindow++;
-        while (md->ooo_count > 0 && md->ooo[slot].raw_data_size != 0) {
-            struct ooodata *ooo = &md->ooo[slot];
+        for (;;) {
+            ooo = md->ooo[(uintmax_t)md->delivered % md->ooo_size];
+            if (md->ooo_count == 0 || ooo == NULL || ooo->raw_data_size == 0)
+                break;
+            seq = md->delivered;
             md->delivered++;
             md->delivered_bytes += (ooo->raw_data_size - 1);
             written = fwrite(ooo->raw_data, ooo->raw_data_size - 1, 1, stdout);
             if (written != 1)
                 exit(1);
+            detach(md, ooo);
             /* Check for EOF */
-            if (slot == md->finalslot) {
+            if (seq == md->finalseq) {
                 GOT_HERE();
-                ccn_schedule_destroy(&md->sched);
-                exit(0);
+                finish(md);
             }
-            free(ooo->raw_data);
-            ooo->raw_data = NULL;
-            ooo->raw_data_size = 0;
-            slot = (slot + 1) % PIPELIMIT;
             md->ooo_count--;
         }
-        md->ooo_base = slot;
     }
     
-    /* Ask for the next one or two */
-    if (md->ooo_count < md->curwindow)
-        ask_more(md, md->delivered + md->ooo_count);
-    if (md->ooo_count < md->curwindow)
+    /* Fill the window */
+    while (md->ooo_count < md->curwindow &&
+           (md->finalseq < 0 || md->delivered + md->ooo_count <= md->finalseq))
         ask_more(md, md->delivered + md->ooo_count);
     
     return(CCN_UPCALL_RESULT_OK);
@@ -514,7 +653,6 @@ main(int argc, char **argv)
 {
     struct ccn *ccn = NULL;
     struct ccn_charbuf *name = NULL;
-    struct ccn_closure *incoming = NULL;
     const char *arg = NULL;
     int res;
     int micros;
@@ -522,11 +660,7 @@ main(int argc, char **argv)
     struct mydata *mydata;
     int allow_stale = 0;
     int use_decimal = 1;
-    int i;
-    unsigned maxwindow = PIPELIMIT-1;
-    
-    if (maxwindow > 31)
-        maxwindow = 31;
+    unsigned maxwindow = MAXWINDOW_DEFAULT;
     
     while ((opt = getopt(argc, argv, "hap:s")) != -1) {
         switch (opt) {
@@ -535,7 +669,7 @@ main(int argc, char **argv)
                 break;
             case 'p':
                 res = atoi(optarg);
-                if (1 <= res && res < PIPELIMIT)
+                if (1 <= res)
                     maxwindow = res;
                 else
                     usage(argv[0]);
@@ -575,16 +709,12 @@ main(int argc, char **argv)
     mydata->report = ccn_schedule_event(mydata->sched, 0, &reporter, NULL, 0);
     mydata->holefiller = NULL;
     mydata->maxwindow = maxwindow;
-    mydata->finalslot = ~0;
-    for (i = 0; i < PIPELIMIT; i++) {
-        incoming = &mydata->ooo[i].closure;
-        incoming->p = &incoming_content;
-        incoming->data = mydata;
-        incoming->intdata = -1;
-    }
-    mydata->ooo_base = 0;
+    mydata->finalseq = -1;
+    mydata->ooo_size = OOO_INITIAL;
+    mydata->ooo = calloc(mydata->ooo_size, sizeof(*mydata->ooo));
     mydata->ooo_count = 0;
     mydata->curwindow = 1;
+    mydata->ssthresh = maxwindow < SSTHRESH_INITIAL ? maxwindow : SSTHRESH_INITIAL;
     gettimeofday(&mydata->start_tv, 0);
     logstream = NULL;
     // logstream = fopen("xxxxxxxxxxxxxxlogstream" + (unsigned)getpid()%10, "wb"); 
@@ -5,17 +5,21 @@
 #include <stdlib.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 
 #include <ccn/ccn.h>
 #include <ccn/uri.h>
 #include <ccn/face_mgmt.h>
 #include <ccn/reg_mgmt.h>
 #include <ccn/charbuf.h>
+#include <ccn/fetch.h>
+#include <ccn/hashtb.h>
 #include <ccn/ccn_dhcp.h>
 
 void ccndhcp_warn(int lineno, const char *format, ...)
@@ -41,15 +45,6 @@ void ccndhcp_fatal(int lineno, const char *format, ...)
     exit(1);
 }
 
-#define ON_ERROR_EXIT(resval, msg) on_error_exit((resval), __LINE__, msg)
-
-static void on_error_exit(int res, int lineno, const char *msg)
-{
-    if (res >= 0)
-        return;
-    ccndhcp_fatal(lineno, "fatal error, res = %d, %s\n", res, msg);
-}
-
 #define ON_ERROR_CLEANUP(resval) \
 {           \
     if ((resval) < 0) { \
@@ -67,6 +62,41 @@ static void on_error_exit(int res, int lineno, const char *msg)
 }
 
 
+/*
+ * Construct the name of a ccnd control request: ccnx:/<ccndid>/<action>/<signed request>
+ */
+static void build_request_name(struct ccn_charbuf *name,
+        const unsigned char *ccndid, size_t ccndid_size,
+        const char *action, const struct ccn_charbuf *request)
+{
+    ccn_name_init(name);
+    ccn_name_append_str(name, "ccnx");
+    ccn_name_append(name, ccndid, ccndid_size);
+    ccn_name_append_str(name, action);
+    ccn_name_append(name, request->buf, request->length);
+}
+
+/*
+ * Encode a request to register a prefix on a face
+ */
+static void append_prefixreg_request(struct ccn_charbuf *c,
+        struct ccn_charbuf *name_prefix, struct ccn_face_instance *face_instance,
+        int lifetime)
+{
+    struct ccn_forwarding_entry forwarding_entry_storage = {0};
+    struct ccn_forwarding_entry *forwarding_entry = &forwarding_entry_storage;
+
+    forwarding_entry->action = "prefixreg";
+    forwarding_entry->name_prefix = name_prefix;
+    forwarding_entry->ccnd_id = face_instance->ccnd_id;
+    forwarding_entry->ccnd_id_size = face_instance->ccnd_id_size;
+    forwarding_entry->faceid = face_instance->faceid;
+    forwarding_entry->flags = -1;
+    forwarding_entry->lifetime = lifetime;
+
+    ccnb_append_forwarding_entry(c, forwarding_entry);
+}
+
 /*
  * Bind a prefix to a face
  */
@@ -80,35 +110,21 @@ int register_prefix(struct ccn *h, struct ccn_charbuf *local_scope_template,
     struct ccn_charbuf *name = NULL;
     struct ccn_charbuf *prefixreg = NULL;
     struct ccn_parsed_ContentObject pcobuf = {0};
-    struct ccn_forwarding_entry forwarding_entry_storage = {0};
-    struct ccn_forwarding_entry *forwarding_entry = &forwarding_entry_storage;
-    struct ccn_forwarding_entry *new_forwarding_entry;
+    struct ccn_forwarding_entry *new_forwarding_entry = NULL;
     const unsigned char *ptr = NULL;
     size_t length = 0;
     int res;
 
-    /* Register or unregister the prefix */
-    forwarding_entry->action = "prefixreg";
-    forwarding_entry->name_prefix = name_prefix;
-    forwarding_entry->ccnd_id = face_instance->ccnd_id;
-    forwarding_entry->ccnd_id_size = face_instance->ccnd_id_size;
-    forwarding_entry->faceid = face_instance->faceid;
-    forwarding_entry->flags = -1;
-    forwarding_entry->lifetime = (~0U) >> 1;
-
     prefixreg = ccn_charbuf_create();
-    ccnb_append_forwarding_entry(prefixreg, forwarding_entry);
+    append_prefixreg_request(prefixreg, name_prefix, face_instance, CCN_DHCP_LIFETIME);
     temp = ccn_charbuf_create();
     res = ccn_sign_content(h, temp, no_name, NULL, prefixreg->buf, prefixreg->length);
     resultbuf = ccn_charbuf_create();
 
     /* construct Interest containing prefixreg request */
     name = ccn_charbuf_create();
-    ccn_name_init(name);
-    ccn_name_append_str(name, "ccnx");
-    ccn_name_append(name, face_instance->ccnd_id, face_instance->ccnd_id_size);
-    ccn_name_append_str(name, "prefixreg");
-    ccn_name_append(name, temp->buf, temp->length);
+    build_request_name(name, face_instance->ccnd_id, face_instance->ccnd_id_size,
+            "prefixreg", temp);
 
     /* send Interest, get Data */
     res = ccn_get(h, name, local_scope_template, 1000, resultbuf, &pcobuf, NULL, 0);
@@ -170,11 +186,8 @@ struct ccn_face_instance *create_face(struct ccn *h, struct ccn_charbuf *local_s
 
     /* Construct the Interest name that will create the face */
     name = ccn_charbuf_create();
-    ccn_name_init(name);
-    ccn_name_append_str(name, "ccnx");
-    ccn_name_append(name, face_instance->ccnd_id, face_instance->ccnd_id_size);
-    ccn_name_append_str(name, face_instance->action);
-    ccn_name_append(name, temp->buf, temp->length);
+    build_request_name(name, face_instance->ccnd_id, face_instance->ccnd_id_size,
+            face_instance->action, temp);
     /* send Interest to retrieve Data that contains the newly created face */
     res = ccn_get(h, name, local_scope_template, 1000, resultbuf, &pcobuf, NULL, 0);
     ON_ERROR_CLEANUP(res);
@@ -204,7 +217,7 @@ cleanup:
 }
 
 /*
- * Get ccnd id
+ * Get ccnd id.  Returns its size, or -1 if it cannot be had.
  */
 static int get_ccndid(struct ccn *h, struct ccn_charbuf *local_scope_template,
         const unsigned char *ccndid)
@@ -214,18 +227,21 @@ static int get_ccndid(struct ccn *h, struct ccn_charbuf *local_scope_template,
     struct ccn_parsed_ContentObject pcobuf = {0};
     char ccndid_uri[] = "ccnx:/%C1.M.S.localhost/%C1.M.SRV/ccnd/KEY";
     const unsigned char *ccndid_result;
-    static size_t ccndid_result_size;
+    size_t ccndid_result_size = 0;
     int res;
 
     name = ccn_charbuf_create();
     resultbuf = ccn_charbuf_create();
 
     res = ccn_name_from_uri(name, ccndid_uri);
-    ON_ERROR_EXIT(res, "Unable to parse service locator URI for ccnd key\n");
+    ON_ERROR_CLEANUP(res);
 
     /* get Data */
     res = ccn_get(h, name, local_scope_template, 4500, resultbuf, &pcobuf, NULL, 0);
-    ON_ERROR_EXIT(res, "Unable to get key from ccnd\n");
+    if (res < 0) {
+        ccndhcp_warn(__LINE__, "Unable to get key from ccnd\n");
+        goto cleanup;
+    }
 
     /* extract from Data */
     res = ccn_ref_tagged_BLOB(CCN_DTAG_PublisherPublicKeyDigest,
@@ -233,22 +249,45 @@ static int get_ccndid(struct ccn *h, struct ccn_charbuf *local_scope_template,
             pcobuf.offset[CCN_PCO_B_PublisherPublicKeyDigest],
             pcobuf.offset[CCN_PCO_E_PublisherPublicKeyDigest],
             &ccndid_result, &ccndid_result_size);
-    ON_ERROR_EXIT(res, "Unable to parse ccnd response for ccnd id\n");
+    if (res < 0) {
+        ccndhcp_warn(__LINE__, "Unable to parse ccnd response for ccnd id\n");
+        goto cleanup;
+    }
 
     memcpy((void *)ccndid, ccndid_result, ccndid_result_size);
 
+cleanup:
     ccn_charbuf_destroy(&name);
     ccn_charbuf_destroy(&resultbuf);
 
-    return (ccndid_result_size);
+    return (res < 0) ? -1 : (int)ccndid_result_size;
+}
+
+/*
+ * Is this a numeric address and port, as ccndhcpserver resolves
+ * gateways to, so that there is nothing to look up?
+ */
+static int dhcp_numeric_gateway(const char *address, const char *port)
+{
+    unsigned char addr[sizeof(struct in6_addr)];
+    const char *p;
+
+    if (port[0] == 0)
+        return 0;
+    for (p = port; *p != 0; p++)
+        if (*p < '0' || *p > '9')
+            return 0;
+    return (inet_pton(AF_INET, address, addr) == 1 ||
+            inet_pton(AF_INET6, address, addr) == 1);
 }
 
 /*
- * Construct a new face instance based on the given address and port
+ * Construct a new face instance based on the given address and port,
+ * asking for the face to be leased for lifetime seconds
  * This face instance is only used to send new face request
  */
 struct ccn_face_instance *construct_face(const unsigned char *ccndid, size_t ccndid_size,
-        const char *address, const char *port)
+        const char *address, const char *port, int lifetime)
 {
     struct ccn_face_instance *fi = calloc(1, sizeof(*fi));
     char rhostnamebuf[NI_MAXHOST];
@@ -261,26 +300,33 @@ struct ccn_face_instance *construct_face(const unsigned char *ccndid, size_t ccn
     int port_off = -1;
     int res;
 
-    res = getaddrinfo(address, port, &hints, &raddrinfo);
-    if (res != 0 || raddrinfo == NULL) {
-        fprintf(stderr, "Error: getaddrinfo\n");
-        return NULL;
+    if (dhcp_numeric_gateway(address, port)) {
+        /* already resolved by the server */
+        snprintf(rhostnamebuf, sizeof(rhostnamebuf), "%s", address);
+        snprintf(rhostportbuf, sizeof(rhostportbuf), "%s", port);
     }
+    else {
+        res = getaddrinfo(address, port, &hints, &raddrinfo);
+        if (res != 0 || raddrinfo == NULL) {
+            fprintf(stderr, "Error: getaddrinfo\n");
+            return NULL;
+        }
 
-    res = getnameinfo(raddrinfo->ai_addr, raddrinfo->ai_addrlen,
-            rhostnamebuf, sizeof(rhostnamebuf),
-            rhostportbuf, sizeof(rhostportbuf),
-            NI_NUMERICHOST | NI_NUMERICSERV);
-    freeaddrinfo(raddrinfo);
-    if (res != 0) {
-        fprintf(stderr, "Error: getnameinfo\n");
-        return NULL;
+        res = getnameinfo(raddrinfo->ai_addr, raddrinfo->ai_addrlen,
+                rhostnamebuf, sizeof(rhostnamebuf),
+                rhostportbuf, sizeof(rhostportbuf),
+                NI_NUMERICHOST | NI_NUMERICSERV);
+        freeaddrinfo(raddrinfo);
+        if (res != 0) {
+            fprintf(stderr, "Error: getnameinfo\n");
+            return NULL;
+        }
     }
 
     fi->store = store;
     fi->descr.ipproto = IPPROTO_UDP;
     fi->descr.mcast_ttl = CCN_DHCP_MCASTTTL;
-    fi->lifetime = CCN_DHCP_LIFETIME;
+    fi->lifetime = lifetime;
 
     ccn_charbuf_append(store, "newface", strlen("newface") + 1);
     host_off = store->length;
@@ -338,7 +384,7 @@ int add_new_face(struct ccn *h, struct ccn_charbuf *prefix, const char *address,
     }
 
     /* construct a face instance for new face request */
-    fi = construct_face(ccndid, ccndid_size, address, port);
+    fi = construct_face(ccndid, ccndid_size, address, port, CCN_DHCP_LIFETIME);
     ON_NULL_CLEANUP(fi);
 
     /* send new face request to actually create a new face */
@@ -366,128 +412,1529 @@ cleanup:
 }
 
 /*
- * Create a face on the multicast address and port, bind the DHCP prefix to the face
+ * State for configuring a list of DHCP entries with requests in parallel
  */
-int join_dhcp_group(struct ccn *h)
+struct dhcp_pipeline {
+    struct ccn *h;
+    struct ccn_charbuf *local_scope_template;
+    struct ccn_charbuf *no_name;
+    unsigned char ccndid[32];
+    size_t ccndid_size;
+    struct ccn_dhcp_entry **nextp;      /* link to the next entry to start on */
+    int more;                           /* entries are still being parsed */
+    int window;                         /* limit on requests in progress */
+    int batch;                          /* pairs per bulkreg request, or 0 */
+    int unreg;                          /* unregister the entries instead */
+    int starting;                       /* guards start_dhcp_requests */
+    struct hashtb *faces;               /* struct dhcp_face by gateway */
+    int inflight;
+    int done;
+    int failed;
+    int requests;                       /* control Interests expressed */
+};
+
+/*
+ * One DHCP entry on its way through newface and then prefixreg,
+ * or a batch of entries in one bulkreg request
+ */
+struct dhcp_request {
+    struct ccn_closure closure;
+    struct dhcp_pipeline *pl;
+    struct ccn_dhcp_entry *de;
+    int count;                          /* entries in a bulkreg request, or 0 */
+    struct ccn_face_instance *fi;       /* the newface request */
+    struct ccn_face_instance *nfi;      /* the new face, once we have it */
+    struct dhcp_face *face;             /* the gateway of the entry */
+    struct dhcp_request *next;          /* waiting for the same newface reply */
+    struct ccn_dhcp_entry **order;      /* bulkreg entries, as they were sent */
+    int norder;
+    int retries;
+    int finished;
+};
+
+/*
+ * A gateway, by resolved address, port and protocol, so that its face is
+ * asked for only once however many entries point at it
+ */
+struct dhcp_face {
+    int faceid;                         /* once the face is made, or -1 */
+    int lifetime;                       /* of its lease, as granted by ccnd */
+    struct dhcp_request *newface;       /* the request that is making it */
+    struct dhcp_request *waiting;       /* entries waiting for it */
+};
+
+#define CCN_DHCP_RETRIES 2
+
+/* faceid of an entry in a bulkreg request that has not been answered */
+#define DHCP_FACEID_PENDING (-2)
+/* as above, for one that is on the same face as the entry before it */
+#define DHCP_FACEID_SAME (-3)
+
+static void start_dhcp_requests(struct dhcp_pipeline *pl);
+static void dhcp_face_ready(struct dhcp_request *req);
+
+/*
+ * Key a face request by the resolved address, port and protocol
+ */
+static void dhcp_face_key(struct ccn_charbuf *key, const struct ccn_face_instance *fi)
+{
+    key->length = 0;
+    ccn_charbuf_append(key, fi->descr.address, strlen(fi->descr.address) + 1);
+    ccn_charbuf_append(key, fi->descr.port, strlen(fi->descr.port) + 1);
+    ccn_charbuf_append_value(key, fi->descr.ipproto, 1);
+}
+
+/*
+ * Sign a request body and express the Interest that carries it
+ */
+static int express_dhcp_request(struct dhcp_pipeline *pl, struct dhcp_request *req,
+        const char *action, struct ccn_charbuf *body)
 {
+    struct ccn_charbuf *temp = ccn_charbuf_create();
+    struct ccn_charbuf *name = ccn_charbuf_create();
     int res;
-    struct ccn_charbuf *prefix = ccn_charbuf_create();
 
-    ccn_name_from_uri(prefix, CCN_DHCP_URI);
-    res = add_new_face(h, prefix, CCN_DHCP_ADDR, CCN_DHCP_PORT);
+    res = ccn_sign_content(pl->h, temp, pl->no_name, NULL, body->buf, body->length);
+    if (res >= 0) {
+        build_request_name(name, pl->ccndid, pl->ccndid_size, action, temp);
+        res = ccn_express_interest(pl->h, name, &req->closure, pl->local_scope_template);
+    }
+    if (res >= 0)
+        pl->requests++;
+    req->retries = 0;
 
-    ccn_charbuf_destroy(&prefix);
+    ccn_charbuf_destroy(&temp);
+    ccn_charbuf_destroy(&name);
 
     return res;
 }
 
-int ccn_dhcp_content_parse(const unsigned char *p, size_t size, struct ccn_dhcp_entry *tail)
+/*
+ * The lease to ask for on the face of an entry, which must last a little
+ * longer than the registration of its prefix
+ */
+static int dhcp_face_lifetime(const struct ccn_dhcp_entry *de)
+{
+    int lifetime = de->lifetime;
+
+    if (lifetime > CCN_DHCP_LEASE_MAX)
+        lifetime = CCN_DHCP_LEASE_MAX;
+    return lifetime + CCN_DHCP_FACE_MARGIN;
+}
+
+/*
+ * Note the face an entry's prefix is registered on, and plan to register
+ * it again when half of the lifetime granted by ccnd has gone.  That is
+ * the lifetime of the prefix or the lease on the face, whichever is less,
+ * since registering again asks for the face again too.
+ */
+static void dhcp_entry_registered(struct ccn_dhcp_entry *de,
+        const struct ccn_forwarding_entry *fe, int face_lifetime)
+{
+    int lifetime = fe->lifetime;
+
+    if (face_lifetime > 0 && face_lifetime < lifetime)
+        lifetime = face_lifetime;
+    de->faceid = fe->faceid;
+    de->renew = time(NULL) + lifetime / 2;
+}
+
+/*
+ * Note that a request is finished, with ok of its entries configured,
+ * and start on more if the window allows
+ */
+static void finish_dhcp_request(struct dhcp_request *req, int ok)
+{
+    struct dhcp_pipeline *pl = req->pl;
+    int n = (req->count > 0) ? req->count : 1;
+
+    if (req->finished)
+        return;
+    req->finished = 1;
+    if (req->face != NULL && req->face->newface == req)
+        dhcp_face_ready(req);   /* it failed, and so do those waiting on it */
+    pl->inflight--;
+    pl->done += n;
+    pl->failed += n - ok;
+    if (req->count == 0 && !ok)
+        fprintf(stderr, "Error %s face at %s:%s\n",
+                pl->unreg ? "unregistering prefix on" : "adding new",
+                req->de->address, req->de->port);
+    start_dhcp_requests(pl);
+    if (pl->inflight == 0 && *pl->nextp == NULL && !pl->more)
+        ccn_set_run_timeout(pl->h, 0);
+}
+
+/*
+ * Note the faceids from a bulkreg reply in the entries of the request.
+ * Returns the number of entries that have both a face and a
+ * forwarding entry.
+ */
+static int parse_bulkreg_reply(struct dhcp_request *req,
+        const unsigned char *p, size_t size)
 {
     struct ccn_buf_decoder decoder;
     struct ccn_buf_decoder *d = ccn_buf_decoder_start(&decoder, p, size);
+    struct ccn_face_instance *nfi = NULL;
+    struct ccn_forwarding_entry *fe = NULL;
+    struct ccn_dhcp_entry *de;
+    size_t start;
+    int ok = 0;
     int i;
-    int count;
-    struct ccn_dhcp_entry *de = tail;
 
-    if (ccn_buf_match_dtag(d, CCN_DTAG_DHCPContent)) {
+    if (ccn_buf_match_dtag(d, CCN_DTAG_Collection))
         ccn_buf_advance(d);
+    else
+        d->decoder.state = -__LINE__;
+    for (i = 0; i < req->norder; i++) {
+        de = req->order[i];
+        if (de->faceid == DHCP_FACEID_PENDING) {
+            /* the first entry on a face follows the face */
+            ccn_face_instance_destroy(&nfi);
+            if (d->decoder.state >= 0 && ccn_buf_match_some_dtag(d)) {
+                start = d->decoder.token_index;
+                ccn_buf_advance_past_element(d);
+                nfi = ccn_face_instance_parse(p + start, d->decoder.token_index - start);
+            }
+        }
+        de->faceid = -1;
+        if (d->decoder.state < 0 || !ccn_buf_match_some_dtag(d))
+            continue;
+        start = d->decoder.token_index;
+        ccn_buf_advance_past_element(d);
+        fe = ccn_forwarding_entry_parse(p + start, d->decoder.token_index - start);
+        if (nfi != NULL && fe != NULL) {
+            dhcp_entry_registered(de, fe, nfi->lifetime);
+            ok++;
+        }
+        else
+            fprintf(stderr, "Error %s at %s:%s\n",
+                    (nfi == NULL) ? "adding new face" : "registering prefix",
+                    de->address, de->port);
+        ccn_forwarding_entry_destroy(&fe);
+    }
+    ccn_face_instance_destroy(&nfi);
+
+    return ok;
+}
 
-        count = ccn_parse_optional_tagged_nonNegativeInteger(d, CCN_DTAG_Count);
+/*
+ * Register the prefix of a request's entry on the face in req->nfi
+ */
+static int start_prefixreg_request(struct dhcp_request *req)
+{
+    struct ccn_charbuf *body = ccn_charbuf_create();
+    int res;
 
-        for (i = 0; i < count; i ++) {
-            struct ccn_charbuf *store = ccn_charbuf_create();
-            size_t start;
-            size_t end;
-            int host_off = -1;
-            int port_off = -1;
+    append_prefixreg_request(body, req->de->name_prefix, req->nfi,
+                             req->de->lifetime);
+    res = express_dhcp_request(req->pl, req, "prefixreg", body);
+    ccn_charbuf_destroy(&body);
 
-            de->next = calloc(1, sizeof(*de));
-            de = de->next;
-            memset(de, 0, sizeof(*de));
-            de->store = store;
-            de->next = NULL;
+    return res;
+}
 
-            if (ccn_buf_match_dtag(d, CCN_DTAG_Name)) {
-                de->name_prefix = ccn_charbuf_create();
-                start = d->decoder.token_index;
-                ccn_parse_Name(d, NULL);
-                end = d->decoder.token_index;
-                ccn_charbuf_append(de->name_prefix, p + start, end - start);
+/*
+ * The newface request for a gateway has been answered (req->nfi is NULL
+ * if it failed).  Note the faceid, and go on to register the prefixes of
+ * the entries that were waiting for it.
+ */
+static void dhcp_face_ready(struct dhcp_request *req)
+{
+    struct dhcp_face *face = req->face;
+    struct dhcp_request *w;
+    int res;
+
+    face->newface = NULL;
+    if (req->nfi != NULL) {
+        face->faceid = req->nfi->faceid;
+        face->lifetime = req->nfi->lifetime;
+    }
+    while ((w = face->waiting) != NULL) {
+        face->waiting = w->next;
+        res = -1;
+        if (req->nfi != NULL) {
+            w->fi->faceid = face->faceid;
+            w->nfi = w->fi;
+            w->fi = NULL;
+            res = start_prefixreg_request(w);
+        }
+        if (res < 0) {
+            /* it never expressed an interest, so there will be no FINAL */
+            finish_dhcp_request(w, 0);
+            ccn_face_instance_destroy(&w->fi);
+            ccn_face_instance_destroy(&w->nfi);
+            free(w);
+        }
+    }
+}
+
+/*
+ * Handle the replies to newface, prefixreg and bulkreg requests
+ */
+static enum ccn_upcall_res dhcp_request_reply(struct ccn_closure *selfp,
+        enum ccn_upcall_kind kind, struct ccn_upcall_info *info)
+{
+    struct dhcp_request *req = selfp->data;
+    struct ccn_forwarding_entry *fe = NULL;
+    const unsigned char *ptr = NULL;
+    size_t length = 0;
+    int res;
+
+    switch (kind) {
+        case CCN_UPCALL_FINAL:
+            ccn_face_instance_destroy(&req->fi);
+            ccn_face_instance_destroy(&req->nfi);
+            free(req->order);
+            free(req);
+            return CCN_UPCALL_RESULT_OK;
+        case CCN_UPCALL_INTEREST_TIMED_OUT:
+            if (req->retries++ < CCN_DHCP_RETRIES) {
+                req->pl->requests++;
+                return CCN_UPCALL_RESULT_REEXPRESS;
             }
-            else
-                de->name_prefix = NULL;
+            finish_dhcp_request(req, 0);
+            return CCN_UPCALL_RESULT_OK;
+        case CCN_UPCALL_CONTENT_UNVERIFIED:
+            return CCN_UPCALL_RESULT_VERIFY;
+        case CCN_UPCALL_CONTENT:
+            break;
+        default:
+            finish_dhcp_request(req, 0);
+            return CCN_UPCALL_RESULT_OK;
+    }
+
+    res = ccn_content_get_value(info->content_ccnb, info->pco->offset[CCN_PCO_E],
+            info->pco, &ptr, &length);
+    if (res < 0) {
+        finish_dhcp_request(req, 0);
+        return CCN_UPCALL_RESULT_OK;
+    }
+
+    if (req->count > 0) {
+        finish_dhcp_request(req, parse_bulkreg_reply(req, ptr, length));
+        return CCN_UPCALL_RESULT_OK;
+    }
 
-            host_off = ccn_parse_tagged_string(d, CCN_DTAG_Host, store);
-            port_off = ccn_parse_tagged_string(d, CCN_DTAG_Port, store);
+    if (req->pl->unreg) {
+        fe = ccn_forwarding_entry_parse(ptr, length);
+        if (fe != NULL)
+            req->de->faceid = -1;
+        finish_dhcp_request(req, fe != NULL);
+        ccn_forwarding_entry_destroy(&fe);
+        return CCN_UPCALL_RESULT_OK;
+    }
 
-            char *b = (char *)store->buf;
-            char *h = b + host_off;
-            char *p = b + port_off;
-            if (host_off >= 0)
-                memcpy((void *)de->address, h, strlen(h));
-            if (port_off >= 0)
-                memcpy((void *)de->port, p, strlen(p));
+    if (req->nfi == NULL) {
+        /* newface reply - chain the prefixreg request off it */
+        req->nfi = ccn_face_instance_parse(ptr, length);
+        if (req->nfi == NULL) {
+            finish_dhcp_request(req, 0);
+            return CCN_UPCALL_RESULT_OK;
         }
+        dhcp_face_ready(req);
+        res = start_prefixreg_request(req);
+        if (res < 0)
+            finish_dhcp_request(req, 0);
+        return CCN_UPCALL_RESULT_OK;
     }
-    else
-        d->decoder.state = -__LINE__;
 
-    if (d->decoder.index != size || !CCN_FINAL_DSTATE(d->decoder.state))
-        ccn_dhcp_content_destroy(tail->next);
+    /* prefixreg reply */
+    fe = ccn_forwarding_entry_parse(ptr, length);
+    if (fe != NULL)
+        dhcp_entry_registered(req->de, fe, req->face->lifetime);
+    finish_dhcp_request(req, fe != NULL);
+    ccn_forwarding_entry_destroy(&fe);
 
-    return count;
+    return CCN_UPCALL_RESULT_OK;
 }
 
-void ccn_dhcp_entry_destroy(struct ccn_dhcp_entry **de)
+/*
+ * Send the next batch of entries in one bulkreg request, if a whole batch
+ * is ready or no more entries are coming.  The entries are grouped by
+ * gateway, so that each face is asked for once, followed by the prefixes
+ * of all the entries on it.  Returns 1 if one was started.
+ */
+static int start_bulkreg_request(struct dhcp_pipeline *pl)
 {
-    if (*de != NULL) {
-        ccn_charbuf_destroy(&(*de)->name_prefix);
-        ccn_charbuf_destroy(&(*de)->store);
-        free(*de);
-        *de = NULL;
+    struct dhcp_request *req;
+    struct ccn_dhcp_entry *de;
+    struct ccn_dhcp_entry **entries;
+    struct ccn_face_instance **fis;
+    struct ccn_charbuf *key;
+    struct ccn_charbuf *body;
+    struct hashtb *groups;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    int *same;                          /* next entry on the same face, or -1 */
+    int *last;
+    int i;
+    int j;
+    int n;
+    int res;
+
+    for (de = *pl->nextp, n = 0; de != NULL && n < pl->batch; de = de->next)
+        n++;
+    if (n == 0 || (n < pl->batch && pl->more))
+        return 0;
+
+    req = calloc(1, sizeof(*req));
+    req->closure.p = &dhcp_request_reply;
+    req->closure.data = req;
+    req->pl = pl;
+    req->de = *pl->nextp;
+    req->count = n;
+    req->order = calloc(n, sizeof(*req->order));
+    pl->inflight++;
+
+    entries = calloc(n, sizeof(*entries));
+    fis = calloc(n, sizeof(*fis));
+    same = calloc(n, sizeof(*same));
+    key = ccn_charbuf_create();
+    groups = hashtb_create(sizeof(int), NULL);
+    hashtb_start(groups, e);
+    for (i = 0; i < n; i++) {
+        de = *pl->nextp;
+        pl->nextp = &de->next;
+        entries[i] = de;
+        same[i] = -1;
+        de->faceid = -1;
+        de->renew = time(NULL) + CCN_DHCP_INTERVAL;
+        fis[i] = construct_face(pl->ccndid, pl->ccndid_size, de->address, de->port,
+                                dhcp_face_lifetime(de));
+        if (fis[i] == NULL) {
+            fprintf(stderr, "Error adding new face at %s:%s\n", de->address, de->port);
+            continue;
+        }
+        dhcp_face_key(key, fis[i]);
+        res = hashtb_seek(e, key->buf, key->length, 0);
+        last = e->data;
+        if (res == HT_OLD_ENTRY) {
+            same[*last] = i;
+            de->faceid = DHCP_FACEID_SAME;
+            ccn_face_instance_destroy(&fis[i]);
+        }
+        else
+            de->faceid = DHCP_FACEID_PENDING;
+        *last = i;
+    }
+    hashtb_end(e);
+    hashtb_destroy(&groups);
+
+    body = ccn_charbuf_create();
+    ccnb_element_begin(body, CCN_DTAG_Collection);
+    for (i = 0; i < n; i++) {
+        if (fis[i] == NULL)
+            continue;
+        /* the face is leased for as long as any of its entries needs it */
+        for (j = same[i]; j >= 0; j = same[j])
+            if (fis[i]->lifetime < dhcp_face_lifetime(entries[j]))
+                fis[i]->lifetime = dhcp_face_lifetime(entries[j]);
+        ccnb_append_face_instance(body, fis[i]);
+        /* ccnd fills in the faceid of the face it makes */
+        for (j = i; j >= 0; j = same[j]) {
+            req->order[req->norder++] = entries[j];
+            append_prefixreg_request(body, entries[j]->name_prefix, fis[i],
+                                     entries[j]->lifetime);
+        }
+        ccn_face_instance_destroy(&fis[i]);
+    }
+    ccnb_element_end(body);
+    free(entries);
+    free(fis);
+    free(same);
+    ccn_charbuf_destroy(&key);
+
+    res = express_dhcp_request(pl, req, "bulkreg", body);
+    ccn_charbuf_destroy(&body);
+    if (res < 0) {
+        finish_dhcp_request(req, 0);
+        free(req->order);
+        free(req);
     }
+
+    return 1;
 }
 
-void ccn_dhcp_content_destroy(struct ccn_dhcp_entry *head)
+/*
+ * Send an unreg request for the next entry, if its prefix is registered
+ */
+static void start_unreg_request(struct dhcp_pipeline *pl)
 {
-    struct ccn_dhcp_entry *de = head;
-    struct ccn_dhcp_entry *next;
+    struct ccn_forwarding_entry forwarding_entry_storage = {0};
+    struct ccn_forwarding_entry *fe = &forwarding_entry_storage;
+    struct dhcp_request *req;
+    struct ccn_dhcp_entry *de = *pl->nextp;
+    struct ccn_charbuf *body;
+    int res;
 
-    while (de != NULL) {
-        next = de->next;
-        ccn_dhcp_entry_destroy(&de);
-        de = next;
+    pl->nextp = &de->next;
+    if (de->faceid < 0 || de->name_prefix == NULL)
+        return;
+
+    req = calloc(1, sizeof(*req));
+    req->closure.p = &dhcp_request_reply;
+    req->closure.data = req;
+    req->pl = pl;
+    req->de = de;
+    pl->inflight++;
+
+    fe->action = "unreg";
+    fe->name_prefix = de->name_prefix;
+    fe->ccnd_id = pl->ccndid;
+    fe->ccnd_id_size = pl->ccndid_size;
+    fe->faceid = de->faceid;
+    fe->flags = -1;
+    fe->lifetime = -1;
+
+    body = ccn_charbuf_create();
+    ccnb_append_forwarding_entry(body, fe);
+    res = express_dhcp_request(pl, req, "unreg", body);
+    ccn_charbuf_destroy(&body);
+    if (res < 0) {
+        finish_dhcp_request(req, 0);
+        free(req);
     }
 }
 
-int ccnb_append_dhcp_content(struct ccn_charbuf *c, int count, const struct ccn_dhcp_entry *head)
+/*
+ * Send requests for further entries, up to the window.  Only the first
+ * entry on a gateway sends a newface request; the others wait for its
+ * reply, or go straight to prefixreg once the face is known.
+ */
+static void start_dhcp_requests(struct dhcp_pipeline *pl)
 {
+    struct dhcp_request *req;
+    struct ccn_dhcp_entry *de;
+    struct ccn_charbuf *body;
+    struct ccn_charbuf *key = NULL;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct dhcp_face *face;
     int res;
-    int i;
-    const struct ccn_dhcp_entry *de = head;
 
-    res = ccnb_element_begin(c, CCN_DTAG_DHCPContent);
-    res |= ccnb_tagged_putf(c, CCN_DTAG_Count, "%d", count);
+    if (pl->starting)
+        return;
+    pl->starting = 1;
+    while (pl->inflight < pl->window && *pl->nextp != NULL) {
+        if (pl->unreg) {
+            start_unreg_request(pl);
+            continue;
+        }
+        if (pl->batch > 0) {
+            if (start_bulkreg_request(pl) == 0)
+                break;
+            continue;
+        }
+        de = *pl->nextp;
+        pl->nextp = &de->next;
+        /* if this one fails, try again later */
+        de->renew = time(NULL) + CCN_DHCP_INTERVAL;
+
+        req = calloc(1, sizeof(*req));
+        req->closure.p = &dhcp_request_reply;
+        req->closure.data = req;
+        req->pl = pl;
+        req->de = de;
+        pl->inflight++;
+
+        req->fi = construct_face(pl->ccndid, pl->ccndid_size, de->address, de->port,
+                                 dhcp_face_lifetime(de));
+        if (req->fi == NULL) {
+            finish_dhcp_request(req, 0);
+            free(req);
+            continue;
+        }
 
-    for (i = 0; i < count; i ++) {
-        if (de == NULL)
-        {
-            fprintf(stderr, "Error: number of ccn_dhcp_entry does not match\n");
-            break;
+        if (key == NULL)
+            key = ccn_charbuf_create();
+        dhcp_face_key(key, req->fi);
+        hashtb_start(pl->faces, e);
+        if (hashtb_seek(e, key->buf, key->length, 0) == HT_NEW_ENTRY) {
+            face = e->data;
+            face->faceid = -1;
+        }
+        face = e->data;
+        hashtb_end(e);
+        req->face = face;
+
+        if (face->faceid >= 0) {
+            req->fi->faceid = face->faceid;
+            req->nfi = req->fi;
+            req->fi = NULL;
+            res = start_prefixreg_request(req);
+        }
+        else if (face->newface != NULL) {
+            req->next = face->waiting;
+            face->waiting = req;
+            continue;
         }
+        else {
+            face->newface = req;
+            body = ccn_charbuf_create();
+            ccnb_append_face_instance(body, req->fi);
+            res = express_dhcp_request(pl, req, req->fi->action, body);
+            ccn_charbuf_destroy(&body);
+        }
+        if (res < 0) {
+            /* The closure was never registered, so there will be no FINAL */
+            finish_dhcp_request(req, 0);
+            ccn_face_instance_destroy(&req->fi);
+            ccn_face_instance_destroy(&req->nfi);
+            free(req);
+        }
+    }
+    pl->starting = 0;
+    ccn_charbuf_destroy(&key);
+}
 
-        if (de->name_prefix != NULL && de->name_prefix->length > 0)
-            res |= ccn_charbuf_append(c, de->name_prefix->buf, de->name_prefix->length);
+/*
+ * Get ready to configure entries: fetch the ccnd id once
+ */
+static int dhcp_pipeline_init(struct dhcp_pipeline *pl, struct ccn *h,
+        int window, int batch)
+{
+    pl->h = h;
+    pl->local_scope_template = ccn_charbuf_create();
+    pl->no_name = ccn_charbuf_create();
+    pl->window = (window > 0) ? window : 1;
+    pl->batch = (batch > 0) ? batch : 0;
+    pl->faces = hashtb_create(sizeof(struct dhcp_face), NULL);
 
-        if (de->address != NULL)
-            res |= ccnb_tagged_putf(c, CCN_DTAG_Host, "%s", de->address);
-        if (de->port != NULL)
-            res |= ccnb_tagged_putf(c, CCN_DTAG_Port, "%s", de->port);
+    init_data(pl->local_scope_template, pl->no_name);
 
-        de = de->next;
+    pl->ccndid_size = get_ccndid(h, pl->local_scope_template, pl->ccndid);
+    if (pl->ccndid_size != sizeof(pl->ccndid)) {
+        fprintf(stderr, "Incorrect size for ccnd id in response\n");
+        return -1;
     }
 
-    res |= ccnb_element_end(c);
+    return 0;
+}
+
+static void dhcp_pipeline_cleanup(struct dhcp_pipeline *pl)
+{
+    ccn_charbuf_destroy(&pl->local_scope_template);
+    ccn_charbuf_destroy(&pl->no_name);
+    hashtb_destroy(&pl->faces);
+}
+
+/*
+ * Run until every entry that was started has finished
+ */
+static int finish_dhcp_requests(struct dhcp_pipeline *pl)
+{
+    int res;
+
+    start_dhcp_requests(pl);
+    while (pl->inflight > 0 || *pl->nextp != NULL) {
+        res = ccn_run(pl->h, 1000);
+        if (res < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Create faces and bind prefixes for a list of DHCP entries.
+ * The ccnd id is fetched once, and up to window entries are in progress
+ * at a time, each with its prefixreg request following its newface reply.
+ * Returns the number of entries that could not be configured, or -1.
+ */
+int add_new_faces(struct ccn *h, struct ccn_dhcp_entry *head, int window)
+{
+    struct dhcp_pipeline pl = {0};
+    struct ccn_dhcp_entry *first = head;
+    int res;
+
+    pl.nextp = &first;
+    res = dhcp_pipeline_init(&pl, h, window, 0);
+    if (res >= 0)
+        res = finish_dhcp_requests(&pl);
+    if (res >= 0)
+        res = pl.failed;
+    dhcp_pipeline_cleanup(&pl);
+
+    return res;
+}
+
+/*
+ * Create faces and bind prefixes for a list of DHCP entries using
+ * bulkreg requests, each carrying up to batch newface/prefixreg pairs.
+ * This needs one signature and one round trip per batch, rather than
+ * two of each per entry.
+ * Returns the number of entries that could not be configured, or -1.
+ */
+int add_new_faces_bulk(struct ccn *h, struct ccn_dhcp_entry *head, int batch)
+{
+    struct dhcp_pipeline pl = {0};
+    struct ccn_dhcp_entry *first = head;
+    int res;
+
+    pl.nextp = &first;
+    res = dhcp_pipeline_init(&pl, h, CCN_DHCP_WINDOW,
+                             (batch > 0) ? batch : CCN_DHCP_BATCH);
+    if (res >= 0)
+        res = finish_dhcp_requests(&pl);
+    if (res >= 0)
+        res = pl.failed;
+    dhcp_pipeline_cleanup(&pl);
+
+    return res;
+}
+
+/*
+ * Register again the entries after head whose renewal time has come,
+ * before their leases run out, along with any that could not be
+ * configured earlier.  The due entries are taken out of the list while
+ * their requests are sent, batch to a bulkreg request if batch is
+ * positive, and put back at the end of it.  The earliest renewal time
+ * of the entries is stored in *nextp (0 if there are none).
+ * Returns the number of entries that could not be renewed, or -1.
+ */
+int renew_dhcp_leases(struct ccn *h, struct ccn_dhcp_entry *head,
+        int window, int batch, time_t *nextp)
+{
+    struct ccn_dhcp_entry due = {0};
+    struct ccn_dhcp_entry *tail = &due;
+    struct ccn_dhcp_entry *prev = head;
+    struct ccn_dhcp_entry *de;
+    time_t now = time(NULL);
+    int res = 0;
+
+    while ((de = prev->next) != NULL) {
+        if (de->renew > now) {
+            prev = de;
+            continue;
+        }
+        prev->next = de->next;
+        de->next = NULL;
+        tail->next = de;
+        tail = de;
+    }
+    if (due.next != NULL) {
+        if (batch > 0)
+            res = add_new_faces_bulk(h, due.next, batch);
+        else
+            res = add_new_faces(h, due.next, window);
+        prev->next = due.next;
+    }
+
+    *nextp = 0;
+    for (de = head->next; de != NULL; de = de->next)
+        if (*nextp == 0 || de->renew < *nextp)
+            *nextp = de->renew;
+
     return res;
 }
 
+/*
+ * Unregister the prefixes of a list of DHCP entries from the faces they
+ * were registered on, up to window at a time.  The faces themselves are
+ * left alone, since other prefixes may use them; ccnd lets them go once
+ * their leases have run out and they are idle.
+ * Returns the number of entries that could not be unregistered, or -1.
+ */
+int remove_faces(struct ccn *h, struct ccn_dhcp_entry *head, int window)
+{
+    struct dhcp_pipeline pl = {0};
+    struct ccn_dhcp_entry *first = head;
+    int res;
+
+    pl.nextp = &first;
+    pl.unreg = 1;
+    res = dhcp_pipeline_init(&pl, h, window, 0);
+    if (res >= 0)
+        res = finish_dhcp_requests(&pl);
+    if (res >= 0)
+        res = pl.failed;
+    dhcp_pipeline_cleanup(&pl);
+
+    return res;
+}
+
+/*
+ * A fetch of the DHCP content that does not block, configuring the entries
+ * as they are parsed if it has a pipeline
+ */
+struct ccn_dhcp_session {
+    struct ccn *h;
+    struct ccn_dhcp_entry *tail;
+    struct ccn_dhcp_parser *dp;
+    struct ccn_fetch *f;
+    struct ccn_fetch_stream *fs;
+    int timeouts;
+    int fetched;                        /* entries, or -1 if the fetch failed */
+    int configure;
+    struct dhcp_pipeline pl;
+};
+
+static struct ccn_dhcp_session *dhcp_session_create(struct ccn *h,
+        struct ccn_dhcp_entry *tail)
+{
+    struct ccn_dhcp_session *s = calloc(1, sizeof(*s));
+
+    s->h = h;
+    s->tail = tail;
+    s->dp = ccn_dhcp_parser_create(tail);
+    s->f = ccn_fetch_new(h);
+    s->fetched = -1;
+
+    return s;
+}
+
+static void dhcp_session_open(struct ccn_dhcp_session *s, struct ccn_charbuf *name)
+{
+    s->fs = ccn_fetch_open(s->f, name, "dhcp", NULL, CCN_DHCP_PIPELINE, CCN_V_HIGHEST, 0);
+    if (s->fs == NULL)
+        fprintf(stderr, "Error getting DHCP content\n");
+}
+
+static void dhcp_session_end_fetch(struct ccn_dhcp_session *s)
+{
+    if (s->dp->state == 2)
+        s->fetched = s->dp->parsed;
+    else
+        fprintf(stderr, "Error getting DHCP content\n");
+    if (s->fs != NULL)
+        ccn_fetch_close(s->fs);
+    s->fs = NULL;
+}
+
+/*
+ * Start fetching the DHCP content named by name (the latest version is
+ * found if it has none), linking the entries after tail.  Requests for the
+ * entries are started as they arrive, so that faces are being made while
+ * later segments are still on their way; see fetch_and_add_new_faces for
+ * window and batch.  Returns NULL if the ccnd id cannot be had.
+ */
+struct ccn_dhcp_session *ccn_dhcp_session_start(struct ccn *h,
+        struct ccn_charbuf *name, struct ccn_dhcp_entry *tail, int window, int batch)
+{
+    struct ccn_dhcp_session *s = dhcp_session_create(h, tail);
+
+    s->configure = 1;
+    s->pl.nextp = &tail->next;
+    s->pl.more = 1;
+    /* before the fetch, whose upcalls would cut ccn_get short */
+    if (dhcp_pipeline_init(&s->pl, h, window, batch) < 0)
+        ccn_dhcp_session_finish(&s, NULL, NULL);
+    else
+        dhcp_session_open(s, name);
+
+    return s;
+}
+
+/*
+ * Do whatever the session can without waiting; call it again after ccn_run
+ * on the handle.  Returns 0 while there is more to do, 1 once the fetch is
+ * over and every entry that arrived has been configured.
+ */
+int ccn_dhcp_session_step(struct ccn_dhcp_session *s)
+{
+    unsigned char buf[CCN_DHCP_SEGMENT_SIZE];
+    intmax_t nread;
+
+    while (s->fs != NULL) {
+        nread = ccn_fetch_read(s->fs, buf, sizeof(buf));
+        if (nread > 0) {
+            if (ccn_dhcp_parser_feed(s->dp, buf, nread) < 0)
+                dhcp_session_end_fetch(s);
+            else if (s->configure)
+                start_dhcp_requests(&s->pl);
+            continue;
+        }
+        if (nread == CCN_FETCH_READ_NONE)
+            return 0;
+        if (nread == CCN_FETCH_READ_TIMEOUT && s->timeouts++ < CCN_DHCP_RETRIES) {
+            ccn_reset_timeout(s->fs);
+            return 0;
+        }
+        dhcp_session_end_fetch(s);
+    }
+    if (!s->configure)
+        return 1;
+    /* still configure the entries that did arrive */
+    s->pl.more = 0;
+    start_dhcp_requests(&s->pl);
+
+    return (s->pl.inflight == 0 && *s->pl.nextp == NULL);
+}
+
+/*
+ * Destroy a session, which must have finished unless its handle is being
+ * destroyed too.  The number of entries linked after tail is stored in
+ * *countp and the number of control Interests expressed in *requestsp, if
+ * they are not NULL.  Returns the number of entries that could not be
+ * configured, or -1 if the content could not all be fetched.
+ */
+int ccn_dhcp_session_finish(struct ccn_dhcp_session **sp, int *countp, int *requestsp)
+{
+    struct ccn_dhcp_session *s = *sp;
+    struct ccn_dhcp_entry *de;
+    int res;
+
+    if (s == NULL)
+        return -1;
+    if (s->fs != NULL)
+        ccn_fetch_close(s->fs);
+    ccn_fetch_destroy(s->f);
+    ccn_dhcp_parser_destroy(&s->dp);
+    res = s->fetched;
+    if (s->configure && res >= 0)
+        res = (s->pl.inflight == 0) ? s->pl.failed : -1;
+    if (countp != NULL)
+        for (*countp = 0, de = s->tail->next; de != NULL; de = de->next)
+            (*countp)++;
+    if (requestsp != NULL)
+        *requestsp = s->pl.requests;
+    if (s->configure)
+        dhcp_pipeline_cleanup(&s->pl);
+    free(s);
+    *sp = NULL;
+
+    return res;
+}
+
+/*
+ * Fetch the DHCP content named by name, linking the entries after tail.
+ * Returns the number of entries, or -1.
+ */
+int fetch_dhcp_content(struct ccn *h, struct ccn_charbuf *name,
+        struct ccn_dhcp_entry *tail)
+{
+    struct ccn_dhcp_session *s = dhcp_session_create(h, tail);
+    int res;
+
+    dhcp_session_open(s, name);
+    while (ccn_dhcp_session_step(s) == 0)
+        if (ccn_run(h, 1000) < 0)
+            break;
+    res = ccn_dhcp_session_finish(&s, NULL, NULL);
+    if (res < 0) {
+        ccn_dhcp_content_destroy(tail->next);
+        tail->next = NULL;
+    }
+
+    return res;
+}
+
+/*
+ * Fetch the DHCP content named by name, which is versioned and segmented,
+ * and configure the entries as they are parsed.  The entries go in bulkreg
+ * requests of batch pairs if batch is positive; otherwise up to window of
+ * them are in progress at a time.  They are linked after tail, and their
+ * number is stored in *countp.
+ * Returns the number of entries that could not be configured, or -1.
+ */
+int fetch_and_add_new_faces(struct ccn *h, struct ccn_charbuf *name,
+        struct ccn_dhcp_entry *tail, int window, int batch, int *countp)
+{
+    struct ccn_dhcp_session *s;
+
+    *countp = 0;
+    s = ccn_dhcp_session_start(h, name, tail, window, batch);
+    if (s == NULL)
+        return -1;
+    while (ccn_dhcp_session_step(s) == 0)
+        if (ccn_run(h, 1000) < 0)
+            break;
+
+    return ccn_dhcp_session_finish(&s, countp, NULL);
+}
+
+/*
+ * Copy the value of the last component of name, the version of
+ * versioned content, to version.  Returns 0, or -1 if there is none.
+ */
+int ccn_dhcp_version(const struct ccn_charbuf *name, struct ccn_charbuf *version)
+{
+    struct ccn_indexbuf *comps = ccn_indexbuf_create();
+    const unsigned char *vers = NULL;
+    size_t vers_size = 0;
+    int n;
+    int res = -1;
+
+    n = ccn_name_split(name, comps);
+    if (n > 0 && ccn_name_comp_get(name->buf, comps, n - 1, &vers, &vers_size) >= 0 &&
+        vers_size > 0 && vers[0] == CCN_MARKER_VERSION) {
+        version->length = 0;
+        ccn_charbuf_append(version, vers, vers_size);
+        res = 0;
+    }
+    ccn_indexbuf_destroy(&comps);
+
+    return res;
+}
+
+/*
+ * Get the delta between two versions of the DHCP content, named by from
+ * and to, from a long-running ccndhcpserver.  The removed and added
+ * entries are linked after the respective tails.
+ * Returns the number of changes, or -1 if there is no delta to be had.
+ */
+int get_dhcp_delta(struct ccn *h, struct ccn_charbuf *from, struct ccn_charbuf *to,
+        struct ccn_dhcp_entry *removed, struct ccn_dhcp_entry *added)
+{
+    struct ccn_charbuf *name = ccn_charbuf_create();
+    struct ccn_charbuf *version = ccn_charbuf_create();
+    struct ccn_charbuf *resultbuf = ccn_charbuf_create();
+    struct ccn_parsed_ContentObject pcobuf = {0};
+    const unsigned char *ptr = NULL;
+    size_t length = 0;
+    int res;
+
+    ccn_name_from_uri(name, CCN_DHCP_DELTA_URI);
+    res = ccn_dhcp_version(from, version);
+    if (res < 0)
+        goto cleanup;
+    ccn_name_append(name, version->buf, version->length);
+    res = ccn_dhcp_version(to, version);
+    if (res < 0)
+        goto cleanup;
+    ccn_name_append(name, version->buf, version->length);
+
+    res = ccn_get(h, name, NULL, 2000, resultbuf, &pcobuf, NULL, 0);
+    if (res < 0)
+        goto cleanup;
+    /* the server NACKs if it no longer has the old version */
+    if (pcobuf.type != CCN_CONTENT_DATA) {
+        res = -1;
+        goto cleanup;
+    }
+    res = ccn_content_get_value(resultbuf->buf, resultbuf->length, &pcobuf, &ptr, &length);
+    if (res >= 0)
+        res = ccn_dhcp_delta_parse(ptr, length, removed, added);
+
+cleanup:
+    ccn_charbuf_destroy(&name);
+    ccn_charbuf_destroy(&version);
+    ccn_charbuf_destroy(&resultbuf);
+
+    return res;
+}
+
+/*
+ * Create a face on the multicast address and port, bind the DHCP prefix to the face
+ */
+int join_dhcp_group(struct ccn *h)
+{
+    int res;
+    struct ccn_charbuf *prefix = ccn_charbuf_create();
+
+    ccn_name_from_uri(prefix, CCN_DHCP_URI);
+    res = add_new_face(h, prefix, CCN_DHCP_ADDR, CCN_DHCP_PORT);
+
+    ccn_charbuf_destroy(&prefix);
+
+    return res;
+}
+
+/*
+ * Parse one entry (an optional Name, then Host, Port and an optional
+ * lease lifetime) from the decoder
+ */
+static struct ccn_dhcp_entry *dhcp_entry_parse(struct ccn_buf_decoder *d,
+        const unsigned char *p)
+{
+    struct ccn_dhcp_entry *de = calloc(1, sizeof(*de));
+    struct ccn_charbuf *store = ccn_charbuf_create();
+    size_t start;
+    size_t end;
+    int host_off = -1;
+    int port_off = -1;
+
+    de->store = store;
+    de->next = NULL;
+    de->faceid = -1;
+
+    if (ccn_buf_match_dtag(d, CCN_DTAG_Name)) {
+        de->name_prefix = ccn_charbuf_create();
+        start = d->decoder.token_index;
+        ccn_parse_Name(d, NULL);
+        end = d->decoder.token_index;
+        ccn_charbuf_append(de->name_prefix, p + start, end - start);
+    }
+    else
+        de->name_prefix = NULL;
+
+    host_off = ccn_parse_tagged_string(d, CCN_DTAG_Host, store);
+    port_off = ccn_parse_tagged_string(d, CCN_DTAG_Port, store);
+    de->lifetime = ccn_parse_optional_tagged_nonNegativeInteger(d, CCN_DTAG_FreshnessSeconds);
+    if (de->lifetime <= 0)
+        de->lifetime = CCN_DHCP_LEASE;
+
+    if (host_off >= 0) {
+        char *h = (char *)store->buf + host_off;
+        if (strlen(h) < sizeof(de->address))
+            memcpy((void *)de->address, h, strlen(h));
+    }
+    if (port_off >= 0) {
+        char *port = (char *)store->buf + port_off;
+        if (strlen(port) < sizeof(de->port))
+            memcpy((void *)de->port, port, strlen(port));
+    }
+
+    return de;
+}
+
+/*
+ * Size of the complete element at p, 0 if more bytes are needed,
+ * or -1 if it is malformed
+ */
+static ssize_t dhcp_element_size(const unsigned char *p, size_t n)
+{
+    struct ccn_skeleton_decoder sd = {0};
+    ssize_t res;
+
+    if (n == 0)
+        return 0;
+    res = ccn_skeleton_decode(&sd, p, n);
+    if (sd.state < 0)
+        return -1;
+    if (sd.state != 0 || sd.nest != 0)
+        return 0;
+    return res;
+}
+
+struct ccn_dhcp_parser *ccn_dhcp_parser_create(struct ccn_dhcp_entry *tail)
+{
+    struct ccn_dhcp_parser *dp = calloc(1, sizeof(*dp));
+
+    dp->buf = ccn_charbuf_create();
+    dp->count = -1;
+    dp->tail = tail;
+
+    return dp;
+}
+
+void ccn_dhcp_parser_destroy(struct ccn_dhcp_parser **dpp)
+{
+    if (*dpp != NULL) {
+        ccn_charbuf_destroy(&(*dpp)->buf);
+        free(*dpp);
+        *dpp = NULL;
+    }
+}
+
+/*
+ * Parse as much as possible of the DHCP content with the next size bytes.
+ * Each entry is linked onto the list as soon as all of it has arrived.
+ * Returns the number of new entries, or -1 for an error.
+ */
+int ccn_dhcp_parser_feed(struct ccn_dhcp_parser *dp, const unsigned char *p, size_t size)
+{
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d;
+    struct ccn_charbuf *opener = NULL;
+    const unsigned char *b;
+    size_t index = 0;
+    size_t n;
+    ssize_t len;
+    ssize_t total;
+    int nelem;
+    int fresh = 0;
+    int i;
+
+    if (dp->state < 0)
+        return -1;
+    if (dp->state == 2) {
+        if (size != 0)
+            dp->state = -__LINE__;      /* trailing garbage */
+        return (dp->state < 0) ? -1 : 0;
+    }
+    ccn_charbuf_append(dp->buf, p, size);
+
+    for (;;) {
+        b = dp->buf->buf + index;
+        n = dp->buf->length - index;
+        if (dp->state == 0) {
+            /* <DHCPContent> <Count>count</Count> */
+            opener = ccn_charbuf_create();
+            ccn_charbuf_append_tt(opener, CCN_DTAG_DHCPContent, CCN_DTAG);
+            len = opener->length;
+            i = memcmp(b, opener->buf, (n < (size_t)len) ? n : (size_t)len);
+            ccn_charbuf_destroy(&opener);
+            if (i != 0) {
+                dp->state = -__LINE__;
+                break;
+            }
+            if (n < (size_t)len)
+                break;
+            total = dhcp_element_size(b + len, n - len);
+            if (total < 0) {
+                dp->state = -__LINE__;
+                break;
+            }
+            if (total == 0)
+                break;
+            d = ccn_buf_decoder_start(&decoder, b + len, total);
+            dp->count = ccn_parse_optional_tagged_nonNegativeInteger(d, CCN_DTAG_Count);
+            if (dp->count < 0 || d->decoder.state < 0) {
+                dp->state = -__LINE__;
+                break;
+            }
+            index += len + total;
+            dp->state = 1;
+            continue;
+        }
+        if (n == 0)
+            break;
+        if (b[0] == CCN_CLOSE) {
+            /* </DHCPContent> */
+            index++;
+            dp->state = (dp->parsed == dp->count && index == dp->buf->length) ? 2 : -__LINE__;
+            break;
+        }
+        /* Wait until the whole entry is here */
+        total = 0;
+        nelem = 2;
+        for (i = 0; i < nelem; i++) {
+            len = dhcp_element_size(b + total, n - total);
+            if (len <= 0)
+                break;
+            if (i == 0) {
+                d = ccn_buf_decoder_start(&decoder, b, len);
+                if (ccn_buf_match_dtag(d, CCN_DTAG_Name))
+                    nelem = 3;
+            }
+            total += len;
+        }
+        if (len < 0) {
+            dp->state = -__LINE__;
+            break;
+        }
+        if (i < nelem)
+            break;
+        /* An optional lease lifetime may follow, so look at what comes next */
+        if ((size_t)total == n)
+            break;
+        if (b[total] != CCN_CLOSE) {
+            len = dhcp_element_size(b + total, n - total);
+            if (len < 0) {
+                dp->state = -__LINE__;
+                break;
+            }
+            if (len == 0)
+                break;
+            d = ccn_buf_decoder_start(&decoder, b + total, len);
+            if (ccn_buf_match_dtag(d, CCN_DTAG_FreshnessSeconds))
+                total += len;
+        }
+        d = ccn_buf_decoder_start(&decoder, b, total);
+        dp->tail->next = dhcp_entry_parse(d, b);
+        /* An entry without a usable Host and Port could not be registered */
+        if (d->decoder.state < 0 || d->decoder.index != (size_t)total ||
+            dp->tail->next->address[0] == '\0' || dp->tail->next->port[0] == '\0') {
+            ccn_dhcp_content_destroy(dp->tail->next);
+            dp->tail->next = NULL;
+            dp->state = -__LINE__;
+            break;
+        }
+        dp->tail = dp->tail->next;
+        dp->parsed++;
+        fresh++;
+        index += total;
+    }
+
+    /* Keep only the part not yet parsed, which is at most one entry and a bit */
+    if (index > 0) {
+        memmove(dp->buf->buf, dp->buf->buf + index, dp->buf->length - index);
+        dp->buf->length -= index;
+    }
+
+    return (dp->state < 0) ? -1 : fresh;
+}
+
+/*
+ * Parse complete DHCP content, linking the entries after tail
+ * Returns the number of entries, or -1 for an error.
+ */
+int ccn_dhcp_content_parse(const unsigned char *p, size_t size, struct ccn_dhcp_entry *tail)
+{
+    struct ccn_dhcp_parser *dp = ccn_dhcp_parser_create(tail);
+    int count;
+
+    ccn_dhcp_parser_feed(dp, p, size);
+    count = dp->parsed;
+    if (dp->state != 2) {
+        ccn_dhcp_content_destroy(tail->next);
+        tail->next = NULL;
+        count = -1;
+    }
+    ccn_dhcp_parser_destroy(&dp);
+
+    return count;
+}
+
+void ccn_dhcp_entry_destroy(struct ccn_dhcp_entry **de)
+{
+    if (*de != NULL) {
+        ccn_charbuf_destroy(&(*de)->name_prefix);
+        ccn_charbuf_destroy(&(*de)->store);
+        free(*de);
+        *de = NULL;
+    }
+}
+
+void ccn_dhcp_content_destroy(struct ccn_dhcp_entry *head)
+{
+    struct ccn_dhcp_entry *de = head;
+    struct ccn_dhcp_entry *next;
+
+    while (de != NULL) {
+        next = de->next;
+        ccn_dhcp_entry_destroy(&de);
+        de = next;
+    }
+}
+
+/*
+ * Append the encoding of one entry: its Name (if any), Host, Port and
+ * lease lifetime, which is carried as FreshnessSeconds as it is in a
+ * ForwardingEntry
+ */
+static int append_dhcp_entry(struct ccn_charbuf *c, const struct ccn_dhcp_entry *de)
+{
+    int res = 0;
+
+    if (de->name_prefix != NULL && de->name_prefix->length > 0)
+        res |= ccn_charbuf_append(c, de->name_prefix->buf, de->name_prefix->length);
+
+    if (de->address != NULL)
+        res |= ccnb_tagged_putf(c, CCN_DTAG_Host, "%s", de->address);
+    if (de->port != NULL)
+        res |= ccnb_tagged_putf(c, CCN_DTAG_Port, "%s", de->port);
+    if (de->lifetime > 0)
+        res |= ccnb_tagged_putf(c, CCN_DTAG_FreshnessSeconds, "%d", de->lifetime);
+
+    return res;
+}
+
+int ccnb_append_dhcp_content(struct ccn_charbuf *c, int count, const struct ccn_dhcp_entry *head)
+{
+    int res;
+    int i;
+    const struct ccn_dhcp_entry *de = head;
+
+    res = ccnb_element_begin(c, CCN_DTAG_DHCPContent);
+    res |= ccnb_tagged_putf(c, CCN_DTAG_Count, "%d", count);
+
+    for (i = 0; i < count; i ++) {
+        if (de == NULL)
+        {
+            fprintf(stderr, "Error: number of ccn_dhcp_entry does not match\n");
+            break;
+        }
+
+        res |= append_dhcp_entry(c, de);
+
+        de = de->next;
+    }
+
+    res |= ccnb_element_end(c);
+    return res;
+}
+
+int ccn_dhcp_content_count(const struct ccn_dhcp_entry *head)
+{
+    int count = 0;
+
+    for (; head != NULL; head = head->next)
+        count++;
+
+    return count;
+}
+
+/*
+ * A delta is the entries removed and the entries added between two
+ * versions of the DHCP content:
+ * <DHCPDelta> <DHCPContent>removed</DHCPContent> <DHCPContent>added</DHCPContent> </DHCPDelta>
+ */
+int ccnb_append_dhcp_delta(struct ccn_charbuf *c,
+        const struct ccn_dhcp_entry *removed, const struct ccn_dhcp_entry *added)
+{
+    int res;
+
+    res = ccnb_element_begin(c, CCN_DTAG_DHCPDelta);
+    res |= ccnb_append_dhcp_content(c, ccn_dhcp_content_count(removed), removed);
+    res |= ccnb_append_dhcp_content(c, ccn_dhcp_content_count(added), added);
+    res |= ccnb_element_end(c);
+
+    return res;
+}
+
+/*
+ * Parse a delta, linking the removed and added entries after the
+ * respective tails.  Returns the total number of entries, or -1.
+ */
+int ccn_dhcp_delta_parse(const unsigned char *p, size_t size,
+        struct ccn_dhcp_entry *removed, struct ccn_dhcp_entry *added)
+{
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = ccn_buf_decoder_start(&decoder, p, size);
+    struct ccn_dhcp_entry *tail[2] = {removed, added};
+    size_t start;
+    int count = 0;
+    int res;
+    int i;
+
+    if (ccn_buf_match_dtag(d, CCN_DTAG_DHCPDelta))
+        ccn_buf_advance(d);
+    else
+        d->decoder.state = -__LINE__;
+    for (i = 0; i < 2 && d->decoder.state >= 0; i++) {
+        if (!ccn_buf_match_dtag(d, CCN_DTAG_DHCPContent)) {
+            d->decoder.state = -__LINE__;
+            break;
+        }
+        start = d->decoder.token_index;
+        ccn_buf_advance_past_element(d);
+        res = ccn_dhcp_content_parse(p + start, d->decoder.token_index - start, tail[i]);
+        if (res < 0)
+            d->decoder.state = -__LINE__;
+        else
+            count += res;
+    }
+    ccn_buf_check_close(d);
+    if (d->decoder.state < 0 || d->decoder.index != size) {
+        ccn_dhcp_content_destroy(removed->next);
+        removed->next = NULL;
+        ccn_dhcp_content_destroy(added->next);
+        added->next = NULL;
+        return -1;
+    }
+
+    return count;
+}
+
+/*
+ * Make an unlinked copy of an entry
+ */
+static struct ccn_dhcp_entry *dhcp_entry_copy(const struct ccn_dhcp_entry *de)
+{
+    struct ccn_dhcp_entry *copy = calloc(1, sizeof(*copy));
+
+    if (de->name_prefix != NULL) {
+        copy->name_prefix = ccn_charbuf_create();
+        ccn_charbuf_append_charbuf(copy->name_prefix, de->name_prefix);
+    }
+    memcpy((void *)copy->address, de->address, sizeof(copy->address));
+    memcpy((void *)copy->port, de->port, sizeof(copy->port));
+    copy->lifetime = de->lifetime;
+    copy->faceid = de->faceid;
+    copy->renew = de->renew;
+
+    return copy;
+}
+
+struct dhcp_diff_item {
+    struct ccn_dhcp_entry *de;
+    int seen;
+};
+
+/*
+ * Make a table of the entries of a list, keyed by their encoding
+ */
+static struct hashtb *dhcp_entry_table(struct ccn_dhcp_entry *head,
+        struct ccn_charbuf *key)
+{
+    struct hashtb *ht = hashtb_create(sizeof(struct dhcp_diff_item), NULL);
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct dhcp_diff_item *item;
+    struct ccn_dhcp_entry *de;
+
+    hashtb_start(ht, e);
+    for (de = head; de != NULL; de = de->next) {
+        key->length = 0;
+        append_dhcp_entry(key, de);
+        if (hashtb_seek(e, key->buf, key->length, 0) == HT_NEW_ENTRY) {
+            item = e->data;
+            item->de = de;
+        }
+    }
+    hashtb_end(e);
+
+    return ht;
+}
+
+/*
+ * Compare two lists of entries, linking copies of those only in from
+ * after removed, and copies of those only in to after added.
+ * Returns the number of differences.
+ */
+int ccn_dhcp_content_diff(struct ccn_dhcp_entry *from, struct ccn_dhcp_entry *to,
+        struct ccn_dhcp_entry *removed, struct ccn_dhcp_entry *added)
+{
+    struct ccn_charbuf *key = ccn_charbuf_create();
+    struct hashtb *ht = dhcp_entry_table(from, key);
+    struct dhcp_diff_item *item;
+    struct ccn_dhcp_entry *de;
+    int count = 0;
+
+    for (de = to; de != NULL; de = de->next) {
+        key->length = 0;
+        append_dhcp_entry(key, de);
+        item = hashtb_lookup(ht, key->buf, key->length);
+        if (item != NULL)
+            item->seen = 1;
+        else {
+            added->next = dhcp_entry_copy(de);
+            added = added->next;
+            count++;
+        }
+    }
+    for (de = from; de != NULL; de = de->next) {
+        key->length = 0;
+        append_dhcp_entry(key, de);
+        item = hashtb_lookup(ht, key->buf, key->length);
+        if (item != NULL && !item->seen) {
+            item->seen = 1;
+            removed->next = dhcp_entry_copy(de);
+            removed = removed->next;
+            count++;
+        }
+    }
+
+    hashtb_destroy(&ht);
+    ccn_charbuf_destroy(&key);
+
+    return count;
+}
+
+/*
+ * Unlink the entries after head that match the list of removed ones,
+ * noting their faceids in the removed entries.
+ * Returns the number of entries taken.
+ */
+int ccn_dhcp_content_take(struct ccn_dhcp_entry *head, struct ccn_dhcp_entry *removed)
+{
+    struct ccn_charbuf *key = ccn_charbuf_create();
+    struct hashtb *ht = dhcp_entry_table(removed, key);
+    struct dhcp_diff_item *item;
+    struct ccn_dhcp_entry *prev = head;
+    struct ccn_dhcp_entry *de;
+    int count = 0;
+
+    while ((de = prev->next) != NULL) {
+        key->length = 0;
+        append_dhcp_entry(key, de);
+        item = hashtb_lookup(ht, key->buf, key->length);
+        if (item == NULL || item->seen) {
+            prev = de;
+            continue;
+        }
+        item->seen = 1;
+        item->de->faceid = de->faceid;
+        prev->next = de->next;
+        ccn_dhcp_entry_destroy(&de);
+        count++;
+    }
+
+    hashtb_destroy(&ht);
+    ccn_charbuf_destroy(&key);
+
+    return count;
+}
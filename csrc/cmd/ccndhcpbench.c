@@ -0,0 +1,455 @@
+/**
+ * @file ccndhcpbench.c
+ * @brief Measure how a DHCP server and ccnd cope with many clients at once
+ *
+ * A private ccnd and ccndhcpserver -d are started on this machine, and a
+ * table of entries is published.  Each simulated client is a handle of
+ * its own on the local socket of that ccnd, and they all fetch the table
+ * and configure its entries at the same time, as a rack of nodes coming
+ * up together would.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include <ccn/ccn.h>
+#include <ccn/uri.h>
+#include <ccn/charbuf.h>
+#include <ccn/ccn_dhcp.h>
+
+/*
+ * One simulated DHCP client
+ */
+struct bench_client {
+    struct ccn *h;
+    struct ccn_dhcp_session *s;
+    struct ccn_dhcp_entry head;
+    struct timeval start;               /* when its session was started */
+    double elapsed;                     /* seconds to configure, or -1 */
+    int count;
+    int failed;
+    int requests;
+};
+
+/* the programs we started, to be stopped however we exit */
+static pid_t ccnd_pid;
+static pid_t server_pid;
+
+static void usage(const char *progname)
+{
+    fprintf(stderr,
+            "%s [-n clients] [-e entries] [-g gateways] [-w window] [-b batch]\n"
+            "    [-p port] [-t seconds] [-C ccnd] [-S ccndhcpserver]\n"
+            " -n number of simulated clients (default 100)\n"
+            " -e number of entries in the DHCP table (default 1000)\n"
+            " -g number of distinct gateways the entries are spread over (default 10)\n"
+            " -w newface/prefixreg requests each client keeps in flight (default %d)\n"
+            " -b have the clients send bulkreg requests of this size (%d if 0)\n"
+            " -p port of the private ccnd (default 9800)\n"
+            " -t give up on clients that are not configured after this many\n"
+            "    seconds (default 120)\n"
+            " -C, -S the ccnd and ccndhcpserver programs to run\n"
+            , progname, CCN_DHCP_WINDOW, CCN_DHCP_BATCH);
+    exit(1);
+}
+
+static double seconds_since(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+static double cpu_seconds(const struct rusage *ru)
+{
+    return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+        ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Run a program with its output going to logfile
+ */
+static pid_t spawn(char *const argv[], const char *logfile)
+{
+    pid_t pid;
+    int fd;
+
+    pid = fork();
+    if (pid != 0)
+        return pid;
+    fd = open(logfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0) {
+        dup2(fd, 1);
+        dup2(fd, 2);
+        close(fd);
+    }
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+}
+
+/*
+ * Stop a program we started, returning the CPU time it used
+ */
+static double reap(pid_t pid)
+{
+    struct rusage ru;
+    int status;
+
+    if (pid <= 0)
+        return 0;
+    kill(pid, SIGTERM);
+    memset(&ru, 0, sizeof(ru));
+    if (wait4(pid, &status, 0, &ru) != pid)
+        return 0;
+    return cpu_seconds(&ru);
+}
+
+static void stop_programs(void)
+{
+    if (server_pid > 0)
+        kill(server_pid, SIGTERM);
+    if (ccnd_pid > 0)
+        kill(ccnd_pid, SIGTERM);
+}
+
+static int write_config(const char *filename, int entries, int gateways)
+{
+    FILE *f = fopen(filename, "w");
+    int i;
+
+    if (f == NULL)
+        return -1;
+    for (i = 0; i < entries; i++)
+        fprintf(f, "ccnx:/bench/p%d 127.0.0.1 %d\n", i, 20000 + i % gateways);
+
+    return fclose(f);
+}
+
+/*
+ * Ask ccnd for its statistics over HTTP, and get the Interest totals
+ */
+static int get_interest_counts(int port, unsigned long *acceptedp,
+        unsigned long *droppedp)
+{
+    struct sockaddr_in sin;
+    struct ccn_charbuf *reply = ccn_charbuf_create();
+    const char *request = "GET /?f=xml HTTP/1.0\r\n\r\n";
+    const char *p;
+    char buf[4096];
+    ssize_t n;
+    int fd;
+    int res = -1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0 &&
+            write(fd, request, strlen(request)) == (ssize_t)strlen(request)) {
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            ccn_charbuf_append(reply, buf, n);
+        ccn_charbuf_append_value(reply, 0, 1);
+        p = strstr((const char *)reply->buf, "<interests>");
+        if (p != NULL && (p = strstr(p, "<accepted>")) != NULL &&
+                sscanf(p, "<accepted>%lu", acceptedp) == 1 &&
+                (p = strstr(p, "<dropped>")) != NULL &&
+                sscanf(p, "<dropped>%lu", droppedp) == 1)
+            res = 0;
+    }
+    if (fd >= 0)
+        close(fd);
+    ccn_charbuf_destroy(&reply);
+
+    return res;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, int pct)
+{
+    int i = (n * pct + 99) / 100 - 1;
+
+    return sorted[i < 0 ? 0 : i];
+}
+
+/*
+ * Wait for the server to publish the DHCP content, setting name to its
+ * latest version.  Returns 0, or -1 if nothing turns up.
+ */
+static int wait_for_content(struct ccn *h, struct ccn_charbuf *name)
+{
+    int tries;
+
+    for (tries = 0; tries < 60; tries++) {
+        name->length = 0;
+        ccn_name_from_uri(name, CCN_DHCP_CONTENT_URI);
+        if (ccn_resolve_version(h, name, CCN_V_HIGHEST, 50) >= 0)
+            return 0;
+        usleep(250000);
+    }
+
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    const char *ccnd = "ccnd";
+    const char *server = "ccndhcpserver";
+    char dir[] = "/tmp/ccndhcpbench.XXXXXX";
+    char config[sizeof(dir) + 20];
+    char sockname[sizeof(dir) + 20];
+    char ccndlog[sizeof(dir) + 20];
+    char serverlog[sizeof(dir) + 20];
+    char portstr[10];
+    char *ccnd_argv[2];
+    char *server_argv[5];
+    struct ccn *h = NULL;
+    struct ccn_charbuf *name = ccn_charbuf_create();
+    struct bench_client *clients = NULL;
+    struct pollfd *fds = NULL;
+    struct rlimit rl;
+    struct timeval start;
+    double *times = NULL;
+    double wall = 0;
+    double ccnd_cpu;
+    double server_cpu;
+    unsigned long accepted = 0;
+    unsigned long dropped = 0;
+    int nclients = 100;
+    int entries = 1000;
+    int gateways = 10;
+    int window = CCN_DHCP_WINDOW;
+    int batch = 0;
+    int port = 9800;
+    int timeout = 120;
+    int running = 0;
+    int configured = 0;
+    int fetch_failed = 0;
+    long requests = 0;
+    long failed = 0;
+    int res;
+    int i;
+
+    while ((res = getopt(argc, argv, "hn:e:g:w:b:p:t:C:S:")) != -1) {
+        switch (res) {
+            case 'n':
+                nclients = atoi(optarg);
+                break;
+            case 'e':
+                entries = atoi(optarg);
+                break;
+            case 'g':
+                gateways = atoi(optarg);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            case 'b':
+                batch = atoi(optarg);
+                if (batch <= 0)
+                    batch = CCN_DHCP_BATCH;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 't':
+                timeout = atoi(optarg);
+                break;
+            case 'C':
+                ccnd = optarg;
+                break;
+            case 'S':
+                server = optarg;
+                break;
+            default:
+            case 'h':
+                usage(progname);
+                break;
+        }
+    }
+    if (nclients <= 0 || entries <= 0 || gateways <= 0 || port <= 0)
+        usage(progname);
+
+    /* every client is a connection to ccnd, which inherits our limits */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    snprintf(config, sizeof(config), "%s/dhcp.config", dir);
+    snprintf(sockname, sizeof(sockname), "%s/ccnd.sock", dir);
+    snprintf(ccndlog, sizeof(ccndlog), "%s/ccnd.log", dir);
+    snprintf(serverlog, sizeof(serverlog), "%s/server.log", dir);
+    snprintf(portstr, sizeof(portstr), "%d", port);
+    setenv("CCN_LOCAL_SOCKNAME", sockname, 1);
+    setenv("CCN_LOCAL_PORT", portstr, 1);
+
+    atexit(&stop_programs);
+    if (write_config(config, entries, gateways) < 0) {
+        perror(config);
+        goto Cleanup;
+    }
+
+    ccnd_argv[0] = (char *)ccnd;
+    ccnd_argv[1] = NULL;
+    ccnd_pid = spawn(ccnd_argv, ccndlog);
+    /* a handle that failed to connect cannot be used again */
+    for (i = 0; i < 100; i++) {
+        h = ccn_create();
+        if (ccn_connect(h, NULL) >= 0)
+            break;
+        ccn_destroy(&h);
+        usleep(50000);
+    }
+    if (h == NULL) {
+        fprintf(stderr, "ccnd did not start; see %s\n", ccndlog);
+        goto Cleanup;
+    }
+
+    server_argv[0] = (char *)server;
+    server_argv[1] = "-d";
+    server_argv[2] = "-f";
+    server_argv[3] = config;
+    server_argv[4] = NULL;
+    server_pid = spawn(server_argv, serverlog);
+    if (wait_for_content(h, name) < 0) {
+        fprintf(stderr, "No DHCP content was published; see %s\n", serverlog);
+        goto Cleanup;
+    }
+
+    clients = calloc(nclients, sizeof(*clients));
+    fds = calloc(nclients, sizeof(*fds));
+    times = calloc(nclients, sizeof(*times));
+    for (i = 0; i < nclients; i++) {
+        clients[i].elapsed = -1;
+        clients[i].failed = -1;
+        clients[i].h = ccn_create();
+        if (ccn_connect(clients[i].h, NULL) < 0) {
+            fprintf(stderr, "Only %d clients could connect to ccnd\n", i);
+            nclients = i;
+            break;
+        }
+    }
+
+    /*
+     * Off they go, all at once.  Each client fetches the ccnd id for
+     * itself, and that blocks, so each is timed from its own start.
+     */
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nclients; i++) {
+        gettimeofday(&clients[i].start, NULL);
+        clients[i].s = ccn_dhcp_session_start(clients[i].h, name,
+                &clients[i].head, window, batch);
+        if (clients[i].s != NULL)
+            running++;
+    }
+    while (running > 0 && seconds_since(&start) < timeout) {
+        for (i = 0; i < nclients; i++) {
+            fds[i].fd = (clients[i].s != NULL) ? ccn_get_connection_fd(clients[i].h) : -1;
+            fds[i].events = POLLIN;
+            if (fds[i].fd >= 0 && ccn_output_is_pending(clients[i].h))
+                fds[i].events |= POLLOUT;
+        }
+        poll(fds, nclients, 10);
+        for (i = 0; i < nclients; i++) {
+            struct bench_client *c = &clients[i];
+
+            if (c->s == NULL)
+                continue;
+            ccn_run(c->h, 0);
+            if (ccn_dhcp_session_step(c->s) == 0)
+                continue;
+            c->elapsed = seconds_since(&c->start);
+            c->failed = ccn_dhcp_session_finish(&c->s, &c->count, &c->requests);
+            running--;
+        }
+    }
+    wall = seconds_since(&start);
+
+    for (i = 0; i < nclients; i++) {
+        struct bench_client *c = &clients[i];
+
+        if (c->s != NULL)
+            continue;
+        requests += c->requests;
+        if (c->failed < 0)
+            fetch_failed++;
+        else {
+            failed += c->failed;
+            if (c->elapsed >= 0)
+                times[configured++] = c->elapsed;
+        }
+    }
+    qsort(times, configured, sizeof(*times), compare_doubles);
+    get_interest_counts(port, &accepted, &dropped);
+
+    printf("%d clients, %d entries over %d gateways, %s %d\n",
+           nclients, entries, gateways,
+           batch > 0 ? "bulkreg batch" : "window", batch > 0 ? batch : window);
+    printf("configured: %d, failed to fetch: %d, unfinished: %d, entries failed: %ld\n",
+           configured, fetch_failed, running, failed);
+    if (configured > 0)
+        printf("time to configure, each from its own start (s): min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+               times[0], percentile(times, configured, 50),
+               percentile(times, configured, 90), percentile(times, configured, 99),
+               times[configured - 1]);
+    printf("wall time (s): %.3f\n", wall);
+    printf("control requests of configured clients: %ld (%.1f per client)\n",
+           requests, nclients > 0 ? (double)requests / nclients : 0.0);
+    printf("ccnd interests: %lu accepted, %lu dropped\n", accepted, dropped);
+
+Cleanup:
+    /* clients still at work are left for exit to tidy up */
+    for (i = 0; clients != NULL && i < nclients; i++) {
+        if (clients[i].s != NULL)
+            continue;
+        ccn_dhcp_content_destroy(clients[i].head.next);
+        ccn_destroy(&clients[i].h);
+    }
+    ccn_destroy(&h);
+    server_cpu = reap(server_pid);
+    ccnd_cpu = reap(ccnd_pid);
+    server_pid = ccnd_pid = 0;
+    if (clients != NULL)
+        printf("cpu (s): ccndhcpserver %.3f, ccnd %.3f\n", server_cpu, ccnd_cpu);
+    /* the logs are kept if something went wrong */
+    unlink(config);
+    if (clients != NULL) {
+        unlink(ccndlog);
+        unlink(serverlog);
+        rmdir(dir);
+    }
+    free(clients);
+    free(fds);
+    free(times);
+    ccn_charbuf_destroy(&name);
+
+    return (clients != NULL && running == 0 && fetch_failed == 0) ? 0 : 1;
+}
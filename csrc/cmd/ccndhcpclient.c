@@ -11,39 +11,151 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 
 #include <ccn/ccn.h>
 #include <ccn/uri.h>
 #include <ccn/charbuf.h>
 #include <ccn/ccn_dhcp.h>
 
-int get_dhcp_content(struct ccn *h, struct ccn_dhcp_entry *tail)
+static void usage(const char *progname)
 {
-    struct ccn_charbuf *name = ccn_charbuf_create();
-    struct ccn_charbuf *resultbuf = ccn_charbuf_create();
-    struct ccn_parsed_ContentObject pcobuf = {0};
-    int res;
-    const unsigned char *ptr;
-    size_t length;
-    int count = 0;
+    fprintf(stderr,
+            "%s [-w window] [-b batch] [-d] [-i interval]\n"
+            " -w number of newface/prefixreg requests to keep in flight (default %d)\n"
+            " -b send newface/prefixreg pairs to ccnd in bulkreg requests of this size\n"
+            "    (%d if 0)\n"
+            " -d keep running, applying the changes in each new version of the\n"
+            "    DHCP content\n"
+            " -i seconds between checks for a new version with -d (default %d)\n"
+            , progname, CCN_DHCP_WINDOW, CCN_DHCP_BATCH, CCN_DHCP_INTERVAL);
+    exit(1);
+}
+
+/*
+ * Set name to that of the latest version of the DHCP content.
+ * The timeout is short at first, as ccn_resolve_version waits that long
+ * for an even later version once it has found one, and grows if nothing
+ * is found.  Returns 0, or -1 if there is no version to be had.
+ */
+static int resolve_dhcp_version(struct ccn *h, struct ccn_charbuf *name)
+{
+    int timeout;
+    int res = -1;
 
-    ccn_name_from_uri(name, CCN_DHCP_CONTENT_URI);
+    for (timeout = 50; timeout <= 1600 && res < 0; timeout *= 2) {
+        name->length = 0;
+        ccn_name_from_uri(name, CCN_DHCP_CONTENT_URI);
+        res = ccn_resolve_version(h, name, CCN_V_HIGHEST, timeout);
+    }
+
+    return res;
+}
+
+/*
+ * Bring the configured entries after head, from the version named by
+ * current, up to date with the version named by latest.  The delta is
+ * asked of the server; if it cannot give one, the new version is fetched
+ * in full and compared with what we have.  Prefixes of entries that went
+ * away are unregistered, and new entries are configured.
+ * Returns the number of changes that could not be applied, or -1.
+ */
+static int apply_dhcp_update(struct ccn *h, struct ccn_dhcp_entry *head,
+        struct ccn_charbuf *current, struct ccn_charbuf *latest,
+        int window, int batch)
+{
+    struct ccn_dhcp_entry removed = {0};
+    struct ccn_dhcp_entry added = {0};
+    struct ccn_dhcp_entry fetched = {0};
+    struct ccn_dhcp_entry *tail;
+    int failed = 0;
+    int nremoved;
+    int nadded;
+    int res;
 
-    res = ccn_get(h, name, NULL, 3000, resultbuf, &pcobuf, NULL, 0);
+    res = get_dhcp_delta(h, current, latest, &removed, &added);
     if (res < 0) {
-        fprintf(stderr, "Error getting DHCP content\n");
-        exit(1);
+        res = fetch_dhcp_content(h, latest, &fetched);
+        if (res < 0)
+            return -1;
+        ccn_dhcp_content_diff(head->next, fetched.next, &removed, &added);
+        ccn_dhcp_content_destroy(fetched.next);
+        fprintf(stderr, "Fetched %d entries in full\n", res);
+    }
+    nremoved = ccn_dhcp_content_count(removed.next);
+    nadded = ccn_dhcp_content_count(added.next);
+
+    ccn_dhcp_content_take(head, &removed);
+    if (removed.next != NULL) {
+        res = remove_faces(h, removed.next, window);
+        failed += (res < 0) ? nremoved : res;
+    }
+    if (added.next != NULL) {
+        if (batch > 0)
+            res = add_new_faces_bulk(h, added.next, batch);
+        else
+            res = add_new_faces(h, added.next, window);
+        failed += (res < 0) ? nadded : res;
     }
 
-    ptr = resultbuf->buf;
-    length = resultbuf->length;
-    ccn_content_get_value(ptr, length, &pcobuf, &ptr, &length);
-    count = ccn_dhcp_content_parse(ptr, length, tail);
+    for (tail = head; tail->next != NULL; tail = tail->next)
+        continue;
+    tail->next = added.next;
+    ccn_dhcp_content_destroy(removed.next);
 
-    ccn_charbuf_destroy(&name);
-    ccn_charbuf_destroy(&resultbuf);
+    fprintf(stderr, "Updated to version with %d removed, %d added, %d failed\n",
+            nremoved, nadded, failed);
 
-    return count;
+    return failed;
+}
+
+/*
+ * Keep checking for new versions of the DHCP content every interval
+ * seconds, applying the changes, and renew the registrations of the
+ * entries before their leases run out, until an error occurs
+ */
+static int track_dhcp_content(struct ccn *h, struct ccn_dhcp_entry *head,
+        struct ccn_charbuf *current, int interval, int window, int batch)
+{
+    struct ccn_charbuf *latest = ccn_charbuf_create();
+    time_t next_check = time(NULL) + interval;
+    time_t next_renew = 0;
+    time_t now;
+    int wait;
+    int res;
+
+    renew_dhcp_leases(h, head, window, batch, &next_renew);
+    for (;;) {
+        now = time(NULL);
+        wait = next_check - now;
+        if (next_renew != 0 && next_renew - now < wait)
+            wait = next_renew - now;
+        if (wait > 0) {
+            res = ccn_run(h, wait * 1000);
+            if (res < 0)
+                break;
+        }
+        res = renew_dhcp_leases(h, head, window, batch, &next_renew);
+        if (res > 0)
+            fprintf(stderr, "Failed to renew %d entries\n", res);
+        if (time(NULL) < next_check)
+            continue;
+        next_check = time(NULL) + interval;
+        res = resolve_dhcp_version(h, latest);
+        if (res < 0)
+            continue;
+        if (latest->length == current->length &&
+            memcmp(latest->buf, current->buf, current->length) == 0)
+            continue;
+        res = apply_dhcp_update(h, head, current, latest, window, batch);
+        if (res < 0)
+            continue;  /* try again next time */
+        current->length = 0;
+        ccn_charbuf_append_charbuf(current, latest);
+    }
+    ccn_charbuf_destroy(&latest);
+
+    return -1;
 }
 
 int main(int argc, char **argv)
@@ -51,9 +163,43 @@ int main(int argc, char **argv)
     struct ccn *h = NULL;
     struct ccn_dhcp_entry de_storage = {0};
     struct ccn_dhcp_entry *de = &de_storage;
+    struct ccn_charbuf *name = NULL;
+    struct timeval start;
+    struct timeval stop;
+    int window = CCN_DHCP_WINDOW;
+    int batch = -1;
+    int daemon_mode = 0;
+    int interval = CCN_DHCP_INTERVAL;
     int res;
     int count;
-    int i;
+
+    while ((res = getopt(argc, argv, "b:di:w:h")) != -1) {
+        switch (res) {
+            case 'b':
+                batch = atoi(optarg);
+                if (batch < 0)
+                    usage(argv[0]);
+                break;
+            case 'd':
+                daemon_mode = 1;
+                break;
+            case 'i':
+                interval = atoi(optarg);
+                if (interval <= 0)
+                    usage(argv[0]);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                if (window <= 0)
+                    usage(argv[0]);
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    gettimeofday(&start, NULL);
 
     h = ccn_create();
     res = ccn_connect(h, NULL);
@@ -68,19 +214,31 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    count = get_dhcp_content(h, de);
-    for (i = 0; i < count; i ++)
-    {
-        de = de->next;
-        res = add_new_face(h, de->name_prefix, de->address, de->port);
-        if (res < 0) {
-            fprintf(stderr, "Error adding new face at %s:%s\n", de->address, de->port);
-            exit(1);
-        }
+    if (batch == 0)
+        batch = CCN_DHCP_BATCH;
+    name = ccn_charbuf_create();
+    res = resolve_dhcp_version(h, name);
+    if (res < 0) {
+        ccn_perror(h, "Cannot find DHCP content.");
+        exit(1);
     }
+    res = fetch_and_add_new_faces(h, name, de, window, batch, &count);
+    if (res < 0) {
+        ccn_perror(h, "Cannot add new faces.");
+        exit(1);
+    }
+
+    gettimeofday(&stop, NULL);
+    fprintf(stderr, "Configured %d of %d entries in %.3f seconds\n",
+            count - res, count,
+            (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6);
+
+    if (daemon_mode)
+        res = track_dhcp_content(h, de, name, interval, window, batch);
 
     de = &de_storage;
     ccn_dhcp_content_destroy(de->next);
+    ccn_charbuf_destroy(&name);
     ccn_destroy(&h);
-    exit(res < 0);
+    exit(res != 0);
 }
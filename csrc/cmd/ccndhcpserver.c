@@ -6,32 +6,160 @@
 #include <stdlib.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <poll.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define DHCP_HAVE_INOTIFY 1
+#endif
 
 #include <ccn/ccn.h>
 #include <ccn/uri.h>
 #include <ccn/charbuf.h>
+#include <ccn/indexbuf.h>
+#include <ccn/hashtb.h>
 #include <ccn/ccn_dhcp.h>
 
+/*
+ * A version of the DHCP content.  Its segments are all signed before any
+ * is published, so that a version is either wholly there or not at all.
+ */
+struct dhcp_version {
+    struct ccn_charbuf *version;        /* value of the version component */
+    struct ccn_dhcp_entry head;         /* the entries follow head */
+    int count;
+    struct ccn_charbuf *name;           /* the versioned name */
+    struct ccn_charbuf *body;           /* the encoded DHCPContent, unless */
+    unsigned char *image;               /* it is this mapped image */
+    size_t image_size;
+    struct ccn_charbuf *cobs;           /* the signed segments, end to end */
+    struct ccn_indexbuf *cob_ends;      /* where each segment ends in cobs */
+    struct ccn_parsed_ContentObject *pcos; /* the parse of each segment */
+    struct ccn_charbuf *deltas[CCN_DHCP_HISTORY]; /* signed answers to delta
+                                           interests for this version, by the
+                                           history slot of the from version */
+};
+
+/*
+ * State of a long-running server (-d)
+ */
+struct dhcp_server {
+    struct ccn_closure closure;         /* for delta interests */
+    struct ccn_closure content_closure; /* for DHCP content interests */
+    struct ccn_signing_context *sc;
+    struct ccn_signing_context *nack_sc; /* for deltas that cannot be had */
+    const char *config_file;
+    char *config_dir;
+    char *config_name;
+    int watch_fd;                       /* inotify on the config dir, or -1 */
+    time_t config_mtime;                /* of the config last loaded */
+    int changed;                        /* the config has been modified */
+    int building;                       /* next is being loaded or signed */
+    struct dhcp_version next;           /* the version being built */
+    struct ccn_dhcp_parser *dp;         /* parses its body as it comes in */
+    size_t fed;                         /* bytes of an image given to dp */
+    pid_t loader;                       /* compiling a text config, or 0 */
+    int loader_fd;                      /* where its output comes, or -1 */
+    int published;
+    int current;                        /* latest version in history */
+    struct dhcp_version history[CCN_DHCP_HISTORY];
+    unsigned long deltas;
+};
+
 static void usage(const char *progname)
 {
     fprintf(stderr,
-            "%s [-f config_file]\n"
-            "./ccn_dhcp.config is read by default if no config file is specified\n"
+            "%s [-d] [-f config_file] [-c image_file]\n"
+            "./ccn_dhcp.config is read by default if no config file is specified;\n"
+            "it may be a text config, or an image compiled from one with -c\n"
+            " -c compile the config file into a binary image, which can be\n"
+            "    published as it is, and exit\n"
+            " -d keep running, watching the config file and publishing a new\n"
+            "    version of the DHCP content whenever it changes, and answering\n"
+            "    requests for the changes between versions\n"
             , progname);
     exit(1);
 }
 
+/*
+ * A gateway resolved to numeric form, keyed by host and port
+ */
+struct dhcp_gateway {
+    int ok;
+    char address[INET6_ADDRSTRLEN];
+    char port[NI_MAXSERV];
+};
+
+/*
+ * Resolve a gateway host and port to a numeric address and port, just as
+ * clients would when they make the face, so that they need not.  Each
+ * distinct gateway is looked up only once per config.
+ * Returns the answer, or NULL if the gateway cannot be resolved.
+ */
+static struct dhcp_gateway *resolve_gateway(struct hashtb *gateways,
+        struct ccn_charbuf *key, const char *host, const char *port)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct dhcp_gateway *gw;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_flags = (AI_ADDRCONFIG),
+        .ai_socktype = SOCK_DGRAM};
+    struct addrinfo *raddrinfo = NULL;
+    int res;
+
+    key->length = 0;
+    ccn_charbuf_append(key, host, strlen(host) + 1);
+    ccn_charbuf_append(key, port, strlen(port) + 1);
+    hashtb_start(gateways, e);
+    res = hashtb_seek(e, key->buf, key->length, 0);
+    gw = e->data;
+    hashtb_end(e);
+    if (res == HT_NEW_ENTRY) {
+        res = getaddrinfo(host, port, &hints, &raddrinfo);
+        if (res == 0 && raddrinfo != NULL) {
+            res = getnameinfo(raddrinfo->ai_addr, raddrinfo->ai_addrlen,
+                    gw->address, sizeof(gw->address),
+                    gw->port, sizeof(gw->port),
+                    NI_NUMERICHOST | NI_NUMERICSERV);
+            gw->ok = (res == 0);
+        }
+        if (raddrinfo != NULL)
+            freeaddrinfo(raddrinfo);
+        if (!gw->ok)
+            fprintf(stderr, "Cannot resolve %s:%s, leaving it to the clients\n",
+                    host, port);
+    }
+
+    return gw->ok ? gw : NULL;
+}
+
+/*
+ * Read a text config file, linking its entries after tail.
+ * Gateways are resolved to numeric addresses as they are read.
+ * Returns the number of entries, or -1 if the file cannot be opened or
+ * holds a bad URI (entries already linked are left for the caller to free).
+ */
 int read_config_file(const char *filename, struct ccn_dhcp_entry *tail)
 {
+    struct hashtb *gateways = hashtb_create(sizeof(struct dhcp_gateway), NULL);
+    struct ccn_charbuf *key = ccn_charbuf_create();
+    struct dhcp_gateway *gw;
     char *uri;
     char *host;
     char *port;
+    char *lifetime;
     FILE *cfg;
     char buf[1024];
     int len;
@@ -45,7 +173,8 @@ int read_config_file(const char *filename, struct ccn_dhcp_entry *tail)
     cfg = fopen(filename, "r");
     if (cfg == NULL) {
         fprintf(stderr, "Error opening file %s: %s\n", filename, strerror(errno));
-        exit(1);
+        count = -1;
+        goto done;
     }
 
     while (fgets((char *)buf, sizeof(buf), cfg)) {
@@ -64,81 +193,942 @@ int read_config_file(const char *filename, struct ccn_dhcp_entry *tail)
         if (uri == NULL)    /* blank line */
             continue;
 
+        host = strtok_r(NULL, seps, &last);
+        port = strtok_r(NULL, seps, &last);
+        lifetime = strtok_r(NULL, seps, &last);
+        if (host == NULL || port == NULL) {
+            fprintf(stderr, "Missing gateway for %s\n", uri);
+            continue;
+        }
+        gw = resolve_gateway(gateways, key, host, port);
+        if (gw != NULL) {
+            host = gw->address;
+            port = gw->port;
+        }
+        if (strlen(host) >= sizeof(de->address) || strlen(port) >= sizeof(de->port)) {
+            fprintf(stderr, "Gateway too long for %s: %s:%s\n", uri, host, port);
+            continue;
+        }
+
         de->next = calloc(1, sizeof(*de));
         de = de->next;
         memset(de, 0, sizeof(*de));
         de->next = NULL;
         de->store = NULL;
-
-        host = strtok_r(NULL, seps, &last);
-        port = strtok_r(NULL, seps, &last);
+        de->faceid = -1;
 
         de->name_prefix = ccn_charbuf_create();
         res = ccn_name_from_uri(de->name_prefix, uri);
         if (res < 0) {
             fprintf(stderr, "Bad URI format: %s\n", uri);
-            exit(1);
+            count = -1;
+            break;
         }
 
         memcpy((void *)de->address, host, strlen(host));
         memcpy((void *)de->port, port, strlen(port));
 
+        de->lifetime = CCN_DHCP_LEASE;
+        if (lifetime != NULL) {
+            de->lifetime = atoi(lifetime);
+            if (de->lifetime <= 0 || de->lifetime > CCN_DHCP_LEASE_MAX) {
+                fprintf(stderr, "Bad lease lifetime for %s: %s, using %d\n",
+                        uri, lifetime, CCN_DHCP_LEASE);
+                de->lifetime = CCN_DHCP_LEASE;
+            }
+        }
+
         count ++;
     }
 
     fclose(cfg);
+done:
+    hashtb_destroy(&gateways);
+    ccn_charbuf_destroy(&key);
 
     return count;
 }
 
 /*
- * Publish DHCP content
+ * Get the encoded DHCPContent of a version, wherever it is
  */
-int put_dhcp_content(struct ccn *h, const char *config_file)
+static const unsigned char *dhcp_version_body(struct dhcp_version *v, size_t *sizep)
+{
+    if (v->image != NULL) {
+        *sizep = v->image_size;
+        return v->image;
+    }
+    *sizep = v->body->length;
+    return v->body->buf;
+}
+
+/*
+ * Let go of the body of a version, unmapping it if it is an image
+ */
+static void dhcp_version_drop_body(struct dhcp_version *v)
+{
+    ccn_charbuf_destroy(&v->body);
+    if (v->image != NULL)
+        munmap(v->image, v->image_size);
+    v->image = NULL;
+    v->image_size = 0;
+}
+
+/*
+ * Free what a version holds
+ */
+static void dhcp_version_clear(struct dhcp_version *v)
+{
+    int i;
+
+    for (i = 0; i < CCN_DHCP_HISTORY; i++)
+        ccn_charbuf_destroy(&v->deltas[i]);
+    ccn_charbuf_destroy(&v->version);
+    ccn_dhcp_content_destroy(v->head.next);
+    ccn_charbuf_destroy(&v->name);
+    dhcp_version_drop_body(v);
+    ccn_charbuf_destroy(&v->cobs);
+    ccn_indexbuf_destroy(&v->cob_ends);
+    free(v->pcos);
+    memset(v, 0, sizeof(*v));
+}
+
+/*
+ * Start a new version of the DHCP content from its encoded body
+ */
+static int dhcp_version_start(struct ccn *h, struct dhcp_version *v)
+{
+    int res;
+
+    v->name = ccn_charbuf_create();
+    v->version = ccn_charbuf_create();
+    v->cobs = ccn_charbuf_create();
+    v->cob_ends = ccn_indexbuf_create();
+    ccn_name_from_uri(v->name, CCN_DHCP_CONTENT_URI);
+    res = ccn_create_version(h, v->name, CCN_V_NOW, 0, 0);
+    if (res >= 0)
+        res = ccn_dhcp_version(v->name, v->version);
+    if (res < 0)
+        fprintf(stderr, "Cannot make a new version of the DHCP content.\n");
+
+    return res;
+}
+
+/*
+ * Sign up to n more segments of a version, of CCN_DHCP_SEGMENT_SIZE bytes
+ * of its body each; the last carries the FinalBlockID.
+ * Returns 1 when all are signed, 0 if there are more, or -1.
+ */
+static int dhcp_version_sign(struct ccn_signing_context *sc,
+        struct dhcp_version *v, int n)
 {
     struct ccn_charbuf *name = ccn_charbuf_create();
-    struct ccn_charbuf *resultbuf = ccn_charbuf_create();
-    struct ccn_signing_params sp = CCN_SIGNING_PARAMS_INIT;
+    struct ccn_parsed_ContentObject *pcos;
+    const unsigned char *body;
+    size_t size;
+    size_t offset;
+    size_t start;
+    size_t chunk;
+    int res = 0;
+
+    body = dhcp_version_body(v, &size);
+    for (; n > 0; n--) {
+        offset = v->cob_ends->n * (size_t)CCN_DHCP_SEGMENT_SIZE;
+        if (offset >= size)
+            break;
+        chunk = size - offset;
+        if (chunk > CCN_DHCP_SEGMENT_SIZE)
+            chunk = CCN_DHCP_SEGMENT_SIZE;
+        name->length = 0;
+        ccn_charbuf_append_charbuf(name, v->name);
+        ccn_name_append_numeric(name, CCN_MARKER_SEQNUM, v->cob_ends->n);
+        start = v->cobs->length;
+        res = ccn_signing_context_sign(sc, v->cobs, name,
+                (offset + chunk == size) ? CCN_SP_FINAL_BLOCK : 0,
+                body + offset, chunk);
+        if (res < 0)
+            break;
+        /* kept so that interests can be matched without parsing again */
+        pcos = realloc(v->pcos, (v->cob_ends->n + 1) * sizeof(*pcos));
+        if (pcos == NULL) {
+            res = -1;
+            break;
+        }
+        v->pcos = pcos;
+        res = ccn_parse_ContentObject(v->cobs->buf + start,
+                v->cobs->length - start, &pcos[v->cob_ends->n], NULL);
+        if (res < 0)
+            break;
+        ccn_indexbuf_append_element(v->cob_ends, v->cobs->length);
+    }
+    ccn_charbuf_destroy(&name);
+    if (res < 0) {
+        fprintf(stderr, "Failed to sign DHCP content.\n");
+        return -1;
+    }
+
+    return (v->cob_ends->n * (size_t)CCN_DHCP_SEGMENT_SIZE >= size);
+}
+
+/*
+ * Get segment i of a version, and its parse if pco is not NULL
+ */
+static int dhcp_version_segment(struct dhcp_version *v, size_t i,
+        const unsigned char **cob, size_t *size,
+        struct ccn_parsed_ContentObject **pco)
+{
+    size_t start;
+
+    if (v->cob_ends == NULL || i >= v->cob_ends->n)
+        return -1;
+    start = (i == 0) ? 0 : v->cob_ends->buf[i - 1];
+    *cob = v->cobs->buf + start;
+    *size = v->cob_ends->buf[i] - start;
+    if (pco != NULL)
+        *pco = &v->pcos[i];
+
+    return 0;
+}
+
+/*
+ * Push all the signed segments of a version to the local ccnd at once
+ */
+static int dhcp_version_put(struct ccn *h, struct dhcp_version *v)
+{
+    struct ccn_charbuf *uri = ccn_charbuf_create();
+    const unsigned char *cob;
+    size_t size;
+    size_t i;
+    int res = 0;
+
+    for (i = 0; res >= 0 && dhcp_version_segment(v, i, &cob, &size, NULL) == 0; i++)
+        res = ccn_put(h, cob, size);
+    if (res < 0)
+        fprintf(stderr, "Failed to write DHCP content.\n");
+    else {
+        ccn_uri_append(uri, v->name->buf, v->name->length, 1);
+        fprintf(stderr, "Published %s (%d entries, %d segments)\n",
+                ccn_charbuf_as_string(uri), v->count, (int)v->cob_ends->n);
+    }
+    ccn_charbuf_destroy(&uri);
+
+    return res;
+}
+
+/*
+ * Map a config file into memory if it is an image compiled with -c,
+ * which is the encoded DHCPContent, ready to publish.  The mapping is the
+ * body of a version for as long as that is current, so an image must be
+ * replaced by renaming a new file over it, as -c does, and not rewritten
+ * in place.  Returns 1 with the image in *imagep, 0 if the file is a text
+ * config, or -1 if it is an image that is not whole.
+ */
+static int map_dhcp_image(const char *filename, unsigned char **imagep,
+        size_t *sizep, int *countp)
+{
+    struct ccn_charbuf *opener = ccn_charbuf_create();
+    struct ccn_skeleton_decoder sd = {0};
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d;
+    unsigned char *image = NULL;
+    struct stat st;
+    ssize_t res;
+    int fd;
+
+    ccn_charbuf_append_tt(opener, CCN_DTAG_DHCPContent, CCN_DTAG);
+    fd = open(filename, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > (off_t)opener->length) {
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (image == MAP_FAILED)
+            image = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (image != NULL && memcmp(image, opener->buf, opener->length) != 0) {
+        munmap(image, st.st_size);
+        image = NULL;
+    }
+    ccn_charbuf_destroy(&opener);
+    if (image == NULL)
+        return 0;
+
+    /*
+     * Only the Count is looked at, not the entries, but a truncated or
+     * torn image must not be signed and served, so check that it is
+     * exactly one complete element.
+     */
+    d = ccn_buf_decoder_start(&decoder, image, st.st_size);
+    ccn_buf_advance(d);
+    *countp = ccn_parse_optional_tagged_nonNegativeInteger(d, CCN_DTAG_Count);
+    res = ccn_skeleton_decode(&sd, image, st.st_size);
+    if (*countp < 0 || d->decoder.state < 0 ||
+        sd.state != 0 || sd.nest != 0 || res != st.st_size) {
+        fprintf(stderr, "%s is not a whole DHCP image\n", filename);
+        munmap(image, st.st_size);
+        return -1;
+    }
+    *imagep = image;
+    *sizep = st.st_size;
+
+    return 1;
+}
+
+/*
+ * Read a text config file and encode it as DHCPContent, appended to body.
+ * Returns the number of entries, or -1.
+ */
+static int encode_dhcp_config(const char *filename, struct ccn_charbuf *body)
+{
+    struct ccn_dhcp_entry head = {0};
+    int count;
+
+    count = read_config_file(filename, &head);
+    if (count >= 0 && ccnb_append_dhcp_content(body, count, head.next) < 0)
+        count = -1;
+    ccn_dhcp_content_destroy(head.next);
+
+    return count;
+}
+
+/*
+ * Load a config file, text or image, into the body of a version; its
+ * entries are not needed for publishing, so they are not kept.
+ * Returns the number of entries.
+ */
+static int load_dhcp_config(const char *filename, struct dhcp_version *v)
+{
+    unsigned char *image = NULL;
+    size_t size = 0;
+    int res;
+
+    res = map_dhcp_image(filename, &image, &size, &v->count);
+    if (res > 0) {
+        /* the segments are signed straight from the mapping */
+        v->image = image;
+        v->image_size = size;
+    }
+    else if (res == 0) {
+        v->body = ccn_charbuf_create();
+        v->count = encode_dhcp_config(filename, v->body);
+        res = v->count;
+    }
+    if (res < 0) {
+        fprintf(stderr, "Error loading %s\n", filename);
+        return -1;
+    }
+
+    return v->count;
+}
+
+/*
+ * Compile a text config file into an image that can be published as it is
+ */
+static int compile_dhcp_image(const char *config_file, const char *image_file)
+{
     struct ccn_charbuf *body = ccn_charbuf_create();
-    struct ccn_dhcp_entry de_storage = {0};
-    struct ccn_dhcp_entry *de = &de_storage;
-    int entry_count;
+    struct ccn_charbuf *temp = ccn_charbuf_create();
+    FILE *out = NULL;
+    int count;
     int res;
 
-    ccn_name_from_uri(name, CCN_DHCP_CONTENT_URI);
-    sp.type = CCN_CONTENT_DATA;
+    count = encode_dhcp_config(config_file, body);
+    if (count < 0) {
+        ccn_charbuf_destroy(&body);
+        ccn_charbuf_destroy(&temp);
+        return -1;
+    }
+    res = 0;
+
+    /* write it beside the image and rename, so a running server sees it whole */
+    ccn_charbuf_putf(temp, "%s.tmp", image_file);
+    if (res >= 0) {
+        out = fopen(ccn_charbuf_as_string(temp), "w");
+        if (out == NULL ||
+            fwrite(body->buf, 1, body->length, out) != body->length)
+            res = -1;
+        if (out != NULL && fclose(out) != 0)
+            res = -1;
+    }
+    if (res >= 0)
+        res = rename(ccn_charbuf_as_string(temp), image_file);
+    if (res < 0)
+        fprintf(stderr, "Error writing %s: %s\n", image_file, strerror(errno));
+    else
+        fprintf(stderr, "Compiled %d entries into %s (%lu bytes)\n",
+                count, image_file, (unsigned long)body->length);
+
+    ccn_charbuf_destroy(&body);
+    ccn_charbuf_destroy(&temp);
 
-    entry_count = read_config_file(config_file, de);
+    return res;
+}
+
+/*
+ * Publish DHCP content
+ */
+int put_dhcp_content(struct ccn *h, const char *config_file)
+{
+    struct dhcp_version v = {0};
+    struct ccn_signing_context *sc = NULL;
+    int res;
 
-    res = ccnb_append_dhcp_content(body, entry_count, de->next);
+    res = load_dhcp_config(config_file, &v);
+    if (res >= 0)
+        res = dhcp_version_start(h, &v);
+    if (res >= 0) {
+        sc = ccn_signing_context_create(h, NULL);
+        res = (sc == NULL) ? -1 : dhcp_version_sign(sc, &v, INT_MAX);
+    }
+    if (res >= 0)
+        res = dhcp_version_put(h, &v);
+
+    /* let the segments drain to ccnd before we go */
+    while (res >= 0 && ccn_output_is_pending(h))
+        res = ccn_run(h, 100);
+
+    ccn_signing_context_destroy(&sc);
+    dhcp_version_clear(&v);
+
+    return (res < 0) ? -1 : 0;
+}
+
+/*
+ * Start to watch the config file for changes.  The directory is watched
+ * rather than the file, so that a new file renamed over it (as ccndhcpserver
+ * -c and many editors do) is noticed too.  Without inotify, the
+ * modification time of the file is checked every second instead.
+ */
+static void watch_config_file(struct dhcp_server *server)
+{
+    char *dir = strdup(server->config_file);
+    char *name = strdup(server->config_file);
+
+    server->config_dir = strdup(dirname(dir));
+    server->config_name = strdup(basename(name));
+    free(dir);
+    free(name);
+    server->watch_fd = -1;
+#ifdef DHCP_HAVE_INOTIFY
+    server->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (server->watch_fd >= 0 &&
+        inotify_add_watch(server->watch_fd, server->config_dir,
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "Cannot watch %s: %s\n", server->config_dir, strerror(errno));
+        close(server->watch_fd);
+        server->watch_fd = -1;
+    }
+#endif
+}
+
+/*
+ * Note whether the config file has changed since it was last loaded
+ */
+static void check_config_file(struct dhcp_server *server)
+{
+    struct stat st;
+#ifdef DHCP_HAVE_INOTIFY
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t len;
+    ssize_t i;
+
+    if (server->watch_fd >= 0) {
+        while ((len = read(server->watch_fd, buf, sizeof(buf))) > 0) {
+            for (i = 0; i < len; i += sizeof(*event) + event->len) {
+                event = (const struct inotify_event *)(buf + i);
+                if (event->len > 0 && strcmp(event->name, server->config_name) == 0)
+                    server->changed = 1;
+            }
+        }
+        return;
+    }
+#endif
+    if (stat(server->config_file, &st) == 0 && st.st_mtime != server->config_mtime)
+        server->changed = 1;
+}
+
+/*
+ * Compile a text config in a child process, which writes the encoded
+ * DHCPContent to a pipe, so that reading the file and resolving its
+ * gateways hold up nothing.  Returns 0, or -1 if it cannot be started.
+ */
+static int start_dhcp_loader(struct dhcp_server *server)
+{
+    struct ccn_charbuf *body;
+    size_t done = 0;
+    ssize_t n;
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) < 0)
+        return -1;
+    pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        body = ccn_charbuf_create();
+        if (encode_dhcp_config(server->config_file, body) < 0)
+            _exit(1);
+        while (done < body->length) {
+            n = write(fds[1], body->buf + done, body->length - done);
+            if (n < 0 && errno != EINTR)
+                _exit(1);
+            if (n > 0)
+                done += n;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    server->loader = pid;
+    server->loader_fd = fds[0];
+
+    return 0;
+}
+
+/*
+ * Give up on loading the version being built
+ */
+static void stop_dhcp_loader(struct dhcp_server *server)
+{
+    if (server->loader_fd >= 0)
+        close(server->loader_fd);
+    server->loader_fd = -1;
+    if (server->loader > 0) {
+        kill(server->loader, SIGKILL);
+        waitpid(server->loader, NULL, 0);
+    }
+    server->loader = 0;
+    ccn_dhcp_parser_destroy(&server->dp);
+}
+
+/*
+ * Start building a new version from the config file, in place of any
+ * that was being built.  An image is mapped now; a text config is
+ * compiled by a loader process.  Either way its entries are parsed a
+ * piece at a time by build_dhcp_content.
+ */
+static int rebuild_dhcp_content(struct ccn *h, struct dhcp_server *server)
+{
+    struct dhcp_version *v = &server->next;
+    unsigned char *image = NULL;
+    size_t size = 0;
+    struct stat st;
+    int res;
+
+    server->changed = 0;
+    if (stat(server->config_file, &st) == 0)
+        server->config_mtime = st.st_mtime;
+    stop_dhcp_loader(server);
+    dhcp_version_clear(v);
+    server->building = 0;
+    res = map_dhcp_image(server->config_file, &image, &size, &v->count);
+    if (res > 0) {
+        v->image = image;
+        v->image_size = size;
+        server->fed = 0;
+    }
+    else if (res == 0) {
+        v->body = ccn_charbuf_create();
+        res = start_dhcp_loader(server);
+    }
+    if (res >= 0)
+        res = dhcp_version_start(h, v);
     if (res < 0) {
-        fprintf(stderr, "Error appending DHCP content.\n");
-        goto cleanup;
+        fprintf(stderr, "Error loading %s\n", server->config_file);
+        stop_dhcp_loader(server);
+        dhcp_version_clear(v);
+        return -1;
+    }
+    server->dp = ccn_dhcp_parser_create(&v->head);
+    server->building = 1;
+
+    return 0;
+}
+
+/*
+ * Take in some more of the body of the version being built, parsing its
+ * entries as they come: the next piece of a mapped image, or what the
+ * loader has written so far.
+ * Returns 1 when all of it is in, 0 if there is more, or -1 if it is bad.
+ */
+static int dhcp_load_step(struct dhcp_server *server)
+{
+    struct dhcp_version *v = &server->next;
+    size_t step = CCN_DHCP_SIGN_STEP * (size_t)CCN_DHCP_SEGMENT_SIZE;
+    unsigned char *p;
+    ssize_t n;
+    int status = 0;
+    int res = 0;
+
+    if (v->image != NULL) {
+        n = v->image_size - server->fed;
+        if ((size_t)n > step)
+            n = step;
+        res = ccn_dhcp_parser_feed(server->dp, v->image + server->fed, n);
+        server->fed += n;
+        if (res >= 0 && server->fed < v->image_size)
+            return 0;
     }
+    else {
+        p = ccn_charbuf_reserve(v->body, step);
+        n = read(server->loader_fd, p, step);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        if (n > 0) {
+            v->body->length += n;
+            return (ccn_dhcp_parser_feed(server->dp, p, n) < 0) ? -1 : 0;
+        }
+        /* the loader is done */
+        close(server->loader_fd);
+        server->loader_fd = -1;
+        if (waitpid(server->loader, &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            res = -1;
+        server->loader = 0;
+    }
+    if (res < 0 || server->dp->state != 2)
+        return -1;
+    v->count = server->dp->count;
+    ccn_dhcp_parser_destroy(&server->dp);
+
+    return 1;
+}
 
-    res = ccn_sign_content(h, resultbuf, name, &sp, body->buf, body->length);
+/*
+ * Load or sign some more of the version being built, and once it is
+ * complete, publish it and make it the current version in one step.
+ * Until then the previous version goes on being served, so there is
+ * always an answer.  Returns 1 if a new version was published, or -1
+ * if the new version had to be given up.
+ */
+static int build_dhcp_content(struct ccn *h, struct dhcp_server *server)
+{
+    struct dhcp_version *v;
+    int res;
+    int i;
+
+    if (server->dp != NULL) {
+        res = dhcp_load_step(server);
+        if (res >= 0)
+            return 0;
+        fprintf(stderr, "Error loading %s\n", server->config_file);
+        stop_dhcp_loader(server);
+        dhcp_version_clear(&server->next);
+        server->building = 0;
+        return -1;
+    }
+    res = dhcp_version_sign(server->sc, &server->next, CCN_DHCP_SIGN_STEP);
+    if (res == 0)
+        return 0;
+    server->building = 0;
+    if (res > 0)
+        res = dhcp_version_put(h, &server->next);
     if (res < 0) {
-        fprintf(stderr, "Failed to encode ContentObject.\n");
+        dhcp_version_clear(&server->next);
+        return -1;
+    }
+
+    /* the old current version keeps only what is needed for deltas */
+    v = &server->history[server->current];
+    ccn_charbuf_destroy(&v->name);
+    dhcp_version_drop_body(v);
+    ccn_charbuf_destroy(&v->cobs);
+    ccn_indexbuf_destroy(&v->cob_ends);
+    free(v->pcos);
+    v->pcos = NULL;
+
+    /* the oldest version goes, and so do the deltas from it */
+    server->current = (server->current + 1) % CCN_DHCP_HISTORY;
+    for (i = 0; i < CCN_DHCP_HISTORY; i++)
+        ccn_charbuf_destroy(&server->history[i].deltas[server->current]);
+    v = &server->history[server->current];
+    dhcp_version_clear(v);
+    memcpy(v, &server->next, sizeof(*v));
+    memset(&server->next, 0, sizeof(server->next));
+    server->published = 1;
+
+    return 1;
+}
+
+/*
+ * Find a published version by the value of its version component
+ */
+static struct dhcp_version *find_dhcp_version(struct dhcp_server *server,
+        const unsigned char *vers, size_t vers_size)
+{
+    struct dhcp_version *v;
+    int i;
+
+    for (i = 0; i < CCN_DHCP_HISTORY; i++) {
+        v = &server->history[i];
+        if (v->version != NULL && v->version->length == vers_size &&
+            vers_size > 0 && memcmp(v->version->buf, vers, vers_size) == 0)
+            return v;
+    }
+
+    return NULL;
+}
+
+/*
+ * Sign the answer to a delta interest for name: the entries removed and
+ * added between the two versions, or a NACK if the from version is not
+ * known (from is NULL) or the delta is too big
+ */
+static int dhcp_delta_sign(struct dhcp_server *server, struct dhcp_version *from,
+        struct dhcp_version *to, struct ccn_charbuf *name, struct ccn_charbuf *cob)
+{
+    struct ccn_signing_context *sc = server->nack_sc;
+    struct ccn_dhcp_entry removed = {0};
+    struct ccn_dhcp_entry added = {0};
+    struct ccn_charbuf *body = ccn_charbuf_create();
+    int res;
+
+    if (from != NULL) {
+        ccn_dhcp_content_diff(from->head.next, to->head.next, &removed, &added);
+        ccnb_append_dhcp_delta(body, removed.next, added.next);
+        if (body->length <= CCN_DHCP_DELTA_MAX)
+            sc = server->sc;
+        else
+            body->length = 0;
+        ccn_dhcp_content_destroy(removed.next);
+        ccn_dhcp_content_destroy(added.next);
+    }
+    res = ccn_signing_context_sign(sc, cob, name, 0, body->buf, body->length);
+    ccn_charbuf_destroy(&body);
+
+    return res;
+}
+
+/*
+ * Answer interests in ccnx:/local/dhcp/delta/<from>/<to> with the entries
+ * removed and added between the two versions.  If the from version is no
+ * longer known, or the delta is too big, the answer is a NACK, so the
+ * client knows to fetch the to version in full.  The answer between two
+ * versions in the history is kept with the to version, so it is worked
+ * out and signed only once however many clients ask.
+ */
+static enum ccn_upcall_res incoming_delta_interest(struct ccn_closure *selfp,
+        enum ccn_upcall_kind kind, struct ccn_upcall_info *info)
+{
+    struct dhcp_server *server = selfp->data;
+    struct dhcp_version *from = NULL;
+    struct dhcp_version *to = NULL;
+    struct ccn_charbuf *name = NULL;
+    struct ccn_charbuf *cob = NULL;
+    struct ccn_charbuf **cache = NULL;
+    const unsigned char *vers[2];
+    size_t vers_size[2];
+    int nbase;
+    int res;
+
+    switch (kind) {
+        case CCN_UPCALL_FINAL:
+            return CCN_UPCALL_RESULT_OK;
+        case CCN_UPCALL_INTEREST:
+            break;
+        default:
+            return CCN_UPCALL_RESULT_OK;
+    }
+
+    nbase = info->matched_comps;
+    if (info->interest_comps->n - 1 != nbase + 2)
+        return CCN_UPCALL_RESULT_OK;
+    res = ccn_name_comp_get(info->interest_ccnb, info->interest_comps,
+                            nbase, &vers[0], &vers_size[0]);
+    res |= ccn_name_comp_get(info->interest_ccnb, info->interest_comps,
+                             nbase + 1, &vers[1], &vers_size[1]);
+    if (res < 0)
+        return CCN_UPCALL_RESULT_OK;
+    to = find_dhcp_version(server, vers[1], vers_size[1]);
+    if (to == NULL)
+        return CCN_UPCALL_RESULT_OK;
+    from = find_dhcp_version(server, vers[0], vers_size[0]);
+    if (from != NULL)
+        cache = &to->deltas[from - server->history];
+
+    if (cache != NULL && *cache != NULL)
+        cob = *cache;
+    else {
+        name = ccn_charbuf_create();
+        ccn_name_init(name);
+        ccn_name_append_components(name, info->interest_ccnb,
+                                   info->interest_comps->buf[0],
+                                   info->interest_comps->buf[nbase + 2]);
+        cob = ccn_charbuf_create();
+        res = dhcp_delta_sign(server, from, to, name, cob);
+        ccn_charbuf_destroy(&name);
+        if (res < 0) {
+            ccn_charbuf_destroy(&cob);
+            return CCN_UPCALL_RESULT_OK;
+        }
+        /* one from a version that is gone is not kept, as there could be many */
+        if (cache != NULL)
+            *cache = cob;
+    }
+    res = ccn_put(info->h, cob->buf, cob->length);
+    if (res >= 0)
+        server->deltas++;
+    if (cache == NULL)
+        ccn_charbuf_destroy(&cob);
+
+    return (res >= 0) ? CCN_UPCALL_RESULT_INTEREST_CONSUMED : CCN_UPCALL_RESULT_OK;
+}
+
+/*
+ * Answer interests in the DHCP content from the segments of the current
+ * version, in case ccnd no longer has them in its content store
+ */
+static enum ccn_upcall_res incoming_content_interest(struct ccn_closure *selfp,
+        enum ccn_upcall_kind kind, struct ccn_upcall_info *info)
+{
+    struct dhcp_server *server = selfp->data;
+    struct dhcp_version *v = &server->history[server->current];
+    const unsigned char *comp = NULL;
+    size_t comp_size = 0;
+    struct ccn_parsed_ContentObject *pco = NULL;
+    const unsigned char *cob = NULL;
+    size_t size = 0;
+    size_t seg = 0;
+    size_t i;
+    int nbase;
+
+    if (kind != CCN_UPCALL_INTEREST || !server->published)
+        return CCN_UPCALL_RESULT_OK;
+
+    /* <version>/<segment> picks a segment; anything else may match the first */
+    nbase = info->matched_comps;
+    if (info->interest_comps->n - 1 >= nbase + 2 &&
+        ccn_name_comp_get(info->interest_ccnb, info->interest_comps, nbase,
+                          &comp, &comp_size) == 0 &&
+        comp_size == v->version->length &&
+        memcmp(comp, v->version->buf, comp_size) == 0 &&
+        ccn_name_comp_get(info->interest_ccnb, info->interest_comps, nbase + 1,
+                          &comp, &comp_size) == 0 &&
+        comp_size > 0 && comp[0] == CCN_MARKER_SEQNUM) {
+        for (i = 1; i < comp_size; i++)
+            seg = (seg << 8) | comp[i];
+    }
+    if (dhcp_version_segment(v, seg, &cob, &size, &pco) < 0)
+        return CCN_UPCALL_RESULT_OK;
+    if (!ccn_content_matches_interest(cob, size, 1, pco, info->interest_ccnb,
+                                      info->pi->offset[CCN_PI_E], info->pi))
+        return CCN_UPCALL_RESULT_OK;
+    if (ccn_put(info->h, cob, size) < 0)
+        return CCN_UPCALL_RESULT_OK;
+
+    return CCN_UPCALL_RESULT_INTEREST_CONSUMED;
+}
+
+/*
+ * Keep running, republishing the DHCP content as the config file changes,
+ * until an error occurs.  New versions are signed a few segments at a time
+ * between handling interests, so that the server never stops answering.
+ */
+static int serve_dhcp_content(struct ccn *h, const char *config_file)
+{
+    struct dhcp_server server_storage = {{0}};
+    struct dhcp_server *server = &server_storage;
+    struct ccn_signing_params sp = CCN_SIGNING_PARAMS_INIT;
+    struct ccn_charbuf *prefix = ccn_charbuf_create();
+    struct ccn_charbuf *content_prefix = ccn_charbuf_create();
+    struct pollfd fds[3];
+    int nfds;
+    int res;
+    int i;
+
+    server->config_file = config_file;
+    server->loader_fd = -1;
+    server->closure.p = &incoming_delta_interest;
+    server->closure.data = server;
+    server->content_closure.p = &incoming_content_interest;
+    server->content_closure.data = server;
+    watch_config_file(server);
+    server->sc = ccn_signing_context_create(h, NULL);
+    sp.type = CCN_CONTENT_NACK;
+    server->nack_sc = ccn_signing_context_create(h, &sp);
+    if (server->sc == NULL || server->nack_sc == NULL) {
+        res = -1;
         goto cleanup;
     }
 
-    res = ccn_put(h, resultbuf->buf, resultbuf->length);
+    /* the first version is published before anything else is done */
+    res = rebuild_dhcp_content(h, server);
+    while (res >= 0 && server->building) {
+        if (server->loader_fd >= 0) {
+            fds[0].fd = server->loader_fd;
+            fds[0].events = POLLIN;
+            poll(fds, 1, -1);
+        }
+        res = build_dhcp_content(h, server);
+    }
+    if (res < 0)
+        goto cleanup;
+
+    ccn_name_from_uri(prefix, CCN_DHCP_DELTA_URI);
+    ccn_name_from_uri(content_prefix, CCN_DHCP_CONTENT_URI);
+    res = ccn_set_interest_filter(h, prefix, &server->closure);
+    if (res >= 0)
+        res = ccn_set_interest_filter(h, content_prefix, &server->content_closure);
     if (res < 0) {
-        fprintf(stderr, "ccn_put failed.\n");
+        fprintf(stderr, "Cannot register DHCP prefixes.\n");
         goto cleanup;
     }
 
-    ccn_charbuf_destroy(&body);
-    ccn_charbuf_destroy(&name);
-    ccn_charbuf_destroy(&resultbuf);
-    ccn_dhcp_content_destroy(de->next);
+    for (;;) {
+        fds[0].fd = ccn_get_connection_fd(h);
+        fds[0].events = POLLIN;
+        if (ccn_output_is_pending(h))
+            fds[0].events |= POLLOUT;
+        nfds = 1;
+        if (server->watch_fd >= 0) {
+            fds[nfds].fd = server->watch_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        if (server->loader_fd >= 0) {
+            fds[nfds].fd = server->loader_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        /* keep polling while there is signing to do, but not for the loader */
+        res = poll(fds, nfds,
+                   (server->building && server->loader_fd < 0) ? 0 : 1000);
+        if (res < 0 && errno != EINTR)
+            break;
+        res = ccn_run(h, 0);
+        if (res < 0)
+            break;
+        check_config_file(server);
+        /* a config that cannot be loaded leaves the current version in place */
+        if (server->changed && rebuild_dhcp_content(h, server) < 0)
+            fprintf(stderr, "Still serving the previous version.\n");
+        if (server->building) {
+            i = build_dhcp_content(h, server);
+            if (i > 0)
+                fprintf(stderr, "(%lu deltas served so far)\n", server->deltas);
+            else if (i < 0)
+                fprintf(stderr, "Still serving the previous version.\n");
+        }
+    }
 
-    return 0;
 cleanup:
-    ccn_charbuf_destroy(&body);
-    ccn_charbuf_destroy(&name);
-    ccn_charbuf_destroy(&resultbuf);
-    ccn_dhcp_content_destroy(de->next);
+    ccn_set_interest_filter(h, prefix, NULL);
+    ccn_set_interest_filter(h, content_prefix, NULL);
+    ccn_charbuf_destroy(&prefix);
+    ccn_charbuf_destroy(&content_prefix);
+    ccn_signing_context_destroy(&server->sc);
+    ccn_signing_context_destroy(&server->nack_sc);
+    stop_dhcp_loader(server);
+    dhcp_version_clear(&server->next);
+    for (i = 0; i < CCN_DHCP_HISTORY; i++)
+        dhcp_version_clear(&server->history[i]);
+    if (server->watch_fd >= 0)
+        close(server->watch_fd);
+    free(server->config_dir);
+    free(server->config_name);
 
     return -1;
 }
@@ -148,9 +1138,17 @@ int main(int argc, char **argv)
     struct ccn *h = NULL;
     int res;
     const char *config_file = CCN_DHCP_CONFIG;
+    const char *image_file = NULL;
+    int daemon_mode = 0;
 
-    while ((res = getopt(argc, argv, "f:h")) != -1) {
+    while ((res = getopt(argc, argv, "c:df:h")) != -1) {
         switch (res) {
+            case 'c':
+                image_file = optarg;
+                break;
+            case 'd':
+                daemon_mode = 1;
+                break;
             case 'f':
                 config_file = optarg;
                 break;
@@ -160,6 +1158,9 @@ int main(int argc, char **argv)
         }
     }
 
+    if (image_file != NULL)
+        exit(compile_dhcp_image(config_file, image_file) < 0);
+
     h = ccn_create();
     res = ccn_connect(h, NULL);
     if (res < 0) {
@@ -173,7 +1174,10 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    res = put_dhcp_content(h, config_file);
+    if (daemon_mode)
+        res = serve_dhcp_content(h, config_file);
+    else
+        res = put_dhcp_content(h, config_file);
     if (res < 0) {
         ccn_perror(h, "Cannot publish DHCP content.");
         exit(1);
@@ -32,6 +32,8 @@ PROGRAMS = $(INSTALLED_PROGRAMS) \
     ccn_fetch_test \
     ccndhcpserver \
     ccndhcpclient \
+    ccndhcpbench \
+    ccnbulkbench \
     $(PCAP_PROGRAMS)
 
 EXPAT_PROGRAMS = ccn_xmltoccnb
@@ -44,7 +46,8 @@ CSRC =  ccn_ccnbtoxml.c ccn_splitccnb.c ccn_xmltoccnb.c ccnbasicconfig.c \
        ccndumpnames.c ccndumppcap.c ccnget.c ccnhexdumpdata.c \
        ccnls.c ccnnamelist.c ccnput.c ccnrm.c ccnsendchunks.c ccnseqwriter.c \
        ccn_fetch_test.c ccnslurp.c dataresponsetest.c \
-       ccndhcp.c ccndhcpserver.c ccndhcpclient.c
+       ccndhcp.c ccndhcpserver.c ccndhcpclient.c ccndhcpbench.c \
+       ccnbulkbench.c
 
 default all: $(PROGRAMS)
 # Don't try to build broken programs right now.
@@ -120,6 +123,9 @@ ccncatchunks: ccncatchunks.o
 ccncatchunks2: ccncatchunks2.o
 	$(CC) $(CFLAGS) -o $@ ccncatchunks2.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
 
+ccnbulkbench: ccnbulkbench.o
+	$(CC) $(CFLAGS) -o $@ ccnbulkbench.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+
 ccnbasicconfig: ccnbasicconfig.o
 	$(CC) $(CFLAGS) -o $@ ccnbasicconfig.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
 
@@ -168,6 +174,9 @@ ccndhcpserver: ccndhcp.o ccndhcpserver.o
 ccndhcpclient: ccndhcp.o ccndhcpclient.o
 	$(CC) $(CFLAGS) -o $@ ccndhcp.o ccndhcpclient.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
 
+ccndhcpbench: ccndhcp.o ccndhcpbench.o
+	$(CC) $(CFLAGS) -o $@ ccndhcp.o ccndhcpbench.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+
 clean:
 	rm -f *.o libccn.a libccn.1.$(SHEXT) $(PROGRAMS) depend
 	rm -rf *.dSYM $(DEBRIS) *% *~
@@ -245,3 +254,8 @@ dataresponsetest.o: dataresponsetest.c ../include/ccn/ccn.h \
 ccndhcp.o: ccndhcp.c ../include/ccn/ccn_dhcp.h
 ccndhcpserver.o: ccndhcpserver.c ../include/ccn/ccn_dhcp.h
 ccndhcpclient.o: ccndhcpclient.c ../include/ccn/ccn_dhcp.h
+ccndhcpbench.o: ccndhcpbench.c ../include/ccn/ccn_dhcp.h
+ccnbulkbench.o: ccnbulkbench.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/bulkdata.h \
+  ../include/ccn/fetch.h ../include/ccn/uri.h
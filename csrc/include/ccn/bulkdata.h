@@ -0,0 +1,95 @@
+/**
+ * @file ccn/bulkdata.h
+ * @brief Reception of bulk data, delivered in sequence.
+ *
+ * Part of the CCNx C Library.
+ *
+ * Copyright (C) 2008-2011 Palo Alto Research Center, Inc.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CCN_BULKDATA_DEFINED
+#define CCN_BULKDATA_DEFINED
+
+#include <stdint.h>
+#include <ccn/ccn.h>
+
+/**
+ * The client provides a ccn_seqfunc * (and perhaps a matching param)
+ * to specify the scheme for naming the content items in the sequence.
+ * Given the sequence number x, it should place in resultbuf the
+ * corresponding blob that that will be used in the final explicit
+ * Component of the Name of item x in the sequence.  This should
+ * act as a mathematical function, returning the same answer for a given x.
+ * (Usually param will be NULL, but is provided in case it is needed.)
+ */
+typedef void ccn_seqfunc(uintmax_t x, void *param,
+                         struct ccn_charbuf *resultbuf);
+
+/*
+ * Ready-to-use sequencing functions
+ */
+extern ccn_seqfunc ccn_decimal_seqfunc;     /* as from ccnsendchunks */
+extern ccn_seqfunc ccn_binary_seqfunc;      /* segment numbers, as from ccn_seqwriter */
+
+struct ccn_bulkdata;
+
+/**
+ * Start receiving the items named by name_prefix plus a sequence component.
+ *
+ * Interests are kept outstanding for up to window items past the
+ * first undelivered one.  Items are handed to the client closure in
+ * sequence, starting from 0, with the upcall kind and info of their
+ * arrival (CCN_UPCALL_CONTENT, CCN_UPCALL_CONTENT_UNVERIFIED or
+ * CCN_UPCALL_CONTENT_BAD); the client's answer is ignored.
+ * No more is asked for once the item carrying a matching FinalBlockID
+ * has been delivered.  The client closure gets CCN_UPCALL_FINAL when
+ * the reception is stopped, or earlier if it fails because an item
+ * can no longer be had.
+ *
+ * @param h is the ccn handle
+ * @param name_prefix is the ccnb-encoded Name shared by the items
+ * @param seqfunc names the items (NULL for ccn_binary_seqfunc)
+ * @param seqfunc_param is passed to seqfunc
+ * @param window is the number of items to keep asked for (0 for a default)
+ * @param client is the closure for delivery
+ * @returns the new reception, or NULL for an error
+ */
+struct ccn_bulkdata *ccn_bulkdata_start(struct ccn *h,
+                                        const struct ccn_charbuf *name_prefix,
+                                        ccn_seqfunc *seqfunc,
+                                        void *seqfunc_param,
+                                        int window,
+                                        struct ccn_closure *client);
+
+/**
+ * @returns the number of items delivered so far.
+ */
+uintmax_t ccn_bulkdata_delivered(struct ccn_bulkdata *b);
+
+/**
+ * @returns 1 once the final item has been delivered, -1 if the
+ *          reception has failed short of it, otherwise 0.
+ *          A failed reception must still be stopped.
+ */
+int ccn_bulkdata_finished(struct ccn_bulkdata *b);
+
+/**
+ * Stop a reception, discarding anything not yet delivered.
+ *
+ * This may be called from within the client's upcall.
+ * *bp is set to NULL.
+ */
+void ccn_bulkdata_stop(struct ccn_bulkdata **bp);
+
+#endif
@@ -145,6 +145,8 @@ struct ccn *ccn_create(void);
 /*
  * ccn_connect: connect to local ccnd
  * Use NULL for name to get the default.
+ * If CCN_LOCAL_SHM is set in the environment (to other than 0),
+ * traffic is carried in memory shared with ccnd, if it can be.
  * Normal return value is the fd for the connection.
  * On error, returns -1.
  */ 
@@ -155,6 +157,8 @@ int ccn_connect(struct ccn *h, const char *name);
  * This is in case the client needs to know the associated
  * file descriptor, e.g. for use in select/poll.
  * The client should not use this fd for actual I/O.
+ * With shared memory this is not the socket, but is still the
+ * thing to poll for input.
  * Normal return value is the fd for the connection.
  * Returns -1 if the handle is not connected.
  */ 
@@ -288,12 +292,24 @@ enum ccn_content_type {
  * The default is to unregister the handler.  The common use will be for
  * the upcall to register again with an interest modified to prevent matching
  * the same interest again.
+ * If an identical interest from this handle is already in flight, the new
+ * one is not sent; it waits for the same answer (or timeout) instead.
  */
 int ccn_express_interest(struct ccn *h,
                          struct ccn_charbuf *namebuf,
                          struct ccn_closure *action,
                          struct ccn_charbuf *interest_template);
 
+/*
+ * ccn_get_interest_counts: how many interests this handle has sent,
+ * and how many more were saved by waiting on an identical one in flight.
+ */
+struct ccn_interest_counts {
+    uintmax_t sent;
+    uintmax_t aggregated;
+};
+void ccn_get_interest_counts(struct ccn *h, struct ccn_interest_counts *counts);
+
 /***********************************
  * ccn_set_interest_filter: 
  * The action, if provided, will be called when an interest arrives that
@@ -323,6 +339,8 @@ int ccn_set_interest_filter_with_flags(struct ccn *h,
  * this should be a ContentObject sent in response to an Interest,
  * but ccn_put does not check for that.
  * Returns -1 for error, 0 if sent completely, 1 if queued.
+ * If the output queue is full (see ccn_set_output_limit) the message
+ * is not taken, and the error is EAGAIN.
  */
 int ccn_put(struct ccn *h, const void *p, size_t length);
 
@@ -333,6 +351,23 @@ int ccn_put(struct ccn *h, const void *p, size_t length);
  */
 int ccn_output_is_pending(struct ccn *h);
 
+/*
+ * ccn_set_output_cork: gather output into fewer, larger writes
+ * While corked, ccn_put just queues; the queue is written at the end
+ * of each ccn_run slice, or once it holds flush_size bytes.
+ * A flush_size of 0 (the default) uncorks.  Returns old value.
+ */
+size_t ccn_set_output_cork(struct ccn *h, size_t flush_size);
+
+/*
+ * ccn_set_output_limit: bound the output queue
+ * Once anything is queued, ccn_put refuses a message that would take
+ * the queue past limit bytes (EAGAIN), so a fast producer can wait in
+ * ccn_run for it to drain.  A limit of 0 (the default) means no bound.
+ * Returns old value.
+ */
+size_t ccn_set_output_limit(struct ccn *h, size_t limit);
+
 /*
  * ccn_run: process incoming
  * This may serve as the main event loop for simple apps by passing 
@@ -341,6 +376,49 @@ int ccn_output_is_pending(struct ccn *h);
  */
 int ccn_run(struct ccn *h, int timeout);
 
+/*
+ * ccn_get_wait_info: what a handle needs, for client-managed event loops
+ * This does the work ccn_run does before it waits: anything scheduled
+ * that is due (which may make upcalls), and sending corked output.
+ * fds (room for CCN_WAIT_MAX_FDS) are set to the descriptors to poll
+ * and the events wanted on each, and *timeoutp to the milliseconds
+ * until the handle must be looked at again even if nothing is ready.
+ * Returns the number of fds set up, or -1 if not connected.
+ */
+#define CCN_WAIT_MAX_FDS 2
+struct pollfd;
+int ccn_get_wait_info(struct ccn *h, struct pollfd *fds, int *timeoutp);
+
+/*
+ * ccn_process_ready: do the I/O that a wait turned up
+ * The fds are those from ccn_get_wait_info, with revents filled in.
+ * Incoming messages are dispatched to their upcalls.
+ * Returns 0, or -1 if the handle is no longer connected.
+ */
+int ccn_process_ready(struct ccn *h, struct pollfd *fds, int nfds);
+
+/*
+ * ccn_multi: a set of handles that are run together
+ * This is for services that talk to several ccnds.  ccn_run_multi
+ * runs each handle in the set as ccn_run would, with one wait (using
+ * epoll where available) covering all of them.  The set does not own
+ * its handles, and may not be changed while it is running.
+ * ccn_multi_add and ccn_multi_remove return -1 with errno set on error.
+ */
+struct ccn_multi;
+struct ccn_multi *ccn_multi_create(void);
+void ccn_multi_destroy(struct ccn_multi **mp);
+int ccn_multi_add(struct ccn_multi *m, struct ccn *h);
+int ccn_multi_remove(struct ccn_multi *m, struct ccn *h);
+
+/*
+ * ccn_run_multi: process incoming for a set of handles
+ * The timeout is in milliseconds; -1 runs until none of the handles
+ * is connected.  An upcall may use ccn_set_run_timeout on its own
+ * handle to end the run.
+ */
+int ccn_run_multi(struct ccn_multi *m, int timeout);
+
 /*
  * ccn_set_run_timeout: modify ccn_run timeout
  * This may be called from an upcall to change the timeout value.
@@ -724,6 +802,24 @@ int ccn_sign_content(struct ccn *h,
                      const struct ccn_signing_params *params,
                      const void *data, size_t size);
 
+/*
+ * Reusable signing context, for producers that sign many objects
+ * with the same parameters.  See ccn_signing_context_create().
+ */
+struct ccn_signing_context;
+
+struct ccn_signing_context *
+ccn_signing_context_create(struct ccn *h,
+                           const struct ccn_signing_params *params);
+
+int ccn_signing_context_sign(struct ccn_signing_context *sc,
+                             struct ccn_charbuf *resultbuf,
+                             const struct ccn_charbuf *name_prefix,
+                             int sp_flags,
+                             const void *data, size_t size);
+
+void ccn_signing_context_destroy(struct ccn_signing_context **scp);
+
 int ccn_load_private_key(struct ccn *h,
                          const char *keystore_path,
                          const char *keystore_passphrase,
@@ -4,26 +4,100 @@
 
 #define CCN_DHCP_URI "ccnx:/local/dhcp"
 #define CCN_DHCP_CONTENT_URI "ccnx:/local/dhcp/content"
+#define CCN_DHCP_DELTA_URI "ccnx:/local/dhcp/delta"
 #define CCN_DHCP_CONFIG "ccn_dhcp.config"
 #define CCN_DHCP_ADDR "224.0.0.66"
 #define CCN_DHCP_PORT "60006"
 #define CCN_DHCP_LIFETIME ((~0U) >> 1)
+#define CCN_DHCP_LEASE 300     /* default seconds an entry's prefix stays registered */
+#define CCN_DHCP_LEASE_MAX 3600 /* ccnd cuts longer forwarding lifetimes short */
+#define CCN_DHCP_FACE_MARGIN 60 /* seconds a gateway face's lease outlasts its entries' */
 #define CCN_DHCP_MCASTTTL (-1)
+#define CCN_DHCP_WINDOW 16     /* default newface/prefixreg requests in flight */
+#define CCN_DHCP_BATCH 100     /* default newface/prefixreg pairs per bulkreg request */
+#define CCN_DHCP_SEGMENT_SIZE 1024 /* bytes of DHCP content per segment */
+#define CCN_DHCP_PIPELINE 8    /* segments of DHCP content requested ahead */
+#define CCN_DHCP_HISTORY 8     /* versions ccndhcpserver -d keeps for deltas */
+#define CCN_DHCP_SIGN_STEP 16  /* segments ccndhcpserver -d signs between polls */
+#define CCN_DHCP_DELTA_MAX 4096 /* bytes; bigger changes are fetched in full */
+#define CCN_DHCP_INTERVAL 10   /* seconds between version checks by ccndhcpclient -d */
 
 struct ccn_dhcp_entry {
     struct ccn_charbuf *name_prefix;
-    const char address[20];
+    const char address[INET6_ADDRSTRLEN];
     const char port[10];
     struct ccn_charbuf *store;
+    int lifetime;                       /* seconds the registration lasts */
+    int faceid;                         /* where the prefix is registered, or -1 */
+    time_t renew;                       /* when to register the entry again */
     struct ccn_dhcp_entry *next;
 };
 
+/*
+ * State for parsing DHCP content incrementally, as its segments arrive
+ */
+struct ccn_dhcp_parser {
+    struct ccn_charbuf *buf;            /* received bytes not yet parsed */
+    int state;                          /* 0 header, 1 entries, 2 done, <0 error */
+    int count;                          /* entries announced, or -1 */
+    int parsed;                         /* entries parsed so far */
+    struct ccn_dhcp_entry *tail;        /* parsed entries are linked after this */
+};
+
 int join_dhcp_group(struct ccn *h);
 
 int add_new_face(struct ccn *h, struct ccn_charbuf *prefix, const char *address, const char *port);
 
+int add_new_faces(struct ccn *h, struct ccn_dhcp_entry *head, int window);
+
+int add_new_faces_bulk(struct ccn *h, struct ccn_dhcp_entry *head, int batch);
+
+int renew_dhcp_leases(struct ccn *h, struct ccn_dhcp_entry *head,
+        int window, int batch, time_t *nextp);
+
+int remove_faces(struct ccn *h, struct ccn_dhcp_entry *head, int window);
+
+int fetch_dhcp_content(struct ccn *h, struct ccn_charbuf *name,
+        struct ccn_dhcp_entry *tail);
+
+int fetch_and_add_new_faces(struct ccn *h, struct ccn_charbuf *name,
+        struct ccn_dhcp_entry *tail, int window, int batch, int *countp);
+
+struct ccn_dhcp_session;
+
+struct ccn_dhcp_session *ccn_dhcp_session_start(struct ccn *h,
+        struct ccn_charbuf *name, struct ccn_dhcp_entry *tail, int window, int batch);
+
+int ccn_dhcp_session_step(struct ccn_dhcp_session *s);
+
+int ccn_dhcp_session_finish(struct ccn_dhcp_session **sp, int *countp, int *requestsp);
+
+int ccn_dhcp_version(const struct ccn_charbuf *name, struct ccn_charbuf *version);
+
+int get_dhcp_delta(struct ccn *h, struct ccn_charbuf *from, struct ccn_charbuf *to,
+        struct ccn_dhcp_entry *removed, struct ccn_dhcp_entry *added);
+
+struct ccn_dhcp_parser *ccn_dhcp_parser_create(struct ccn_dhcp_entry *tail);
+
+int ccn_dhcp_parser_feed(struct ccn_dhcp_parser *dp, const unsigned char *p, size_t size);
+
+void ccn_dhcp_parser_destroy(struct ccn_dhcp_parser **dpp);
+
 int ccn_dhcp_content_parse(const unsigned char *p, size_t size, struct ccn_dhcp_entry *tail);
 
 void ccn_dhcp_content_destroy(struct ccn_dhcp_entry *head);
 
 int ccnb_append_dhcp_content(struct ccn_charbuf *c, int count, const struct ccn_dhcp_entry *head);
+
+int ccn_dhcp_content_count(const struct ccn_dhcp_entry *head);
+
+int ccnb_append_dhcp_delta(struct ccn_charbuf *c,
+        const struct ccn_dhcp_entry *removed, const struct ccn_dhcp_entry *added);
+
+int ccn_dhcp_delta_parse(const unsigned char *p, size_t size,
+        struct ccn_dhcp_entry *removed, struct ccn_dhcp_entry *added);
+
+int ccn_dhcp_content_diff(struct ccn_dhcp_entry *from, struct ccn_dhcp_entry *to,
+        struct ccn_dhcp_entry *removed, struct ccn_dhcp_entry *added);
+
+int ccn_dhcp_content_take(struct ccn_dhcp_entry *head, struct ccn_dhcp_entry *removed);
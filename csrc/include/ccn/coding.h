@@ -151,6 +151,7 @@ enum ccn_dtag {
     CCN_DTAG_StatusCode = 113,
     CCN_DTAG_StatusText = 114,
     CCN_DTAG_DHCPContent = 115,
+    CCN_DTAG_DHCPDelta = 116,
     CCN_DTAG_SequenceNumber = 256,
     CCN_DTAG_CCNProtocolDataUnit = 17702112
 };
@@ -218,4 +219,9 @@ ssize_t ccn_skeleton_decode(struct ccn_skeleton_decoder *d,
                             const unsigned char *p,
                             size_t n);
 
+/* Same results as ccn_skeleton_decode, without the fast path (for testing) */
+ssize_t ccn_skeleton_decode_bytewise(struct ccn_skeleton_decoder *d,
+                                     const unsigned char *p,
+                                     size_t n);
+
 #endif
@@ -48,4 +48,26 @@ void ccn_digest_init(struct ccn_digest *);
 int ccn_digest_update(struct ccn_digest *, const void *, size_t);
 int ccn_digest_final(struct ccn_digest *, unsigned char *, size_t);
 
+/*
+ * Batched digests of independent buffers.
+ * Each result must have room for the full digest (32 bytes for SHA256).
+ */
+struct ccn_digest_job {
+    const void *data;
+    size_t size;
+    unsigned char *result;
+};
+
+/* How ccn_digest_many_with() should compute a batch */
+enum ccn_digest_engine {
+    CCN_DIGEST_ENGINE_AUTO,     /* pick the fastest available */
+    CCN_DIGEST_ENGINE_SCALAR,   /* one buffer at a time */
+    CCN_DIGEST_ENGINE_MULTIBUF  /* several buffers in parallel SIMD lanes */
+};
+
+/* return codes are negative for errors */
+int ccn_digest_many(enum ccn_digest_id, struct ccn_digest_job *, int n);
+int ccn_digest_many_with(enum ccn_digest_id, struct ccn_digest_job *, int n,
+                         enum ccn_digest_engine);
+
 #endif
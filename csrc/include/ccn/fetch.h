@@ -80,8 +80,9 @@ ccn_fetch_destroy(struct ccn_fetch *f);
  * ccn connection with a 0 timeout.
  *
  * NOTE: periodic calls to ccn_fetch_poll should be performed to update
- * the contents of the streams UNLESS the client is calling ccn_run for
- * the underlying ccn connection.
+ * the contents of the streams UNLESS the client is running the underlying
+ * ccn connection itself (with ccn_run, ccn_run_multi, or ccn_get_wait_info
+ * and ccn_process_ready).
  * @returns the count of streams that have pending data or have ended.
  */
 int
@@ -110,7 +111,10 @@ ccn_fetch_get_ccn(struct ccn_fetch *f);
  * and an attempt is made to determine the version number using the highest
  * version.  If interestTemplate == NULL then a suitable default is used.
  * The max number of buffers (maxBufs) is a hint, and may be clamped to an
- * implementation minimum or maximum.
+ * implementation minimum or maximum.  It limits the window of segments
+ * requested ahead, which starts at one and adapts to the path.
+ * Any InterestLifetime in the template is replaced by the stream's
+ * retransmission timeout.
  * If assumeFixed, then assume that the segment size is given by the first
  * segment fetched, otherwise segments may be of variable size. 
  * @returns NULL if the stream creation failed,
@@ -163,6 +167,31 @@ ccn_fetch_read(struct ccn_fetch_stream *fs,
 			   void *buf,
 			   intmax_t len);
 
+/**
+ * Reads bytes from a stream without copying them.
+ * Sets *bufp to point at most len bytes at the read position, all from a
+ * single segment held by the stream, so that the caller can write them
+ * straight to its sink.
+ * The bytes remain valid until they are given back with
+ * ccn_fetch_release_ref, or until the stream is closed; the segment is not
+ * reclaimed before then.
+ * Will not wait for bytes to arrive.
+ * Advances the read position on a successful read.
+ * @returns the same as ccn_fetch_read.
+ */
+intmax_t
+ccn_fetch_read_ref(struct ccn_fetch_stream *fs,
+				   const unsigned char **bufp,
+				   intmax_t len);
+
+/**
+ * Gives back bytes obtained from ccn_fetch_read_ref.
+ * buf must be the pointer set by that call.
+ */
+void
+ccn_fetch_release_ref(struct ccn_fetch_stream *fs,
+					  const unsigned char *buf);
+
 /**
  * Resets the timeout indicator, which will cause pending interests to be
  * retried.  The client determines conditions for a timeout to be considered
@@ -190,4 +219,31 @@ ccn_fetch_seek(struct ccn_fetch_stream *fs,
 intmax_t
 ccn_fetch_position(struct ccn_fetch_stream *fs);
 
+/**
+ * Statistics for a stream.
+ * The window is the number of segments the stream may have requested ahead
+ * of the read position; it adapts to the path, up to maxWindow (the number
+ * of buffers).  Lost segments are requested again after rtoUSecs, which is
+ * derived from the round trip time estimates.
+ */
+struct ccn_fetch_stats {
+	int window;				// congestion window, in segments
+	int ssthresh;			// slow start threshold, in segments
+	int maxWindow;			// the limit on the window
+	intmax_t srttUSecs;		// smoothed round trip time (< 0 if no sample yet)
+	intmax_t rttvarUSecs;	// round trip time variation
+	intmax_t rtoUSecs;		// retransmission timeout
+	intmax_t segsRequested;	// interests expressed, including retransmissions
+	intmax_t segsRead;		// segments received
+	intmax_t retransmits;	// interests expressed again after a timeout
+	intmax_t timeouts;		// segments given up on
+};
+
+/**
+ * Gets the congestion window, round trip time estimates and request counts
+ * of a stream.
+ */
+void
+ccn_fetch_get_stats(struct ccn_fetch_stream *fs, struct ccn_fetch_stats *stats);
+
 #endif
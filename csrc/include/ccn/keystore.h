@@ -42,6 +42,15 @@ struct ccn_pkey;
  */
 struct ccn_certificate;
 
+/*
+ * Kinds of signing keys that may be held in a keystore
+ */
+enum ccn_keytype {
+    CCN_KEYTYPE_UNKNOWN = 0,
+    CCN_KEYTYPE_RSA,            /* RSA PKCS#1 v1.5 */
+    CCN_KEYTYPE_EC              /* ECDSA, NIST P-256 */
+};
+
 struct ccn_keystore *ccn_keystore_create(void);
 void ccn_keystore_destroy(struct ccn_keystore **p);
 int ccn_keystore_init(struct ccn_keystore *p, char *name, char *password);
@@ -50,5 +59,9 @@ const struct ccn_pkey *ccn_keystore_public_key(struct ccn_keystore *p);
 ssize_t ccn_keystore_public_key_digest_length(struct ccn_keystore *p);
 const unsigned char *ccn_keystore_public_key_digest(struct ccn_keystore *p);
 const struct ccn_certificate *ccn_keystore_certificate(struct ccn_keystore *p);
+enum ccn_keytype ccn_keystore_key_type(struct ccn_keystore *p);
 int ccn_keystore_file_init(char *filename, char *password, char *subject, int keylength, int validity_days);
+int ccn_keystore_file_init_keytype(char *filename, char *password, char *subject,
+                                   enum ccn_keytype keytype, int keylength, int validity_days);
+enum ccn_keytype ccn_keytype_from_string(const char *s);
 #endif
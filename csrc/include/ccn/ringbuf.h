@@ -0,0 +1,94 @@
+/**
+ * @file ccn/ringbuf.h
+ * @brief A byte ring for receiving streams of messages.
+ *
+ * Bytes are appended at one end and consumed from the other, and the
+ * unconsumed bytes may always be used in place as one contiguous piece,
+ * so a partial message at the end of a read never has to be moved to
+ * make room for the next one.
+ *
+ * Where the platform allows, the storage is mapped twice in a row so the
+ * ring wraps around without a seam.  Otherwise a plain buffer is used,
+ * and the live bytes are slid down only when the free space at the end
+ * runs low.
+ *
+ * Part of the CCNx C Library.
+ *
+ * Copyright (C) 2011 Palo Alto Research Center, Inc.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CCN_RINGBUF_DEFINED
+#define CCN_RINGBUF_DEFINED
+
+#include <stddef.h>
+
+struct ccn_ringbuf;
+
+/**
+ * Create an empty ring.
+ * @param size is the minimum capacity in bytes; it is rounded up to
+ *        a power of 2 that is at least a page.
+ * @returns the new ring, or NULL with errno set.
+ */
+struct ccn_ringbuf *ccn_ringbuf_create(size_t size);
+
+/**
+ * Release the ring and its storage.
+ */
+void ccn_ringbuf_destroy(struct ccn_ringbuf **rbp);
+
+/**
+ * @returns the number of bytes the ring can hold.
+ */
+size_t ccn_ringbuf_capacity(struct ccn_ringbuf *rb);
+
+/**
+ * @returns the number of unconsumed bytes.
+ */
+size_t ccn_ringbuf_length(struct ccn_ringbuf *rb);
+
+/**
+ * @returns the start of the unconsumed bytes, which are contiguous.
+ */
+unsigned char *ccn_ringbuf_data(struct ccn_ringbuf *rb);
+
+/**
+ * Get the free space that follows the unconsumed bytes.
+ *
+ * The caller may fill some of this and then ccn_ringbuf_commit() it.
+ * @param sizep is set to the number of bytes available, which may
+ *        be 0 if the ring is full.
+ * @returns the start of the free space.
+ */
+unsigned char *ccn_ringbuf_space(struct ccn_ringbuf *rb, size_t *sizep);
+
+/**
+ * Append size bytes that have been placed in the free space.
+ */
+void ccn_ringbuf_commit(struct ccn_ringbuf *rb, size_t size);
+
+/**
+ * Discard size bytes from the front of the unconsumed bytes.
+ */
+void ccn_ringbuf_consume(struct ccn_ringbuf *rb, size_t size);
+
+/**
+ * Make the ring hold at least size bytes, keeping its contents.
+ *
+ * Pointers previously obtained from the ring are invalidated.
+ * @returns 0, or -1 with errno set (and the ring unchanged).
+ */
+int ccn_ringbuf_grow(struct ccn_ringbuf *rb, size_t size);
+
+#endif
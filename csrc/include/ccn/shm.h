@@ -0,0 +1,132 @@
+/**
+ * @file ccn/shm.h
+ * @brief Shared-memory transport between ccnd and its local clients.
+ *
+ * A local client may ask, over its freshly connected unix-domain socket,
+ * to move its traffic into shared memory.  ccnd answers by passing back
+ * a sealed memfd holding two rings (one per direction) and an eventfd
+ * doorbell for each side.  From then on ccnb messages are written
+ * straight into the rings, and the socket is kept only so that either
+ * side notices when the other goes away.
+ *
+ * Each ring is a byte stream, mapped twice in a row so that anything
+ * between the tail and the head may be used in place as one
+ * contiguous piece.  A doorbell is rung only when its owner has said
+ * it is about to sleep, so a busy pair exchanges no system calls at all.
+ *
+ * These are for the use of ccnd and the client library.
+ *
+ * Part of the CCNx C Library.
+ *
+ * Copyright (C) 2011 Palo Alto Research Center, Inc.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CCN_SHM_DEFINED
+#define CCN_SHM_DEFINED
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * What a client sends on a new connection to ask for shared memory.
+ * It is not the start of any ccnb message.
+ */
+#define CCN_SHM_HELLO "CCNxSHM1"
+#define CCN_SHM_HELLO_SIZE 8
+
+/** Default size of each ring, in bytes */
+#define CCN_SHM_RING_SIZE (1 << 20)
+
+struct ccn_shm;
+
+/**
+ * Set up the rings for a new client (ccnd side) and send them
+ * over the client's socket.
+ *
+ * @param sock is the connected unix-domain socket
+ * @param ringsize is the size of each ring (rounded up to a power of 2,
+ *        and at least a page)
+ * @returns the new rings, or NULL (with errno set) if they could not
+ *          be made or sent, in which case the client has been told
+ *          to carry on using the socket.
+ */
+struct ccn_shm *ccn_shm_offer(int sock, size_t ringsize);
+
+/**
+ * Ask ccnd for shared memory (client side).
+ *
+ * The socket should still be in blocking mode.
+ * @param sock is the connected unix-domain socket
+ * @param timeout_ms bounds the wait for the answer
+ * @returns the rings, or NULL with errno set.  ECONNREFUSED means that
+ *          shared memory is not to be had (ccnd declined, or this
+ *          platform lacks it) and the socket may be used as usual;
+ *          after any other error the state of the stream is unknown.
+ */
+struct ccn_shm *ccn_shm_request(int sock, int timeout_ms);
+
+/**
+ * Unmap the rings and close the doorbells.
+ */
+void ccn_shm_destroy(struct ccn_shm **sp);
+
+/**
+ * @returns the fd that becomes readable when our doorbell is rung.
+ */
+int ccn_shm_doorbell_fd(struct ccn_shm *s);
+
+/**
+ * @returns the number of bytes that fit in each ring.
+ */
+size_t ccn_shm_capacity(struct ccn_shm *s);
+
+/**
+ * Append bytes to the outbound ring.
+ *
+ * Like a nonblocking write, this may accept fewer bytes than offered.
+ * @returns the number of bytes taken.
+ */
+size_t ccn_shm_write(struct ccn_shm *s, const void *data, size_t size);
+
+/**
+ * Look at what is waiting in the inbound ring.
+ *
+ * @param bufp is set to the start of the unconsumed bytes, which
+ *        are contiguous and stay put until they are consumed.
+ * @returns the number of bytes available, or -1 if the peer has
+ *          left the ring in an impossible state.
+ */
+ssize_t ccn_shm_peek(struct ccn_shm *s, unsigned char **bufp);
+
+/**
+ * Release bytes at the front of the inbound ring to the peer.
+ */
+void ccn_shm_consume(struct ccn_shm *s, size_t size);
+
+/**
+ * Get ready to sleep waiting on our doorbell.
+ *
+ * This asks the peer to ring us when there is new input, and also when
+ * there is room for more output if want_space is nonzero.  If there is
+ * already something to do, the doorbell is rung right away.
+ * @returns 1 if there was already something to do, otherwise 0.
+ */
+int ccn_shm_prepare_wait(struct ccn_shm *s, int want_space);
+
+/**
+ * Quiet our doorbell after it has been rung.
+ */
+void ccn_shm_clear_doorbell(struct ccn_shm *s);
+
+#endif
@@ -1,10 +1,10 @@
 /**
  * @file ccn_bulkdata.c
- * @brief (INCOMPLETE)Support for transport of bulk data.
+ * @brief Support for transport of bulk data.
  * 
  * Part of the CCNx C Library.
  *
- * Copyright (C) 2008, 2009 Palo Alto Research Center, Inc.
+ * Copyright (C) 2008, 2009, 2011 Palo Alto Research Center, Inc.
  *
  * This library is free software; you can redistribute it and/or modify it
  * under the terms of the GNU Lesser General Public License version 2.1
@@ -22,32 +22,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <ccn/bloom.h>
 #include <ccn/ccn.h>
+#include <ccn/bulkdata.h>
 
-/************ Candidate API stuff - was in ccn/ccn.h for a while ******/
-/***********************************
- * Bulk data
- */
-
-/*
- * The client provides a ccn_seqfunc * (and perhaps a matching param)
- * to specify the scheme for naming the content items in the sequence.
- * Given the sequence number x, it should place in resultbuf the
- * corresponding blob that that will be used in the final explicit
- * Component of the Name of item x in the sequence.  This should
- * act as a mathematical function, returning the same answer for a given x.
- * (Ususally param will be NULL, but is provided in case it is needed.)
- */
-typedef void ccn_seqfunc(uintmax_t x, void *param,
-                         struct ccn_charbuf *resultbuf);
-
-/*
- * Ready-to-use sequencing functions
- */
-extern ccn_seqfunc ccn_decimal_seqfunc;
-extern ccn_seqfunc ccn_binary_seqfunc;
-/**********************************************************************/
+#define CCN_BULKDATA_DEFAULT_WINDOW 16
 
 /*
  * Encode the number in decimal ascii
@@ -63,6 +41,7 @@ ccn_decimal_seqfunc(uintmax_t x, void *param, struct ccn_charbuf *resultbuf)
 /*
  * Encode the number in big-endian binary, using one more than the
  * minimum number of bytes (that is, the first byte is always zero).
+ * This is the same as a CCN_MARKER_SEQNUM component.
  */
 void
 ccn_binary_seqfunc(uintmax_t x, void *param, struct ccn_charbuf *resultbuf)
@@ -71,7 +50,7 @@ ccn_binary_seqfunc(uintmax_t x, void *param, struct ccn_charbuf *resultbuf)
     int n;
     unsigned char *b;
     (void)param; /* unused */
-    for (n = 0, m = 0; x < m; n++)
+    for (n = 0, m = 0; x > m; n++)
         m = (m << 8) | 0xff;
     b = ccn_charbuf_reserve(resultbuf, n + 1);
     resultbuf->length = n + 1;
@@ -82,163 +61,357 @@ ccn_binary_seqfunc(uintmax_t x, void *param, struct ccn_charbuf *resultbuf)
 /*
  * Our private record of the state of the bulk data reception
  */
-struct bulkdata {
+struct ccn_bulkdata {
+    struct ccn *h;
     ccn_seqfunc *seqfunc;           /* the sequence number scheme */
     void *seqfunc_param;            /* parameters thereto, if needed */
     struct pending *first;          /* start of list of pending items */
     struct ccn_closure *client;     /* client-supplied upcall for delivery */
     uintmax_t next_expected;        /* smallest undelivered sequence number */
+    uintmax_t next_to_ask;          /* smallest sequence number not asked for */
+    uintmax_t final;                /* sequence number of the last item */
     struct ccn_charbuf *name_prefix;
-    int prefix_comps;
+    struct ccn_charbuf *templ;
+    int window;                     /* how many items to keep pending */
+    int n_pending;
+    int busy;                       /* nesting depth of our upcalls */
+    unsigned char have_final;       /* final is known */
+    unsigned char finished;         /* final has been delivered */
+    unsigned char stopped;
+    unsigned char failed;           /* gave up with an item missing */
     /* pubid, etc? */
 };
 
+/*
+ * One item we have asked for.  Pending items are kept in a circular
+ * doubly-linked list, in sequence order.
+ */
 struct pending {
     struct pending *prev;           /* links for doubly-linked list */
     struct pending *next;
-    struct bulkdata *parent;
+    struct ccn_bulkdata *parent;    /* NULL once off the list */
     uintmax_t x;                    /* sequence number for this item */
     struct ccn_closure closure;     /* our closure for getting matching data */
     unsigned char *content_ccnb;    /* the content that has arrived */
     size_t content_size;
+    enum ccn_upcall_kind kind;      /* how it arrived */
+    int finalized;                  /* ccn is done with closure */
 };
 
-static enum ccn_upcall_res deliver_content(struct ccn *h, struct bulkdata *b);
-static void express_bulkdata_interest(struct ccn *h, struct pending *b);
-// XXX - missing a way to create a struct bulkdata *
-// XXX - missing code to create new pendings
+static enum ccn_upcall_res incoming_bulkdata(struct ccn_closure *selfp,
+                                             enum ccn_upcall_kind kind,
+                                             struct ccn_upcall_info *info);
+static void deliver_content(struct ccn_bulkdata *b);
+static struct pending *ask_for_item(struct ccn_bulkdata *b, uintmax_t x,
+                                    struct pending *prev);
+static int express_bulkdata_interest(struct ccn_bulkdata *b);
+static void fail_bulkdata(struct ccn_bulkdata *b);
+
+static void
+free_pending(struct pending *p)
+{
+    free(p->content_ccnb);
+    free(p);
+}
+
+/*
+ * Take p off the list of b.  It is freed now if ccn is done with it,
+ * otherwise when the FINAL upcall arrives.
+ */
+static void
+detach_pending(struct ccn_bulkdata *b, struct pending *p)
+{
+    if (p->parent == NULL)
+        return;
+    if (p == b->first)
+        b->first = (p == p->next) ? NULL : p->next;
+    p->prev->next = p->next;
+    p->next->prev = p->prev;
+    p->next = p->prev = p;
+    p->parent = NULL;
+    b->n_pending--;
+    if (p->finalized)
+        free_pending(p);
+    else if (p->content_ccnb != NULL) {
+        free(p->content_ccnb);
+        p->content_ccnb = NULL;
+        p->content_size = 0;
+    }
+}
+
+/*
+ * Check whether the content is the last item, as marked by its FinalBlockID.
+ */
+static int
+is_final(struct ccn_upcall_info *info)
+{
+    const unsigned char *ccnb = info->content_ccnb;
+    const unsigned char *finalid = NULL;
+    size_t finalid_size = 0;
+    const unsigned char *nameid = NULL;
+    size_t nameid_size = 0;
+    struct ccn_indexbuf *cc = info->content_comps;
+    
+    if (ccnb == NULL || info->pco == NULL || cc == NULL || cc->n < 2)
+        return(0);
+    if (info->pco->offset[CCN_PCO_B_FinalBlockID] ==
+        info->pco->offset[CCN_PCO_E_FinalBlockID])
+        return(0);
+    ccn_ref_tagged_BLOB(CCN_DTAG_FinalBlockID, ccnb,
+                        info->pco->offset[CCN_PCO_B_FinalBlockID],
+                        info->pco->offset[CCN_PCO_E_FinalBlockID],
+                        &finalid, &finalid_size);
+    ccn_ref_tagged_BLOB(CCN_DTAG_Component, ccnb,
+                        cc->buf[cc->n - 2], cc->buf[cc->n - 1],
+                        &nameid, &nameid_size);
+    return(finalid_size == nameid_size &&
+           0 == memcmp(finalid, nameid, nameid_size));
+}
+
+static void
+deliver(struct ccn_bulkdata *b, enum ccn_upcall_kind kind,
+        struct ccn_upcall_info *info)
+{
+    (*b->client->p)(b->client, kind, info);
+    if (b->stopped)
+        return;
+    if (b->have_final && b->next_expected == b->final) {
+        b->finished = 1;
+        while (b->first != NULL)
+            detach_pending(b, b->first);
+    }
+    b->next_expected += 1;
+}
+
+/*
+ * Ask for more, up to the window, unless we know where the end is
+ */
+static void
+fill_window(struct ccn_bulkdata *b)
+{
+    while (!b->stopped && !b->failed && !b->finished &&
+           b->n_pending < b->window &&
+           !(b->have_final && b->next_to_ask > b->final)) {
+        if (express_bulkdata_interest(b) < 0) {
+            /* Try again when something arrives, if anything will */
+            if (b->n_pending == 0)
+                fail_bulkdata(b);
+            break;
+        }
+    }
+}
+
+/*
+ * Let go of the client closure, which gets its FINAL upcall if
+ * this was the last reference.
+ */
+static void
+release_client(struct ccn_bulkdata *b)
+{
+    struct ccn_closure *client = b->client;
+    struct ccn_upcall_info info = {0};
+    
+    b->client = NULL;
+    if (client != NULL && (--(client->refcount)) == 0) {
+        info.h = b->h;
+        (client->p)(client, CCN_UPCALL_FINAL, &info);
+    }
+}
+
+/*
+ * Give up on a reception that has an item it can no longer get.
+ * The client gets CCN_UPCALL_FINAL without the final item, and
+ * ccn_bulkdata_finished reports the failure; b itself lasts until
+ * ccn_bulkdata_stop.
+ */
+static void
+fail_bulkdata(struct ccn_bulkdata *b)
+{
+    if (b->stopped || b->failed || b->finished)
+        return;
+    b->failed = 1;
+    while (b->first != NULL)
+        detach_pending(b, b->first);
+    release_client(b);
+}
+
+/*
+ * Ask again for the item p stands for, keeping its place in the list,
+ * and take p off the list.  Failing that, give up on the reception,
+ * since the item would never be delivered otherwise.
+ */
+static void
+requeue_pending(struct ccn_bulkdata *b, struct pending *p)
+{
+    if (ask_for_item(b, p->x, p) == NULL) {
+        fail_bulkdata(b);
+        return;
+    }
+    detach_pending(b, p);
+}
 
+static void
+release_bulkdata(struct ccn_bulkdata *b)
+{
+    if (b->busy > 0 || !b->stopped)
+        return;
+    ccn_charbuf_destroy(&b->name_prefix);
+    ccn_charbuf_destroy(&b->templ);
+    free(b);
+}
 
-/*static*/ enum ccn_upcall_res
-imcoming_bulkdata(struct ccn_closure *selfp,
+static enum ccn_upcall_res
+incoming_bulkdata(struct ccn_closure *selfp,
                   enum ccn_upcall_kind kind,
                   struct ccn_upcall_info *info)
 {
-    struct bulkdata *b;
+    struct ccn_bulkdata *b;
     struct pending *p = selfp->data;
-    enum ccn_upcall_res res = CCN_UPCALL_RESULT_ERR;
+    size_t size;
 
     assert(selfp == &p->closure);
     b = p->parent;
     
     switch (kind) {
         case CCN_UPCALL_FINAL:
-            p->prev->next = p->next->prev;
-            p->next->prev = p->prev->next;
-            if (b != NULL && p == b->first)
-                b->first = (p == p->next) ? NULL : p->next;
-            if (p->content_ccnb != NULL)
-                free(p->content_ccnb);
-            free(p);
+            p->finalized = 1;
+            if (b != NULL && p->content_ccnb == NULL) {
+                /*
+                 * The interest went away unanswered, as when the handle
+                 * is destroyed.  Asking again might not be possible, and
+                 * the item can't be skipped, so the reception fails.
+                 */
+                b->busy++;
+                fail_bulkdata(b);
+                b->busy--;
+                release_bulkdata(b);
+                return(CCN_UPCALL_RESULT_OK);
+            }
+            if (b == NULL)
+                free_pending(p);
             return(CCN_UPCALL_RESULT_OK);
-	case CCN_UPCALL_CONTENT:
-    	case CCN_UPCALL_CONTENT_UNVERIFIED:
-	case CCN_UPCALL_CONTENT_BAD:
-            /* XXX - should we be returning bad (signature failed) content */
+        case CCN_UPCALL_CONTENT:
+        case CCN_UPCALL_CONTENT_UNVERIFIED:
+        case CCN_UPCALL_CONTENT_BAD:
+            /* The client decides what to do with bad (signature failed) content */
             break;
         case CCN_UPCALL_INTEREST_TIMED_OUT:
             /* XXX - may want to give client a chance to decide */ 
+            if (b == NULL)
+                return(CCN_UPCALL_RESULT_OK);
             return(CCN_UPCALL_RESULT_REEXPRESS);
         default:
             return(CCN_UPCALL_RESULT_ERR);
     }
-    /* XXX - check to see if seq comp matches, if not we have a hole to fill */
-    
-    if (p->content_ccnb == NULL) {
+    if (b == NULL || p->content_ccnb != NULL)
+        return(CCN_UPCALL_RESULT_OK);
+    b->busy++;
+    if (is_final(info) && !b->have_final) {
+        b->have_final = 1;
+        b->final = p->x;
+    }
     if (p->x == b->next_expected) {
         /* Good, we have in-order data to deliver to the caller */
-        res = (*b->client->p)(b->client, kind, info);
-        if (res == CCN_UPCALL_RESULT_OK) {
-            b->next_expected += 1;
-            b->first = (p == p->next) ? NULL : p->next;
-            p->prev->next = p->next->prev;
-            p->next->prev = p->prev->next;
-            p->next = p->prev = p;
-            p->parent = NULL;
-        }
-        // else ...
+        detach_pending(b, p);
+        deliver(b, kind, info);
     }
-    else if (p->content_ccnb == NULL) {
+    else {
         /* Out-of-order data, save it for later */
-        size_t size = info->pco->offset[CCN_PCO_E];
-        selfp->refcount++; /* don't call FINAL just yet */
+        size = info->pco->offset[CCN_PCO_E];
         p->content_ccnb = malloc(size);
-        memcpy(p->content_ccnb, info->content_ccnb, size);
-        p->content_size = size;
-    }
-    }
-    while (b->first != NULL && b->first->x == b->next_expected &&
-           b->first->content_ccnb != NULL) {
-        res = deliver_content(info->h, b);
-        if (res != CCN_UPCALL_RESULT_OK)
-            break;
-    }
-    if (b->first == NULL) {
-        // XXX 
-        return(CCN_UPCALL_RESULT_OK);
-    }
-    for (p = b->first; p->x >= b->next_expected; p = p->next) {
-        // XXX - this is not really right ...
-        if (p->content_ccnb == NULL)
-            express_bulkdata_interest(info->h, p);
+        if (p->content_ccnb != NULL) {
+            memcpy(p->content_ccnb, info->content_ccnb, size);
+            p->content_size = size;
+            p->kind = kind;
+        }
+        else
+            requeue_pending(b, p); /* no room now; it must come again */
     }
+    while (!b->stopped && b->first != NULL &&
+           b->first->x == b->next_expected && b->first->content_ccnb != NULL)
+        deliver_content(b);
+    fill_window(b);
+    b->busy--;
+    release_bulkdata(b);
     return(CCN_UPCALL_RESULT_OK);
 }
 
-static void
-express_bulkdata_interest(struct ccn *h, struct pending *p)
+/*
+ * Make a pending item for sequence number x and express an interest
+ * for it.  The item goes on the list of b just after prev, or at the
+ * end if prev is NULL.
+ * @returns the new item, or NULL if it could not be asked for.
+ */
+static struct pending *
+ask_for_item(struct ccn_bulkdata *b, uintmax_t x, struct pending *prev)
 {
     int res;
-    struct bulkdata *b = NULL;
-    int prefix_comps = -1;
-    int addl_comps = -1;
+    struct pending *p = NULL;
     struct ccn_charbuf *name = NULL;
-    struct ccn_charbuf *templ = NULL;
     struct ccn_charbuf *seq = NULL;
     
-    b = p->parent;
-    if (b == NULL)
-        return;
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+        return(NULL);
+    p->x = x;
+    p->closure.p = &incoming_bulkdata;
+    p->closure.data = p;
     name = ccn_charbuf_create();
-    templ = ccn_charbuf_create();
     seq = ccn_charbuf_create();
-
     ccn_charbuf_append(name, b->name_prefix->buf, b->name_prefix->length);
-    
-    seq->length = 0;
     (*b->seqfunc)(p->x, b->seqfunc_param, seq);
     ccn_name_append(name, seq->buf, seq->length);
-    prefix_comps = -1;
-    addl_comps = 1;
-    
-    ccn_charbuf_append_tt(templ, CCN_DTAG_Interest, CCN_DTAG);
-
-    ccn_charbuf_append_tt(templ, CCN_DTAG_Name, CCN_DTAG);
-    ccn_charbuf_append_closer(templ); /* </Name> */
-
-    // XXX - may want to set Min/MaxSuffixComponents
-    
-    ccn_charbuf_append_closer(templ); /* </Interest> */
-    res = ccn_express_interest(h, name, &p->closure, templ);
-    assert(res >= 0); // XXX - handle this better
+    res = ccn_express_interest(b->h, name, &p->closure, b->templ);
     ccn_charbuf_destroy(&name);
-    ccn_charbuf_destroy(&templ);
     ccn_charbuf_destroy(&seq);
+    if (res < 0) {
+        free(p);
+        return(NULL);
+    }
+    p->parent = b;
+    if (b->first == NULL)
+        b->first = p->next = p->prev = p;
+    else {
+        if (prev == NULL)
+            prev = b->first->prev;
+        p->prev = prev;
+        p->next = prev->next;
+        p->prev->next = p;
+        p->next->prev = p;
+    }
+    b->n_pending++;
+    return(p);
+}
+
+/*
+ * Append a pending item for the next sequence number and express
+ * an interest for it.
+ * @returns 0, or -1 if it could not be asked for.
+ */
+static int
+express_bulkdata_interest(struct ccn_bulkdata *b)
+{
+    if (ask_for_item(b, b->next_to_ask, NULL) == NULL)
+        return(-1);
+    b->next_to_ask++;
+    return(0);
 }
 
 /*
  * deliver_content is used to deliver a previously-buffered
  * ContentObject to the client.
  */
-static enum ccn_upcall_res
-deliver_content(struct ccn *h, struct bulkdata *b)
+static void
+deliver_content(struct ccn_bulkdata *b)
 {
     struct ccn_upcall_info info = {0};
     struct ccn_parsed_ContentObject obj = {0};
     struct pending *p = b->first;
+    enum ccn_upcall_kind kind = p->kind;
     int res;
-    enum ccn_upcall_res ans;
+    
     assert(p != NULL && p->x == b->next_expected && p->content_ccnb != NULL);
+    info.h = b->h;
     info.pco = &obj;
     info.content_comps = ccn_indexbuf_create();
     res = ccn_parse_ContentObject(p->content_ccnb, p->content_size,
@@ -247,19 +420,79 @@ deliver_content(struct ccn *h, struct bulkdata *b)
     info.content_ccnb = p->content_ccnb;
     info.matched_comps = info.content_comps->n - 2;
     /* XXX - we have no matched interest to present */
-    ans = (*b->client->p)(b->client, CCN_UPCALL_CONTENT, &info);
-    // XXX - check for refusal
-    info.content_ccnb = NULL;
-    free(p->content_ccnb);
+    /* Take ownership of the buffer, since detaching would free it */
     p->content_ccnb = NULL;
     p->content_size = 0;
+    detach_pending(b, p);
+    deliver(b, kind, &info);
+    free((void *)info.content_ccnb);
     ccn_indexbuf_destroy(&info.content_comps);
-    if (ans == CCN_UPCALL_RESULT_OK) {
-        struct ccn_closure *old = &p->closure;
-        if ((--(old->refcount)) == 0) {
-            info.pco = NULL;
-            (old->p)(old, CCN_UPCALL_FINAL, &info);
-        }
+}
+
+struct ccn_bulkdata *
+ccn_bulkdata_start(struct ccn *h,
+                   const struct ccn_charbuf *name_prefix,
+                   ccn_seqfunc *seqfunc,
+                   void *seqfunc_param,
+                   int window,
+                   struct ccn_closure *client)
+{
+    struct ccn_bulkdata *b = NULL;
+    struct ccn_charbuf *templ = NULL;
+    
+    if (h == NULL || name_prefix == NULL || client == NULL)
+        return(NULL);
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+        return(NULL);
+    b->h = h;
+    b->seqfunc = (seqfunc != NULL) ? seqfunc : &ccn_binary_seqfunc;
+    b->seqfunc_param = seqfunc_param;
+    b->window = (window > 0) ? window : CCN_BULKDATA_DEFAULT_WINDOW;
+    b->name_prefix = ccn_charbuf_create();
+    ccn_charbuf_append(b->name_prefix, name_prefix->buf, name_prefix->length);
+    b->templ = templ = ccn_charbuf_create();
+    ccn_charbuf_append_tt(templ, CCN_DTAG_Interest, CCN_DTAG);
+    ccn_charbuf_append_tt(templ, CCN_DTAG_Name, CCN_DTAG);
+    ccn_charbuf_append_closer(templ); /* </Name> */
+    ccnb_tagged_putf(templ, CCN_DTAG_MaxSuffixComponents, "%d", 1);
+    ccn_charbuf_append_closer(templ); /* </Interest> */
+    b->client = client;
+    client->refcount++;
+    fill_window(b);
+    if (b->n_pending == 0) {
+        ccn_bulkdata_stop(&b);
+        return(NULL);
     }
-    return(ans);
+    return(b);
+}
+
+uintmax_t
+ccn_bulkdata_delivered(struct ccn_bulkdata *b)
+{
+    return(b->next_expected);
+}
+
+int
+ccn_bulkdata_finished(struct ccn_bulkdata *b)
+{
+    if (b->failed)
+        return(-1);
+    return(b->finished);
+}
+
+void
+ccn_bulkdata_stop(struct ccn_bulkdata **bp)
+{
+    struct ccn_bulkdata *b = *bp;
+    
+    *bp = NULL;
+    if (b == NULL || b->stopped)
+        return;
+    b->stopped = 1;
+    /* Outstanding interests die off as they time out */
+    while (b->first != NULL)
+        detach_pending(b, b->first);
+    release_client(b);
+    release_bulkdata(b);
 }
@@ -32,6 +32,10 @@
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define CCN_HAVE_EPOLL 1
+#endif
 
 #include <ccn/ccn.h>
 #include <ccn/ccn_private.h>
@@ -43,13 +47,26 @@
 #include <ccn/reg_mgmt.h>
 #include <ccn/signing.h>
 #include <ccn/keystore.h>
+#include <ccn/ringbuf.h>
+#include <ccn/schedule.h>
+#include <ccn/shm.h>
 #include <ccn/uri.h>
 
+/* How long to wait for ccnd to answer a request for shared memory */
+#define CCN_SHM_REQUEST_MS 1000
+
+/* Bounds on how far the receive buffer grows to keep up with the socket */
+#define CCN_INBUF_MIN_SIZE (1 << 16)
+#define CCN_INBUF_MAX_SIZE (1 << 20)
+
 struct ccn {
     int sock;
+    struct ccn_shm *shm;        /* rings shared with ccnd, if any */
     size_t outbufindex;
+    size_t cork_size;           /* gather this much output before writing */
+    size_t outbuf_limit;        /* ccn_put refuses to queue beyond this */
     struct ccn_charbuf *interestbuf;
-    struct ccn_charbuf *inbuf;
+    struct ccn_ringbuf *inbuf;
     struct ccn_charbuf *outbuf;
     struct ccn_charbuf *ccndid;
     struct hashtb *interests_by_prefix;
@@ -67,6 +84,13 @@ struct ccn {
     int verbose_error;
     int tap;
     int running;
+    struct ccn_upcall_info *answering; /* ContentObject being dispatched */
+    uintmax_t interests_sent;
+    uintmax_t interests_aggregated;
+    struct ccn_schedule *sched; /* when each expressed interest is due */
+    struct ccn_gettime ticktock; /* keeps now current for sched */
+    int keys_seen;              /* size of keys when waiters last checked */
+    int connects;               /* bumped by each ccn_connect */
 };
 
 struct expressed_interest;
@@ -74,6 +98,8 @@ struct ccn_reg_closure;
 
 struct interests_by_prefix { /* keyed by components of name prefix */
     struct expressed_interest *list;
+    const unsigned char *key;    /* our own key, for removing the entry */
+    size_t keysize;
 };
 
 struct expressed_interest {
@@ -86,6 +112,8 @@ struct expressed_interest {
     int outstanding;             /* number currently outstanding (0 or 1) */
     int lifetime_us;             /* interest lifetime in microseconds */
     struct ccn_charbuf *wanted_pub; /* waiting for this pub to arrive */
+    struct interests_by_prefix *entry; /* the list we are on */
+    struct ccn_scheduled_event *ev; /* wakeup for aging, or NULL */
     struct expressed_interest *next; /* link to next in list */
 };
 
@@ -111,13 +139,16 @@ struct ccn_reg_closure {
 #define XXX \
     do { NOTE_ERR(h, -76); ccn_perror(h, "Please write some more code here"); } while (0)
 
-static void ccn_refresh_interest(struct ccn *, struct expressed_interest *);
+static void ccn_refresh_interest(struct ccn *, struct interests_by_prefix *,
+                                 struct expressed_interest *);
 static void ccn_initiate_prefix_reg(struct ccn *,
                                     const void *, size_t,
                                     struct interest_filter *);
 static void finalize_pkey(struct hashtb_enumerator *e);
 static void finalize_keystore(struct hashtb_enumerator *e);
 static int ccn_pushout(struct ccn *h);
+static int ccn_interest_timer(struct ccn_schedule *, void *,
+                              struct ccn_scheduled_event *, int);
 
 static int
 tv_earlier(const struct timeval *a, const struct timeval *b)
@@ -229,6 +260,18 @@ ccn_replace_handler(struct ccn *h,
     }
 }
 
+/**
+ * Clock for the handle's schedule, which keeps h->now up to date as well.
+ */
+static void
+ccn_client_gettime(const struct ccn_gettime *self, struct ccn_timeval *result)
+{
+    struct ccn *h = self->data;
+    gettimeofday(&h->now, NULL);
+    result->s = h->now.tv_sec;
+    result->micros = h->now.tv_usec;
+}
+
 /**
  * Create a client handle.
  * The new handle is not yet connected.
@@ -274,11 +317,35 @@ ccn_create(void)
     } else {
     h->tap = -1;
     }
+    memcpy(h->ticktock.descr, "ccnTOD", 7);
+    h->ticktock.micros_per_base = 1000000;
+    h->ticktock.gettime = &ccn_client_gettime;
+    h->ticktock.data = h;
+    h->sched = ccn_schedule_create(h, &h->ticktock);
+    if (h->sched == NULL) {
+        ccn_destroy(&h);
+        return(NULL);
+    }
     return(h);
 }
 
+static int
+ccn_connect_sock(struct ccn *h, struct sockaddr_un *addr)
+{
+    h->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (h->sock == -1)
+        return(NOTE_ERRNO(h));
+    if (connect(h->sock, (struct sockaddr *)addr, sizeof(*addr)) == -1)
+        return(NOTE_ERRNO(h));
+    return(0);
+}
+
 /**
  * Connect to local ccnd.
+ *
+ * If the environment variable CCN_LOCAL_SHM is set to something other
+ * than 0, ask ccnd to carry our traffic in shared memory instead of
+ * over the socket.  If ccnd cannot, the socket is used as usual.
  * @param h is a ccn library handle
  * @param name is the name of the unix-domain socket to connect to;
  *             use NULL to get the default.
@@ -288,6 +355,7 @@ int
 ccn_connect(struct ccn *h, const char *name)
 {
     struct sockaddr_un addr = {0};
+    const char *s;
     int res;
     if (h == NULL)
         return(-1);
@@ -301,35 +369,76 @@ ccn_connect(struct ccn *h, const char *name)
         addr.sun_family = AF_UNIX;
         strncpy(addr.sun_path, name, sizeof(addr.sun_path));
     }
-    h->sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (h->sock == -1)
-        return(NOTE_ERRNO(h));
-    res = connect(h->sock, (struct sockaddr *)&addr, sizeof(addr));
-    if (res == -1)
-        return(NOTE_ERRNO(h));
+    if (ccn_connect_sock(h, &addr) == -1)
+        return(-1);
+    s = getenv("CCN_LOCAL_SHM");
+    if (s != NULL && s[0] != 0 && strcmp(s, "0") != 0) {
+        h->shm = ccn_shm_request(h->sock, CCN_SHM_REQUEST_MS);
+        if (h->shm == NULL && errno != ECONNREFUSED) {
+            /* No telling what ccnd made of that, so start afresh */
+            close(h->sock);
+            if (ccn_connect_sock(h, &addr) == -1)
+                return(-1);
+        }
+    }
     res = fcntl(h->sock, F_SETFL, O_NONBLOCK);
     if (res == -1)
         return(NOTE_ERRNO(h));
-    return(h->sock);
+    h->connects++;
+    return(ccn_get_connection_fd(h));
 }
 
+/**
+ * Get the fd to poll for activity on the connection.
+ *
+ * When the traffic is in shared memory, this is the doorbell that
+ * ccnd rings; ccn_run() asks for that before it returns.
+ */
 int
 ccn_get_connection_fd(struct ccn *h)
 {
+    if (h->shm != NULL)
+        return(ccn_shm_doorbell_fd(h->shm));
     return(h->sock);
 }
 
+/**
+ * Wait a little while for ccnd to make room for the rest of our output.
+ */
+static void
+ccn_shm_drain(struct ccn *h)
+{
+    struct pollfd fds[2];
+    int i;
+
+    for (i = 0; i < 100 && ccn_pushout(h) == 1; i++) {
+        fds[0].fd = h->sock;
+        fds[0].events = POLLIN;
+        fds[1].fd = ccn_shm_doorbell_fd(h->shm);
+        fds[1].events = POLLIN;
+        ccn_shm_prepare_wait(h->shm, 1);
+        if (poll(fds, 2, 10) > 0) {
+            if (fds[0].revents != 0)
+                break;
+            ccn_shm_clear_doorbell(h->shm);
+        }
+    }
+}
+
 int
 ccn_disconnect(struct ccn *h)
 {
     int res;
     res = ccn_pushout(h);
-    if (res == 1) {
+    if (res == 1 && h->shm != NULL)
+        ccn_shm_drain(h);
+    else if (res == 1) {
         res = fcntl(h->sock, F_SETFL, 0); /* clear O_NONBLOCK */
         if (res == 0)
             ccn_pushout(h);
     }
-    ccn_charbuf_destroy(&h->inbuf);
+    ccn_shm_destroy(&h->shm);
+    ccn_ringbuf_destroy(&h->inbuf);
     ccn_charbuf_destroy(&h->outbuf);
     res = close(h->sock);
     h->sock = -1;
@@ -373,6 +482,8 @@ ccn_destroy_interest(struct ccn *h, struct expressed_interest *i)
         ccn_gripe(i);
         return(NULL);
     }
+    if (i->ev != NULL)
+        ccn_schedule_cancel(h->sched, i->ev);
     ccn_replace_handler(h, &(i->action), NULL);
     replace_interest_msg(i, NULL);
     ccn_charbuf_destroy(&i->wanted_pub);
@@ -432,6 +543,7 @@ ccn_destroy(struct ccn **hp)
         hashtb_end(e);
         hashtb_destroy(&(h->interests_by_prefix));
     }
+    ccn_schedule_destroy(&h->sched);
     if (h->interest_filters != NULL) {
         for (hashtb_start(h->interest_filters, e); e->data != NULL; hashtb_next(e)) {
             struct interest_filter *i = e->data;
@@ -556,6 +668,23 @@ ccn_express_interest(struct ccn *h,
     prefixend = ccn_check_namebuf(h, namebuf, -1, 1);
     if (prefixend < 0)
         return(prefixend);
+    interest = calloc(1, sizeof(*interest));
+    if (interest == NULL)
+        return(NOTE_ERRNO(h));
+    interest->magic = 0x7059e5f4;
+    ccn_construct_interest(h, namebuf, interest_template, interest);
+    if (interest->interest_msg == NULL) {
+        free(interest);
+        return(-1);
+    }
+    /* Come back to age it when its lifetime is up */
+    interest->ev = ccn_schedule_event(h->sched, interest->lifetime_us,
+                                      &ccn_interest_timer, interest, 0);
+    if (interest->ev == NULL) {
+        NOTE_ERRNO(h);
+        ccn_destroy_interest(h, interest);
+        return(-1);
+    }
     /*
      * To make it easy to lookup prefixes of names, we keep only
      * the prefix name components as the key in the hash table.
@@ -566,30 +695,22 @@ ccn_express_interest(struct ccn *h,
     if (entry == NULL) {
         NOTE_ERRNO(h);
         hashtb_end(e);
+        ccn_destroy_interest(h, interest);
         return(res);
     }
-    if (res == HT_NEW_ENTRY)
+    if (res == HT_NEW_ENTRY) {
         entry->list = NULL;
-    interest = calloc(1, sizeof(*interest));
-    if (interest == NULL) {
-        NOTE_ERRNO(h);
-        hashtb_end(e);
-        return(-1);
-    }
-    interest->magic = 0x7059e5f4;
-    ccn_construct_interest(h, namebuf, interest_template, interest);
-    if (interest->interest_msg == NULL) {
-        free(interest);
-        hashtb_end(e);
-        return(-1);
+        entry->key = e->key;
+        entry->keysize = e->keysize;
     }
     ccn_replace_handler(h, &(interest->action), action);
     interest->target = 1;
+    interest->entry = entry;
     interest->next = entry->list;
     entry->list = interest;
     hashtb_end(e);
     /* Actually send the interest out right away */
-    ccn_refresh_interest(h, interest);
+    ccn_refresh_interest(h, entry, interest);
     return(0);
 }
 
@@ -642,6 +763,28 @@ ccn_set_interest_filter(struct ccn *h, struct ccn_charbuf *namebuf,
     return(ccn_set_interest_filter_with_flags(h, namebuf, action, forw_flags));
 }
 
+/**
+ * Write to ccnd, as write(2) would.
+ */
+static ssize_t
+ccn_write(struct ccn *h, const void *p, size_t size)
+{
+    if (h->shm != NULL)
+        return(ccn_shm_write(h->shm, p, size));
+    return(write(h->sock, p, size));
+}
+
+/**
+ * @returns the number of bytes waiting to be sent.
+ */
+static size_t
+ccn_output_queued(struct ccn *h)
+{
+    if (h->outbuf == NULL)
+        return(0);
+    return(h->outbuf->length - h->outbufindex);
+}
+
 static int
 ccn_pushout(struct ccn *h)
 {
@@ -651,7 +794,7 @@ ccn_pushout(struct ccn *h)
         if (h->sock < 0)
             return(1);
         size = h->outbuf->length - h->outbufindex;
-        res = write(h->sock, h->outbuf->buf + h->outbufindex, size);
+        res = ccn_write(h, h->outbuf->buf + h->outbufindex, size);
         if (res == size) {
             h->outbuf->length = h->outbufindex = 0;
             return(0);
@@ -664,16 +807,29 @@ ccn_pushout(struct ccn *h)
     return(0);
 }
 
-int
-ccn_put(struct ccn *h, const void *p, size_t length)
+/**
+ * Send or queue a message.
+ *
+ * If bounded is nonzero, the message is refused (with EAGAIN) when it
+ * would take the queue past the limit set by ccn_set_output_limit().
+ * The library's own interests are not bounded, since no caller is
+ * there to retry them.
+ */
+static int
+ccn_put_msg(struct ccn *h, const void *p, size_t length, int bounded)
 {
     struct ccn_skeleton_decoder dd = {0};
     ssize_t res;
+    size_t queued;
     if (h == NULL || p == NULL || length == 0)
         return(NOTE_ERR(h, EINVAL));
     res = ccn_skeleton_decode(&dd, p, length);
     if (!(res == length && dd.state == 0))
         return(NOTE_ERR(h, EINVAL));
+    queued = ccn_output_queued(h);
+    if (bounded && h->outbuf_limit != 0 && queued != 0 &&
+        queued + length > h->outbuf_limit)
+        return(NOTE_ERR(h, EAGAIN));
     if (h->tap != -1) {
         res = write(h->tap, p, length);
         if (res == -1) {
@@ -682,15 +838,21 @@ ccn_put(struct ccn *h, const void *p, size_t length)
             h->tap = -1;
         }
     }
-    if (h->outbuf != NULL && h->outbufindex < h->outbuf->length) {
-        // XXX - should limit unbounded growth of h->outbuf
-        ccn_charbuf_append(h->outbuf, p, length); // XXX - check res
+    if (queued != 0 || h->cork_size != 0) {
+        if (h->outbuf == NULL) {
+            h->outbuf = ccn_charbuf_create();
+            h->outbufindex = 0;
+        }
+        if (ccn_charbuf_append(h->outbuf, p, length) < 0)
+            return(NOTE_ERRNO(h));
+        if (h->cork_size != 0 && queued + length < h->cork_size)
+            return(1); /* ccn_run will send it at the end of the slice */
         return (ccn_pushout(h));
     }
     if (h->sock == -1)
         res = 0;
     else
-        res = write(h->sock, p, length);
+        res = ccn_write(h, p, length);
     if (res == length)
         return(0);
     if (res == -1) {
@@ -706,12 +868,58 @@ ccn_put(struct ccn *h, const void *p, size_t length)
     return(1);
 }
 
+int
+ccn_put(struct ccn *h, const void *p, size_t length)
+{
+    return(ccn_put_msg(h, p, length, 1));
+}
+
 int
 ccn_output_is_pending(struct ccn *h)
 {
     return(h != NULL && h->outbuf != NULL && h->outbufindex < h->outbuf->length);
 }
 
+/**
+ * Gather output into fewer, larger writes.
+ *
+ * While corked, ccn_put() only queues its message.  The queue is written
+ * at the end of each ccn_run() slice, or as soon as it holds flush_size
+ * bytes.
+ * @param h is the ccn handle.
+ * @param flush_size is the threshold, or 0 to uncork (which also tries
+ *        to write out whatever is queued).
+ * @returns the old value.
+ */
+size_t
+ccn_set_output_cork(struct ccn *h, size_t flush_size)
+{
+    size_t ans = h->cork_size;
+    h->cork_size = flush_size;
+    if (flush_size == 0 || ccn_output_queued(h) >= flush_size)
+        ccn_pushout(h);
+    return(ans);
+}
+
+/**
+ * Bound the output queue.
+ *
+ * Once the queue is nonempty, ccn_put() refuses any message that would
+ * take it past limit bytes, returning -1 with ccn_geterror() set to
+ * EAGAIN.  The caller should let ccn_run() drain the queue and try again.
+ * @param h is the ccn handle.
+ * @param limit is the high-water mark in bytes, or 0 (the default)
+ *        for no bound.
+ * @returns the old value.
+ */
+size_t
+ccn_set_output_limit(struct ccn *h, size_t limit)
+{
+    size_t ans = h->outbuf_limit;
+    h->outbuf_limit = limit;
+    return(ans);
+}
+
 struct ccn_charbuf *
 ccn_grab_buffered_output(struct ccn *h)
 {
@@ -723,25 +931,79 @@ ccn_grab_buffered_output(struct ccn *h)
     return(NULL);
 }
 
+/**
+ * Find an interest identical to the given one that is still in flight,
+ * so the given one may wait for its answer instead of being sent again.
+ *
+ * One that is answered by the ContentObject now being dispatched does
+ * not count, since that answer is already being used up.
+ */
+static struct expressed_interest *
+ccn_find_inflight_twin(struct ccn *h, struct interests_by_prefix *entry,
+                       struct expressed_interest *interest)
+{
+    struct ccn_upcall_info *info = h->answering;
+    struct expressed_interest *ie;
+    int delta;
+    for (ie = entry->list; ie != NULL; ie = ie->next) {
+        if (ie == interest || ie->target == 0 || ie->outstanding == 0 ||
+            ie->interest_msg == NULL || ie->size != interest->size ||
+            memcmp(ie->interest_msg, interest->interest_msg, ie->size) != 0)
+            continue;
+        if (h->now.tv_sec - ie->lasttime.tv_sec > CCN_INTEREST_LIFETIME_SEC)
+            continue;
+        delta = (h->now.tv_sec  - ie->lasttime.tv_sec)*1000000 +
+                (h->now.tv_usec - ie->lasttime.tv_usec);
+        if (delta < 0 || delta >= ie->lifetime_us)
+            continue;
+        if (info != NULL &&
+            ccn_content_matches_interest(info->content_ccnb,
+                                         info->pco->offset[CCN_PCO_E],
+                                         1, info->pco,
+                                         ie->interest_msg, ie->size, NULL))
+            continue;
+        return(ie);
+    }
+    return(NULL);
+}
+
 static void
-ccn_refresh_interest(struct ccn *h, struct expressed_interest *interest)
+ccn_refresh_interest(struct ccn *h, struct interests_by_prefix *entry,
+                     struct expressed_interest *interest)
 {
+    struct expressed_interest *twin;
     int res;
     if (interest->magic != 0x7059e5f4) {
         ccn_gripe(interest);
         return;
     }
     if (interest->outstanding < interest->target) {
-        res = ccn_put(h, interest->interest_msg, interest->size);
+        if (h->now.tv_sec == 0)
+            gettimeofday(&h->now, NULL);
+        twin = ccn_find_inflight_twin(h, entry, interest);
+        if (twin != NULL) {
+            /* Share the twin's answer, or its timeout */
+            interest->outstanding += 1;
+            interest->lasttime = twin->lasttime;
+            h->interests_aggregated++;
+            return;
+        }
+        res = ccn_put_msg(h, interest->interest_msg, interest->size, 0);
         if (res >= 0) {
             interest->outstanding += 1;
-            if (h->now.tv_sec == 0)
-                gettimeofday(&h->now, NULL);
             interest->lasttime = h->now;
+            h->interests_sent++;
         }
     }
 }
 
+void
+ccn_get_interest_counts(struct ccn *h, struct ccn_interest_counts *counts)
+{
+    counts->sent = h->interests_sent;
+    counts->aggregated = h->interests_aggregated;
+}
+
 static int
 ccn_get_content_type(const unsigned char *ccnb,
                      const struct ccn_parsed_ContentObject *pco)
@@ -1129,7 +1391,8 @@ ccn_initiate_key_fetch(struct ccn *h,
  * refresh the interest.
  */
 static void
-ccn_check_pub_arrival(struct ccn *h, struct expressed_interest *interest)
+ccn_check_pub_arrival(struct ccn *h, struct interests_by_prefix *entry,
+                      struct expressed_interest *interest)
 {
     struct ccn_charbuf *want = interest->wanted_pub;
     if (want == NULL)
@@ -1137,7 +1400,7 @@ ccn_check_pub_arrival(struct ccn *h, struct expressed_interest *interest)
     if (hashtb_lookup(h->keys, want->buf, want->length) != NULL) {
         ccn_charbuf_destroy(&interest->wanted_pub);
         interest->target = 1;
-        ccn_refresh_interest(h, interest);
+        ccn_refresh_interest(h, entry, interest);
     }
 }
 
@@ -1186,11 +1449,14 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
     else {
         /* This message should be a ContentObject. */
         struct ccn_parsed_ContentObject obj = {0};
+        enum ccn_upcall_kind verdict = CCN_UPCALL_CONTENT;
+        int verified = 0;
         info.pco = &obj;
         info.content_comps = ccn_indexbuf_create();
         res = ccn_parse_ContentObject(msg, size, &obj, info.content_comps);
         if (res >= 0) {
             info.content_ccnb = msg;
+            h->answering = &info;
             if (h->interests_by_prefix != NULL) {
                 struct ccn_indexbuf *comps = info.content_comps;
                 size_t keystart = comps->buf[0];
@@ -1215,18 +1481,23 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
                                                                  interest->interest_msg,
                                                                  interest->size,
                                                                  info.pi)) {
-                                    enum ccn_upcall_kind upcall_kind = CCN_UPCALL_CONTENT;
-                                    struct ccn_pkey *pubkey = NULL;
-                                    int type = ccn_get_content_type(msg, info.pco);
-                                    if (type == CCN_CONTENT_KEY)
-                                        res = ccn_cache_key(h, msg, size, info.pco);
-                                    res = ccn_locate_key(h, msg, info.pco, &pubkey);
-                                    if (res == 0) {
-                                        /* we have the pubkey, use it to verify the msg */
-                                        res = ccn_verify_signature(msg, size, info.pco, pubkey);
-                                        upcall_kind = (res == 1) ? CCN_UPCALL_CONTENT : CCN_UPCALL_CONTENT_BAD;
-                                    } else
-                                        upcall_kind = CCN_UPCALL_CONTENT_UNVERIFIED;
+                                    enum ccn_upcall_kind upcall_kind = verdict;
+                                    if (!verified) {
+                                        /* Only once, however many are waiting */
+                                        struct ccn_pkey *pubkey = NULL;
+                                        int type = ccn_get_content_type(msg, info.pco);
+                                        if (type == CCN_CONTENT_KEY)
+                                            res = ccn_cache_key(h, msg, size, info.pco);
+                                        res = ccn_locate_key(h, msg, info.pco, &pubkey);
+                                        if (res == 0) {
+                                            /* we have the pubkey, use it to verify the msg */
+                                            res = ccn_verify_signature(msg, size, info.pco, pubkey);
+                                            upcall_kind = (res == 1) ? CCN_UPCALL_CONTENT : CCN_UPCALL_CONTENT_BAD;
+                                        } else
+                                            upcall_kind = CCN_UPCALL_CONTENT_UNVERIFIED;
+                                        verdict = upcall_kind;
+                                        verified = 1;
+                                    }
                                     interest->outstanding -= 1;
                                     info.interest_ccnb = interest->interest_msg;
                                     info.matched_comps = i;
@@ -1236,7 +1507,7 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
                                     if (interest->magic != 0x7059e5f4)
                                         ccn_gripe(interest);
                                     if (ures == CCN_UPCALL_RESULT_REEXPRESS)
-                                        ccn_refresh_interest(h, interest);
+                                        ccn_refresh_interest(h, entry, interest);
                                     else if (ures == CCN_UPCALL_RESULT_VERIFY &&
                                              upcall_kind == CCN_UPCALL_CONTENT_UNVERIFIED) { /* KEYS */
                                         ccn_initiate_key_fetch(h, msg, info.pco, interest);
@@ -1253,56 +1524,122 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
             }
         }
     } // XXX whew, what a lot of right braces!
+    h->answering = NULL;
     ccn_indexbuf_release(h, info.interest_comps);
     ccn_indexbuf_destroy(&info.content_comps);
     h->running--;
 }
 
+/**
+ * Dispatch the messages waiting in the ring from ccnd.
+ *
+ * Each message is used in place, and handed back to ccnd once
+ * it has been dispatched.
+ */
+static int
+ccn_process_shm_input(struct ccn *h)
+{
+    struct ccn_shm *shm = h->shm;
+    struct ccn_skeleton_decoder *d = &h->decoder;
+    unsigned char *buf = NULL;
+    ssize_t avail;
+    ssize_t msgstart = 0;
+
+    avail = ccn_shm_peek(shm, &buf);
+    if (avail < 0)
+        goto Botch;
+    memset(d, 0, sizeof(*d));
+    while (msgstart < avail) {
+        ccn_skeleton_decode(d, buf + msgstart, avail - msgstart);
+        if (d->state != 0)
+            break;
+        ccn_dispatch_message(h, buf + msgstart, d->index - msgstart);
+        if (h->shm != shm)
+            return(0);
+        ccn_shm_consume(shm, d->index - msgstart);
+        msgstart = d->index;
+    }
+    if (d->state < 0 ||
+        (msgstart == 0 && avail == ccn_shm_capacity(shm)))
+        goto Botch;
+    return(0);
+Botch:
+    NOTE_ERR(h, EPROTO);
+    ccn_disconnect(h);
+    return(-1);
+}
+
+/**
+ * Read what ccnd has sent and dispatch the complete messages.
+ *
+ * The socket is drained into a ring with one read per call, and each
+ * message is dispatched where it lies, so a partial message at the end
+ * is never moved.  The ring starts small, and grows when a read fills
+ * it (up to CCN_INBUF_MAX_SIZE) or when a single message will not fit.
+ */
 static int
 ccn_process_input(struct ccn *h)
 {
     ssize_t res;
-    ssize_t msgstart;
+    size_t avail;
+    size_t size;
     unsigned char *buf;
+    unsigned char *msg;
     struct ccn_skeleton_decoder *d = &h->decoder;
-    struct ccn_charbuf *inbuf = h->inbuf;
-    if (inbuf == NULL)
-        h->inbuf = inbuf = ccn_charbuf_create();
-    if (inbuf->length == 0)
+    struct ccn_ringbuf *inbuf = h->inbuf;
+    int crowded;
+    if (h->shm != NULL)
+        return(ccn_process_shm_input(h));
+    if (inbuf == NULL) {
+        h->inbuf = inbuf = ccn_ringbuf_create(CCN_INBUF_MIN_SIZE);
+        if (inbuf == NULL)
+            return(NOTE_ERRNO(h));
+    }
+    if (ccn_ringbuf_length(inbuf) == 0)
         memset(d, 0, sizeof(*d));
-    buf = ccn_charbuf_reserve(inbuf, 8800);
-    res = read(h->sock, buf, inbuf->limit - inbuf->length);
+    buf = ccn_ringbuf_space(inbuf, &avail);
+    if (avail == 0) {
+        /* One message fills the whole buffer */
+        size = ccn_ringbuf_capacity(inbuf);
+        if (ccn_ringbuf_grow(inbuf, 2 * size) < 0)
+            return(NOTE_ERRNO(h));
+        buf = ccn_ringbuf_space(inbuf, &avail);
+        if (avail == 0)
+            return(NOTE_ERR(h, EMSGSIZE));
+    }
+    res = read(h->sock, buf, avail);
     if (res == 0) {
         ccn_disconnect(h);
         return(-1);
     }
     if (res == -1) {
         if (errno == EAGAIN)
-            res = 0;
-        else
-            return(NOTE_ERRNO(h));
+            return(0);
+        return(NOTE_ERRNO(h));
     }
-    inbuf->length += res;
-    msgstart = 0;
-    ccn_skeleton_decode(d, buf, res);
+    crowded = ((size_t)res == avail);
+    ccn_ringbuf_commit(inbuf, res);
+    msg = ccn_ringbuf_data(inbuf);
+    ccn_skeleton_decode(d, msg + d->index, ccn_ringbuf_length(inbuf) - d->index);
     while (d->state == 0) {
-        ccn_dispatch_message(h, inbuf->buf + msgstart, 
-                              d->index - msgstart);
-        msgstart = d->index;
-        if (msgstart == inbuf->length) {
-            inbuf->length = 0;
-            return(0);
-        }
-        ccn_skeleton_decode(d, inbuf->buf + d->index,
-                            inbuf->length - d->index);
+        size = d->index;
+        ccn_dispatch_message(h, msg, size);
+        if (h->inbuf != inbuf)
+            return(0); /* disconnected by a handler */
+        ccn_ringbuf_consume(inbuf, size);
+        memset(d, 0, sizeof(*d));
+        if (ccn_ringbuf_length(inbuf) == 0)
+            break;
+        msg = ccn_ringbuf_data(inbuf);
+        ccn_skeleton_decode(d, msg, ccn_ringbuf_length(inbuf));
     }
-    if (msgstart < inbuf->length && msgstart > 0) {
-        /* move partial message to start of buffer */
-        memmove(inbuf->buf, inbuf->buf + msgstart,
-                inbuf->length - msgstart);
-        inbuf->length -= msgstart;
-        d->index -= msgstart;
+    if (d->state < 0) {
+        NOTE_ERR(h, EPROTO);
+        ccn_disconnect(h);
+        return(-1);
     }
+    if (crowded && ccn_ringbuf_capacity(inbuf) < CCN_INBUF_MAX_SIZE)
+        ccn_ringbuf_grow(inbuf, 2 * ccn_ringbuf_capacity(inbuf));
     return(0);
 }
 
@@ -1324,8 +1661,8 @@ ccn_update_refresh_us(struct ccn *h, struct timeval *tv)
 
 static void
 ccn_age_interest(struct ccn *h,
-                 struct expressed_interest *interest,
-                 const unsigned char *key, size_t keysize)
+                 struct interests_by_prefix *entry,
+                 struct expressed_interest *interest)
 {
     struct ccn_parsed_interest pi = {0};
     struct ccn_upcall_info info = {0};
@@ -1386,25 +1723,103 @@ ccn_age_interest(struct ccn *h,
             ccn_indexbuf_release(h, info.interest_comps);
         }
         if (ures == CCN_UPCALL_RESULT_REEXPRESS)
-            ccn_refresh_interest(h, interest);
+            ccn_refresh_interest(h, entry, interest);
         else
             interest->target = 0;
     }
 }
 
+/**
+ * Unlink an interest from its list and free it, along with the
+ * list's hash table entry if that is left empty.
+ */
+static void
+ccn_remove_interest(struct ccn *h, struct expressed_interest *interest)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct interests_by_prefix *entry = interest->entry;
+    struct expressed_interest **ip;
+    for (ip = &(entry->list); *ip != NULL; ip = &((*ip)->next)) {
+        if (*ip == interest) {
+            *ip = interest->next;
+            break;
+        }
+    }
+    /* Unlinked first, since the final upcall might express another */
+    ccn_destroy_interest(h, interest);
+    if (entry->list == NULL) {
+        hashtb_start(h->interests_by_prefix, e);
+        if (hashtb_seek(e, entry->key, entry->keysize, 0) == HT_OLD_ENTRY)
+            hashtb_delete(e);
+        hashtb_end(e);
+    }
+}
+
+/**
+ * Scheduled action for an expressed interest.
+ *
+ * Each interest has one of these pending, set for when its lifetime
+ * will be up, so that an interest is looked at only when something
+ * might need doing.  It is harmless for the event to come early, since
+ * the interest is simply aged and the event rescheduled.  Interests
+ * that are no longer wanted are disposed of here as well.
+ */
+static int
+ccn_interest_timer(struct ccn_schedule *sched,
+                   void *clienth,
+                   struct ccn_scheduled_event *ev,
+                   int flags)
+{
+    struct ccn *h = clienth;
+    struct expressed_interest *interest = ev->evdata;
+    int delta;
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
+        interest->ev = NULL;
+        return(0);
+    }
+    if (interest->magic != 0x7059e5f4) {
+        ccn_gripe(interest);
+        return(0);
+    }
+    ccn_check_pub_arrival(h, interest->entry, interest);
+    if (interest->target != 0)
+        ccn_age_interest(h, interest->entry, interest);
+    if (interest->target == 0 && interest->wanted_pub == NULL) {
+        interest->ev = NULL;
+        ccn_remove_interest(h, interest);
+        return(0);
+    }
+    if (interest->target == 0 || interest->outstanding == 0)
+        return(interest->lifetime_us); /* waiting for a key, or to send */
+    delta = (h->now.tv_sec  - interest->lasttime.tv_sec)*1000000 +
+            (h->now.tv_usec - interest->lasttime.tv_usec);
+    if (delta < 0)
+        delta = 0;
+    if (delta >= interest->lifetime_us)
+        return(1);
+    return(interest->lifetime_us - delta);
+}
+
+/**
+ * Give interests that were waiting for keys a chance to go again,
+ * if any new keys have come in.
+ */
 static void
-ccn_clean_all_interests(struct ccn *h)
+ccn_check_key_waiters(struct ccn *h)
 {
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
     struct interests_by_prefix *entry;
-    for (hashtb_start(h->interests_by_prefix, e); e->data != NULL;) {
+    struct expressed_interest *ie;
+    if (h->interests_by_prefix == NULL || h->keys == NULL ||
+        hashtb_n(h->keys) == h->keys_seen)
+        return;
+    h->keys_seen = hashtb_n(h->keys);
+    for (hashtb_start(h->interests_by_prefix, e); e->data != NULL; hashtb_next(e)) {
         entry = e->data;
-        ccn_clean_interests_by_prefix(h, entry);
-        if (entry->list == NULL)
-            hashtb_delete(e);
-        else
-            hashtb_next(e);
+        for (ie = entry->list; ie != NULL; ie = ie->next)
+            ccn_check_pub_arrival(h, entry, ie);
     }
     hashtb_end(e);
 }
@@ -1438,9 +1853,7 @@ ccn_process_scheduled_operations(struct ccn *h)
 {
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    struct interests_by_prefix *entry;
-    struct expressed_interest *ie;
-    int need_clean = 0;
+    int microsec;
     h->refresh_us = 5 * CCN_INTEREST_LIFETIME_MICROSEC;
     gettimeofday(&h->now, NULL);
     if (ccn_output_is_pending(h))
@@ -1458,29 +1871,11 @@ ccn_process_scheduled_operations(struct ccn *h)
         }
         hashtb_end(e);
     }
-    if (h->interests_by_prefix != NULL) {
-        for (hashtb_start(h->interests_by_prefix, e); e->data != NULL; hashtb_next(e)) {
-            entry = e->data;
-            ccn_check_interests(entry->list);
-            if (entry->list == NULL)
-                need_clean = 1;
-            else {
-                for (ie = entry->list; ie != NULL; ie = ie->next) {
-                    ccn_check_pub_arrival(h, ie);
-                    if (ie->target != 0)
-                        ccn_age_interest(h, ie, e->key, e->keysize);
-                    if (ie->target == 0 && ie->wanted_pub == NULL) {
-                        ccn_replace_handler(h, &(ie->action), NULL);
-                        replace_interest_msg(ie, NULL);
-                        need_clean = 1;
-                    }
-                }
-            }
-        }
-        hashtb_end(e);
-        if (need_clean)
-            ccn_clean_all_interests(h);
-    }
+    ccn_check_key_waiters(h);
+    /* Only the interests that are due */
+    microsec = ccn_schedule_run(h->sched);
+    if (microsec >= 0 && microsec < h->refresh_us)
+        h->refresh_us = microsec;
     h->running--;
     return(h->refresh_us);
 }
@@ -1502,6 +1897,126 @@ ccn_set_run_timeout(struct ccn *h, int timeout)
     return(ans);
 }
 
+/**
+ * Get ready to wait for a handle to have something to do.
+ *
+ * This is for client-managed event loops, and is what ccn_run does
+ * before each wait.  Scheduled work that is due is done (which may
+ * make upcalls) and corked output is sent.
+ * @param h is the ccn handle.
+ * @param fds has room for CCN_WAIT_MAX_FDS entries, which are set to
+ *        the descriptors to poll and the events wanted on each.
+ * @param timeoutp is set to the number of milliseconds until the
+ *        handle needs attention even if nothing becomes ready.
+ * @returns the number of fds set up, or -1 if not connected.
+ */
+int
+ccn_get_wait_info(struct ccn *h, struct pollfd *fds, int *timeoutp)
+{
+    int microsec;
+    int nfds;
+    if (h->running != 0)
+        return(NOTE_ERR(h, EBUSY));
+    if (h->sock == -1)
+        return(-1);
+    /*
+     * Corked output is pending until it is pushed, and pending output
+     * holds off the scheduled operations; so push first.
+     */
+    if (h->cork_size != 0)
+        ccn_pushout(h);
+    microsec = ccn_process_scheduled_operations(h);
+    if (h->sock == -1)
+        return(-1);
+    if (h->cork_size != 0)
+        ccn_pushout(h); /* end of a slice; send what was gathered */
+    memset(fds, 0, CCN_WAIT_MAX_FDS * sizeof(fds[0]));
+    fds[0].fd = h->sock;
+    fds[0].events = POLLIN;
+    nfds = 1;
+    if (h->shm != NULL) {
+        /* The socket only tells us when ccnd goes away */
+        fds[1].fd = ccn_shm_doorbell_fd(h->shm);
+        fds[1].events = POLLIN;
+        nfds = 2;
+        ccn_shm_prepare_wait(h->shm, ccn_output_is_pending(h));
+    }
+    else if (ccn_output_is_pending(h))
+        fds[0].events |= POLLOUT;
+    *timeoutp = (microsec + 999) / 1000;
+    return(nfds);
+}
+
+/**
+ * Ask ccnd to ring the doorbell again before control leaves the library.
+ *
+ * The doorbell is quiet once rung, so without this a caller polling
+ * the connection fd could sleep on input that is already in the ring.
+ * Anything that slipped in while we were not looking is handled once
+ * here; if more is left after that, the doorbell is left ringing.
+ */
+static void
+ccn_shm_rearm(struct ccn *h)
+{
+    if (h->shm == NULL || h->sock == -1)
+        return;
+    if (ccn_shm_prepare_wait(h->shm, ccn_output_is_pending(h))) {
+        ccn_shm_clear_doorbell(h->shm);
+        ccn_pushout(h);
+        ccn_process_input(h);
+        if (h->shm != NULL && h->sock != -1)
+            ccn_shm_prepare_wait(h->shm, ccn_output_is_pending(h));
+    }
+}
+
+/**
+ * Do the I/O that a wait set up by ccn_get_wait_info has turned up.
+ *
+ * Incoming messages are dispatched, so this makes upcalls.
+ * @param h is the ccn handle.
+ * @param fds are as filled in by ccn_get_wait_info, with revents set.
+ * @param nfds is the number of entries.
+ * @returns 0, or -1 if the handle is no longer connected.
+ */
+int
+ccn_process_ready(struct ccn *h, struct pollfd *fds, int nfds)
+{
+    short sock_revents = 0;
+    short bell_revents = 0;
+    int i;
+    if (h->running != 0)
+        return(NOTE_ERR(h, EBUSY));
+    if (h->sock == -1)
+        return(-1);
+    for (i = 0; i < nfds; i++) {
+        if (fds[i].fd == h->sock)
+            sock_revents |= fds[i].revents;
+        else if (h->shm != NULL && fds[i].fd == ccn_shm_doorbell_fd(h->shm))
+            bell_revents |= fds[i].revents;
+    }
+    if (h->shm != NULL) {
+        if (bell_revents != 0)
+            ccn_shm_clear_doorbell(h->shm);
+        if ((bell_revents | sock_revents) != 0) {
+            ccn_pushout(h);
+            ccn_process_input(h);
+        }
+        if (sock_revents != 0 && h->sock != -1)
+            ccn_disconnect(h);
+        else
+            ccn_shm_rearm(h);
+    }
+    else {
+        if ((sock_revents & POLLOUT) != 0)
+            ccn_pushout(h);
+        if ((sock_revents & (POLLIN | POLLERR | POLLHUP)) != 0)
+            ccn_process_input(h);
+    }
+    if (h->err == ENOTCONN && h->sock != -1)
+        ccn_disconnect(h);
+    return((h->sock == -1) ? -1 : 0);
+}
+
 /**
  * Run the ccn client event loop.
  * This may serve as the main event loop for simple apps by passing 
@@ -1514,21 +2029,21 @@ int
 ccn_run(struct ccn *h, int timeout)
 {
     struct timeval start;
-    struct pollfd fds[1];
-    int microsec;
+    struct pollfd fds[CCN_WAIT_MAX_FDS];
+    int nfds;
     int millisec;
+    int wait;
     int res = -1;
     if (h->running != 0)
         return(NOTE_ERR(h, EBUSY));
-    memset(fds, 0, sizeof(fds));
     memset(&start, 0, sizeof(start));
     h->timeout = timeout;
     for (;;) {
-        if (h->sock == -1) {
+        nfds = ccn_get_wait_info(h, fds, &wait);
+        if (nfds < 0) {
             res = -1;
             break;
         }
-        microsec = ccn_process_scheduled_operations(h);
         timeout = h->timeout;
         if (start.tv_sec == 0)
             start = h->now;
@@ -1540,34 +2055,383 @@ ccn_run(struct ccn *h, int timeout)
                 break;
             }
         }
-        fds[0].fd = h->sock;
-        fds[0].events = POLLIN;
-        if (ccn_output_is_pending(h))
-            fds[0].events |= POLLOUT;
-        millisec = microsec / 1000;
-        if (timeout >= 0 && timeout < millisec)
-            millisec = timeout;
-        res = poll(fds, 1, millisec);
+        if (timeout >= 0 && timeout < wait)
+            wait = timeout;
+        res = poll(fds, nfds, wait);
         if (res < 0 && errno != EINTR) {
             res = NOTE_ERRNO(h);
             break;
         }
-        if (res > 0) {
-            if ((fds[0].revents | POLLOUT) != 0)
-                ccn_pushout(h);
-            if ((fds[0].revents | POLLIN) != 0)
-                ccn_process_input(h);
-        }
-        if (h->err == ENOTCONN)
+        if (res > 0)
+            ccn_process_ready(h, fds, nfds);
+        if (h->err == ENOTCONN && h->sock != -1)
             ccn_disconnect(h);
         if (h->timeout == 0)
             break;
     }
+    if (h->cork_size != 0)
+        ccn_pushout(h);
+    ccn_shm_rearm(h);
     if (h->running != 0)
         abort();
     return((res < 0) ? res : 0);
 }
 
+struct ccn_multi_member;
+
+struct ccn_multi_slot {
+    struct ccn_multi_member *member;
+    int fd;                     /* as registered with epoll, or -1 */
+    short events;               /* as registered */
+};
+
+struct ccn_multi_member {
+    struct ccn *h;
+    int connects;               /* h->connects when last registered */
+    int nfds;                   /* -1 if not connected */
+    int ready;                  /* something turned up in the wait */
+    struct pollfd fds[CCN_WAIT_MAX_FDS];
+    struct ccn_multi_slot slot[CCN_WAIT_MAX_FDS];
+};
+
+/**
+ * A set of handles to be run together by ccn_run_multi.
+ *
+ * With epoll, each member's descriptors stay registered from one wait
+ * to the next, and are only touched when what the handle wants changes,
+ * so the cost of a wait does not grow with the number of idle members.
+ * Elsewhere (or if epoll cannot be had) a poll array is rebuilt each time.
+ */
+struct ccn_multi {
+    int epfd;                   /* -1 to use poll */
+    int running;
+    int n;
+    int limit;
+    struct ccn_multi_member **members;
+    struct pollfd *pfds;        /* for poll, or epoll results */
+};
+
+struct ccn_multi *
+ccn_multi_create(void)
+{
+    struct ccn_multi *m;
+    m = calloc(1, sizeof(*m));
+    if (m == NULL)
+        return(NULL);
+    m->epfd = -1;
+#ifdef CCN_HAVE_EPOLL
+    m->epfd = epoll_create(16);
+    if (m->epfd != -1)
+        fcntl(m->epfd, F_SETFD, FD_CLOEXEC);
+#endif
+    return(m);
+}
+
+void
+ccn_multi_destroy(struct ccn_multi **mp)
+{
+    struct ccn_multi *m = *mp;
+    int i;
+    if (m == NULL)
+        return;
+    for (i = 0; i < m->n; i++)
+        free(m->members[i]);
+    free(m->members);
+    free(m->pfds);
+    if (m->epfd != -1)
+        close(m->epfd);
+    free(m);
+    *mp = NULL;
+}
+
+static int
+ccn_multi_find(struct ccn_multi *m, struct ccn *h)
+{
+    int i;
+    for (i = 0; i < m->n; i++)
+        if (m->members[i]->h == h)
+            return(i);
+    return(-1);
+}
+
+/**
+ * Add a handle to the set.
+ * @returns 0, or -1 with errno set.
+ */
+int
+ccn_multi_add(struct ccn_multi *m, struct ccn *h)
+{
+    struct ccn_multi_member *mm;
+    void *p;
+    int i;
+    if (m->running != 0 || h == NULL) {
+        errno = (h == NULL) ? EINVAL : EBUSY;
+        return(-1);
+    }
+    if (ccn_multi_find(m, h) >= 0)
+        return(0);
+    if (m->n == m->limit) {
+        p = realloc(m->members, (2 * m->limit + 4) * sizeof(m->members[0]));
+        if (p == NULL)
+            return(-1);
+        m->members = p;
+        p = realloc(m->pfds, (2 * m->limit + 4) * CCN_WAIT_MAX_FDS *
+                             sizeof(m->pfds[0]));
+        if (p == NULL)
+            return(-1);
+        m->pfds = p;
+        m->limit = 2 * m->limit + 4;
+    }
+    mm = calloc(1, sizeof(*mm));
+    if (mm == NULL)
+        return(-1);
+    mm->h = h;
+    mm->connects = h->connects;
+    mm->nfds = -1;
+    for (i = 0; i < CCN_WAIT_MAX_FDS; i++) {
+        mm->slot[i].member = mm;
+        mm->slot[i].fd = -1;
+    }
+    m->members[m->n++] = mm;
+    return(0);
+}
+
+/**
+ * Take a handle out of the set.  The handle itself is left alone.
+ * @returns 0, or -1 with errno set.
+ */
+int
+ccn_multi_remove(struct ccn_multi *m, struct ccn *h)
+{
+    struct ccn_multi_member *mm;
+    int i;
+    if (m->running != 0) {
+        errno = EBUSY;
+        return(-1);
+    }
+    i = ccn_multi_find(m, h);
+    if (i < 0) {
+        errno = ENOENT;
+        return(-1);
+    }
+    mm = m->members[i];
+    m->members[i] = m->members[--m->n];
+#ifdef CCN_HAVE_EPOLL
+    if (m->epfd != -1 && mm->connects == h->connects) {
+        for (i = 0; i < CCN_WAIT_MAX_FDS; i++)
+            if (mm->slot[i].fd != -1)
+                epoll_ctl(m->epfd, EPOLL_CTL_DEL, mm->slot[i].fd, NULL);
+    }
+#endif
+    free(mm);
+    return(0);
+}
+
+#ifdef CCN_HAVE_EPOLL
+/**
+ * Bring the epoll registrations of a member up to date with what
+ * its handle now wants.
+ */
+static void
+ccn_multi_register(struct ccn_multi *m, struct ccn_multi_member *mm)
+{
+    struct ccn_multi_slot *slot;
+    struct epoll_event ev;
+    short events;
+    int fd;
+    int op;
+    int res;
+    int i;
+    if (mm->nfds < 0 || mm->connects != mm->h->connects) {
+        /* Closing the old connection took it out of the epoll set */
+        for (i = 0; i < CCN_WAIT_MAX_FDS; i++)
+            mm->slot[i].fd = -1;
+        mm->connects = mm->h->connects;
+    }
+    for (i = 0; i < CCN_WAIT_MAX_FDS; i++) {
+        slot = &mm->slot[i];
+        fd = (i < mm->nfds) ? mm->fds[i].fd : -1;
+        events = (i < mm->nfds) ? mm->fds[i].events : 0;
+        if (slot->fd == fd && (fd == -1 || slot->events == events))
+            continue;
+        if (slot->fd != -1 && slot->fd != fd) {
+            epoll_ctl(m->epfd, EPOLL_CTL_DEL, slot->fd, NULL);
+            slot->fd = -1;
+        }
+        if (fd == -1)
+            continue;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = (((events & POLLIN) != 0) ? EPOLLIN : 0) |
+                    (((events & POLLOUT) != 0) ? EPOLLOUT : 0);
+        ev.data.ptr = slot;
+        op = (slot->fd == fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        res = epoll_ctl(m->epfd, op, fd, &ev);
+        if (res == -1 && errno == ENOENT)
+            res = epoll_ctl(m->epfd, EPOLL_CTL_ADD, fd, &ev);
+        else if (res == -1 && errno == EEXIST)
+            res = epoll_ctl(m->epfd, EPOLL_CTL_MOD, fd, &ev);
+        slot->fd = (res == 0) ? fd : -1;
+        slot->events = events;
+    }
+}
+
+/**
+ * Wait with epoll, and note in each member's fds what turned up.
+ */
+static int
+ccn_multi_epoll_wait(struct ccn_multi *m, int wait)
+{
+    struct epoll_event events[64];
+    struct ccn_multi_slot *slot;
+    struct pollfd *pfd;
+    int res;
+    int i;
+    res = epoll_wait(m->epfd, events, 64, wait);
+    for (i = 0; i < res; i++) {
+        slot = events[i].data.ptr;
+        pfd = &slot->member->fds[slot - slot->member->slot];
+        pfd->revents =
+            (((events[i].events & EPOLLIN) != 0) ? POLLIN : 0) |
+            (((events[i].events & EPOLLOUT) != 0) ? POLLOUT : 0) |
+            (((events[i].events & EPOLLERR) != 0) ? POLLERR : 0) |
+            (((events[i].events & EPOLLHUP) != 0) ? POLLHUP : 0);
+        slot->member->ready = 1;
+    }
+    return(res);
+}
+#endif
+
+/**
+ * Wait with poll, and note in each member's fds what turned up.
+ */
+static int
+ccn_multi_poll_wait(struct ccn_multi *m, int wait)
+{
+    struct ccn_multi_member *mm;
+    int nfds = 0;
+    int res;
+    int i;
+    int j;
+    for (i = 0; i < m->n; i++) {
+        mm = m->members[i];
+        for (j = 0; j < mm->nfds; j++)
+            m->pfds[nfds++] = mm->fds[j];
+    }
+    res = poll(m->pfds, nfds, wait);
+    if (res <= 0)
+        return(res);
+    for (nfds = 0, i = 0; i < m->n; i++) {
+        mm = m->members[i];
+        for (j = 0; j < mm->nfds; j++, nfds++) {
+            mm->fds[j].revents = m->pfds[nfds].revents;
+            if (mm->fds[j].revents != 0)
+                mm->ready = 1;
+        }
+    }
+    return(res);
+}
+
+/**
+ * Run the event loop for a set of handles.
+ *
+ * This does for every handle in the set what ccn_run does for one,
+ * with a single wait covering all of their connections.  An upcall may
+ * end the run early by setting its handle's run timeout to 0.
+ * @param m is the set of handles.
+ * @param timeout is in milliseconds, or -1 to run until none of the
+ *        handles is connected.
+ * @returns a negative value for error, zero for success.
+ */
+int
+ccn_run_multi(struct ccn_multi *m, int timeout)
+{
+    struct ccn_multi_member *mm;
+    struct timeval start;
+    struct timeval now;
+    int millisec;
+    int wait;
+    int live;
+    int stop;
+    int res = -1;
+    int i;
+    if (m->running != 0) {
+        errno = EBUSY;
+        return(-1);
+    }
+    for (i = 0; i < m->n; i++) {
+        if (m->members[i]->h->running != 0) {
+            errno = EBUSY;
+            return(-1);
+        }
+    }
+    for (i = 0; i < m->n; i++)
+        m->members[i]->h->timeout = timeout;
+    m->running = 1;
+    gettimeofday(&start, NULL);
+    for (;;) {
+        live = 0;
+        wait = -1;
+        timeout = -1;
+        for (i = 0; i < m->n; i++) {
+            mm = m->members[i];
+            mm->ready = 0;
+            mm->nfds = ccn_get_wait_info(mm->h, mm->fds, &millisec);
+#ifdef CCN_HAVE_EPOLL
+            if (m->epfd != -1)
+                ccn_multi_register(m, mm);
+#endif
+            if (mm->nfds < 0)
+                continue;
+            live++;
+            if (wait < 0 || millisec < wait)
+                wait = millisec;
+            if (mm->h->timeout >= 0 &&
+                (timeout < 0 || mm->h->timeout < timeout))
+                timeout = mm->h->timeout;
+        }
+        if (live == 0) {
+            res = -1;
+            break;
+        }
+        if (timeout >= 0) {
+            gettimeofday(&now, NULL);
+            millisec = (now.tv_sec  - start.tv_sec) * 1000 +
+                       (now.tv_usec - start.tv_usec) / 1000;
+            if (millisec > timeout) {
+                res = 0;
+                break;
+            }
+            if (timeout - millisec < wait || wait < 0)
+                wait = timeout - millisec;
+        }
+#ifdef CCN_HAVE_EPOLL
+        if (m->epfd != -1)
+            res = ccn_multi_epoll_wait(m, wait);
+        else
+#endif
+            res = ccn_multi_poll_wait(m, wait);
+        if (res < 0 && errno != EINTR)
+            break;
+        stop = (timeout == 0);
+        for (i = 0; i < m->n; i++) {
+            mm = m->members[i];
+            if (mm->ready)
+                ccn_process_ready(mm->h, mm->fds, mm->nfds);
+            if (mm->h->timeout == 0)
+                stop = 1;
+        }
+        if (stop)
+            break;
+    }
+    for (i = 0; i < m->n; i++) {
+        mm = m->members[i];
+        if (mm->h->cork_size != 0 && mm->h->sock != -1)
+            ccn_pushout(mm->h);
+    }
+    m->running = 0;
+    return((res < 0) ? -1 : 0);
+}
+
 /* This is the upcall for implementing ccn_get() */
 struct simple_get_data {
     struct ccn_closure closure;
@@ -2218,6 +3082,50 @@ ccn_chk_signing_params(struct ccn *h,
     return(res);
 }
 
+/**
+ * Append a KeyLocator that contains the public key of keystore.
+ * @returns 0 for success, -1 for error
+ */
+static int
+ccn_append_key_locator_key(struct ccn_charbuf *c, struct ccn_keystore *keystore)
+{
+    int res = 0;
+    
+    res |= ccn_charbuf_append_tt(c, CCN_DTAG_KeyLocator, CCN_DTAG);
+    res |= ccn_charbuf_append_tt(c, CCN_DTAG_Key, CCN_DTAG);
+    if (ccn_append_pubkey_blob(c, ccn_keystore_public_key(keystore)) < 0)
+        res = -1;
+    res |= ccn_charbuf_append_closer(c); /* </Key> */
+    res |= ccn_charbuf_append_closer(c); /* </KeyLocator> */
+    return(res == 0 ? 0 : -1);
+}
+
+/**
+ * Append a FinalBlockID blob that marks the last component of name
+ * as the final block.
+ * @returns 0 for success, -1 for error
+ */
+static int
+ccn_append_final_block_id(struct ccn_charbuf *c,
+                          const struct ccn_charbuf *name)
+{
+    struct ccn_indexbuf *ndx;
+    const unsigned char *comp = NULL;
+    size_t size = 0;
+    int ncomp;
+    int res = -1;
+    
+    ndx = ccn_indexbuf_create();
+    ncomp = ccn_name_split(name, ndx);
+    if (ncomp > 0 &&
+        ccn_name_comp_get(name->buf, ndx, ncomp - 1, &comp, &size) == 0) {
+        res = ccn_charbuf_append_tt(c, size, CCN_BLOB);
+        res |= ccn_charbuf_append(c, comp, size);
+    }
+    ccn_indexbuf_destroy(&ndx);
+    return(res == 0 ? 0 : -1);
+}
+
 /**
  * Create a signed ContentObject.
  *
@@ -2256,33 +3164,14 @@ ccn_sign_content(struct ccn *h,
         keystore = *pk;
         signed_info = ccn_charbuf_create();
         if (keylocator == NULL && (p.sp_flags & CCN_SP_OMIT_KEY_LOCATOR) == 0) {
-            /* Construct a key locator containing the key itself */
             keylocator = ccn_charbuf_create();
-            ccn_charbuf_append_tt(keylocator, CCN_DTAG_KeyLocator, CCN_DTAG);
-            ccn_charbuf_append_tt(keylocator, CCN_DTAG_Key, CCN_DTAG);
-            res = ccn_append_pubkey_blob(keylocator,
-                                         ccn_keystore_public_key(keystore));
-            ccn_charbuf_append_closer(keylocator); /* </Key> */
-            ccn_charbuf_append_closer(keylocator); /* </KeyLocator> */
+            res = ccn_append_key_locator_key(keylocator, keystore);
         }
         if (res >= 0 && (p.sp_flags & CCN_SP_FINAL_BLOCK) != 0) {
-            int ncomp;
-            struct ccn_indexbuf *ndx;
-            const unsigned char *comp = NULL;
-            size_t size = 0;
-            
-            ndx = ccn_indexbuf_create();
-            ncomp = ccn_name_split(name_prefix, ndx);
-            if (ncomp < 0)
+            finalblockid = ccn_charbuf_create();
+            res = ccn_append_final_block_id(finalblockid, name_prefix);
+            if (res < 0)
                 res = NOTE_ERR(h, EINVAL);
-            else {
-                finalblockid = ccn_charbuf_create();
-                ccn_name_comp_get(name_prefix->buf,
-                                  ndx, ncomp - 1, &comp, &size);
-                ccn_charbuf_append_tt(finalblockid, size, CCN_BLOB);
-                ccn_charbuf_append(finalblockid, comp, size);
-            }
-            ccn_indexbuf_destroy(&ndx);
         }
         if (res >= 0)
             res = ccn_signed_info_create(signed_info,
@@ -2313,3 +3202,196 @@ ccn_sign_content(struct ccn *h,
     ccn_charbuf_destroy(&signed_info);
     return(res);
 }
+
+/**
+ * State for signing a stream of ContentObjects that share their
+ * signing parameters.
+ *
+ * The invariant parts of the SignedInfo are encoded once, when the
+ * context is created; each object then needs only its Timestamp and
+ * FinalBlockID filled in before the digest and signature are computed.
+ */
+struct ccn_signing_context {
+    struct ccn *h;
+    struct ccn_keystore *keystore;  /**< owned by h->keystores */
+    int sp_flags;
+    struct ccn_charbuf *si_head;    /**< SignedInfo start through publisher id */
+    struct ccn_charbuf *si_middle;  /**< Type and FreshnessSeconds */
+    struct ccn_charbuf *si_tail;    /**< KeyLocator and SignedInfo closer */
+    struct ccn_charbuf *timestamp;  /**< from template, or NULL for "now" */
+    struct ccn_charbuf *finalblockid; /**< from template, or NULL */
+    struct ccn_charbuf *signed_info; /**< scratch for the assembled result */
+};
+
+/**
+ * Create a reusable signing context.
+ *
+ * The params are interpreted just as for ccn_sign_content(), and are
+ * checked and captured at this time.  The context refers to a private key
+ * held by the handle, so it must be destroyed before the handle is.
+ *
+ * @param h is the ccn handle
+ * @param params describe the ancillary information needed, or NULL for
+ *        the defaults
+ * @returns the new context, or NULL for error
+ */
+struct ccn_signing_context *
+ccn_signing_context_create(struct ccn *h,
+                           const struct ccn_signing_params *params)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_signing_params p = CCN_SIGNING_PARAMS_INIT;
+    struct ccn_signing_context *sc = NULL;
+    struct ccn_charbuf *keylocator = NULL;
+    struct ccn_keystore *keystore = NULL;
+    int res;
+    
+    sc = calloc(1, sizeof(*sc));
+    if (sc == NULL) {
+        NOTE_ERRNO(h);
+        return(NULL);
+    }
+    res = ccn_chk_signing_params(h, params, &p, &sc->timestamp,
+                                 &sc->finalblockid, &keylocator);
+    if (res >= 0) {
+        hashtb_start(h->keystores, e);
+        if (hashtb_seek(e, p.pubid, sizeof(p.pubid), 0) == HT_OLD_ENTRY) {
+            struct ccn_keystore **pk = e->data;
+            keystore = *pk;
+        }
+        else {
+            res = NOTE_ERR(h, -1);
+            hashtb_delete(e);
+        }
+        hashtb_end(e);
+    }
+    if (res < 0)
+        goto Bail;
+    sc->h = h;
+    sc->keystore = keystore;
+    sc->sp_flags = p.sp_flags;
+    sc->si_head = ccn_charbuf_create();
+    sc->si_middle = ccn_charbuf_create();
+    sc->si_tail = ccn_charbuf_create();
+    sc->signed_info = ccn_charbuf_create();
+    if (sc->si_head == NULL || sc->si_middle == NULL ||
+        sc->si_tail == NULL || sc->signed_info == NULL) {
+        NOTE_ERRNO(h);
+        goto Bail;
+    }
+    /* This follows the layout produced by ccn_signed_info_create() */
+    res |= ccn_charbuf_append_tt(sc->si_head, CCN_DTAG_SignedInfo, CCN_DTAG);
+    res |= ccnb_append_tagged_blob(sc->si_head,
+                                   CCN_DTAG_PublisherPublicKeyDigest,
+                                   ccn_keystore_public_key_digest(keystore),
+                                   ccn_keystore_public_key_digest_length(keystore));
+    if (p.type != CCN_CONTENT_DATA) {
+        res |= ccn_charbuf_append_tt(sc->si_middle, CCN_DTAG_Type, CCN_DTAG);
+        res |= ccn_charbuf_append_tt(sc->si_middle, 3, CCN_BLOB);
+        res |= ccn_charbuf_append_value(sc->si_middle, p.type, 3);
+        res |= ccn_charbuf_append_closer(sc->si_middle);
+    }
+    if (p.freshness >= 0)
+        res |= ccnb_tagged_putf(sc->si_middle, CCN_DTAG_FreshnessSeconds,
+                                "%d", p.freshness);
+    if (keylocator != NULL)
+        res |= ccn_charbuf_append_charbuf(sc->si_tail, keylocator);
+    else if ((p.sp_flags & CCN_SP_OMIT_KEY_LOCATOR) == 0)
+        res |= ccn_append_key_locator_key(sc->si_tail, keystore);
+    res |= ccn_charbuf_append_closer(sc->si_tail); /* </SignedInfo> */
+    if (res != 0) {
+        NOTE_ERR(h, EINVAL);
+        goto Bail;
+    }
+    ccn_charbuf_destroy(&keylocator);
+    return(sc);
+Bail:
+    ccn_charbuf_destroy(&keylocator);
+    ccn_signing_context_destroy(&sc);
+    return(NULL);
+}
+
+/**
+ * Destroy a signing context created by ccn_signing_context_create().
+ */
+void
+ccn_signing_context_destroy(struct ccn_signing_context **scp)
+{
+    struct ccn_signing_context *sc = *scp;
+    
+    if (sc == NULL)
+        return;
+    ccn_charbuf_destroy(&sc->si_head);
+    ccn_charbuf_destroy(&sc->si_middle);
+    ccn_charbuf_destroy(&sc->si_tail);
+    ccn_charbuf_destroy(&sc->timestamp);
+    ccn_charbuf_destroy(&sc->finalblockid);
+    ccn_charbuf_destroy(&sc->signed_info);
+    free(sc);
+    *scp = NULL;
+}
+
+/**
+ * Create a signed ContentObject using a signing context.
+ *
+ * The result is the same as ccn_sign_content() would produce given the
+ * params that were used to create the context, but only the Timestamp
+ * and FinalBlockID portions of the SignedInfo are encoded per call.
+ *
+ * @param sc is the signing context
+ * @param resultbuf - result buffer to which the ContentObject will be appended
+ * @param name_prefix contains the ccnb-encoded name
+ * @param sp_flags may be CCN_SP_FINAL_BLOCK to mark this object as the
+ *        final block, in addition to the flags the context was created with;
+ *        other bits are not allowed
+ * @param data points to the raw content
+ * @param size is the size of the raw content, in bytes
+ * @returns 0 for success, -1 for error
+ */
+int
+ccn_signing_context_sign(struct ccn_signing_context *sc,
+                         struct ccn_charbuf *resultbuf,
+                         const struct ccn_charbuf *name_prefix,
+                         int sp_flags,
+                         const void *data, size_t size)
+{
+    struct ccn *h = sc->h;
+    struct ccn_charbuf *si = sc->signed_info;
+    int res = 0;
+    
+    if ((sp_flags & ~CCN_SP_FINAL_BLOCK) != 0 ||
+        (sp_flags != 0 && sc->finalblockid != NULL))
+        return(NOTE_ERR(h, EINVAL));
+    sp_flags |= sc->sp_flags;
+    si->length = 0;
+    res |= ccn_charbuf_append_charbuf(si, sc->si_head);
+    res |= ccn_charbuf_append_tt(si, CCN_DTAG_Timestamp, CCN_DTAG);
+    if (sc->timestamp != NULL)
+        res |= ccn_charbuf_append_charbuf(si, sc->timestamp);
+    else
+        res |= ccnb_append_now_blob(si, CCN_MARKER_NONE);
+    res |= ccn_charbuf_append_closer(si);
+    res |= ccn_charbuf_append_charbuf(si, sc->si_middle);
+    if (sc->finalblockid != NULL || (sp_flags & CCN_SP_FINAL_BLOCK) != 0) {
+        res |= ccn_charbuf_append_tt(si, CCN_DTAG_FinalBlockID, CCN_DTAG);
+        if (sc->finalblockid != NULL)
+            res |= ccn_charbuf_append_charbuf(si, sc->finalblockid);
+        else
+            res |= ccn_append_final_block_id(si, name_prefix);
+        res |= ccn_charbuf_append_closer(si);
+    }
+    res |= ccn_charbuf_append_charbuf(si, sc->si_tail);
+    if (res != 0)
+        return(NOTE_ERR(h, EINVAL));
+    res = ccn_encode_ContentObject(resultbuf,
+                                   name_prefix,
+                                   si,
+                                   data,
+                                   size,
+                                   NULL, // XXX
+                                   ccn_keystore_private_key(sc->keystore));
+    if (res < 0)
+        return(NOTE_ERR(h, -1));
+    return(0);
+}
@@ -17,6 +17,8 @@
  * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
  * Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <stdint.h>
+#include <string.h>
 #include <ccn/coding.h>
 
 /**
@@ -26,6 +28,9 @@
  */
 #define XML(goop) ((void)0)
 
+static ssize_t skeleton_decode(struct ccn_skeleton_decoder *d,
+                               const unsigned char *p, size_t n, int fast);
+
 /**
  * Decodes ccnb decoded data
  *
@@ -56,6 +61,146 @@
 ssize_t
 ccn_skeleton_decode(struct ccn_skeleton_decoder *d,
                     const unsigned char *p, size_t n)
+{
+    return(skeleton_decode(d, p, n, 1));
+}
+
+/**
+ * Decodes ccnb decoded data one byte at a time
+ *
+ * This is the general state machine without the fast path of
+ * ccn_skeleton_decode().  The results are exactly the same; it is
+ * provided as a reference for testing.
+ */
+ssize_t
+ccn_skeleton_decode_bytewise(struct ccn_skeleton_decoder *d,
+                             const unsigned char *p, size_t n)
+{
+    return(skeleton_decode(d, p, n, 0));
+}
+
+/**
+ * Find the size of a token header.
+ *
+ * The final byte of a header is the only one with the high bit set.
+ * Where possible, the first 8 bytes are checked all at once.
+ * @returns the number of bytes in the header, or 0 if it is not
+ *          found within the first 8 bytes of the available input.
+ */
+static size_t
+skeleton_header_size(const unsigned char *p, size_t avail)
+{
+    size_t k;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t w;
+    
+    if (avail >= 8) {
+        memcpy(&w, p, sizeof(w));
+        w &= 0x8080808080808080ULL;
+        if (w == 0)
+            return(0);
+        return((__builtin_ctzll(w) >> 3) + 1);
+    }
+#endif
+    for (k = 0; k < avail && k < 8; k++)
+        if ((p[k] & CCN_TT_HBIT) != CCN_CLOSE)
+            return(k + 1);
+    return(0);
+}
+
+/**
+ * Fast path for the skeleton decoder.
+ *
+ * Consumes whole DTAG, BLOB, UDATA and CLOSE tokens, which make up
+ * nearly all real traffic, without stepping through the general state
+ * machine for each header byte; BLOB and UDATA bodies are skipped in one
+ * step.  Called only at the start of a token, outside of pause mode
+ * and attribute processing.  On reaching anything else (another token
+ * type, a header split across buffers, an error) it stops at the start
+ * of that token, so that the general code can produce exactly the same
+ * outcome.
+ *
+ * @returns the new input index.  *statep is set to CCN_DSTATE_INITIAL
+ *          if the outermost element was closed, or to the body state if
+ *          the input ends in the middle of a BLOB or UDATA.
+ */
+static size_t
+skeleton_fast(struct ccn_skeleton_decoder *d,
+              const unsigned char *p, size_t i, size_t n,
+              int *statep, int *tagstatep, size_t *numvalp)
+{
+    int tagstate = *tagstatep;
+    size_t numval = *numvalp;
+    size_t chunk;
+    size_t val;
+    size_t k;
+    size_t j;
+    unsigned char c;
+    
+    while (i < n) {
+        c = p[i];
+        if (c == CCN_CLOSE) {
+            if (d->nest <= 0)
+                break;
+            d->token_index = i + d->index;
+            i++;
+            tagstate = 0;
+            d->nest -= 1;
+            if (d->nest == 0) {
+                *statep = CCN_DSTATE_INITIAL;
+                break;
+            }
+            continue;
+        }
+        if ((c & CCN_TT_HBIT) != CCN_CLOSE)
+            k = 1;
+        else
+            k = skeleton_header_size(p + i, n - i);
+        if (k == 0)
+            break;
+        c = p[i + k - 1];
+        if ((c & CCN_TT_MASK) != CCN_DTAG && (c & CCN_TT_MASK) != CCN_BLOB &&
+            (c & CCN_TT_MASK) != CCN_UDATA)
+            break;
+        val = 0;
+        for (j = 0; j + 1 < k; j++) {
+            if (val > ((~(size_t)0U) >> (7 + CCN_TT_BITS)))
+                break;
+            val = (val << 7) + (p[i + j] & 127);
+        }
+        if (j + 1 < k)
+            break; /* let the general code report the overflow */
+        numval = (val << (7-CCN_TT_BITS)) +
+                 ((c >> CCN_TT_BITS) & CCN_MAX_TINY);
+        d->token_index = i + d->index;
+        i += k;
+        if ((c & CCN_TT_MASK) == CCN_DTAG) {
+            d->nest += 1;
+            d->element_index = d->token_index;
+            tagstate = 1;
+            continue;
+        }
+        tagstate = 0;
+        chunk = n - i;
+        if (chunk > numval)
+            chunk = numval;
+        numval -= chunk;
+        i += chunk;
+        if (numval != 0) {
+            *statep = ((c & CCN_TT_MASK) == CCN_BLOB) ?
+                      CCN_DSTATE_BLOB : CCN_DSTATE_UDATA;
+            break;
+        }
+    }
+    *tagstatep = tagstate;
+    *numvalp = numval;
+    return(i);
+}
+
+static ssize_t
+skeleton_decode(struct ccn_skeleton_decoder *d,
+                const unsigned char *p, size_t n, int fast)
 {
     enum ccn_decoder_state state = d->state;
     int tagstate = 0;
@@ -73,6 +218,21 @@ ccn_skeleton_decode(struct ccn_skeleton_decoder *d,
         switch (state) {
             case CCN_DSTATE_INITIAL:
             case CCN_DSTATE_NEWTOKEN: /* start new thing */
+                if (fast && !pause && tagstate <= 1) {
+                    int fstate = CCN_DSTATE_NEWTOKEN;
+                    ssize_t start = i;
+                    i = skeleton_fast(d, p, i, n, &fstate, &tagstate, &numval);
+                    if (i != start)
+                        state = CCN_DSTATE_NEWTOKEN;
+                    if (fstate != CCN_DSTATE_NEWTOKEN) {
+                        state = fstate;
+                        if (state == CCN_DSTATE_INITIAL)
+                            n = i;
+                        break;
+                    }
+                    if (i == n)
+                        break;
+                }
                 d->token_index = i + d->index;
                 if (tagstate > 1 && tagstate-- == 2) {
                     XML("\""); /* close off the attribute value */
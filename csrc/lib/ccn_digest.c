@@ -17,10 +17,26 @@
  * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
  * Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <openssl/sha.h>
 #include <ccn/digest.h>
 
+#if defined(__GNUC__) && !defined(CCN_DIGEST_NO_MULTIBUF)
+#define CCN_DIGEST_HAVE_MULTIBUF 1
+#endif
+
+/* Left unoptimized, the lanes lose to OpenSSL's assembly, so AUTO skips them */
+#if defined(CCN_DIGEST_HAVE_MULTIBUF) && defined(__OPTIMIZE__)
+#define CCN_DIGEST_AUTO_MULTIBUF 1
+#endif
+
+#if defined(CCN_DIGEST_HAVE_MULTIBUF) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define CCN_DIGEST_HAVE_CPUID 1
+#endif
+
 struct ccn_digest {
     enum ccn_digest_id id;
     unsigned short sz;
@@ -99,3 +115,321 @@ ccn_digest_final(struct ccn_digest *d, unsigned char *result, size_t digest_size
     d->ready = 0;
     return((res == 1) ? 0 : -1);
 }
+
+/*
+ * Batched SHA-256
+ *
+ * The multi-buffer engine runs the SHA-256 compression function on
+ * MB_LANES independent messages at once, one message per element of a
+ * vector.  It is written with the GCC vector extensions so that the
+ * compiler can use whatever SIMD unit the target has (SSE2, NEON),
+ * without any assembly or special build flags; on x86 a copy compiled
+ * for AVX2 is chosen at run time if the processor has it.  When a lane's
+ * message is done, the next pending job is started in that lane.
+ *
+ * On processors with the SHA instruction set extensions, OpenSSL's
+ * single-buffer code is faster still, so the automatic choice uses that.
+ */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* These work on both scalars and vectors */
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define BSIG0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BSIG1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SSIG0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+static uint32_t
+get_be32(const unsigned char *p)
+{
+    return(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+static void
+put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int
+sha256_scalar_many(struct ccn_digest_job *jobs, int n)
+{
+    int i;
+    
+    for (i = 0; i < n; i++)
+        SHA256(jobs[i].data, jobs[i].size, jobs[i].result);
+    return(0);
+}
+
+#ifdef CCN_DIGEST_HAVE_MULTIBUF
+
+#define MB_LANES 8
+typedef uint32_t mb_vec __attribute__((vector_size(4 * MB_LANES)));
+
+struct mb_lane {
+    struct ccn_digest_job *job; /* NULL if the lane is idle */
+    size_t nblocks;             /* including the padding */
+    size_t next;                /* next block to be compressed */
+    unsigned char pad[128];     /* the final one or two blocks */
+};
+
+static void
+sha256_block(uint32_t st[8], const unsigned char *p)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    int t;
+    
+    for (t = 0; t < 16; t++)
+        w[t] = get_be32(p + 4 * t);
+    for (; t < 64; t++)
+        w[t] = SSIG1(w[t - 2]) + w[t - 7] + SSIG0(w[t - 15]) + w[t - 16];
+    a = st[0]; b = st[1]; c = st[2]; d = st[3];
+    e = st[4]; f = st[5]; g = st[6]; h = st[7];
+    for (t = 0; t < 64; t++) {
+        t1 = h + BSIG1(e) + CH(e, f, g) + sha256_k[t] + w[t];
+        t2 = BSIG0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+    st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+}
+
+static inline __attribute__((always_inline)) void
+mb_block_body(mb_vec st[8], const unsigned char *blk[MB_LANES])
+{
+    mb_vec w[16];
+    mb_vec a, b, c, d, e, f, g, h, k, t1, t2;
+    int i, t;
+    
+    for (t = 0; t < 16; t++)
+        for (i = 0; i < MB_LANES; i++)
+            w[t][i] = get_be32(blk[i] + 4 * t);
+    a = st[0]; b = st[1]; c = st[2]; d = st[3];
+    e = st[4]; f = st[5]; g = st[6]; h = st[7];
+    for (t = 0; t < 64; t++) {
+        if (t >= 16)
+            w[t & 15] = SSIG1(w[(t - 2) & 15]) + w[(t - 7) & 15] +
+                        SSIG0(w[(t - 15) & 15]) + w[t & 15];
+        for (i = 0; i < MB_LANES; i++)
+            k[i] = sha256_k[t];
+        t1 = h + BSIG1(e) + CH(e, f, g) + k + w[t & 15];
+        t2 = BSIG0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+    st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+}
+
+typedef void (*mb_block_fn)(mb_vec st[8], const unsigned char *blk[MB_LANES]);
+
+static void
+mb_block(mb_vec st[8], const unsigned char *blk[MB_LANES])
+{
+    mb_block_body(st, blk);
+}
+
+#ifdef CCN_DIGEST_HAVE_CPUID
+/* The same code, compiled to use the full width of AVX2 registers */
+__attribute__((target("avx2"))) static void
+mb_block_avx2(mb_vec st[8], const unsigned char *blk[MB_LANES])
+{
+    mb_block_body(st, blk);
+}
+#endif
+
+static mb_block_fn
+mb_choose_block_fn(void)
+{
+#ifdef CCN_DIGEST_HAVE_CPUID
+    if (__builtin_cpu_supports("avx2"))
+        return(&mb_block_avx2);
+#endif
+    return(&mb_block);
+}
+
+static void
+mb_lane_start(struct mb_lane *l, mb_vec st[8], int i,
+              struct ccn_digest_job *job)
+{
+    size_t full = job->size / 64;
+    size_t rem = job->size % 64;
+    size_t padlen = (rem < 56) ? 64 : 128;
+    uint64_t bits = (uint64_t)job->size * 8;
+    int j;
+    
+    memset(l->pad, 0, padlen);
+    memcpy(l->pad, (const unsigned char *)job->data + 64 * full, rem);
+    l->pad[rem] = 0x80;
+    for (j = 0; j < 8; j++)
+        l->pad[padlen - 1 - j] = bits >> (8 * j);
+    l->job = job;
+    l->nblocks = full + padlen / 64;
+    l->next = 0;
+    for (j = 0; j < 8; j++)
+        st[j][i] = sha256_iv[j];
+}
+
+static const unsigned char *
+mb_lane_block(struct mb_lane *l)
+{
+    size_t full = l->job->size / 64;
+    
+    if (l->next < full)
+        return((const unsigned char *)l->job->data + 64 * l->next);
+    return(l->pad + 64 * (l->next - full));
+}
+
+static int
+sha256_multibuf_many(struct ccn_digest_job *jobs, int n)
+{
+    static const unsigned char idle[64];
+    mb_block_fn block = mb_choose_block_fn();
+    struct mb_lane lane[MB_LANES];
+    const unsigned char *blk[MB_LANES];
+    mb_vec st[8];
+    uint32_t st1[8];
+    int nextjob = 0;
+    int active = 0;
+    int i, j;
+    
+    memset(st, 0, sizeof(st));
+    for (i = 0; i < MB_LANES; i++) {
+        lane[i].job = NULL;
+        if (nextjob < n) {
+            mb_lane_start(&lane[i], st, i, &jobs[nextjob++]);
+            active++;
+        }
+    }
+    while (active > 1 || (active == 1 && nextjob < n)) {
+        for (i = 0; i < MB_LANES; i++)
+            blk[i] = (lane[i].job != NULL) ? mb_lane_block(&lane[i]) : idle;
+        (*block)(st, blk);
+        for (i = 0; i < MB_LANES; i++) {
+            if (lane[i].job == NULL || ++(lane[i].next) < lane[i].nblocks)
+                continue;
+            for (j = 0; j < 8; j++)
+                put_be32(lane[i].job->result + 4 * j, st[j][i]);
+            lane[i].job = NULL;
+            active--;
+            if (nextjob < n) {
+                mb_lane_start(&lane[i], st, i, &jobs[nextjob++]);
+                active++;
+            }
+        }
+    }
+    /* A lone straggler is cheaper to finish one lane at a time */
+    for (i = 0; i < MB_LANES && active > 0; i++) {
+        if (lane[i].job == NULL)
+            continue;
+        for (j = 0; j < 8; j++)
+            st1[j] = st[j][i];
+        for (; lane[i].next < lane[i].nblocks; lane[i].next++)
+            sha256_block(st1, mb_lane_block(&lane[i]));
+        for (j = 0; j < 8; j++)
+            put_be32(lane[i].job->result + 4 * j, st1[j]);
+        active--;
+    }
+    return(0);
+}
+#endif
+
+#ifdef CCN_DIGEST_AUTO_MULTIBUF
+/*
+ * Check for the x86 SHA extensions, which OpenSSL uses if present.
+ */
+static int
+have_sha_extensions(void)
+{
+#ifdef CCN_DIGEST_HAVE_CPUID
+    static int cached = -1;
+    unsigned a, b, c, d;
+    
+    if (cached < 0) {
+        cached = 0;
+        if (__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, a, b, c, d);
+            cached = (b >> 29) & 1;
+        }
+    }
+    return(cached);
+#else
+    return(0);
+#endif
+}
+#endif
+
+/**
+ * Compute the digests of several independent buffers.
+ *
+ * @param id selects the digest algorithm; only SHA256 is supported.
+ * @param jobs describe the buffers and where their digests go.
+ * @param n is the number of jobs.
+ * @param engine selects the implementation; an engine that is not
+ *        available falls back to one that is.
+ * @returns 0 for success, -1 for error.
+ */
+int
+ccn_digest_many_with(enum ccn_digest_id id, struct ccn_digest_job *jobs,
+                     int n, enum ccn_digest_engine engine)
+{
+    if (id != CCN_DIGEST_DEFAULT && id != CCN_DIGEST_SHA256)
+        return(-1);
+    if (n <= 0)
+        return(n == 0 ? 0 : -1);
+    /* Below half a batch of lanes, idle lanes eat up the advantage */
+    if (engine == CCN_DIGEST_ENGINE_AUTO) {
+        engine = CCN_DIGEST_ENGINE_SCALAR;
+#ifdef CCN_DIGEST_AUTO_MULTIBUF
+        if (n >= 4 && !have_sha_extensions())
+            engine = CCN_DIGEST_ENGINE_MULTIBUF;
+#endif
+    }
+#ifdef CCN_DIGEST_HAVE_MULTIBUF
+    if (engine == CCN_DIGEST_ENGINE_MULTIBUF)
+        return(sha256_multibuf_many(jobs, n));
+#endif
+    return(sha256_scalar_many(jobs, n));
+}
+
+/**
+ * Compute the digests of several independent buffers, using the
+ * fastest method available.
+ * @returns 0 for success, -1 for error.
+ */
+int
+ccn_digest_many(enum ccn_digest_id id, struct ccn_digest_job *jobs, int n)
+{
+    return(ccn_digest_many_with(id, jobs, n, CCN_DIGEST_ENGINE_AUTO));
+}
@@ -28,8 +28,13 @@
  * an interest for a segment and the interest times out.  Current behavior is
  * to treat this as an end-of-stream (prematurely and silently)
  *
- * TBD: need to provide a more principled (or maybe just controlled) way to
- * handle interest timeouts.
+ * Each stream keeps a round trip time estimate (SRTT and RTTVAR, as for TCP)
+ * from the segments that arrive, and expresses its interests with a
+ * lifetime of the retransmission timeout derived from it, so that a lost
+ * segment is asked for again quickly.  The number of segments requested
+ * ahead of the read position is a congestion window, which grows by one
+ * per segment in slow start and by one per window after that, and is
+ * halved (once per timeout period) when a request times out.
  */
 
 #include <ccn/fetch.h>
@@ -47,6 +52,10 @@
 // TBD: the following constants should be more principled
 #define CCN_VERSION_TIMEOUT 8000
 #define CCN_INTEREST_TIMEOUT_USECS 15000000
+#define CCN_FETCH_INITIAL_RTO_USECS 1000000
+#define CCN_FETCH_MIN_RTO_USECS 1000000	// producers may answer slowly, and ccnd delays repeats
+#define CCN_FETCH_MAX_RTO_USECS CCN_INTEREST_LIFETIME_MICROSEC
+#define CCN_FETCH_MAX_BUFS 64
 #define MaxSuffixDefault 4
 
 typedef intmax_t seg_t;
@@ -84,6 +93,7 @@ struct ccn_fetch_buffer {
 	intmax_t pos;		// the base byte position for this segment
 	int len;			// the number of valid bytes
 	int max;			// the buffer size
+	int refs;			// references lent by ccn_fetch_read_ref
 	unsigned char *buf;	// where the bytes are
 };
 
@@ -91,7 +101,9 @@ struct localClosure {
 	struct ccn_fetch_stream *fs;
 	struct localClosure *next;
 	seg_t reqSeg;
-	TimeMarker startClock;
+	TimeMarker startClock;	// when this interest was expressed
+	TimeMarker firstClock;	// when the segment was first asked for
+	int retries;			// times the segment has been asked for again
 };
 
 struct ccn_fetch_stream {
@@ -118,6 +130,14 @@ struct ccn_fetch_stream {
 	intmax_t timeoutsSeen;
 	seg_t segsRead;
 	seg_t segsRequested;
+	int cwnd;				// congestion window, in segments
+	int ssthresh;			// slow start threshold, in segments
+	int cwndCount;			// segments toward the next additive increase
+	TimeMarker lastDecrease;	// when the window was last cut
+	intmax_t srttUSecs;		// smoothed round trip time (< 0 if no sample yet)
+	intmax_t rttvarUSecs;	// round trip time variation
+	intmax_t rtoUSecs;		// retransmission timeout
+	intmax_t retransmits;
 };
 
 // forward reference
@@ -172,6 +192,29 @@ make_data_template(int maxSuffix) {
     return(cb);
 }
 
+static struct ccn_charbuf *
+make_timed_template(struct ccn_charbuf *templ, intmax_t usecs) {
+	// copies an interest template, with its InterestLifetime (if any)
+	// replaced by the given number of microseconds
+	struct ccn_parsed_interest pi = {0};
+	struct ccn_charbuf *cb = ccn_charbuf_create();
+	if (ccn_parse_interest(templ->buf, templ->length, &pi, NULL) < 0) {
+		ccn_charbuf_append_charbuf(cb, templ);
+		return(cb);
+	}
+	size_t start = pi.offset[CCN_PI_B_InterestLifetime];
+	size_t stop = pi.offset[CCN_PI_E_InterestLifetime];
+	unsigned char buf[3] = {0};
+	intmax_t lifetime = usecs * 4096 / 1000000;
+	int i;
+	for (i = sizeof(buf) - 1; i >= 0; i--, lifetime >>= 8)
+		buf[i] = lifetime & 0xff;
+	ccn_charbuf_append(cb, templ->buf, start);
+	ccnb_append_tagged_blob(cb, CCN_DTAG_InterestLifetime, buf, sizeof(buf));
+	ccn_charbuf_append(cb, templ->buf + stop, templ->length - stop);
+	return(cb);
+}
+
 static seg_t
 GetNumberFromInfo(const unsigned char *ccnb,
 				  enum ccn_dtag tt, size_t start, size_t stop) {
@@ -227,6 +270,7 @@ AddSegRequest(struct ccn_fetch_stream *fs, seg_t seg) {
 	req->fs = fs;
 	req->reqSeg = seg;
 	req->startClock = GetCurrentTimeUSecs();
+	req->firstClock = req->startClock;
 	req->next = fs->requests;
 	fs->requests = req;
 	if (debug != NULL && (flags & ccn_fetch_flags_NoteAddRem)) {
@@ -332,8 +376,6 @@ NewBufferForSeg(struct ccn_fetch_stream *fs, seg_t seg, size_t len) {
 	fs->nBufs++;
 	fb->next = fs->bufList;
 	fs->bufList = fb;
-	fs->segsAhead++;
-	if (fs->segsAhead >= fs->maxBufs) fs->segsAhead = fs->maxBufs-1;
 	if (fs->segSize <= 0 && pos >= 0) {
 		// segment size is variable or unknown
 		// position for buffer is known, so propagate forwards
@@ -362,7 +404,8 @@ PruneSegments(struct ccn_fetch_stream *fs) {
 	struct ccn_fetch_buffer *fb = fs->bufList;
 	while (fb != NULL && fs->nBufs > fs->maxBufs) {
 		struct ccn_fetch_buffer *next = fb->next;
-		if (fs->maxBufs == 0 || (fb->pos >= 0 && start > (fb->pos + fb->len))) {
+		if (fs->maxBufs == 0
+			|| (fb->refs == 0 && fb->pos >= 0 && start > (fb->pos + fb->len))) {
 			// this buffer is going away
 			// note: keep buffer immediately before readStart if possible
 			if (lag == NULL) {
@@ -382,34 +425,102 @@ PruneSegments(struct ccn_fetch_stream *fs) {
 }
 
 static void
+SetWindow(struct ccn_fetch_stream *fs, int cwnd) {
+	// sets the congestion window, which limits the segments requested
+	// ahead of the read position to fewer than the buffers allowed
+	if (cwnd > fs->maxBufs) cwnd = fs->maxBufs;
+	if (cwnd < 1) cwnd = 1;
+	fs->cwnd = cwnd;
+	fs->segsAhead = cwnd-1;
+}
+
+static void
+GrowWindow(struct ccn_fetch_stream *fs) {
+	// a new segment has arrived: open the window by one segment each time
+	// in slow start, and by one segment per window after that
+	if (fs->cwnd < fs->ssthresh) {
+		SetWindow(fs, fs->cwnd+1);
+	} else if (++fs->cwndCount >= fs->cwnd) {
+		fs->cwndCount = 0;
+		SetWindow(fs, fs->cwnd+1);
+	}
+}
+
+static void
+SetTimeout(struct ccn_fetch_stream *fs, intmax_t rto) {
+	if (rto < CCN_FETCH_MIN_RTO_USECS) rto = CCN_FETCH_MIN_RTO_USECS;
+	if (rto > CCN_FETCH_MAX_RTO_USECS) rto = CCN_FETCH_MAX_RTO_USECS;
+	fs->rtoUSecs = rto;
+}
+
+static void
+NoteLoss(struct ccn_fetch_stream *fs) {
+	// a request has timed out: halve the window and back off the timeout,
+	// but only once per timeout period, as the requests lost from one
+	// window are one congestion event
+	TimeMarker now = GetCurrentTimeUSecs();
+	if (fs->lastDecrease != 0 && DeltaTime(fs->lastDecrease, now) < fs->rtoUSecs)
+		return;
+	fs->ssthresh = fs->cwnd/2;
+	if (fs->ssthresh < 2) fs->ssthresh = 2;
+	fs->cwndCount = 0;
+	fs->lastDecrease = now;
+	SetWindow(fs, fs->cwnd/2);
+	SetTimeout(fs, 2*fs->rtoUSecs);
+}
+
+static void
+NoteRoundTrip(struct ccn_fetch_stream *fs, struct localClosure *req) {
+	// updates the round trip time estimates and the retransmission timeout
+	// as for TCP (RFC 6298), but only from segments that were asked for
+	// once, since an answer to a retried request could be to any of them
+	if (req->retries > 0) return;
+	intmax_t rtt = DeltaTime(req->startClock, GetCurrentTimeUSecs());
+	if (rtt < 0) rtt = 0;
+	if (fs->srttUSecs < 0) {
+		fs->srttUSecs = rtt;
+		fs->rttvarUSecs = rtt/2;
+	} else {
+		intmax_t err = rtt - fs->srttUSecs;
+		if (err < 0) err = -err;
+		fs->rttvarUSecs = (3*fs->rttvarUSecs + err)/4;
+		fs->srttUSecs = (7*fs->srttUSecs + rtt)/8;
+	}
+	SetTimeout(fs, fs->srttUSecs + 4*fs->rttvarUSecs);
+}
+
+static struct localClosure *
 NeedSegment(struct ccn_fetch_stream *fs, seg_t seg) {
 	// requests that a specific segment interest be registered
 	// but ONLY if it the request not already in flight
 	// AND the segment is not already in a buffer
+	// returns the new request if one was made
 	struct ccn_fetch_buffer *fb = FindBufferForSeg(fs, seg);
 	if (fb != NULL)
 		// no point in requesting what we have
-		return;
+		return NULL;
 	if (fs->finalSeg >= 0 && seg > fs->finalSeg)
 		// no point in requesting off the end, either
-		return;
+		return NULL;
 	if (fs->timeoutSeg > 0 && seg >= fs->timeoutSeg)
 		// don't request a timed-out segment
-		return;
+		return NULL;
 	if (fs->zeroLenSeg > 0 && seg >= fs->zeroLenSeg)
 		// don't request a zero-length segment
-		return;
+		return NULL;
 	struct localClosure *req = AddSegRequest(fs, seg);
 	if (req != NULL) {
 		FILE *debug = fs->parent->debug;
 		ccn_fetch_flags flags = fs->parent->debugFlags;
 		struct ccn_charbuf *temp = sequenced_name(fs->name, seg);
+		struct ccn_charbuf *templ = make_timed_template(fs->interest, fs->rtoUSecs);
 		struct ccn *h = fs->parent->h;
 		struct ccn_closure *action = calloc(1, sizeof(*action));
 		action->data = req;
 		action->p = &CallMe;
-		int res = ccn_express_interest(h, temp, action, fs->interest);
+		int res = ccn_express_interest(h, temp, action, templ);
 		ccn_charbuf_destroy(&temp);
+		ccn_charbuf_destroy(&templ);
 		if (res >= 0) {
 			// the ccn connection accepted our request
 			fs->reqBusy++;
@@ -420,10 +531,11 @@ NeedSegment(struct ccn_fetch_stream *fs, seg_t seg) {
 						fs->id, seg);
 				if (fs->finalSeg >= 0)
 					fprintf(debug, ", final %jd", fs->finalSeg);
-				fprintf(debug, "\n");
+				fprintf(debug, ", window %d, rto %jd us\n",
+						fs->cwnd, fs->rtoUSecs);
 				fflush(debug);
 			}
-			return;
+			return req;
 		}
 		// the request was not placed, so get rid of the evidence
 		// CallMe won't get a chance to free it
@@ -436,8 +548,8 @@ NeedSegment(struct ccn_fetch_stream *fs, seg_t seg) {
 		RemSegRequest(fs, req);
 		free(req);
 		free(action);
-        
 	}
+	return NULL;
 }
 
 static void
@@ -500,13 +612,13 @@ CallMe(struct ccn_closure *selfp,
 			if (finalSeg >= 0 && thisSeg > finalSeg)
 				// ignore this timeout quickly
 				return(CCN_UPCALL_RESULT_OK);
-			intmax_t dt = DeltaTime(req->startClock, GetCurrentTimeUSecs());
+			intmax_t dt = DeltaTime(req->firstClock, GetCurrentTimeUSecs());
 			if (dt >= fs->timeoutUSecs) {
 				// timed out, too many retries
 				// assume that this interest will never produce
 				seg_t timeoutSeg = fs->timeoutSeg;
 				fs->timeoutsSeen++;
-				fs->segsAhead = 0;
+				SetWindow(fs, 1);
 				if (timeoutSeg < 0 || thisSeg < timeoutSeg) {
 					// we can infer a new timeoutSeg
 					fs->timeoutSeg = thisSeg;
@@ -522,8 +634,28 @@ CallMe(struct ccn_closure *selfp,
 				}
 				return(CCN_UPCALL_RESULT_OK);
 			}
-			// TBD: may need to reseed bloom filter?  who to ask?
-			return(CCN_UPCALL_RESULT_REEXPRESS);
+			// no answer within the retransmission timeout, so back off,
+			// cut the window, and ask again with the longer timeout
+			// (reexpressing would keep the old interest lifetime)
+			TimeMarker firstClock = req->firstClock;
+			int retries = req->retries;
+			fs->retransmits++;
+			NoteLoss(fs);
+			RemSegRequest(fs, req);
+			if (fs->reqBusy > 0) fs->reqBusy--;
+			req = NeedSegment(fs, thisSeg);
+			if (req != NULL) {
+				req->firstClock = firstClock;
+				req->retries = retries+1;
+			}
+			if (debug != NULL && (flags & ccn_fetch_flags_NoteTimeout)) {
+				fprintf(debug, 
+						"-- ccn_fetch retransmit, %s, seg %jd, window %d, rto %jd us\n",
+						fs->id, thisSeg, fs->cwnd, fs->rtoUSecs);
+				fflush(debug);
+			}
+			// the old interest is finished with, and FINAL will free it
+			return(CCN_UPCALL_RESULT_OK);
 		}
 		case CCN_UPCALL_CONTENT_UNVERIFIED:
 			return (CCN_UPCALL_RESULT_VERIFY);
@@ -540,6 +672,8 @@ CallMe(struct ccn_closure *selfp,
 	struct ccn_fetch_buffer *fb = FindBufferForSeg(fs, thisSeg);
 	if (fb == NULL) {
 		// we don't already have the data yet
+		NoteRoundTrip(fs, req);
+		GrowWindow(fs);
 		const unsigned char *data = NULL;
 		size_t dataLen = 0;
 		size_t ccnb_size = info->pco->offset[CCN_PCO_E];
@@ -685,8 +819,9 @@ ccn_fetch_destroy(struct ccn_fetch *f) {
  * ccn connection with a 0 timeout.
  *
  * NOTE: periodic calls to ccn_fetch_poll should be performed to update
- * the contents of the streams UNLESS the client is calling ccn_run for
- * the underlying ccn connection.
+ * the contents of the streams UNLESS the client is running the underlying
+ * ccn connection itself (with ccn_run, ccn_run_multi, or ccn_get_wait_info
+ * and ccn_process_ready).
  * @returns the count of streams that have pending data or have ended.
  */
 extern int
@@ -757,7 +892,7 @@ ccn_fetch_open(struct ccn_fetch *f,
 	// returns a new ccn_fetch_stream object based on the arguments
 	// returns NULL if not successful
     if (maxBufs <= 0) return NULL;
-	if (maxBufs > 16) maxBufs = 16;
+	if (maxBufs > CCN_FETCH_MAX_BUFS) maxBufs = CCN_FETCH_MAX_BUFS;
 	int res = 0;
 	FILE *debug = f->debug;
 	ccn_fetch_flags flags = f->debugFlags;
@@ -798,7 +933,11 @@ ccn_fetch_open(struct ccn_fetch *f,
 	fs->timeoutSeg = -1;
 	fs->zeroLenSeg = -1;
 	fs->parent = f;
-	fs->timeoutUSecs = CCN_INTEREST_TIMEOUT_USECS;  // TBD: how to get better timeout?
+	fs->timeoutUSecs = CCN_INTEREST_TIMEOUT_USECS;
+	fs->srttUSecs = -1;
+	fs->rtoUSecs = CCN_FETCH_INITIAL_RTO_USECS;
+	fs->ssthresh = maxBufs;
+	SetWindow(fs, 1);
 	
 	// use the supplied template or the default
 	if (interestTemplate != NULL) {
@@ -882,11 +1021,14 @@ ccn_fetch_close(struct ccn_fetch_stream *fs) {
 	}
 	if (debug != NULL && (flags & ccn_fetch_flags_NoteOpenClose)) {
 		fprintf(debug, 
-				"-- ccn_fetch close, %s, segReq %jd, segsRead %jd, timeouts %jd\n",
+				"-- ccn_fetch close, %s, segReq %jd, segsRead %jd, timeouts %jd"
+				", retransmits %jd, srtt %jd us\n",
 				fs->id,
 				fs->segsRequested,
 				fs->segsRead,
-				fs->timeoutsSeen);
+				fs->timeoutsSeen,
+				fs->retransmits,
+				fs->srttUSecs);
 		fflush(debug);
 	}
 	// finally, get rid of the stream object
@@ -1020,13 +1162,102 @@ ccn_fetch_read(struct ccn_fetch_stream *fs,
 	return nr;
 }
 
+/**
+ * Lends bytes from a stream without copying them.
+ * Sets *bufp to the bytes at the read position, up to len of them, from
+ * the one segment that holds that position.
+ * The bytes stay valid until passed to ccn_fetch_release_ref, or until the
+ * stream is closed.
+ * Advances the read position on a successful read.
+ * @returns the same as ccn_fetch_read.
+ */
+extern intmax_t
+ccn_fetch_read_ref(struct ccn_fetch_stream *fs,
+				   const unsigned char **bufp,
+				   intmax_t len) {
+	if (len < 0 || bufp == NULL) {
+		return CCN_FETCH_READ_NONE;
+	}
+	*bufp = NULL;
+	intmax_t pos = fs->readPosition;
+	if (fs->fileSize >= 0 && pos >= fs->fileSize) {
+		// file size known, and we are at the limit
+		return CCN_FETCH_READ_END;
+	}
+	seg_t seg = fs->readSeg;
+	if (fs->timeoutSeg >= 0 && seg >= fs->timeoutSeg)
+		// if a needed read timed out, then we say so
+		return CCN_FETCH_READ_TIMEOUT;
+	if (fs->zeroLenSeg >= 0 && seg >= fs->zeroLenSeg)
+		// if we got a zero length segment, report it
+		return CCN_FETCH_READ_ZERO;
+	intmax_t nr = 0;
+	struct ccn_fetch_buffer *fb = FindBufferForSeg(fs, seg);
+	if (fb != NULL && len > 0) {
+		intmax_t start = fb->pos;
+		intmax_t lo = start;
+		if (lo < 0) {
+			// segments delivered at random might cause this
+			lo = pos;
+			fb->pos = pos;
+		}
+		intmax_t hi = lo + fb->len;
+		if (pos < lo || pos >= hi) {
+			// this SHOULD NOT HAPPEN!
+			FILE *debug = fs->parent->debug;
+			if (debug != NULL) {
+				fprintf(debug, 
+						"** ccn_fetch read_ref, %s, seg %jd, pos %jd, lo %jd, hi %jd\n",
+						fs->id, seg, pos, (intmax_t) lo, (intmax_t) hi);
+				fflush(debug);
+			}
+		} else {
+			nr = hi - pos;
+			if (nr > len) nr = len;
+			*bufp = fb->buf+(pos-lo);
+			fb->refs++;
+			pos = pos + nr;
+			fs->readPosition = pos;
+			fs->readStart = start;
+			if (pos == hi) {
+				// finished the bytes in this segment
+				seg++;
+				fs->readSeg = seg;
+				fs->readStart = pos;
+			}
+		}
+	}
+	NeedSegments(fs);
+	PruneSegments(fs);
+	if (nr == 0) {
+		return CCN_FETCH_READ_NONE;
+	}
+	return nr;
+}
+
+/**
+ * Gives back bytes lent by ccn_fetch_read_ref, so that the segment
+ * holding them can be reclaimed.
+ */
+extern void
+ccn_fetch_release_ref(struct ccn_fetch_stream *fs, const unsigned char *buf) {
+	struct ccn_fetch_buffer *fb = fs->bufList;
+	for (; fb != NULL; fb = fb->next) {
+		if (fb->refs > 0 && buf >= fb->buf && buf < fb->buf+fb->len) {
+			fb->refs--;
+			break;
+		}
+	}
+	PruneSegments(fs);
+}
+
 /**
  * Resets the timeout marker.
  */
 extern void
 ccn_reset_timeout(struct ccn_fetch_stream *fs) {
 	fs->timeoutSeg = -1;
-	fs->segsAhead = 0;
+	SetWindow(fs, 1);
 }
 
 /**
@@ -1047,7 +1278,7 @@ ccn_fetch_seek(struct ccn_fetch_stream *fs, intmax_t pos) {
 		// (also resets bad segment indicators)
 		fs->timeoutSeg = -1;
 		fs->zeroLenSeg = -1;
-		fs->segsAhead = 0;
+		SetWindow(fs, 1);
 	} else if (pos == fs->readPosition) {
 		// no change
 		return 0;
@@ -1090,4 +1321,22 @@ ccn_fetch_position(struct ccn_fetch_stream *fs) {
 	return fs->readPosition;
 }
 
+/**
+ * Gets the congestion window, round trip time estimates and request counts
+ * of a stream.
+ */
+extern void
+ccn_fetch_get_stats(struct ccn_fetch_stream *fs, struct ccn_fetch_stats *stats) {
+	stats->window = fs->cwnd;
+	stats->ssthresh = fs->ssthresh;
+	stats->maxWindow = fs->maxBufs;
+	stats->srttUSecs = fs->srttUSecs;
+	stats->rttvarUSecs = fs->rttvarUSecs;
+	stats->rtoUSecs = fs->rtoUSecs;
+	stats->segsRequested = fs->segsRequested;
+	stats->segsRead = fs->segsRead;
+	stats->retransmits = fs->retransmits;
+	stats->timeouts = fs->timeoutsSeen;
+}
+
 
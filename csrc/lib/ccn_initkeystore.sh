@@ -14,6 +14,7 @@
 #
 # Create a ccn keystore without relying on java
 : ${RSA_KEYSIZE:=1024}
+: ${CCN_KEY_TYPE:=rsa}
 : ${CCN_USER:=`id -n -u`}
 Fail () {
   echo '*** Failed' "$*"
@@ -37,8 +38,14 @@ countryName_default		= AU
 countryName_min			= 2
 countryName_max			= 2
 EOF
+case "$CCN_KEY_TYPE" in
+  rsa) NEWKEY=rsa:$RSA_KEYSIZE ;;
+  ec)  openssl ecparam -name prime256v1 -out ecparam.pem || Fail openssl ecparam
+       NEWKEY=ec:ecparam.pem ;;
+  *)   Fail \$CCN_KEY_TYPE must be rsa or ec ;;
+esac
 openssl req    -config openssl.cnf      \
-               -newkey rsa:$RSA_KEYSIZE \
+               -newkey $NEWKEY          \
                -x509                    \
                -keyout private_key.pem  \
                -out certout.pem         \
@@ -20,8 +20,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/objects.h>
 #include <openssl/rsa.h>
 #include <openssl/evp.h>
 #include <openssl/x509v3.h>
@@ -135,6 +138,40 @@ ccn_keystore_certificate(struct ccn_keystore *p)
     return ((const void *)(p->certificate));
 }
 
+/**
+ * Report what kind of signing key the keystore holds.
+ */
+enum ccn_keytype
+ccn_keystore_key_type(struct ccn_keystore *p)
+{
+    if (0 == p->initialized)
+        return (CCN_KEYTYPE_UNKNOWN);
+    switch (EVP_PKEY_type(EVP_PKEY_id(p->private_key))) {
+        case EVP_PKEY_RSA:
+            return (CCN_KEYTYPE_RSA);
+        case EVP_PKEY_EC:
+            return (CCN_KEYTYPE_EC);
+        default:
+            return (CCN_KEYTYPE_UNKNOWN);
+    }
+}
+
+/**
+ * Parse the name of a key type ("rsa" or "ec").
+ *
+ * A NULL or empty string yields the default, CCN_KEYTYPE_RSA.
+ * @returns CCN_KEYTYPE_UNKNOWN if the name is not recognized.
+ */
+enum ccn_keytype
+ccn_keytype_from_string(const char *s)
+{
+    if (s == NULL || s[0] == 0 || 0 == strcasecmp(s, "rsa"))
+        return (CCN_KEYTYPE_RSA);
+    if (0 == strcasecmp(s, "ec") || 0 == strcasecmp(s, "ecdsa"))
+        return (CCN_KEYTYPE_EC);
+    return (CCN_KEYTYPE_UNKNOWN);
+}
+
 static int
 add_cert_extension_with_context(X509 *cert, int nid, char *value)
 {
@@ -163,7 +200,7 @@ add_cert_extension(X509 *cert, int nid, char *value)
     return(1);
 }
 /**
- * Create a PKCS12 keystore file
+ * Create a PKCS12 keystore file holding an RSA key
  * @param filename  the name of the keystore file to be created.
  * @param password  the import/export password for the keystore.
  * @param subject   the subject (and issuer) name in the certificate.
@@ -179,8 +216,82 @@ int
 ccn_keystore_file_init(char *filename, char *password,
                        char *subject, int keylength, int validity_days)
 {
-	RSA *rsa = RSA_new();
-    BIGNUM *pub_exp = BN_new();
+    return (ccn_keystore_file_init_keytype(filename, password, subject,
+                                           CCN_KEYTYPE_RSA, keylength,
+                                           validity_days));
+}
+
+/*
+ * Generate a fresh key pair of the requested type into pkey.
+ * For RSA, keylength is the modulus size in bits (default 1024).
+ * For EC, only the 256-bit NIST curve is supported.
+ * Returns 1 for success, 0 for failure, as OpenSSL does.
+ */
+static int
+generate_key(EVP_PKEY *pkey, enum ccn_keytype keytype, int keylength)
+{
+    RSA *rsa = NULL;
+    BIGNUM *pub_exp = NULL;
+    EC_KEY *ec = NULL;
+    int res = 0;
+    
+    switch (keytype) {
+        case CCN_KEYTYPE_RSA:
+            if (keylength <= 0)
+                keylength = 1024;
+            rsa = RSA_new();
+            pub_exp = BN_new();
+            if (rsa == NULL || pub_exp == NULL)
+                break;
+            BN_set_word(pub_exp, RSA_F4);
+            res = 1;
+            res &= RSA_generate_key_ex(rsa, keylength, pub_exp, NULL);
+            res &= EVP_PKEY_set1_RSA(pkey, rsa);
+            break;
+        case CCN_KEYTYPE_EC:
+            if (keylength > 0 && keylength != 256)
+                break;
+            ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+            if (ec == NULL)
+                break;
+            /* Name the curve in the encoding rather than spelling it out */
+            EC_KEY_set_asn1_flag(ec, OPENSSL_EC_NAMED_CURVE);
+            res = 1;
+            res &= EC_KEY_generate_key(ec);
+            res &= EVP_PKEY_set1_EC_KEY(pkey, ec);
+            break;
+        default:
+            break;
+    }
+    if (rsa != NULL)
+        RSA_free(rsa);
+    if (pub_exp != NULL)
+        BN_free(pub_exp);
+    if (ec != NULL)
+        EC_KEY_free(ec);
+    return (res);
+}
+
+/**
+ * Create a PKCS12 keystore file
+ * @param filename  the name of the keystore file to be created.
+ * @param password  the import/export password for the keystore.
+ * @param subject   the subject (and issuer) name in the certificate.
+                    A lowercase version of the subject name will be used for the
+                    "friendly name" (alias) associated with the private key.
+ * @param keytype   the kind of key pair to generate.
+ * @param keylength the number of bits in the key to be generated.
+ *                  A value <= 0 will result in the default for the keytype
+ *                  (1024 for RSA, 256 for EC) being used.
+ * @param validity_days the number of days the certificate in the keystore will
+ *                  be valid.  A value <= 0 will result in the default (30) being used.
+ * @returns 0 on success, -1 on failure
+ */
+int
+ccn_keystore_file_init_keytype(char *filename, char *password,
+                               char *subject, enum ccn_keytype keytype,
+                               int keylength, int validity_days)
+{
     EVP_PKEY *pkey = EVP_PKEY_new();
     X509 *cert = X509_new();
     X509_NAME *name = NULL;
@@ -196,21 +307,17 @@ ccn_keystore_file_init(char *filename, char *password,
     int ans = -1;
     
     // Check whether initial allocations succeeded.
-    if (rsa == NULL || pub_exp == NULL || pkey == NULL || cert == NULL)
+    if (pkey == NULL || cert == NULL)
         goto Bail;
     
-    // Set up default values for keylength and expiration.
-    if (keylength <= 0)
-        keylength = 1024;
+    // Set up default value for expiration.
     if (validity_days <= 0)
         validity_days = 30;
     
     OpenSSL_add_all_algorithms();
     
-    BN_set_word(pub_exp, RSA_F4);
     res = 1;
-    res &= RSA_generate_key_ex(rsa, keylength, pub_exp, NULL);
-    res &= EVP_PKEY_set1_RSA(pkey, rsa);
+    res &= generate_key(pkey, keytype, keylength);
     res &= X509_set_version(cert, 2);       // 2 => X509v3
 	if (res == 0)
         goto Bail;
@@ -238,7 +345,10 @@ ccn_keystore_file_init(char *filename, char *password,
     
     // Add the necessary extensions.
     res &= add_cert_extension(cert, NID_basic_constraints, "critical,CA:FALSE");
-    res &= add_cert_extension(cert, NID_key_usage, "digitalSignature,nonRepudiation,keyEncipherment,dataEncipherment,keyAgreement");
+    if (keytype == CCN_KEYTYPE_EC)
+        res &= add_cert_extension(cert, NID_key_usage, "digitalSignature,nonRepudiation,keyAgreement");
+    else
+        res &= add_cert_extension(cert, NID_key_usage, "digitalSignature,nonRepudiation,keyEncipherment,dataEncipherment,keyAgreement");
     res &= add_cert_extension(cert, NID_ext_key_usage, "clientAuth");
     
     if (res == 0)
@@ -263,7 +373,7 @@ ccn_keystore_file_init(char *filename, char *password,
         goto Bail;
     
     // The certificate is complete, sign it.
-    res = X509_sign(cert, pkey, EVP_sha1());
+    res = X509_sign(cert, pkey, keytype == CCN_KEYTYPE_EC ? EVP_sha256() : EVP_sha1());
     if (res == 0)
         goto Bail;
 
@@ -305,14 +415,6 @@ Bail:
         EVP_PKEY_free(pkey);
         pkey = NULL;
     }
-    if (rsa != NULL) {
-        RSA_free(rsa);
-        rsa = NULL;
-    }
-    if (pub_exp != NULL){
-        BN_free(pub_exp);
-        pub_exp = NULL;
-    }
     if (cert != NULL) {
         X509_free(cert);
         cert = NULL;
@@ -0,0 +1,224 @@
+/**
+ * @file ccn_ringbuf.c
+ * @brief A byte ring for receiving streams of messages.
+ *
+ * Part of the CCNx C Library.
+ *
+ * Copyright (C) 2011 Palo Alto Research Center, Inc.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE     /* for memfd_create */
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <ccn/ringbuf.h>
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+#define CCN_RINGBUF_HAVE_MIRROR 1
+#endif
+
+struct ccn_ringbuf {
+    unsigned char *buf;
+    size_t size;        /**< capacity, a power of 2 */
+    size_t start;       /**< offset of the first unconsumed byte */
+    size_t length;      /**< number of unconsumed bytes */
+    int mirrored;       /**< buf is mapped twice in a row */
+};
+
+#ifdef CCN_RINGBUF_HAVE_MIRROR
+/**
+ * Map size bytes of fresh memory twice in a row.
+ * @returns the base of the 2 * size byte mapping, or NULL.
+ */
+static unsigned char *
+map_mirrored(size_t size)
+{
+    unsigned char *base = NULL;
+    void *p;
+    int fd;
+
+    fd = memfd_create("ccn-ringbuf", MFD_CLOEXEC);
+    if (fd == -1)
+        return(NULL);
+    if (ftruncate(fd, size) == -1)
+        goto Bail;
+    base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        base = NULL;
+        goto Bail;
+    }
+    p = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (p != MAP_FAILED)
+        p = mmap(base + size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0);
+    if (p == MAP_FAILED) {
+        munmap(base, 2 * size);
+        base = NULL;
+    }
+Bail:
+    close(fd);  /* the mappings keep the memory */
+    return(base);
+}
+#endif
+
+static void
+release_storage(unsigned char *buf, size_t size, int mirrored)
+{
+    if (buf == NULL)
+        return;
+#ifdef CCN_RINGBUF_HAVE_MIRROR
+    if (mirrored) {
+        munmap(buf, 2 * size);
+        return;
+    }
+#endif
+    free(buf);
+}
+
+/**
+ * Get storage for a ring of the given size, mirrored if possible.
+ */
+static unsigned char *
+get_storage(size_t size, int *mirroredp)
+{
+    unsigned char *buf = NULL;
+
+#ifdef CCN_RINGBUF_HAVE_MIRROR
+    buf = map_mirrored(size);
+#endif
+    *mirroredp = (buf != NULL);
+    if (buf == NULL)
+        buf = malloc(size);
+    return(buf);
+}
+
+static size_t
+round_size(size_t size)
+{
+    size_t n = sysconf(_SC_PAGESIZE);
+
+    while (n < size && n < ((size_t)1 << 30))
+        n <<= 1;
+    return(n);
+}
+
+struct ccn_ringbuf *
+ccn_ringbuf_create(size_t size)
+{
+    struct ccn_ringbuf *rb;
+
+    rb = calloc(1, sizeof(*rb));
+    if (rb == NULL)
+        return(NULL);
+    rb->size = round_size(size);
+    rb->buf = get_storage(rb->size, &rb->mirrored);
+    if (rb->buf == NULL) {
+        free(rb);
+        return(NULL);
+    }
+    return(rb);
+}
+
+void
+ccn_ringbuf_destroy(struct ccn_ringbuf **rbp)
+{
+    struct ccn_ringbuf *rb = *rbp;
+
+    if (rb == NULL)
+        return;
+    release_storage(rb->buf, rb->size, rb->mirrored);
+    free(rb);
+    *rbp = NULL;
+}
+
+size_t
+ccn_ringbuf_capacity(struct ccn_ringbuf *rb)
+{
+    return(rb->size);
+}
+
+size_t
+ccn_ringbuf_length(struct ccn_ringbuf *rb)
+{
+    return(rb->length);
+}
+
+unsigned char *
+ccn_ringbuf_data(struct ccn_ringbuf *rb)
+{
+    return(rb->buf + rb->start);
+}
+
+unsigned char *
+ccn_ringbuf_space(struct ccn_ringbuf *rb, size_t *sizep)
+{
+    if (!rb->mirrored && rb->start + rb->length > rb->size - rb->size / 4) {
+        /* Running out of room at the end; slide down what is left */
+        memmove(rb->buf, rb->buf + rb->start, rb->length);
+        rb->start = 0;
+    }
+    if (rb->mirrored)
+        *sizep = rb->size - rb->length;
+    else
+        *sizep = rb->size - rb->start - rb->length;
+    return(rb->buf + rb->start + rb->length);
+}
+
+void
+ccn_ringbuf_commit(struct ccn_ringbuf *rb, size_t size)
+{
+    if (size > rb->size - rb->length)
+        abort();
+    rb->length += size;
+}
+
+void
+ccn_ringbuf_consume(struct ccn_ringbuf *rb, size_t size)
+{
+    if (size > rb->length)
+        abort();
+    rb->length -= size;
+    rb->start += size;
+    if (rb->length == 0)
+        rb->start = 0;
+    else if (rb->start >= rb->size)
+        rb->start -= rb->size;
+}
+
+int
+ccn_ringbuf_grow(struct ccn_ringbuf *rb, size_t size)
+{
+    unsigned char *buf;
+    int mirrored;
+
+    size = round_size(size);
+    if (size <= rb->size)
+        return(0);
+    buf = get_storage(size, &mirrored);
+    if (buf == NULL)
+        return(-1);
+    memcpy(buf, rb->buf + rb->start, rb->length);
+    release_storage(rb->buf, rb->size, rb->mirrored);
+    rb->buf = buf;
+    rb->size = size;
+    rb->start = 0;
+    rb->mirrored = mirrored;
+    return(0);
+}
@@ -34,6 +34,8 @@ struct ccn_seqwriter {
     struct ccn_charbuf *nv;
     struct ccn_charbuf *buffer;
     struct ccn_charbuf *cob0;
+    struct ccn_parsed_ContentObject pco0; /**< parse of cob0, for matching */
+    struct ccn_signing_context *sc;
     uintmax_t seqnum;
     int batching;
     unsigned char interests_possibly_pending;
@@ -45,14 +47,15 @@ seqw_next_cob(struct ccn_seqwriter *w)
 {
     struct ccn_charbuf *cob = ccn_charbuf_create();
     struct ccn_charbuf *name = ccn_charbuf_create();
-    struct ccn_signing_params sp = CCN_SIGNING_PARAMS_INIT;
+    int sp_flags = 0;
     int res;
     
     if (w->closed)
-        sp.sp_flags |= CCN_SP_FINAL_BLOCK;
+        sp_flags |= CCN_SP_FINAL_BLOCK;
     ccn_charbuf_append(name, w->nv->buf, w->nv->length);
     ccn_name_append_numeric(name, CCN_MARKER_SEQNUM, w->seqnum);
-    res = ccn_sign_content(w->h, cob, name, &sp, w->buffer->buf, w->buffer->length);
+    res = ccn_signing_context_sign(w->sc, cob, name, sp_flags,
+                                   w->buffer->buf, w->buffer->length);
     if (res < 0)
         ccn_charbuf_destroy(&cob);
     ccn_charbuf_destroy(&name);
@@ -77,6 +80,7 @@ seqw_incoming_interest(
             ccn_charbuf_destroy(&w->nv);
             ccn_charbuf_destroy(&w->buffer);
             ccn_charbuf_destroy(&w->cob0);
+            ccn_signing_context_destroy(&w->sc);
             free(w);
             break;
         case CCN_UPCALL_INTEREST:
@@ -102,7 +106,7 @@ seqw_incoming_interest(
             if (w->cob0 != NULL) {
                 cob = w->cob0;
                 if (ccn_content_matches_interest(cob->buf, cob->length,
-                                                 1, NULL,
+                                                 1, &w->pco0,
                                                  info->interest_ccnb,
                                                  info->pi->offset[CCN_PI_E],
                                                  info->pi)) {
@@ -157,8 +161,10 @@ ccn_seqw_create(struct ccn *h, struct ccn_charbuf *name)
     w->h = h;
     w->seqnum = 0;
     w->interests_possibly_pending = 1;
-    res = ccn_set_interest_filter(h, nb, &(w->cl));
+    w->sc = ccn_signing_context_create(h, NULL);
+    res = (w->sc == NULL) ? -1 : ccn_set_interest_filter(h, nb, &(w->cl));
     if (res < 0) {
+        ccn_signing_context_destroy(&w->sc);
         ccn_charbuf_destroy(&w->nb);
         ccn_charbuf_destroy(&w->nv);
         ccn_charbuf_destroy(&w->buffer);
@@ -222,7 +228,9 @@ ccn_seqw_write(struct ccn_seqwriter *w, const void *buf, size_t size)
         if (cob != NULL) {
             res = ccn_put(w->h, cob->buf, cob->length);
             if (res >= 0) {
-                if (w->seqnum == 0) {
+                if (w->seqnum == 0 &&
+                    ccn_parse_ContentObject(cob->buf, cob->length,
+                                            &w->pco0, NULL) >= 0) {
                     w->cob0 = cob;
                     cob = NULL;
                 }
@@ -0,0 +1,518 @@
+/**
+ * @file ccn_shm.c
+ * @brief Shared-memory rings between ccnd and its local clients.
+ *
+ * Part of the CCNx C Library.
+ *
+ * Copyright (C) 2011 Palo Alto Research Center, Inc.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE     /* for memfd_create and file seals */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <ccn/shm.h>
+
+#if defined(__linux__) && defined(__GNUC__) && defined(MFD_ALLOW_SEALING)
+#include <sys/eventfd.h>
+#define CCN_SHM_HAVE_MEMFD 1
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define CCN_SHM_ANSWER_YES 'Y'
+#define CCN_SHM_ANSWER_NO 'N'
+#define CCN_SHM_NFDS 3
+
+/**
+ * Send ccnd's one-byte answer to a hello, with any fds attached.
+ */
+static int
+send_answer(int sock, char answer, const int *fds, int nfds)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(CCN_SHM_NFDS * sizeof(int))];
+    } u;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &answer;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        memset(&u, 0, sizeof(u));
+        msg.msg_control = u.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1)
+        return(-1);
+    return(0);
+}
+
+#ifdef CCN_SHM_HAVE_MEMFD
+
+#define CCN_SHM_MAGIC 0x43534d31
+#define SHM_BARRIER() __sync_synchronize()
+
+/**
+ * The shared state of one direction.
+ *
+ * head and tail count bytes ever written and consumed, modulo 2**32.
+ * Only the producer stores head, and only the consumer stores tail;
+ * each gets its own cache line.
+ */
+struct ccn_shm_ctl {
+    volatile unsigned head;
+    unsigned char pad1[60];
+    volatile unsigned tail;
+    unsigned char pad2[60];
+    volatile unsigned waiting;      /**< consumer is about to sleep */
+    volatile unsigned space_wanted; /**< producer is waiting for room */
+    unsigned char pad3[56];
+};
+
+/**
+ * The first page of the shared memory; the rings follow.
+ */
+struct ccn_shm_header {
+    unsigned magic;
+    unsigned ringsize;
+    unsigned char pad[56];
+    struct ccn_shm_ctl ctl[2];      /**< [0] is client to ccnd */
+};
+
+struct ccn_shm_ring {
+    struct ccn_shm_ctl *ctl;
+    unsigned char *data;            /**< ringsize bytes, mapped twice */
+};
+
+struct ccn_shm {
+    struct ccn_shm_header *hdr;
+    size_t pagesize;
+    size_t ringsize;                /**< a power of 2 */
+    struct ccn_shm_ring in;
+    struct ccn_shm_ring out;
+    unsigned in_seen;               /**< inbound head as of the last peek */
+    int doorbell;                   /**< ours, rung by the peer */
+    int peer_doorbell;
+};
+
+/**
+ * Map size bytes of fd at offset, and then the same again just after,
+ * so that a run of bytes that wraps around is contiguous.
+ */
+static unsigned char *
+map_twice(int fd, off_t offset, size_t size)
+{
+    unsigned char *base;
+    void *p;
+
+    base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return(NULL);
+    p = mmap(base, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, offset);
+    if (p != MAP_FAILED)
+        p = mmap(base + size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, offset);
+    if (p == MAP_FAILED) {
+        munmap(base, 2 * size);
+        return(NULL);
+    }
+    return(base);
+}
+
+void
+ccn_shm_destroy(struct ccn_shm **sp)
+{
+    struct ccn_shm *s = *sp;
+
+    if (s == NULL)
+        return;
+    if (s->in.data != NULL)
+        munmap(s->in.data, 2 * s->ringsize);
+    if (s->out.data != NULL)
+        munmap(s->out.data, 2 * s->ringsize);
+    if (s->hdr != NULL)
+        munmap(s->hdr, s->pagesize);
+    if (s->doorbell != -1)
+        close(s->doorbell);
+    if (s->peer_doorbell != -1)
+        close(s->peer_doorbell);
+    free(s);
+    *sp = NULL;
+}
+
+/**
+ * Map the shared memory, as one side or the other.
+ *
+ * The client side takes the ring size from the header, after checking
+ * it against the size of the memfd.
+ */
+static struct ccn_shm *
+shm_map(int memfd, size_t ringsize, int ccnd_side)
+{
+    struct ccn_shm *s;
+    struct stat st;
+    int in = ccnd_side ? 0 : 1;
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return(NULL);
+    s->doorbell = s->peer_doorbell = -1;
+    s->pagesize = sysconf(_SC_PAGESIZE);
+    s->hdr = mmap(NULL, s->pagesize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, memfd, 0);
+    if (s->hdr == MAP_FAILED) {
+        s->hdr = NULL;
+        goto Bail;
+    }
+    if (ccnd_side) {
+        s->hdr->magic = CCN_SHM_MAGIC;
+        s->hdr->ringsize = ringsize;
+    }
+    else {
+        ringsize = s->hdr->ringsize;
+        if (s->hdr->magic != CCN_SHM_MAGIC ||
+            ringsize < s->pagesize || (ringsize & (ringsize - 1)) != 0 ||
+            fstat(memfd, &st) == -1 ||
+            st.st_size != (off_t)(s->pagesize + 2 * ringsize)) {
+            errno = EPROTO;
+            goto Bail;
+        }
+    }
+    s->ringsize = ringsize;
+    s->in.ctl = &s->hdr->ctl[in];
+    s->in.data = map_twice(memfd, s->pagesize + in * ringsize, ringsize);
+    s->out.ctl = &s->hdr->ctl[1 - in];
+    s->out.data = map_twice(memfd, s->pagesize + (1 - in) * ringsize, ringsize);
+    if (s->in.data == NULL || s->out.data == NULL)
+        goto Bail;
+    return(s);
+Bail:
+    ccn_shm_destroy(&s);
+    return(NULL);
+}
+
+struct ccn_shm *
+ccn_shm_offer(int sock, size_t ringsize)
+{
+    struct ccn_shm *s = NULL;
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t n;
+    int fds[CCN_SHM_NFDS] = {-1, -1, -1};
+    int save;
+
+    for (n = pagesize; n < ringsize && n < (1U << 30); n <<= 1)
+        continue;
+    ringsize = n;
+    fds[0] = memfd_create("ccnd-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fds[0] == -1)
+        goto Refuse;
+    /* Sealed, so that the client cannot take the pages out from under us */
+    if (ftruncate(fds[0], pagesize + 2 * ringsize) == -1 ||
+        fcntl(fds[0], F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+        goto Refuse;
+    s = shm_map(fds[0], ringsize, 1);
+    if (s == NULL)
+        goto Refuse;
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[1] == -1 || fds[2] == -1)
+        goto Refuse;
+    s->peer_doorbell = fds[1];
+    s->doorbell = fds[2];
+    if (send_answer(sock, CCN_SHM_ANSWER_YES, fds, CCN_SHM_NFDS) == -1) {
+        save = errno;
+        close(fds[0]);
+        ccn_shm_destroy(&s);
+        errno = save;
+        return(NULL);
+    }
+    close(fds[0]);
+    return(s);
+Refuse:
+    save = errno;
+    if (s != NULL)
+        ccn_shm_destroy(&s);
+    else {
+        if (fds[1] != -1) close(fds[1]);
+        if (fds[2] != -1) close(fds[2]);
+    }
+    if (fds[0] != -1)
+        close(fds[0]);
+    send_answer(sock, CCN_SHM_ANSWER_NO, NULL, 0);
+    errno = save;
+    return(NULL);
+}
+
+struct ccn_shm *
+ccn_shm_request(int sock, int timeout_ms)
+{
+    struct ccn_shm *s = NULL;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    struct pollfd pfd;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(CCN_SHM_NFDS * sizeof(int))];
+    } u;
+    int fds[CCN_SHM_NFDS];
+    int nfds = 0;
+    int i;
+    char answer = 0;
+    ssize_t res;
+
+    res = write(sock, CCN_SHM_HELLO, CCN_SHM_HELLO_SIZE);
+    if (res != CCN_SHM_HELLO_SIZE) {
+        if (res >= 0)
+            errno = EPROTO;
+        return(NULL);
+    }
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    res = poll(&pfd, 1, timeout_ms);
+    if (res <= 0) {
+        if (res == 0)
+            errno = ETIMEDOUT; /* perhaps a ccnd that does not know about us */
+        return(NULL);
+    }
+    memset(&msg, 0, sizeof(msg));
+    memset(&u, 0, sizeof(u));
+    iov.iov_base = &answer;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof(u.buf);
+    res = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (res != 1) {
+        if (res >= 0)
+            errno = EPROTO;
+        return(NULL);
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (nfds > CCN_SHM_NFDS)
+                nfds = CCN_SHM_NFDS;
+            memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+        }
+    }
+    if (answer == CCN_SHM_ANSWER_NO && nfds == 0) {
+        errno = ECONNREFUSED;
+        return(NULL);
+    }
+    if (answer == CCN_SHM_ANSWER_YES && nfds == CCN_SHM_NFDS &&
+        (msg.msg_flags & MSG_CTRUNC) == 0)
+        s = shm_map(fds[0], 0, 0);
+    else
+        errno = EPROTO;
+    if (s != NULL) {
+        s->doorbell = fds[1];
+        s->peer_doorbell = fds[2];
+        nfds = 1;
+    }
+    for (i = 0; i < nfds; i++)
+        close(fds[i]);
+    return(s);
+}
+
+int
+ccn_shm_doorbell_fd(struct ccn_shm *s)
+{
+    return(s->doorbell);
+}
+
+size_t
+ccn_shm_capacity(struct ccn_shm *s)
+{
+    return(s->ringsize);
+}
+
+size_t
+ccn_shm_write(struct ccn_shm *s, const void *data, size_t size)
+{
+    struct ccn_shm_ctl *ctl = s->out.ctl;
+    unsigned head = ctl->head;
+    size_t room = s->ringsize - (unsigned)(head - ctl->tail);
+
+    if (room > s->ringsize)
+        room = 0; /* the peer has botched the tail */
+    if (size > room)
+        size = room;
+    if (size == 0)
+        return(0);
+    memcpy(s->out.data + (head & (s->ringsize - 1)), data, size);
+    SHM_BARRIER();
+    ctl->head = head + size;
+    SHM_BARRIER();
+    if (ctl->waiting) {
+        ctl->waiting = 0;
+        eventfd_write(s->peer_doorbell, 1);
+    }
+    return(size);
+}
+
+ssize_t
+ccn_shm_peek(struct ccn_shm *s, unsigned char **bufp)
+{
+    struct ccn_shm_ctl *ctl = s->in.ctl;
+    unsigned tail = ctl->tail;
+    unsigned n;
+
+    s->in_seen = ctl->head;
+    n = s->in_seen - tail;
+    SHM_BARRIER();
+    if (n > s->ringsize)
+        return(-1);
+    *bufp = s->in.data + (tail & (s->ringsize - 1));
+    return(n);
+}
+
+void
+ccn_shm_consume(struct ccn_shm *s, size_t size)
+{
+    struct ccn_shm_ctl *ctl = s->in.ctl;
+
+    SHM_BARRIER();
+    ctl->tail += size;
+    SHM_BARRIER();
+    if (ctl->space_wanted) {
+        ctl->space_wanted = 0;
+        eventfd_write(s->peer_doorbell, 1);
+    }
+}
+
+int
+ccn_shm_prepare_wait(struct ccn_shm *s, int want_space)
+{
+    struct ccn_shm_ctl *in = s->in.ctl;
+    struct ccn_shm_ctl *out = s->out.ctl;
+    int ready;
+
+    in->waiting = 1;
+    if (want_space)
+        out->space_wanted = 1;
+    SHM_BARRIER();
+    /* A partial message already looked at is not worth waking for */
+    ready = (in->head != s->in_seen);
+    if (want_space && (unsigned)(out->head - out->tail) < s->ringsize)
+        ready = 1;
+    if (ready)
+        eventfd_write(s->doorbell, 1);
+    return(ready);
+}
+
+void
+ccn_shm_clear_doorbell(struct ccn_shm *s)
+{
+    eventfd_t count;
+
+    eventfd_read(s->doorbell, &count);
+}
+
+#else
+
+/*
+ * Without memfd and eventfd, ccnd declines and clients do not ask.
+ * The remaining entries are unreachable, since there are no rings.
+ */
+
+struct ccn_shm *
+ccn_shm_offer(int sock, size_t ringsize)
+{
+    send_answer(sock, CCN_SHM_ANSWER_NO, NULL, 0);
+    errno = ENOSYS;
+    return(NULL);
+}
+
+struct ccn_shm *
+ccn_shm_request(int sock, int timeout_ms)
+{
+    errno = ECONNREFUSED;
+    return(NULL);
+}
+
+void
+ccn_shm_destroy(struct ccn_shm **sp)
+{
+    *sp = NULL;
+}
+
+int
+ccn_shm_doorbell_fd(struct ccn_shm *s)
+{
+    return(-1);
+}
+
+size_t
+ccn_shm_capacity(struct ccn_shm *s)
+{
+    return(0);
+}
+
+size_t
+ccn_shm_write(struct ccn_shm *s, const void *data, size_t size)
+{
+    return(0);
+}
+
+ssize_t
+ccn_shm_peek(struct ccn_shm *s, unsigned char **bufp)
+{
+    return(-1);
+}
+
+void
+ccn_shm_consume(struct ccn_shm *s, size_t size)
+{
+}
+
+int
+ccn_shm_prepare_wait(struct ccn_shm *s, int want_space)
+{
+    return(0);
+}
+
+void
+ccn_shm_clear_doorbell(struct ccn_shm *s)
+{
+}
+
+#endif
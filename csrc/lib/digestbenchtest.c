@@ -0,0 +1,132 @@
+/**
+ * @file digestbenchtest.c
+ * 
+ * A simple test program to check and benchmark batched digests.
+ *
+ * Copyright (C) 2011 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <ccn/digest.h>
+
+#define NBUF 64
+#define MAXSIZE 8800
+#define ROUNDS 200
+
+static unsigned char data[NBUF][MAXSIZE];
+static unsigned char expected[NBUF][32];
+static unsigned char got[NBUF][32];
+
+static void
+reference_digests(struct ccn_digest_job *jobs, int n)
+{
+  struct ccn_digest *d = ccn_digest_create(CCN_DIGEST_SHA256);
+  int i;
+
+  for (i = 0; i < n; i++) {
+    ccn_digest_init(d);
+    ccn_digest_update(d, jobs[i].data, jobs[i].size);
+    ccn_digest_final(d, expected[i], sizeof(expected[i]));
+  }
+  ccn_digest_destroy(&d);
+}
+
+/*
+ * Check an engine against ccn_digest_update, using sizes chosen to
+ * exercise the padding boundaries and uneven lane lengths.
+ */
+static int
+check_engine(enum ccn_digest_engine engine, const char *label)
+{
+  struct ccn_digest_job jobs[NBUF];
+  int i;
+
+  for (i = 0; i < NBUF; i++) {
+    jobs[i].data = data[i];
+    jobs[i].size = (i < 10) ? 50 + i : (i * 137) % MAXSIZE;
+    jobs[i].result = got[i];
+  }
+  jobs[0].size = 0;
+  reference_digests(jobs, NBUF);
+  memset(got, 0, sizeof(got));
+  if (ccn_digest_many_with(CCN_DIGEST_SHA256, jobs, NBUF, engine) != 0 ||
+      memcmp(got, expected, sizeof(got)) != 0) {
+    printf("%s: wrong answer\n", label);
+    return(1);
+  }
+  /* Odd batch sizes leave lanes idle */
+  memset(got, 0, sizeof(got));
+  if (ccn_digest_many_with(CCN_DIGEST_SHA256, jobs + 3, 3, engine) != 0 ||
+      memcmp(got[3], expected[3], 3 * 32) != 0) {
+    printf("%s: wrong answer for small batch\n", label);
+    return(1);
+  }
+  return(0);
+}
+
+static void
+bench_engine(enum ccn_digest_engine engine, const char *label,
+             size_t size, int batch)
+{
+  struct ccn_digest_job jobs[NBUF];
+  struct timeval start, end;
+  double secs;
+  int i, r;
+
+  for (i = 0; i < batch; i++) {
+    jobs[i].data = data[i];
+    jobs[i].size = size;
+    jobs[i].result = got[i];
+  }
+  gettimeofday(&start, NULL);
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < NBUF; i += batch)
+      ccn_digest_many_with(CCN_DIGEST_SHA256, jobs, batch, engine);
+  gettimeofday(&end, NULL);
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  printf("%-9s size %4u batch %2d: %8.1f MB/s\n", label, (unsigned)size,
+         batch, secs > 0 ? (double)size * NBUF * ROUNDS / secs / 1e6 : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const size_t sizes[] = {400, 1500, 4096, 8800};
+  static const int batches[] = {1, 4, 16};
+  int status = 0;
+  unsigned i, j;
+
+  srandom(time(NULL));
+  for (i = 0; i < NBUF; i++)
+    for (j = 0; j < MAXSIZE; j++)
+      data[i][j] = random();
+  status |= check_engine(CCN_DIGEST_ENGINE_SCALAR, "scalar");
+  status |= check_engine(CCN_DIGEST_ENGINE_MULTIBUF, "multibuf");
+  status |= check_engine(CCN_DIGEST_ENGINE_AUTO, "auto");
+  if (status != 0)
+    return(1);
+  if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    return(0);
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    for (j = 0; j < sizeof(batches) / sizeof(batches[0]); j++) {
+      bench_engine(CCN_DIGEST_ENGINE_SCALAR, "scalar", sizes[i], batches[j]);
+      bench_engine(CCN_DIGEST_ENGINE_MULTIBUF, "multibuf", sizes[i], batches[j]);
+      bench_engine(CCN_DIGEST_ENGINE_AUTO, "auto", sizes[i], batches[j]);
+    }
+  }
+  return(0);
+}
@@ -18,7 +18,8 @@ CCNLIBDIR = ../lib
 
 PROGRAMS = hashtbtest matrixtest skel_decode_test \
     smoketestclientlib  \
-    encodedecodetest signbenchtest basicparsetest
+    encodedecodetest signbenchtest digestbenchtest recvbenchtest \
+    basicparsetest
 
 BROKEN_PROGRAMS =
 DEBRIS = ccn_verifysig
@@ -28,13 +29,14 @@ CSRC = ccn_bloom.c ccn_buf_decoder.c ccn_buf_encoder.c ccn_bulkdata.c \
        ccn_dtag_table.c ccn_indexbuf.c ccn_interest.c ccn_keystore.c \
        ccn_match.c ccn_reg_mgmt.c ccn_face_mgmt.c \
        ccn_matrix.c ccn_merkle_path_asn1.c ccn_name_util.c ccn_schedule.c \
-       ccn_seqwriter.c ccn_signing.c \
+       ccn_ringbuf.c ccn_seqwriter.c ccn_shm.c ccn_signing.c \
        ccn_sockcreate.c ccn_traverse.c ccn_uri.c \
        ccn_verifysig.c ccn_versioning.c \
        ccn_header.c \
        ccn_fetch.c \
        encodedecodetest.c hashtb.c hashtbtest.c \
-       matrixtest.c signbenchtest.c skel_decode_test.c \
+       matrixtest.c signbenchtest.c digestbenchtest.c recvbenchtest.c \
+       skel_decode_test.c \
        smoketestclientlib.c basicparsetest.c \
        ccn_sockaddrutil.c ccn_setup_sockaddr_un.c
 LIBS = libccn.a
@@ -42,8 +44,8 @@ LIB_OBJS = ccn_client.o ccn_charbuf.o ccn_indexbuf.o ccn_coding.o \
        ccn_dtag_table.o ccn_schedule.o ccn_matrix.o ccn_extend_dict.o \
        ccn_buf_decoder.o ccn_uri.o ccn_buf_encoder.o ccn_bloom.o \
        ccn_name_util.o ccn_face_mgmt.o ccn_reg_mgmt.o ccn_digest.o \
-       ccn_interest.o ccn_keystore.o ccn_seqwriter.o ccn_signing.o \
-       ccn_sockcreate.o ccn_traverse.o \
+       ccn_interest.o ccn_keystore.o ccn_seqwriter.o ccn_shm.o ccn_signing.o \
+       ccn_ringbuf.o ccn_sockcreate.o ccn_traverse.o \
        ccn_match.o hashtb.o ccn_merkle_path_asn1.o \
        ccn_sockaddrutil.o ccn_setup_sockaddr_un.o \
        ccn_bulkdata.o ccn_versioning.o ccn_header.o ccn_fetch.o
@@ -73,8 +75,12 @@ shlib: $(SHLIBNAME)
 
 lib: libccn.a
 
-test: default keystore_check encodedecodetest
+test: default keystore_check encodedecodetest digestbenchtest recvbenchtest
 	./encodedecodetest -o /dev/null
+	./digestbenchtest -c
+	./recvbenchtest -c
+	./recvbenchtest -c -m 4
+	./recvbenchtest -c -b
 
 dtag_check: _always
 	@./gen_dtag_table 2>/dev/null | diff - ccn_dtag_table.c | grep '^[<]' >/dev/null && echo '*** Warning: ccn_dtag_table.c may be out of sync with tagnames.cvsdict' || :
@@ -154,6 +160,12 @@ signbenchtest.o:
 signbenchtest: signbenchtest.o
 	$(CC) $(CFLAGS) -o $@ signbenchtest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto 
 
+digestbenchtest: digestbenchtest.o
+	$(CC) $(CFLAGS) -o $@ digestbenchtest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+
+recvbenchtest: recvbenchtest.o
+	$(CC) $(CFLAGS) -o $@ recvbenchtest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+
 ccndumppcap: ccndumppcap.o
 	$(CC) $(CFLAGS) -o $@ ccndumppcap.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto -lpcap
 
@@ -173,16 +185,18 @@ ccn_buf_encoder.o: ccn_buf_encoder.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
   ../include/ccn/indexbuf.h ../include/ccn/signing.h \
   ../include/ccn/ccn_private.h
-ccn_bulkdata.o: ccn_bulkdata.c ../include/ccn/bloom.h \
-  ../include/ccn/ccn.h ../include/ccn/coding.h ../include/ccn/charbuf.h \
-  ../include/ccn/indexbuf.h
+ccn_bulkdata.o: ccn_bulkdata.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/bulkdata.h
 ccn_charbuf.o: ccn_charbuf.c ../include/ccn/charbuf.h
 ccn_client.o: ccn_client.c ../include/ccn/ccn.h ../include/ccn/coding.h \
   ../include/ccn/charbuf.h ../include/ccn/indexbuf.h \
   ../include/ccn/ccn_private.h ../include/ccn/ccnd.h \
   ../include/ccn/digest.h ../include/ccn/hashtb.h \
   ../include/ccn/reg_mgmt.h ../include/ccn/signing.h \
-  ../include/ccn/keystore.h ../include/ccn/uri.h
+  ../include/ccn/keystore.h ../include/ccn/ringbuf.h \
+  ../include/ccn/schedule.h ../include/ccn/shm.h \
+  ../include/ccn/uri.h
 ccn_coding.o: ccn_coding.c ../include/ccn/coding.h
 ccn_digest.o: ccn_digest.c ../include/ccn/digest.h
 ccn_extend_dict.o: ccn_extend_dict.c ../include/ccn/charbuf.h \
@@ -214,6 +228,8 @@ ccn_schedule.o: ccn_schedule.c ../include/ccn/schedule.h
 ccn_seqwriter.o: ccn_seqwriter.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
   ../include/ccn/indexbuf.h ../include/ccn/seqwriter.h
+ccn_ringbuf.o: ccn_ringbuf.c ../include/ccn/ringbuf.h
+ccn_shm.o: ccn_shm.c ../include/ccn/shm.h
 ccn_signing.o: ccn_signing.c ../include/ccn/merklepathasn1.h \
   ../include/ccn/ccn.h ../include/ccn/coding.h ../include/ccn/charbuf.h \
   ../include/ccn/indexbuf.h ../include/ccn/signing.h \
@@ -243,12 +259,17 @@ encodedecodetest.o: encodedecodetest.c ../include/ccn/ccn.h \
   ../include/ccn/indexbuf.h ../include/ccn/bloom.h ../include/ccn/uri.h \
   ../include/ccn/digest.h ../include/ccn/keystore.h \
   ../include/ccn/signing.h ../include/ccn/random.h
+digestbenchtest.o: digestbenchtest.c ../include/ccn/digest.h
 hashtb.o: hashtb.c ../include/ccn/hashtb.h
 hashtbtest.o: hashtbtest.c ../include/ccn/hashtb.h
 matrixtest.o: matrixtest.c ../include/ccn/matrix.h
+recvbenchtest.o: recvbenchtest.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/shm.h ../include/ccn/uri.h
 signbenchtest.o: signbenchtest.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
-  ../include/ccn/indexbuf.h ../include/ccn/keystore.h
+  ../include/ccn/indexbuf.h ../include/ccn/keystore.h \
+  ../include/ccn/signing.h
 skel_decode_test.o: skel_decode_test.c ../include/ccn/charbuf.h \
   ../include/ccn/coding.h
 smoketestclientlib.o: smoketestclientlib.c ../include/ccn/ccn.h \
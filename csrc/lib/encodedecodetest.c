@@ -25,6 +25,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include <ccn/ccn.h>
 #include <ccn/bloom.h>
@@ -187,6 +188,204 @@ static const char *all_chars_percent_encoded_canon =
  "%E0%E1%E2%E3%E4%E5%E6%E7%E8%E9%EA%EB%EC%ED%EE%EF"
  "%F0%F1%F2%F3%F4%F5%F6%F7%F8%F9%FA%FB%FC%FD%FE%FF";
 
+/*
+ * Append a random, mostly well-formed, ccnb element.
+ * Token values and lengths range from tiny to multi-byte headers,
+ * and attributes and other rare token types turn up now and then.
+ */
+static void
+append_random_ccnb(struct ccn_charbuf *c, int depth)
+{
+    int i;
+    int n;
+    int r;
+    size_t len;
+    
+    ccn_charbuf_append_tt(c, (random() % 4 == 0) ? random() : random() % 100, CCN_DTAG);
+    n = random() % 6;
+    for (i = 0; i < n; i++) {
+        r = random() % 12;
+        len = (random() % 4 == 0) ? random() % 3000 : random() % 40;
+        if (r < 3 && depth < 6)
+            append_random_ccnb(c, depth + 1);
+        else if (r < 7 || r == 11) {
+            ccn_charbuf_append_tt(c, len, (r == 11) ? CCN_UDATA : CCN_BLOB);
+            while (len-- > 0)
+                ccn_charbuf_append_value(c, random() & 0xFF, 1);
+        }
+        else if (r == 7) {
+            ccn_charbuf_append_tt(c, 2, CCN_ATTR);
+            ccn_charbuf_append(c, "abc", 3);
+            ccn_charbuf_append_tt(c, 1, CCN_UDATA);
+            ccn_charbuf_append(c, "x", 1);
+        }
+        else if (r == 8) {
+            ccn_charbuf_append_tt(c, random() % 20, CCN_DATTR);
+            ccn_charbuf_append_tt(c, 0, CCN_UDATA);
+        }
+        else if (r == 9) {
+            ccn_charbuf_append_tt(c, 3, CCN_TAG);
+            ccn_charbuf_append(c, "Name", 4);
+            ccn_charbuf_append_closer(c);
+        }
+        else {
+            ccn_charbuf_append_tt(c, random() % 300, CCN_EXT);
+            ccn_charbuf_append_closer(c);
+        }
+    }
+    ccn_charbuf_append_closer(c);
+}
+
+static int
+same_decoder_state(const struct ccn_skeleton_decoder *a,
+                   const struct ccn_skeleton_decoder *b)
+{
+    return(a->index == b->index && a->state == b->state &&
+           a->nest == b->nest && a->numval == b->numval &&
+           a->token_index == b->token_index &&
+           a->element_index == b->element_index);
+}
+
+/*
+ * Feed the same input, split into the same pieces, to both the fast
+ * and the bytewise skeleton decoder, and check that they agree.
+ */
+static int
+compare_skeleton_decoders(const unsigned char *buf, size_t len, int pause)
+{
+    struct ccn_skeleton_decoder fd = {0};
+    struct ccn_skeleton_decoder bd = {0};
+    size_t pos = 0;
+    size_t chunk;
+    ssize_t fres;
+    ssize_t bres;
+    
+    fd.state = bd.state = pause;
+    while (pos < len) {
+        chunk = len - pos;
+        if (random() % 2 == 0)
+            chunk = 1 + random() % chunk;
+        fres = ccn_skeleton_decode(&fd, buf + pos, chunk);
+        bres = ccn_skeleton_decode_bytewise(&bd, buf + pos, chunk);
+        if (fres != bres || !same_decoder_state(&fd, &bd)) {
+            printf("Skeleton decoders differ at %lu: "
+                   "res %d/%d state %d/%d index %d/%d nest %d/%d\n",
+                   (unsigned long)pos, (int)fres, (int)bres,
+                   fd.state, bd.state, (int)fd.index, (int)bd.index,
+                   fd.nest, bd.nest);
+            return(-1);
+        }
+        if (fres <= 0 || fd.state < 0)
+            break;
+        pos += fres;
+    }
+    return(0);
+}
+
+/*
+ * Differential test of the skeleton decoder fast path, using random
+ * element streams - some intact, some damaged or truncated.
+ */
+static int
+test_skeleton_decode_fast(void)
+{
+    struct ccn_charbuf *c = ccn_charbuf_create();
+    int trial;
+    int k;
+    int res = 0;
+    
+    srandom(29);
+    for (trial = 0; trial < 20000 && res == 0; trial++) {
+        c->length = 0;
+        for (k = 1 + random() % 3; k > 0; k--)
+            append_random_ccnb(c, 0);
+        if (trial % 3 == 1) {
+            for (k = random() % 4; k >= 0; k--)
+                c->buf[random() % c->length] = random() & 0xFF;
+        }
+        if (trial % 5 == 2)
+            c->length = random() % c->length;
+        res |= compare_skeleton_decoders(c->buf, c->length, 0);
+        res |= compare_skeleton_decoders(c->buf, c->length, CCN_DSTATE_PAUSE);
+    }
+    ccn_charbuf_destroy(&c);
+    return(res);
+}
+
+static double
+elapsed_seconds(const struct timeval *t0)
+{
+    struct timeval t1;
+    
+    gettimeofday(&t1, NULL);
+    return((t1.tv_sec - t0->tv_sec) + (t1.tv_usec - t0->tv_usec) / 1e6);
+}
+
+/*
+ * Measure skeleton decoder throughput on a stream of ContentObjects
+ * shaped like real traffic, for several payload sizes.
+ */
+static int
+bench_skeleton_decode(void)
+{
+    static const size_t sizes[] = {64, 1024, 8192};
+    struct ccn_charbuf *obj = ccn_charbuf_create();
+    struct ccn_charbuf *stream = ccn_charbuf_create();
+    unsigned char junk[8192] = {0};
+    struct timeval t0;
+    double secs;
+    size_t total;
+    size_t pos;
+    int rep;
+    int fast;
+    int i;
+    int j;
+    
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        obj->length = 0;
+        ccnb_element_begin(obj, CCN_DTAG_ContentObject);
+        ccnb_element_begin(obj, CCN_DTAG_Signature);
+        ccnb_append_tagged_blob(obj, CCN_DTAG_SignatureBits, junk, 128);
+        ccnb_element_end(obj);
+        ccnb_element_begin(obj, CCN_DTAG_Name);
+        for (j = 0; j < 6; j++)
+            ccnb_append_tagged_blob(obj, CCN_DTAG_Component, "component", 9);
+        ccnb_element_end(obj);
+        ccnb_element_begin(obj, CCN_DTAG_SignedInfo);
+        ccnb_append_tagged_blob(obj, CCN_DTAG_PublisherPublicKeyDigest, junk, 32);
+        ccnb_append_now_blob(obj, CCN_MARKER_NONE);
+        ccnb_tagged_putf(obj, CCN_DTAG_FreshnessSeconds, "%d", 10);
+        ccnb_element_end(obj);
+        ccnb_append_tagged_blob(obj, CCN_DTAG_Content, junk, sizes[i]);
+        ccnb_element_end(obj);
+        stream->length = 0;
+        while (stream->length < (1 << 22))
+            ccn_charbuf_append_charbuf(stream, obj);
+        for (fast = 0; fast < 2; fast++) {
+            total = 0;
+            gettimeofday(&t0, NULL);
+            for (rep = 0; (secs = elapsed_seconds(&t0)) < 0.5; rep++) {
+                struct ccn_skeleton_decoder d = {0};
+                for (pos = 0; pos < stream->length; pos = d.index) {
+                    if (fast)
+                        ccn_skeleton_decode(&d, stream->buf + pos, stream->length - pos);
+                    else
+                        ccn_skeleton_decode_bytewise(&d, stream->buf + pos, stream->length - pos);
+                    if (d.state != 0)
+                        return(1);
+                }
+                total += stream->length;
+            }
+            printf("skeleton decode %s: %5lu-byte objects %7.3f GB/s\n",
+                   fast ? "fast    " : "bytewise", (unsigned long)obj->length,
+                   total / secs / 1e9);
+        }
+    }
+    ccn_charbuf_destroy(&obj);
+    ccn_charbuf_destroy(&stream);
+    return(0);
+}
+
 int
 main (int argc, char *argv[]) {
     struct ccn_charbuf *buffer = ccn_charbuf_create();
@@ -213,10 +412,14 @@ main (int argc, char *argv[]) {
 
     int i;
 
+    if (argc == 2 && strcmp(argv[1], "-b") == 0) {
+        exit(bench_skeleton_decode());
+    }
     if (argc == 3 && strcmp(argv[1], "-o") == 0) {
 	outname = argv[2];
     } else {
 	printf("Usage: %s -o <outfilename>\n", argv[0]);
+	printf("       %s -b\n", argv[0]);
 	exit(1);
     }
 
@@ -255,6 +458,10 @@ main (int argc, char *argv[]) {
     memset(&dd, 0, sizeof(dd));
     printf("Done with signed_info\n");
 
+    printf("Comparing fast and bytewise skeleton decoders\n");
+    if (test_skeleton_decode_fast() != 0)
+        result = 1;
+
     printf("Encoding sample message data length %d\n", (int)strlen(contents[0]));
     cur_path = path_create(paths[0]);
     if (encode_message(buffer, cur_path, contents[0], strlen(contents[0]), signed_info, ccn_keystore_private_key(keystore))) {
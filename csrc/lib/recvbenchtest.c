@@ -0,0 +1,499 @@
+/**
+ * @file recvbenchtest.c
+ *
+ * A simple test program to check and benchmark the client receive path.
+ *
+ * A child process stands in for ccnd on a private unix-domain socket,
+ * and writes Interests of mixed sizes as fast as it can.
+ * The client counts them as they are dispatched to its interest filter,
+ * checking that each arrives whole and in order.
+ *
+ * With -m, there are several such connections, all run by one
+ * ccn_run_multi, and each handle also keeps an unanswered interest
+ * going so that its timeouts must be kept alongside the traffic.
+ *
+ * With -b, the stand-in ccnd carries the traffic in shared memory, and
+ * the client returns from ccn_run after each message and sleeps in its
+ * own poll on the connection fd, so a doorbell that is left quiet shows
+ * up as a stall.
+ *
+ * Copyright (C) 2011 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+#include <ccn/shm.h>
+#include <ccn/uri.h>
+
+#define NMSG 251        /* distinct messages, sent round robin */
+#define STALL_SECS 5
+#define MAXCONN 64
+
+struct counter {
+  struct ccn_closure closure;
+  const size_t *blobsize;
+  const size_t *msgsize;
+  long count;
+  long bad;
+  int yield;    /* return from ccn_run after each message */
+};
+
+struct waiter {
+  struct ccn_closure closure;
+  long timeouts;
+};
+
+static size_t blobsize[NMSG];
+static size_t msgsize[NMSG];
+
+static void
+usage(const char *progname)
+{
+  fprintf(stderr,
+          "%s [-c] [-n count] [-s minsize] [-S maxsize] [-m conns | -b]\n"
+          "   Sends count (default 200000) Interests carrying blobs of\n"
+          "   minsize to maxsize bytes (default 1 to 16000) to a client\n"
+          "   over a unix-domain socket, and reports the receive rate.\n"
+          "   -c just checks that a smaller stream arrives intact\n"
+          "   -m sends count on each of conns connections at once\n"
+          "   -b uses shared memory, and polls the connection fd itself\n",
+          progname);
+  exit(1);
+}
+
+/*
+ * Make the round of messages.  The bulk of each is an Exclude component,
+ * so that the receive path rather than name lookup sets the pace.  The
+ * first byte of each blob, and the second name component, say where the
+ * message falls in the round.
+ */
+static void
+make_messages(struct ccn_charbuf *stream, int minsize, int maxsize)
+{
+  struct ccn_charbuf *name = ccn_charbuf_create();
+  unsigned char *blob = calloc(1, maxsize);
+  unsigned char idx;
+  size_t start;
+  int i, j;
+
+  for (i = 0; i < NMSG; i++) {
+    blobsize[i] = minsize + random() % (maxsize - minsize + 1);
+    idx = i;
+    for (j = 0; j < blobsize[i]; j++)
+      blob[j] = i + j;
+    ccn_name_init(name);
+    ccn_name_append_str(name, "recvbench");
+    ccn_name_append(name, &idx, 1);
+    start = stream->length;
+    ccn_charbuf_append_tt(stream, CCN_DTAG_Interest, CCN_DTAG);
+    ccn_charbuf_append_charbuf(stream, name);
+    ccn_charbuf_append_tt(stream, CCN_DTAG_Exclude, CCN_DTAG);
+    ccn_charbuf_append_tt(stream, CCN_DTAG_Component, CCN_DTAG);
+    ccn_charbuf_append_tt(stream, blobsize[i], CCN_BLOB);
+    ccn_charbuf_append(stream, blob, blobsize[i]);
+    ccn_charbuf_append_closer(stream); /* </Component> */
+    ccn_charbuf_append_closer(stream); /* </Exclude> */
+    ccn_charbuf_append_closer(stream); /* </Interest> */
+    msgsize[i] = stream->length - start;
+  }
+  ccn_charbuf_destroy(&name);
+  free(blob);
+}
+
+static int
+write_all(int fd, const unsigned char *p, size_t size)
+{
+  ssize_t res;
+
+  while (size > 0) {
+    res = write(fd, p, size);
+    if (res <= 0)
+      return(-1);
+    p += res;
+    size -= res;
+  }
+  return(0);
+}
+
+/*
+ * Like write_all, but into the ring, sleeping on our doorbell when it is
+ * full.  Whatever the client sends is thrown away.
+ */
+static int
+shm_write_all(struct ccn_shm *shm, int fd, const unsigned char *p, size_t size)
+{
+  struct pollfd fds[2];
+  unsigned char *in;
+  ssize_t avail;
+  size_t res;
+
+  while (size > 0) {
+    res = ccn_shm_write(shm, p, size);
+    p += res;
+    size -= res;
+    avail = ccn_shm_peek(shm, &in);
+    if (avail < 0)
+      return(-1);
+    ccn_shm_consume(shm, avail);
+    if (size == 0 || res > 0)
+      continue;
+    fds[0].fd = ccn_shm_doorbell_fd(shm);
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    fds[1].events = POLLIN;
+    ccn_shm_prepare_wait(shm, 1);
+    if (poll(fds, 2, STALL_SECS * 1000) <= 0 || fds[1].revents != 0)
+      return(-1);
+    ccn_shm_clear_doorbell(shm);
+  }
+  return(0);
+}
+
+/*
+ * Play ccnd: send count messages, then wait for the client to hang up.
+ */
+static void
+run_server(int listener, struct ccn_charbuf *stream, long count, int bell)
+{
+  unsigned char buf[1024];
+  struct ccn_shm *shm = NULL;
+  size_t remsize = 0;
+  size_t off;
+  long r;
+  int fd;
+  int i;
+
+  fd = accept(listener, NULL, NULL);
+  if (fd == -1)
+    _exit(1);
+  if (bell) {
+    if (read(fd, buf, CCN_SHM_HELLO_SIZE) != CCN_SHM_HELLO_SIZE ||
+        memcmp(buf, CCN_SHM_HELLO, CCN_SHM_HELLO_SIZE) != 0)
+      _exit(1);
+    /* Where there is no shared memory the client stays on the socket */
+    shm = ccn_shm_offer(fd, CCN_SHM_RING_SIZE);
+  }
+  for (i = 0; i < count % NMSG; i++)
+    remsize += msgsize[i];
+  if (shm != NULL) {
+    /*
+     * Dribble out the first round, so that the client keeps finding
+     * the ring empty and has to be rung for each message.
+     */
+    for (off = 0, i = 0; i < NMSG && i < count; off += msgsize[i], i++) {
+      if (shm_write_all(shm, fd, stream->buf + off, msgsize[i]) < 0)
+        _exit(1);
+      usleep(1000);
+    }
+    for (r = 1; r < count / NMSG; r++)
+      if (shm_write_all(shm, fd, stream->buf, stream->length) < 0)
+        _exit(1);
+    if (count > NMSG && shm_write_all(shm, fd, stream->buf, remsize) < 0)
+      _exit(1);
+  }
+  else {
+    for (r = 0; r < count / NMSG; r++)
+      if (write_all(fd, stream->buf, stream->length) < 0)
+        _exit(1);
+    if (write_all(fd, stream->buf, remsize) < 0)
+      _exit(1);
+  }
+  while (read(fd, buf, sizeof(buf)) > 0)
+    continue;
+  _exit(0);
+}
+
+static enum ccn_upcall_res
+incoming_interest(struct ccn_closure *selfp,
+                  enum ccn_upcall_kind kind,
+                  struct ccn_upcall_info *info)
+{
+  struct counter *c = selfp->data;
+  struct ccn_buf_decoder decoder;
+  struct ccn_buf_decoder *d;
+  const unsigned char *blob = NULL;
+  const unsigned char *comp = NULL;
+  size_t size = 0;
+  size_t compsize = 0;
+  const unsigned short *offset;
+  int i;
+
+  if (kind != CCN_UPCALL_INTEREST)
+    return(CCN_UPCALL_RESULT_OK);
+  i = c->count++ % NMSG;
+  offset = info->pi->offset;
+  d = ccn_buf_decoder_start(&decoder,
+                            info->interest_ccnb + offset[CCN_PI_B_Exclude],
+                            offset[CCN_PI_E_Exclude] - offset[CCN_PI_B_Exclude]);
+  if (ccn_buf_match_dtag(d, CCN_DTAG_Exclude)) {
+    ccn_buf_advance(d);
+    if (ccn_buf_match_dtag(d, CCN_DTAG_Component)) {
+      ccn_buf_advance(d);
+      ccn_buf_match_blob(d, &blob, &size);
+    }
+  }
+  if (offset[CCN_PI_E] != c->msgsize[i] || blob == NULL ||
+      size != c->blobsize[i] ||
+      blob[0] != (unsigned char)i ||
+      blob[size - 1] != (unsigned char)(i + size - 1) ||
+      ccn_name_comp_get(info->interest_ccnb, info->interest_comps, 1,
+                        &comp, &compsize) < 0 ||
+      compsize != 1 || comp[0] != (unsigned char)i)
+    c->bad++;
+  if (c->yield)
+    ccn_set_run_timeout(info->h, 0);
+  return(CCN_UPCALL_RESULT_OK);
+}
+
+static enum ccn_upcall_res
+unanswered(struct ccn_closure *selfp,
+           enum ccn_upcall_kind kind,
+           struct ccn_upcall_info *info)
+{
+  struct waiter *w = selfp->data;
+
+  if (kind != CCN_UPCALL_INTEREST_TIMED_OUT)
+    return(CCN_UPCALL_RESULT_OK);
+  w->timeouts++;
+  return(CCN_UPCALL_RESULT_REEXPRESS);
+}
+
+/*
+ * Start a stand-in ccnd that will send count messages, and return the
+ * client's handle connected to it.
+ */
+static struct ccn *
+start_pair(struct ccn_charbuf *stream, long count, int i, int bell,
+           pid_t *pidp)
+{
+  struct sockaddr_un addr = {0};
+  struct ccn *h;
+  int listener;
+
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/.recvbench.%d.%d",
+           (int)getpid(), i);
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener == -1 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(listener, 1) == -1) {
+    perror(addr.sun_path);
+    exit(1);
+  }
+  *pidp = fork();
+  if (*pidp == 0)
+    run_server(listener, stream, count, bell);
+  close(listener);
+  h = ccn_create();
+  if (*pidp == -1 || ccn_connect(h, addr.sun_path) == -1) {
+    perror("recvbenchtest");
+    unlink(addr.sun_path);
+    exit(1);
+  }
+  unlink(addr.sun_path);
+  return(h);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *progname = argv[0];
+  struct ccn *h[MAXCONN] = {0};
+  struct ccn_multi *m = NULL;
+  struct ccn_charbuf *stream = ccn_charbuf_create();
+  struct ccn_charbuf *prefix = ccn_charbuf_create();
+  struct ccn_charbuf *templ = ccn_charbuf_create();
+  struct counter c[MAXCONN];
+  struct waiter w[MAXCONN];
+  pid_t pid[MAXCONN];
+  unsigned char lifetime[2] = {0x02, 0x00}; /* 1/8 second */
+  struct timeval start, end;
+  struct rusage ru0, ru1;
+  struct pollfd pfd;
+  double secs;
+  double cpu;
+  double bytes;
+  long count = 200000;
+  long total;
+  long got;
+  long last = -1;
+  long bad;
+  int minsize = 1;
+  int maxsize = 16000;
+  int nconn = 1;
+  int check = 0;
+  int bell = 0;
+  int quiet = 0;
+  int idle = 0;
+  int status = 0;
+  int waiting;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "hcbn:s:S:m:")) != -1) {
+    switch (opt) {
+      case 'c':
+        check = 1;
+        count = 20000;
+        break;
+      case 'b':
+        bell = 1;
+        break;
+      case 'n':
+        count = atol(optarg);
+        if (count <= 0)
+          usage(progname);
+        break;
+      case 's':
+        minsize = atoi(optarg);
+        break;
+      case 'S':
+        maxsize = atoi(optarg);
+        break;
+      case 'm':
+        nconn = atoi(optarg);
+        if (nconn < 1 || nconn > MAXCONN)
+          usage(progname);
+        break;
+      case 'h':
+      default:
+        usage(progname);
+    }
+  }
+  if (minsize < 1 || maxsize < minsize || (bell && nconn > 1))
+    usage(progname);
+  srandom(1);
+  make_messages(stream, minsize, maxsize);
+  for (bytes = 0, i = 0; i < count; i++)
+    bytes += msgsize[i % NMSG];
+  bytes *= nconn;
+  total = count * nconn;
+  /* Unless asked for, this is about the socket */
+  if (bell)
+    setenv("CCN_LOCAL_SHM", "1", 1);
+  else
+    unsetenv("CCN_LOCAL_SHM");
+  for (i = 0; i < nconn; i++)
+    h[i] = start_pair(stream, count, i, bell, &pid[i]);
+  ccn_name_from_uri(prefix, "ccnx:/recvbench");
+  for (i = 0; i < nconn; i++) {
+    memset(&c[i], 0, sizeof(c[i]));
+    c[i].closure.p = &incoming_interest;
+    c[i].closure.data = &c[i];
+    c[i].blobsize = blobsize;
+    c[i].msgsize = msgsize;
+    c[i].yield = bell;
+    ccn_set_interest_filter(h[i], prefix, &c[i].closure);
+  }
+  if (nconn > 1) {
+    m = ccn_multi_create();
+    ccn_charbuf_append_tt(templ, CCN_DTAG_Interest, CCN_DTAG);
+    ccn_charbuf_append_tt(templ, CCN_DTAG_Name, CCN_DTAG);
+    ccn_charbuf_append_closer(templ); /* </Name> */
+    ccnb_append_tagged_blob(templ, CCN_DTAG_InterestLifetime,
+                            lifetime, sizeof(lifetime));
+    ccn_charbuf_append_closer(templ); /* </Interest> */
+    ccn_name_from_uri(prefix, "ccnx:/recvbench/unanswered");
+    for (i = 0; i < nconn; i++) {
+      memset(&w[i], 0, sizeof(w[i]));
+      w[i].closure.p = &unanswered;
+      w[i].closure.data = &w[i];
+      ccn_express_interest(h[i], prefix, &w[i].closure, templ);
+      ccn_multi_add(m, h[i]);
+    }
+  }
+  getrusage(RUSAGE_SELF, &ru0);
+  gettimeofday(&start, NULL);
+  for (;;) {
+    for (got = 0, waiting = 0, i = 0; i < nconn; i++) {
+      got += c[i].count;
+      if (m != NULL && w[i].timeouts == 0)
+        waiting++;
+    }
+    if ((got == total && waiting == 0) || idle >= STALL_SECS * 10)
+      break;
+    if (bell) {
+      /* Sleep where a caller with its own event loop would */
+      if (ccn_run(h[0], 100) < 0)
+        break;
+      if (c[0].count == total)
+        continue;
+      pfd.fd = ccn_get_connection_fd(h[0]);
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, STALL_SECS * 1000) == 0) {
+        quiet = 1;
+        break;
+      }
+      continue;
+    }
+    if ((m != NULL ? ccn_run_multi(m, 100) : ccn_run(h[0], 100)) < 0)
+      break;
+    idle = (got == last) ? idle + 1 : 0;
+    last = got;
+  }
+  gettimeofday(&end, NULL);
+  getrusage(RUSAGE_SELF, &ru1);
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  /* The receiving side's own cost, which the sender's speed does not hide */
+  cpu = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) +
+        (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) +
+        (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6 +
+        (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+  for (got = 0, bad = 0, waiting = 0, i = 0; i < nconn; i++) {
+    got += c[i].count;
+    bad += c[i].bad;
+    if (m != NULL && w[i].timeouts == 0)
+      waiting++;
+  }
+  if (quiet) {
+    printf("connection fd stayed quiet after %ld of %ld\n", got, total);
+    status = 1;
+  }
+  else if (got != total || bad != 0) {
+    printf("received %ld of %ld, %ld damaged\n", got, total, bad);
+    status = 1;
+  }
+  else if (waiting != 0) {
+    printf("%d of %d handles saw no interest timeout\n", waiting, nconn);
+    status = 1;
+  }
+  else if (!check)
+    printf("%ld messages of %d to %d bytes over %d connection%s:"
+           " %.0f bytes in %.6f secs,"
+           " %.0f messages/sec, %.1f MB/s, %.3f usecs cpu/message\n",
+           total, minsize, maxsize, nconn, nconn == 1 ? "" : "s",
+           bytes, secs,
+           secs > 0 ? total / secs : 0.0,
+           secs > 0 ? bytes / secs / 1e6 : 0.0,
+           cpu * 1e6 / total);
+  ccn_multi_destroy(&m);
+  for (i = 0; i < nconn; i++)
+    ccn_destroy(&h[i]);
+  for (i = 0; i < nconn; i++)
+    waitpid(pid[i], NULL, 0);
+  ccn_charbuf_destroy(&templ);
+  ccn_charbuf_destroy(&prefix);
+  ccn_charbuf_destroy(&stream);
+  return(status);
+}
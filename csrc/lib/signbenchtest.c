@@ -23,13 +23,187 @@
 #include <ccn/ccn.h>
 #include <ccn/charbuf.h>
 #include <ccn/keystore.h>
+#include <ccn/signing.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #define FRESHNESS 10 
 #define COUNT 3000
 #define PAYLOAD_SIZE 51
 
+static void
+make_name(struct ccn_charbuf *path, struct ccn_charbuf *seq, int i)
+{
+  ccn_name_init(path);
+  ccn_name_append_str(path, "rtp");
+  ccn_name_append_str(path, "protocol");
+  ccn_name_append_str(path, "13.2.117.34");
+  ccn_name_append_str(path, "domain");
+  ccn_name_append_str(path, "smetters");
+  ccn_name_append_str(path, "principal");
+  ccn_name_append_str(path, "2021915340");
+  ccn_name_append_str(path, "id");
+  ccn_charbuf_putf(seq, "%u", i);
+  ccn_name_append(path, seq->buf, seq->length);
+  ccn_name_append_str(path, "seq");
+}
+
+static void
+report(const char *what, struct timeval *start, struct timeval *end)
+{
+  int sec, usec;
+  
+  sec = end->tv_sec - start->tv_sec;
+  usec = (int)end->tv_usec - (int)start->tv_usec;
+  while (usec < 0) {
+    sec--;
+    usec += 1000000;
+  }
+  printf("%s: %d in %d.%06d secs\n", what, COUNT, sec, usec);
+}
+
+/*
+ * Compare ccn_sign_content, which rebuilds the SignedInfo for every
+ * object, with a reusable ccn_signing_context.
+ */
+static int
+bench_handle_signing(const char *msgbuf)
+{
+  struct ccn *h = ccn_create();
+  struct ccn_signing_params sp = CCN_SIGNING_PARAMS_INIT;
+  struct ccn_signing_context *sc = NULL;
+  struct ccn_charbuf *message = ccn_charbuf_create();
+  struct ccn_charbuf *path = ccn_charbuf_create();
+  struct ccn_charbuf *seq = ccn_charbuf_create();
+  struct timeval start, end;
+  int res = 0;
+  int i;
+
+  sp.freshness = FRESHNESS;
+  gettimeofday(&start, NULL);
+  for (i = 0; i < COUNT && res >= 0; i++) {
+    make_name(path, seq, i);
+    res = ccn_sign_content(h, message, path, &sp, msgbuf, PAYLOAD_SIZE);
+    ccn_charbuf_reset(message);
+    ccn_charbuf_reset(path);
+    ccn_charbuf_reset(seq);
+  }
+  gettimeofday(&end, NULL);
+  if (res < 0) {
+    printf("ccn_sign_content failed\n");
+    goto Finish;
+  }
+  report("ccn_sign_content", &start, &end);
+
+  sc = ccn_signing_context_create(h, &sp);
+  if (sc == NULL) {
+    printf("ccn_signing_context_create failed\n");
+    res = -1;
+    goto Finish;
+  }
+  gettimeofday(&start, NULL);
+  for (i = 0; i < COUNT && res >= 0; i++) {
+    make_name(path, seq, i);
+    res = ccn_signing_context_sign(sc, message, path, 0, msgbuf, PAYLOAD_SIZE);
+    ccn_charbuf_reset(message);
+    ccn_charbuf_reset(path);
+    ccn_charbuf_reset(seq);
+  }
+  gettimeofday(&end, NULL);
+  if (res < 0)
+    printf("ccn_signing_context_sign failed\n");
+  else
+    report("ccn_signing_context_sign", &start, &end);
+
+Finish:
+  ccn_signing_context_destroy(&sc);
+  ccn_charbuf_destroy(&message);
+  ccn_charbuf_destroy(&path);
+  ccn_charbuf_destroy(&seq);
+  ccn_destroy(&h);
+  return(res < 0 ? 1 : 0);
+}
+
+/*
+ * Compare sign and verify throughput for each kind of key, using
+ * freshly generated throwaway keystores.
+ */
+static int
+bench_keytype(enum ccn_keytype keytype, const char *label, const char *msgbuf)
+{
+  struct ccn_keystore *keystore = ccn_keystore_create();
+  struct ccn_charbuf *signed_info = ccn_charbuf_create();
+  struct ccn_charbuf *message = ccn_charbuf_create();
+  struct ccn_charbuf *path = ccn_charbuf_create();
+  struct ccn_charbuf *seq = ccn_charbuf_create();
+  struct ccn_charbuf *temp = ccn_charbuf_create();
+  struct ccn_parsed_ContentObject pco = {0};
+  struct timeval start, end;
+  char what[64];
+  int res;
+  int i;
+
+  ccn_charbuf_putf(temp, "/tmp/signbenchtest-%d.keystore", (int)getpid());
+  res = ccn_keystore_file_init_keytype(ccn_charbuf_as_string(temp),
+                                       "signbenchtest", "signbenchtest",
+                                       keytype, 0, 1);
+  if (res == 0)
+    res = ccn_keystore_init(keystore, ccn_charbuf_as_string(temp),
+                            "signbenchtest");
+  unlink(ccn_charbuf_as_string(temp));
+  if (res != 0) {
+    printf("%s: unable to create keystore\n", label);
+    goto Finish;
+  }
+  res = ccn_signed_info_create(signed_info,
+                               ccn_keystore_public_key_digest(keystore),
+                               ccn_keystore_public_key_digest_length(keystore),
+                               NULL, CCN_CONTENT_DATA, FRESHNESS, NULL, NULL);
+  gettimeofday(&start, NULL);
+  for (i = 0; i < COUNT && res == 0; i++) {
+    ccn_charbuf_reset(message);
+    make_name(path, seq, i);
+    res = ccn_encode_ContentObject(message, path, signed_info,
+                                   msgbuf, PAYLOAD_SIZE, NULL,
+                                   ccn_keystore_private_key(keystore));
+    ccn_charbuf_reset(path);
+    ccn_charbuf_reset(seq);
+  }
+  gettimeofday(&end, NULL);
+  if (res != 0) {
+    printf("%s: signing failed\n", label);
+    goto Finish;
+  }
+  snprintf(what, sizeof(what), "%s sign", label);
+  report(what, &start, &end);
+
+  res = ccn_parse_ContentObject(message->buf, message->length, &pco, NULL);
+  gettimeofday(&start, NULL);
+  for (i = 0; i < COUNT && res >= 0; i++) {
+    if (ccn_verify_signature(message->buf, message->length, &pco,
+                             ccn_keystore_public_key(keystore)) != 1)
+      res = -1;
+  }
+  gettimeofday(&end, NULL);
+  if (res < 0) {
+    printf("%s: verification failed\n", label);
+    goto Finish;
+  }
+  snprintf(what, sizeof(what), "%s verify", label);
+  report(what, &start, &end);
+  res = 0;
+
+Finish:
+  ccn_keystore_destroy(&keystore);
+  ccn_charbuf_destroy(&signed_info);
+  ccn_charbuf_destroy(&message);
+  ccn_charbuf_destroy(&path);
+  ccn_charbuf_destroy(&seq);
+  ccn_charbuf_destroy(&temp);
+  return(res == 0 ? 0 : 1);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -80,18 +254,7 @@ main(int argc, char **argv)
       printf(".");
       fflush(stdout);
     }
-    ccn_name_init(path);
-    ccn_name_append_str(path, "rtp");
-    ccn_name_append_str(path, "protocol");
-    ccn_name_append_str(path, "13.2.117.34");
-    ccn_name_append_str(path, "domain");
-    ccn_name_append_str(path, "smetters");
-    ccn_name_append_str(path, "principal");
-    ccn_name_append_str(path, "2021915340");
-    ccn_name_append_str(path, "id");
-    ccn_charbuf_putf(seq, "%u", i);
-    ccn_name_append(path, seq->buf, seq->length);
-    ccn_name_append_str(path, "seq");
+    make_name(path, seq, i);
   
     res = ccn_encode_ContentObject(/* out */ message,
 				   path, signed_info, 
@@ -113,5 +276,8 @@ main(int argc, char **argv)
 
   printf("\nComplete in %d.%06d secs\n", sec, usec);
 
-  return(0);
+  res = bench_handle_signing(msgbuf);
+  res |= bench_keytype(CCN_KEYTYPE_RSA, "RSA-1024", msgbuf);
+  res |= bench_keytype(CCN_KEYTYPE_EC, "ECDSA-P256", msgbuf);
+  return(res);
 }
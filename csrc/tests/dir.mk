@@ -37,6 +37,7 @@ ALLTESTS = \
   test_newface \
   test_prefixreg \
   test_selfreg \
+  test_shm_transport \
   test_short_stuff \
   test_single_ccnd \
   test_single_ccnd_teardown \